@@ -0,0 +1,146 @@
+#include "acpi.h"
+#include "memorymanagement.h"
+#include "paging.h"
+#include "stdio.h"
+
+/**
+ * Where the BIOS data area keeps the segment of the extended BIOS data area.
+ */
+const uint32_t EBDA_SEGMENT_POINTER = 0x40E;
+
+const uint32_t BIOS_AREA_START = 0xE0000;
+const uint32_t BIOS_AREA_END = 0x100000;
+
+/**
+ * The size of the root pointer in ACPI 1.0, which the first checksum covers.
+ */
+const uint32_t ACPI_ROOT_POINTER_V1_SIZE = 20;
+
+ACPITables *ACPITables::activeACPITables = 0;
+
+ACPITables::ACPITables()
+{
+    root = 0;
+    extended = false;
+
+    const ACPIRootPointer *rootPointer = FindRootPointer();
+    if (rootPointer == 0)
+    {
+        printf("acpi: no root pointer\n");
+        return;
+    }
+
+    /**
+     * The XSDT holds the same tables as the RSDT, but is the one to use when there is one.
+     */
+    if (rootPointer->revision >= 2 && rootPointer->xsdtAddress != 0 &&
+        Checksum(rootPointer, rootPointer->length))
+    {
+        root = Table(rootPointer->xsdtAddress);
+        extended = root != 0;
+    }
+    if (root == 0)
+    {
+        root = Table(rootPointer->rsdtAddress);
+    }
+    if (root == 0)
+    {
+        printf("acpi: the root table is corrupt or out of reach\n");
+        return;
+    }
+
+    activeACPITables = this;
+}
+
+ACPITables::~ACPITables()
+{
+    if (activeACPITables == this)
+    {
+        activeACPITables = 0;
+    }
+}
+
+bool ACPITables::Checksum(const void *data, uint32_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < size; i++)
+    {
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+bool ACPITables::Mapped(uint64_t address, uint32_t size)
+{
+    uint64_t end = address + size;
+    return end <= PHYSICAL_MEMORY_LIMIT || (address >= USER_SPACE_END && end <= 0x100000000ULL);
+}
+
+const ACPIRootPointer *ACPITables::FindRootPointer()
+{
+    uint32_t ebda = *(const uint16_t *)EBDA_SEGMENT_POINTER << 4;
+    uint32_t areas[2][2] = {{ebda, ebda + 1024}, {BIOS_AREA_START, BIOS_AREA_END}};
+
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        if (areas[i][0] == 0)
+        {
+            continue;
+        }
+        for (uint32_t address = areas[i][0]; address < areas[i][1]; address += 16)
+        {
+            const ACPIRootPointer *rootPointer = (const ACPIRootPointer *)address;
+            if (memcmp(rootPointer->signature, "RSD PTR ", 8) == 0 &&
+                Checksum(rootPointer, ACPI_ROOT_POINTER_V1_SIZE))
+            {
+                return rootPointer;
+            }
+        }
+    }
+    return 0;
+}
+
+const ACPITableHeader *ACPITables::Table(uint64_t address)
+{
+    if (address == 0 || !Mapped(address, sizeof(ACPITableHeader)))
+    {
+        return 0;
+    }
+    const ACPITableHeader *table = (const ACPITableHeader *)(uint32_t)address;
+    if (table->length < sizeof(ACPITableHeader) || !Mapped(address, table->length) ||
+        !Checksum(table, table->length))
+    {
+        return 0;
+    }
+    return table;
+}
+
+bool ACPITables::Found() { return root != 0; }
+
+const ACPITableHeader *ACPITables::Find(const char *signature)
+{
+    if (root == 0)
+    {
+        return 0;
+    }
+
+    uint32_t entrySize = extended ? 8 : 4;
+    uint32_t count = (root->length - sizeof(ACPITableHeader)) / entrySize;
+    const uint8_t *entries = (const uint8_t *)root + sizeof(ACPITableHeader);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        /**
+         * The entries aren't aligned in the XSDT (its header is 36 bytes).
+         */
+        uint64_t address = 0;
+        memcpy(&address, entries + i * entrySize, entrySize);
+
+        const ACPITableHeader *table = Table(address);
+        if (table != 0 && memcmp(table->signature, signature, 4) == 0)
+        {
+            return table;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,171 @@
+/**
+ * @file acpi.h
+ * @author rohan843
+ * @brief Contains the lookup of the ACPI tables the firmware leaves in memory, and the layout of
+ * the ones the kernel reads.
+ *
+ * The firmware places a root pointer (the RSDP, starting with "RSD PTR ") either in the first KiB
+ * of the extended BIOS data area or in the BIOS area 0xE0000 - 0xFFFFF, on a 16 byte boundary. It
+ * points to the root table (the RSDT, or the XSDT from ACPI 2.0 on), which lists the physical
+ * addresses of all the other tables. Every table starts with the same header, and its bytes add up
+ * to 0.
+ */
+
+#ifndef __ACPI_H
+#define __ACPI_H
+
+#include "types.h"
+
+/**
+ * @brief The root system description pointer.
+ */
+struct ACPIRootPointer
+{
+    char signature[8];
+    uint8_t checksum;
+    char oemId[6];
+
+    /**
+     * 0 for ACPI 1.0, where the structure ends with `rsdtAddress`. 2 or more from ACPI 2.0 on.
+     */
+    uint8_t revision;
+    uint32_t rsdtAddress;
+
+    uint32_t length;
+    uint64_t xsdtAddress;
+    uint8_t extendedChecksum;
+    uint8_t reserved[3];
+} __attribute__((packed));
+
+/**
+ * @brief The header every ACPI table starts with.
+ */
+struct ACPITableHeader
+{
+    char signature[4];
+
+    /**
+     * The size of the whole table, header included.
+     */
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oemId[6];
+    char oemTableId[8];
+    uint32_t oemRevision;
+    uint32_t creatorId;
+    uint32_t creatorRevision;
+} __attribute__((packed));
+
+/**
+ * @brief The multiple APIC description table ("APIC"), which lists the processors' local APICs
+ * and the I/O APICs. Variable length entries follow it, each starting with its type and length.
+ */
+struct MultipleAPICDescriptionTable
+{
+    ACPITableHeader header;
+
+    /**
+     * The physical address of the local APICs' registers (each processor sees its own there).
+     */
+    uint32_t localAPICAddress;
+    uint32_t flags;
+} __attribute__((packed));
+
+/**
+ * Types of the entries of the MADT.
+ */
+const uint8_t MADT_LOCAL_APIC = 0;
+const uint8_t MADT_IO_APIC = 1;
+const uint8_t MADT_LOCAL_APIC_ADDRESS = 5;
+
+struct MADTEntry
+{
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed));
+
+/**
+ * @brief A processor, and the ID of its local APIC.
+ */
+struct MADTLocalAPIC
+{
+    MADTEntry entry;
+    uint8_t processorId;
+    uint8_t apicId;
+
+    /**
+     * Bit 0 tells the processor is enabled. A disabled one must not be started.
+     */
+    uint32_t flags;
+} __attribute__((packed));
+
+/**
+ * @brief Replaces the local APIC address of the table's header.
+ */
+struct MADTLocalAPICAddress
+{
+    MADTEntry entry;
+    uint16_t reserved;
+    uint64_t address;
+} __attribute__((packed));
+
+const uint32_t MADT_PROCESSOR_ENABLED = 1 << 0;
+
+class ACPITables
+{
+  protected:
+    /**
+     * The RSDT or the XSDT, or 0 if there is none.
+     */
+    const ACPITableHeader *root;
+
+    /**
+     * Whether `root` is the XSDT, whose entries are 64 - bit.
+     */
+    bool extended;
+
+    /**
+     * @brief Looks for the root pointer in the areas the firmware may put it in.
+     */
+    static const ACPIRootPointer *FindRootPointer();
+
+    /**
+     * @brief Tells whether some bytes add up to 0.
+     */
+    static bool Checksum(const void *data, uint32_t size);
+
+    /**
+     * @brief Tells whether a range of physical memory can be read through the kernel's identity
+     * mapping (see paging.h).
+     */
+    static bool Mapped(uint64_t address, uint32_t size);
+
+    /**
+     * @brief Returns a table by its physical address, if it is mapped and its checksum is right.
+     */
+    static const ACPITableHeader *Table(uint64_t address);
+
+  public:
+    static ACPITables *activeACPITables;
+
+    /**
+     * @brief Finds the root table. Needs paging to be on.
+     */
+    ACPITables();
+    ~ACPITables();
+
+    /**
+     * @brief Tells whether the root table was found.
+     */
+    bool Found();
+
+    /**
+     * @brief Looks a table up by its signature, e.g., "APIC" for the MADT.
+     *
+     * @return The table, or 0 if there is none (or it is corrupt).
+     */
+    const ACPITableHeader *Find(const char *signature);
+};
+
+#endif
@@ -0,0 +1,596 @@
+#include "ata.h"
+#include "memorymanagement.h"
+#include "multitasking.h"
+#include "stdio.h"
+
+/**
+ * ATA commands.
+ */
+const uint8_t ATA_READ_SECTORS = 0x20;
+const uint8_t ATA_WRITE_SECTORS = 0x30;
+const uint8_t ATA_READ_DMA = 0xC8;
+const uint8_t ATA_WRITE_DMA = 0xCA;
+const uint8_t ATA_FLUSH_CACHE = 0xE7;
+const uint8_t ATA_IDENTIFY = 0xEC;
+
+/**
+ * Bits of the status register.
+ */
+const uint8_t ATA_STATUS_ERROR = 1 << 0;
+const uint8_t ATA_STATUS_DATA_REQUEST = 1 << 3;
+const uint8_t ATA_STATUS_DEVICE_FAULT = 1 << 5;
+const uint8_t ATA_STATUS_BUSY = 1 << 7;
+
+/**
+ * Bits of the bus master command and status registers.
+ */
+const uint8_t BUS_MASTER_START = 1 << 0;
+const uint8_t BUS_MASTER_TO_MEMORY = 1 << 3;
+const uint8_t BUS_MASTER_STATUS_ERROR = 1 << 1;
+const uint8_t BUS_MASTER_STATUS_INTERRUPT = 1 << 2;
+
+const uint16_t PRD_LAST = 1 << 15;
+
+/**
+ * The most sectors a single (28 - bit) command can move. A sector count of 0 means 256.
+ */
+const uint32_t ATA_MAX_SECTORS = 256;
+const uint32_t ATA_SECTOR_SIZE = 512;
+
+/**
+ * How many times the status is polled before a drive is given up on.
+ */
+const uint32_t ATA_TIMEOUT = 1000000;
+
+/** AdvancedTechnologyAttachmentChannel Class */
+
+AdvancedTechnologyAttachmentChannel::AdvancedTechnologyAttachmentChannel(
+    InterruptManager *manager, uint16_t base, uint16_t control, uint16_t busMasterBase,
+    uint8_t interrupt)
+    : InterruptHandler(0x20 + interrupt, manager), dataPort(base), errorPort(base + 1),
+      sectorCountPort(base + 2), lbaLowPort(base + 3), lbaMidPort(base + 4), lbaHiPort(base + 5),
+      devicePort(base + 6), commandPort(base + 7), controlPort(control),
+      busMasterCommandPort(busMasterBase), busMasterStatusPort(busMasterBase + 2),
+      busMasterTablePort(busMasterBase + 4)
+{
+    busMaster = busMasterBase != 0;
+    regions = 0;
+    transferPending = false;
+    transferFailed = false;
+    busy = false;
+
+    /**
+     * The PRD table must be 4 byte aligned and must not cross a 64 KiB boundary. A frame is both.
+     */
+    if (busMaster)
+    {
+        regions =
+            (PhysicalRegionDescriptor *)PhysicalMemoryManager::activePhysicalMemoryManager
+                ->AllocateFrame();
+        busMaster = regions != 0;
+    }
+
+    /**
+     * Clearing the control register enables the channel's interrupts.
+     */
+    controlPort.Write(0);
+}
+
+AdvancedTechnologyAttachmentChannel::~AdvancedTechnologyAttachmentChannel()
+{
+    if (regions != 0)
+    {
+        PhysicalMemoryManager::activePhysicalMemoryManager->FreeFrame((uint32_t)regions);
+    }
+}
+
+bool AdvancedTechnologyAttachmentChannel::HandleInterrupt(uint32_t *esp)
+{
+    uint8_t busMasterStatus = busMaster ? busMasterStatusPort.Read() : 0;
+
+    /**
+     * Reading the status register acknowledges the interrupt. (PIO transfers interrupt too, once
+     * per sector, but they poll, so there's nothing else to do for them.)
+     */
+    uint8_t status = commandPort.Read();
+
+    if (transferPending && (busMasterStatus & BUS_MASTER_STATUS_INTERRUPT))
+    {
+        busMasterCommandPort.Write(0);
+        busMasterStatusPort.Write(BUS_MASTER_STATUS_INTERRUPT | BUS_MASTER_STATUS_ERROR);
+
+        transferFailed = (busMasterStatus & BUS_MASTER_STATUS_ERROR) ||
+                         (status & (ATA_STATUS_ERROR | ATA_STATUS_DEVICE_FAULT));
+        transferPending = false;
+        TaskManager::activeTaskManager->Wakeup(this);
+    }
+
+    /**
+     * The bus master interrupt bit is set whenever the drive interrupts. Without bus master
+     * registers, there's no telling, so the interrupt is taken as the channel's.
+     */
+    return !busMaster || (busMasterStatus & BUS_MASTER_STATUS_INTERRUPT);
+}
+
+void AdvancedTechnologyAttachmentChannel::Acquire()
+{
+    uint32_t eflags;
+    asm volatile("pushfl\n"
+                 "popl %0\n"
+                 "cli"
+                 : "=r"(eflags));
+
+    while (busy)
+    {
+        TaskManager::activeTaskManager->Sleep((void *)&busy);
+    }
+    busy = true;
+
+    asm volatile("pushl %0\n"
+                 "popfl"
+                 :
+                 : "r"(eflags)
+                 : "cc");
+}
+
+void AdvancedTechnologyAttachmentChannel::Release()
+{
+    busy = false;
+    TaskManager::activeTaskManager->Wakeup((void *)&busy);
+}
+
+bool AdvancedTechnologyAttachmentChannel::HasBusMaster() { return busMaster; }
+
+void AdvancedTechnologyAttachmentChannel::Delay()
+{
+    /**
+     * Each read of the alternate status register takes about 100 ns.
+     */
+    for (int i = 0; i < 4; i++)
+    {
+        controlPort.Read();
+    }
+}
+
+bool AdvancedTechnologyAttachmentChannel::WaitReady()
+{
+    /**
+     * The alternate status register is polled, as reading it doesn't acknowledge interrupts.
+     */
+    for (uint32_t i = 0; i < ATA_TIMEOUT; i++)
+    {
+        uint8_t status = controlPort.Read();
+        if (!(status & ATA_STATUS_BUSY))
+        {
+            return !(status & (ATA_STATUS_ERROR | ATA_STATUS_DEVICE_FAULT));
+        }
+    }
+    return false;
+}
+
+bool AdvancedTechnologyAttachmentChannel::WaitDataRequest()
+{
+    for (uint32_t i = 0; i < ATA_TIMEOUT; i++)
+    {
+        uint8_t status = controlPort.Read();
+        if (status & ATA_STATUS_BUSY)
+        {
+            continue;
+        }
+        if (status & (ATA_STATUS_ERROR | ATA_STATUS_DEVICE_FAULT))
+        {
+            return false;
+        }
+        if (status & ATA_STATUS_DATA_REQUEST)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void AdvancedTechnologyAttachmentChannel::Command(bool master, uint32_t sector, uint32_t count,
+                                                  uint8_t command)
+{
+    /**
+     * Bit 6 selects LBA addressing, bit 4 the slave. The low 4 bits are bits 24 - 27 of the LBA.
+     */
+    devicePort.Write(0xE0 | (master ? 0 : 0x10) | ((sector >> 24) & 0x0F));
+    Delay();
+
+    errorPort.Write(0);
+    sectorCountPort.Write(count & 0xFF);
+    lbaLowPort.Write(sector & 0xFF);
+    lbaMidPort.Write((sector >> 8) & 0xFF);
+    lbaHiPort.Write((sector >> 16) & 0xFF);
+    commandPort.Write(command);
+}
+
+bool AdvancedTechnologyAttachmentChannel::Identify(bool master, uint16_t *data)
+{
+    devicePort.Write(master ? 0xA0 : 0xB0);
+    Delay();
+
+    /**
+     * A status of 0xFF is what a channel without any drives reads as.
+     */
+    if (controlPort.Read() == 0xFF)
+    {
+        return false;
+    }
+
+    sectorCountPort.Write(0);
+    lbaLowPort.Write(0);
+    lbaMidPort.Write(0);
+    lbaHiPort.Write(0);
+    commandPort.Write(ATA_IDENTIFY);
+
+    if (commandPort.Read() == 0)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < ATA_TIMEOUT && (controlPort.Read() & ATA_STATUS_BUSY); i++)
+    {
+    }
+
+    /**
+     * ATAPI and SATA drives don't take the command, and leave their signature in these ports.
+     */
+    if (lbaMidPort.Read() != 0 || lbaHiPort.Read() != 0)
+    {
+        return false;
+    }
+
+    if (!WaitDataRequest())
+    {
+        return false;
+    }
+    dataPort.ReadString(data, 256);
+    return true;
+}
+
+bool AdvancedTechnologyAttachmentChannel::TransferProgrammed(bool master, uint32_t sector,
+                                                             uint32_t count, uint8_t *buffer,
+                                                             bool write)
+{
+    if (!WaitReady())
+    {
+        return false;
+    }
+    Command(master, sector, count, write ? ATA_WRITE_SECTORS : ATA_READ_SECTORS);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (!WaitDataRequest())
+        {
+            return false;
+        }
+        if (write)
+        {
+            dataPort.WriteString((const uint16_t *)(buffer + i * ATA_SECTOR_SIZE),
+                                 ATA_SECTOR_SIZE / 2);
+        }
+        else
+        {
+            dataPort.ReadString((uint16_t *)(buffer + i * ATA_SECTOR_SIZE), ATA_SECTOR_SIZE / 2);
+        }
+    }
+
+    return write ? WaitReady() : true;
+}
+
+bool AdvancedTechnologyAttachmentChannel::TransferDirect(bool master, uint32_t sector,
+                                                         uint32_t count, uint8_t *buffer,
+                                                         bool write)
+{
+    if (!WaitReady())
+    {
+        return false;
+    }
+
+    /**
+     * One region per 64 KiB piece of the buffer. (256 sectors take 3 regions at most.)
+     */
+    uint32_t address = (uint32_t)buffer;
+    uint32_t bytes = count * ATA_SECTOR_SIZE;
+    uint32_t entries = 0;
+    while (bytes > 0)
+    {
+        uint32_t length = 0x10000 - (address & 0xFFFF);
+        if (length > bytes)
+        {
+            length = bytes;
+        }
+        regions[entries].address = address;
+        regions[entries].byteCount = length & 0xFFFF;
+        regions[entries].flags = 0;
+        entries++;
+        address += length;
+        bytes -= length;
+    }
+    regions[entries - 1].flags = PRD_LAST;
+
+    uint32_t eflags;
+    asm volatile("pushfl\n"
+                 "popl %0\n"
+                 "cli"
+                 : "=r"(eflags));
+
+    busMasterCommandPort.Write(0);
+    busMasterTablePort.Write((uint32_t)regions);
+    busMasterStatusPort.Write(BUS_MASTER_STATUS_INTERRUPT | BUS_MASTER_STATUS_ERROR);
+
+    /**
+     * The direction is from the controller's point of view: a disk read writes to memory.
+     */
+    uint8_t direction = write ? 0 : BUS_MASTER_TO_MEMORY;
+    busMasterCommandPort.Write(direction);
+
+    transferPending = true;
+    transferFailed = false;
+    Command(master, sector, count, write ? ATA_WRITE_DMA : ATA_READ_DMA);
+    busMasterCommandPort.Write(direction | BUS_MASTER_START);
+
+    /**
+     * Interrupts stay disabled until we sleep, so the completion can't be missed.
+     */
+    while (transferPending)
+    {
+        TaskManager::activeTaskManager->Sleep(this);
+    }
+
+    asm volatile("pushl %0\n"
+                 "popfl"
+                 :
+                 : "r"(eflags)
+                 : "cc");
+
+    return !transferFailed;
+}
+
+bool AdvancedTechnologyAttachmentChannel::Flush(bool master)
+{
+    if (!WaitReady())
+    {
+        return false;
+    }
+    Command(master, 0, 0, ATA_FLUSH_CACHE);
+    return WaitReady();
+}
+
+/** AdvancedTechnologyAttachment Class */
+
+AdvancedTechnologyAttachment::AdvancedTechnologyAttachment(
+    AdvancedTechnologyAttachmentChannel *channel, bool master, uint32_t number,
+    uint32_t sectorCount, bool directMemoryAccess)
+{
+    this->channel = channel;
+    this->master = master;
+    this->sectorCount = sectorCount;
+    this->directMemoryAccess = directMemoryAccess;
+
+    name[0] = 'a';
+    name[1] = 't';
+    name[2] = 'a';
+    name[3] = '0' + number;
+    name[4] = '\0';
+}
+
+AdvancedTechnologyAttachment::~AdvancedTechnologyAttachment() {}
+
+const char *AdvancedTechnologyAttachment::Name() { return name; }
+
+uint32_t AdvancedTechnologyAttachment::SectorCount() { return sectorCount; }
+
+bool AdvancedTechnologyAttachment::Read(uint32_t sector, uint32_t count, void *buffer)
+{
+    return Transfer(sector, count, (uint8_t *)buffer, false);
+}
+
+bool AdvancedTechnologyAttachment::Write(uint32_t sector, uint32_t count, const void *buffer)
+{
+    return Transfer(sector, count, (uint8_t *)buffer, true);
+}
+
+bool AdvancedTechnologyAttachment::Transfer(uint32_t sector, uint32_t count, uint8_t *buffer,
+                                            bool write)
+{
+    if (sector >= sectorCount || count > sectorCount - sector)
+    {
+        return false;
+    }
+
+    /**
+     * The controller works with physical addresses, so DMA is only possible for buffers in the
+     * identity mapped part of memory. Others (in user space) go through PIO.
+     */
+    uint32_t address = (uint32_t)buffer;
+    bool dma = directMemoryAccess && address % 2 == 0 &&
+               address + count * ATA_SECTOR_SIZE <= PHYSICAL_MEMORY_LIMIT;
+
+    channel->Acquire();
+
+    /**
+     * As many sectors as possible go into each command.
+     */
+    bool success = true;
+    while (success && count > 0)
+    {
+        uint32_t sectors = count < ATA_MAX_SECTORS ? count : ATA_MAX_SECTORS;
+        if (dma)
+        {
+            success = channel->TransferDirect(master, sector, sectors, buffer, write);
+        }
+        else
+        {
+            success = channel->TransferProgrammed(master, sector, sectors, buffer, write);
+        }
+        sector += sectors;
+        count -= sectors;
+        buffer += sectors * ATA_SECTOR_SIZE;
+    }
+
+    if (success && write)
+    {
+        success = channel->Flush(master);
+    }
+
+    channel->Release();
+    return success;
+}
+
+bool AdvancedTechnologyAttachment::SetDirectMemoryAccess(bool enabled)
+{
+    if (enabled && !channel->HasBusMaster())
+    {
+        return false;
+    }
+    directMemoryAccess = enabled;
+    return true;
+}
+
+bool AdvancedTechnologyAttachment::DirectMemoryAccessSupported()
+{
+    return channel->HasBusMaster();
+}
+
+/** IntegratedDriveElectronicsController Class */
+
+/**
+ * Bits of the programming interface byte, telling whether a channel runs in native PCI mode (with
+ * ports from its BARs and the device's IRQ) instead of at the legacy ISA ports and IRQs.
+ */
+const uint8_t IDE_PRIMARY_NATIVE = 1 << 0;
+const uint8_t IDE_SECONDARY_NATIVE = 1 << 2;
+
+static uint16_t CommandBlock(PeripheralComponentInterconnectDeviceDescriptor *device,
+                             bool secondary)
+{
+    if (device->interfaceId & (secondary ? IDE_SECONDARY_NATIVE : IDE_PRIMARY_NATIVE))
+    {
+        return device->bars[secondary ? 2 : 0].address;
+    }
+    return secondary ? 0x170 : 0x1F0;
+}
+
+static uint16_t ControlBlock(PeripheralComponentInterconnectDeviceDescriptor *device,
+                             bool secondary)
+{
+    if (device->interfaceId & (secondary ? IDE_SECONDARY_NATIVE : IDE_PRIMARY_NATIVE))
+    {
+        return device->bars[secondary ? 3 : 1].address + 2;
+    }
+    return secondary ? 0x376 : 0x3F6;
+}
+
+static uint16_t BusMasterBlock(PeripheralComponentInterconnectDeviceDescriptor *device,
+                               bool secondary)
+{
+    BaseAddressRegister *bar = &device->bars[4];
+    if (bar->type != InputOutput || bar->address == 0)
+    {
+        return 0;
+    }
+    return bar->address + (secondary ? 8 : 0);
+}
+
+static uint8_t InterruptLine(PeripheralComponentInterconnectDeviceDescriptor *device,
+                             bool secondary)
+{
+    if (device->interfaceId & (secondary ? IDE_SECONDARY_NATIVE : IDE_PRIMARY_NATIVE))
+    {
+        return device->interrupt;
+    }
+    return secondary ? 15 : 14;
+}
+
+IntegratedDriveElectronicsController *IntegratedDriveElectronicsController::activeController = 0;
+
+IntegratedDriveElectronicsController::IntegratedDriveElectronicsController(
+    PeripheralComponentInterconnectDeviceDescriptor *device, InterruptManager *interrupts)
+    : primary(interrupts, CommandBlock(device, false), ControlBlock(device, false),
+              BusMasterBlock(device, false), InterruptLine(device, false)),
+      secondary(interrupts, CommandBlock(device, true), ControlBlock(device, true),
+                BusMasterBlock(device, true), InterruptLine(device, true))
+{
+    for (int i = 0; i < 4; i++)
+    {
+        drives[i] = 0;
+    }
+    activeController = this;
+}
+
+IntegratedDriveElectronicsController::~IntegratedDriveElectronicsController()
+{
+    if (activeController == this)
+    {
+        activeController = 0;
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        if (drives[i] != 0)
+        {
+            delete drives[i];
+        }
+    }
+}
+
+void IntegratedDriveElectronicsController::Activate()
+{
+    uint16_t *identification = new uint16_t[256];
+
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        AdvancedTechnologyAttachmentChannel *channel = i < 2 ? &primary : &secondary;
+        bool master = i % 2 == 0;
+        if (!channel->Identify(master, identification))
+        {
+            continue;
+        }
+
+        /**
+         * Words 60 - 61 hold the number of sectors addressable with 28 - bit LBAs. Bit 8 of word
+         * 49 tells whether the drive can do DMA.
+         */
+        uint32_t sectors = identification[60] | ((uint32_t)identification[61] << 16);
+        bool dma = (identification[49] & (1 << 8)) && channel->HasBusMaster();
+        if (sectors == 0)
+        {
+            continue;
+        }
+
+        drives[i] = new AdvancedTechnologyAttachment(channel, master, i, sectors, dma);
+        BlockDevice::Register(drives[i]);
+
+        printf(drives[i]->Name());
+        printf(": ");
+        printfDec(sectors / 2048);
+        printf(dma ? " MiB, DMA\n" : " MiB, PIO\n");
+    }
+
+    delete[] identification;
+}
+
+AdvancedTechnologyAttachment *IntegratedDriveElectronicsController::Drive(uint32_t index)
+{
+    if (index >= 4)
+    {
+        return 0;
+    }
+    return drives[index];
+}
+
+/**
+ * @brief Creates the driver for an IDE controller found on the PCI bus.
+ */
+static Driver *CreateIntegratedDriveElectronicsController(
+    PeripheralComponentInterconnectDeviceDescriptor *device,
+    PeripheralComponentInterconnectController *pci, InterruptManager *interrupts)
+{
+    pci->EnableBusMastering(device);
+    return new IntegratedDriveElectronicsController(device, interrupts);
+}
+
+const PeripheralComponentInterconnectDriverEntry IntegratedDriveElectronicsController::DriverEntry =
+    {PCI_ANY_ID, PCI_ANY_ID, 0x01, 0x01, &CreateIntegratedDriveElectronicsController};
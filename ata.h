@@ -0,0 +1,228 @@
+/**
+ * @file ata.h
+ * @author rohan843
+ * @brief Contains the driver for ATA disks on a PCI IDE controller (like QEMU's PIIX3/PIIX4).
+ *
+ * An IDE controller has 2 channels (primary and secondary), each with up to 2 drives (master and
+ * slave) sharing the channel's registers and IRQ. Sectors can be moved in 2 ways:
+ *
+ * 1. PIO: the CPU copies every word through the data port (`rep insw`/`rep outsw`), waiting on
+ *    the status register for each sector.
+ * 2. Bus master DMA: the controller copies the data itself, following a table of physical memory
+ *    regions (PRDs), and raises the channel's IRQ once the whole command is done. The waiting task
+ *    sleeps meanwhile.
+ *
+ * Drives are addressed with 28 - bit LBAs, so only the first 128 GiB of a disk are used.
+ */
+
+#ifndef __ATA_H
+#define __ATA_H
+
+#include "blockdevice.h"
+#include "driver.h"
+#include "interrupts.h"
+#include "pci.h"
+#include "port.h"
+#include "types.h"
+
+/**
+ * @brief An entry of a PRD table: a physically contiguous region that doesn't cross a 64 KiB
+ * boundary.
+ */
+struct PhysicalRegionDescriptor
+{
+    uint32_t address;
+
+    /**
+     * 0 means 64 KiB.
+     */
+    uint16_t byteCount;
+
+    /**
+     * Bit 15 marks the last entry.
+     */
+    uint16_t flags;
+} __attribute__((packed));
+
+/**
+ * @brief One channel of the controller: the registers and IRQ shared by its 2 drives.
+ */
+class AdvancedTechnologyAttachmentChannel : public InterruptHandler
+{
+  protected:
+    Port16Bit dataPort;
+    Port8Bit errorPort;
+    Port8Bit sectorCountPort;
+    Port8Bit lbaLowPort;
+    Port8Bit lbaMidPort;
+    Port8Bit lbaHiPort;
+    Port8Bit devicePort;
+    Port8Bit commandPort;
+    Port8Bit controlPort;
+
+    /**
+     * The bus master registers. Only usable if `busMaster` is set.
+     */
+    bool busMaster;
+    Port8Bit busMasterCommandPort;
+    Port8Bit busMasterStatusPort;
+    Port32Bit busMasterTablePort;
+
+    /**
+     * The PRD table, in a frame of its own.
+     */
+    PhysicalRegionDescriptor *regions;
+
+    /**
+     * Set while a DMA command runs, cleared by the interrupt handler.
+     */
+    volatile bool transferPending;
+    volatile bool transferFailed;
+
+    /**
+     * Set while a drive of the channel is in use. Commands of the 2 drives can't overlap.
+     */
+    volatile bool busy;
+
+    /**
+     * @brief Waits out the 400 ns a drive needs after being selected.
+     */
+    void Delay();
+
+    /**
+     * @brief Waits until the drive is no longer busy.
+     *
+     * @return false if it reported an error, or didn't answer in time.
+     */
+    bool WaitReady();
+
+    /**
+     * @brief Waits until the drive is ready to move a sector of data.
+     *
+     * @return false if it reported an error, or didn't answer in time.
+     */
+    bool WaitDataRequest();
+
+    void Command(bool master, uint32_t sector, uint32_t count, uint8_t command);
+
+  public:
+    /**
+     * @param base The first of the 8 command block ports.
+     * @param control The control/alternate status port.
+     * @param busMasterBase The channel's bus master registers, or 0 if there are none.
+     * @param interrupt The IRQ of the channel.
+     */
+    AdvancedTechnologyAttachmentChannel(InterruptManager *manager, uint16_t base, uint16_t control,
+                                        uint16_t busMasterBase, uint8_t interrupt);
+    ~AdvancedTechnologyAttachmentChannel();
+
+    virtual bool HandleInterrupt(uint32_t *esp);
+
+    /**
+     * @brief Waits for exclusive use of the channel.
+     */
+    void Acquire();
+    void Release();
+
+    bool HasBusMaster();
+
+    /**
+     * @brief Identifies a drive.
+     *
+     * @param data Where to store the 256 words of identification data.
+     * @return false if there is no ATA drive there.
+     */
+    bool Identify(bool master, uint16_t *data);
+
+    /**
+     * @brief Moves at most 256 sectors with a single PIO command.
+     */
+    bool TransferProgrammed(bool master, uint32_t sector, uint32_t count, uint8_t *buffer,
+                            bool write);
+
+    /**
+     * @brief Moves at most 256 sectors with a single DMA command, sleeping until the completion
+     * interrupt. The buffer must be physically contiguous (below 1 GiB), and 2 byte aligned.
+     * Interrupts must be active.
+     */
+    bool TransferDirect(bool master, uint32_t sector, uint32_t count, uint8_t *buffer,
+                        bool write);
+
+    bool Flush(bool master);
+};
+
+/**
+ * @brief An ATA drive.
+ */
+class AdvancedTechnologyAttachment : public BlockDevice
+{
+  protected:
+    AdvancedTechnologyAttachmentChannel *channel;
+    bool master;
+    char name[5];
+    uint32_t sectorCount;
+
+    /**
+     * Whether transfers use DMA (if the buffer allows it) rather than PIO.
+     */
+    bool directMemoryAccess;
+
+    bool Transfer(uint32_t sector, uint32_t count, uint8_t *buffer, bool write);
+
+  public:
+    /**
+     * @param number The drive number, for its name.
+     */
+    AdvancedTechnologyAttachment(AdvancedTechnologyAttachmentChannel *channel, bool master,
+                                 uint32_t number, uint32_t sectorCount, bool directMemoryAccess);
+    ~AdvancedTechnologyAttachment();
+
+    virtual const char *Name();
+    virtual uint32_t SectorCount();
+    virtual bool Read(uint32_t sector, uint32_t count, void *buffer);
+    virtual bool Write(uint32_t sector, uint32_t count, const void *buffer);
+
+    /**
+     * @brief Chooses between DMA and PIO transfers (e.g., to compare them).
+     *
+     * @return false if DMA was asked for, but the drive or controller doesn't support it.
+     */
+    bool SetDirectMemoryAccess(bool enabled);
+
+    bool DirectMemoryAccessSupported();
+};
+
+/**
+ * @brief The PCI IDE controller: sets up its channels and registers the drives found.
+ */
+class IntegratedDriveElectronicsController : public Driver
+{
+  protected:
+    AdvancedTechnologyAttachmentChannel primary;
+    AdvancedTechnologyAttachmentChannel secondary;
+
+    AdvancedTechnologyAttachment *drives[4];
+
+  public:
+    static IntegratedDriveElectronicsController *activeController;
+
+    IntegratedDriveElectronicsController(PeripheralComponentInterconnectDeviceDescriptor *device,
+                                         InterruptManager *interrupts);
+    ~IntegratedDriveElectronicsController();
+
+    virtual void Activate();
+
+    /**
+     * @brief Returns a drive: 0 and 1 are the primary master and slave, 2 and 3 the secondary.
+     *
+     * @return The drive, or 0 if there is none.
+     */
+    AdvancedTechnologyAttachment *Drive(uint32_t index);
+
+    /**
+     * The driver registry entry (class 0x01, subclass 0x01: IDE controllers).
+     */
+    static const PeripheralComponentInterconnectDriverEntry DriverEntry;
+};
+
+#endif
@@ -0,0 +1,1900 @@
+#include "benchmark.h"
+#include "port.h"
+#include "memorymanagement.h"
+#include "paging.h"
+#include "stdio.h"
+
+uint32_t Divide(uint64_t dividend, uint32_t divisor)
+{
+    uint32_t high = dividend >> 32;
+    uint32_t low = dividend & 0xFFFFFFFF;
+    if (divisor == 0 || high >= divisor)
+    {
+        return 0xFFFFFFFF;
+    }
+
+    uint32_t quotient, remainder;
+    asm("divl %4" : "=a"(quotient), "=d"(remainder) : "a"(low), "d"(high), "rm"(divisor));
+    return quotient;
+}
+
+void PrintBenchmarkResult(const char *name, uint64_t cycles, uint32_t operations)
+{
+    printf(name);
+    printf(": ");
+    printfDec(Divide(cycles, operations));
+    printf(" cycles/op\n");
+}
+
+uint32_t TimestampCounterFrequency()
+{
+    static uint32_t frequency = 0;
+    if (frequency != 0)
+    {
+        return frequency;
+    }
+
+    /**
+     * Counts the cycles of a 10 ms one-shot countdown of PIT channel 2. Its gate is bit 0 of port
+     * 0x61 (bit 1 would connect it to the speaker), and bit 5 of that port is its output, which
+     * goes high when the count reaches 0.
+     */
+    Port8Bit speakerPort(0x61);
+    Port8Bit channel2Port(0x42);
+    Port8Bit pitCommandPort(0x43);
+
+    uint8_t speaker = speakerPort.Read();
+    speakerPort.Write((speaker & ~0x02) & ~0x01);
+
+    uint32_t count = PIT_FREQUENCY / 100;
+    pitCommandPort.Write(0xB0); // Channel 2, low then high byte, mode 0 (one-shot), binary.
+    channel2Port.Write(count & 0xFF);
+    channel2Port.Write(count >> 8);
+
+    speakerPort.Write((speaker & ~0x02) | 0x01);
+    uint64_t start = ReadTimestampCounter();
+    while (!(speakerPort.Read() & 0x20))
+    {
+    }
+    uint64_t cycles = ReadTimestampCounter() - start;
+
+    speakerPort.Write(speaker);
+
+    frequency = (uint32_t)cycles * 100;
+    return frequency;
+}
+
+void PrintThroughputResult(const char *name, uint64_t cycles, uint32_t operations,
+                           uint64_t bytes)
+{
+    /**
+     * Going through microseconds keeps every division within 32 bits.
+     */
+    uint32_t microseconds = Divide(cycles, TimestampCounterFrequency() / 1000000);
+    if (microseconds == 0)
+    {
+        microseconds = 1;
+    }
+
+    printf(name);
+    printf(": ");
+    printfDec(Divide((uint64_t)operations * 1000000, microseconds));
+    printf(" ops/s, ");
+    printfDec(Divide(bytes * 1000000 / 1024, microseconds));
+    printf(" KiB/s\n");
+}
+
+/** System call benchmark */
+
+static const uint32_t SYSCALL_BENCHMARK_ITERATIONS = 100000;
+
+/**
+ * @brief Filled in by the ring 3 part of the benchmark.
+ */
+static struct
+{
+    bool sysenterSupported;
+    uint64_t interruptCycles;
+    uint64_t sysenterCycles;
+} syscallBenchmarkResults USER_DATA;
+
+/**
+ * @brief The ring 3 part of the system call benchmark. Everything it calls must be inlined, as
+ * it can't use any kernel function.
+ */
+static void USER_TEXT SyscallBenchmarkUserMode()
+{
+    uint64_t start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < SYSCALL_BENCHMARK_ITERATIONS; i++)
+    {
+        SystemCall(SYSCALL_NULL);
+    }
+    syscallBenchmarkResults.interruptCycles = ReadTimestampCounter() - start;
+
+    if (syscallBenchmarkResults.sysenterSupported)
+    {
+        start = ReadTimestampCounter();
+        for (uint32_t i = 0; i < SYSCALL_BENCHMARK_ITERATIONS; i++)
+        {
+            FastSystemCall(SYSCALL_NULL);
+        }
+        syscallBenchmarkResults.sysenterCycles = ReadTimestampCounter() - start;
+    }
+
+    SystemCall(SYSCALL_EXIT);
+}
+
+void RunSyscallBenchmark(SyscallHandler *syscalls)
+{
+    static uint8_t userStack[4096] USER_DATA;
+
+    syscallBenchmarkResults.sysenterSupported = SyscallHandler::FastSystemCallsSupported();
+    syscalls->EnterUserMode(&SyscallBenchmarkUserMode, (uint32_t)(userStack + sizeof(userStack)));
+
+    PrintBenchmarkResult("int 0x80 null syscall", syscallBenchmarkResults.interruptCycles,
+                         SYSCALL_BENCHMARK_ITERATIONS);
+    if (syscallBenchmarkResults.sysenterSupported)
+    {
+        PrintBenchmarkResult("sysenter null syscall", syscallBenchmarkResults.sysenterCycles,
+                             SYSCALL_BENCHMARK_ITERATIONS);
+    }
+    else
+    {
+        printf("sysenter null syscall: not supported by this CPU\n");
+    }
+}
+
+/** ELF loader benchmark */
+
+static const uint32_t ELF_BENCHMARK_INSTANCES = 32;
+
+void RunElfLoaderBenchmark(ElfProgram *program, GlobalDescriptorTable *gdt)
+{
+    PhysicalMemoryManager *frames = PhysicalMemoryManager::activePhysicalMemoryManager;
+    MemoryManager *heap = MemoryManager::activeMemoryManager;
+
+    /**
+     * The instances are only loaded, never added to the run queues: other processors would run
+     * them (and fault pages in) while the memory is counted. They are deleted afterwards.
+     */
+    Task *tasks[ELF_BENCHMARK_INSTANCES];
+    uint32_t freeFramesBefore = frames->FreeFrameCount();
+    uint32_t heapBefore = heap->UsedBytes();
+
+    uint64_t start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < ELF_BENCHMARK_INSTANCES; i++)
+    {
+        tasks[i] = program->Load(gdt);
+    }
+    uint64_t cycles = ReadTimestampCounter() - start;
+
+    uint32_t frameBytes = (freeFramesBefore - frames->FreeFrameCount()) * PAGE_SIZE;
+    uint32_t heapBytes = heap->UsedBytes() - heapBefore;
+    for (uint32_t i = 0; i < ELF_BENCHMARK_INSTANCES; i++)
+    {
+        delete tasks[i];
+    }
+
+    PrintBenchmarkResult("ELF program start", cycles, ELF_BENCHMARK_INSTANCES);
+    printf("ELF program start: ");
+    printfDec(frameBytes / ELF_BENCHMARK_INSTANCES);
+    printf(" bytes of frames, ");
+    printfDec(heapBytes / ELF_BENCHMARK_INSTANCES);
+    printf(" bytes of heap per instance\n");
+}
+
+/** Initrd benchmark */
+
+static const uint32_t INITRD_BENCHMARK_INDEXES = 16;
+static const uint32_t INITRD_BENCHMARK_LOOKUPS = 1000;
+
+void RunInitrdBenchmark(const uint8_t *image, uint32_t size)
+{
+    uint64_t start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < INITRD_BENCHMARK_INDEXES; i++)
+    {
+        delete new InitialRamdisk(image, size);
+    }
+    PrintBenchmarkResult("initrd index", ReadTimestampCounter() - start, INITRD_BENCHMARK_INDEXES);
+
+    InitialRamdisk initrd(image, size);
+    uint32_t files = initrd.FileCount();
+    if (files == 0)
+    {
+        return;
+    }
+
+    /**
+     * The first open of a compressed file includes decompressing it.
+     */
+    uint32_t bytes = 0;
+    start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < files; i++)
+    {
+        InitrdFile *file = initrd.Open(initrd.File(i)->path);
+        bytes += file != 0 ? file->size : 0;
+    }
+    PrintBenchmarkResult("initrd first open", ReadTimestampCounter() - start, files);
+    printf("initrd first open: ");
+    printfDec(bytes);
+    printf(" bytes in ");
+    printfDec(files);
+    printf(" files\n");
+
+    start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < INITRD_BENCHMARK_LOOKUPS; i++)
+    {
+        initrd.Open(initrd.File(i % files)->path);
+    }
+    PrintBenchmarkResult("initrd lookup", ReadTimestampCounter() - start,
+                         INITRD_BENCHMARK_LOOKUPS);
+
+    start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < INITRD_BENCHMARK_LOOKUPS; i++)
+    {
+        initrd.Open("no/such/file");
+    }
+    PrintBenchmarkResult("initrd failed lookup", ReadTimestampCounter() - start,
+                         INITRD_BENCHMARK_LOOKUPS);
+}
+
+/** PCI benchmark */
+
+static const uint32_t PCI_BENCHMARK_LOOKUPS = 1000;
+
+void RunPciBenchmark(PeripheralComponentInterconnectController *pci)
+{
+    uint32_t accesses = pci->ConfigurationAccesses();
+    uint64_t start = ReadTimestampCounter();
+    uint32_t devices = pci->EnumerateDevices();
+    PrintBenchmarkResult("PCI scan", ReadTimestampCounter() - start, 1);
+    printf("PCI scan: ");
+    printfDec(devices);
+    printf(" devices, ");
+    printfDec(pci->ConfigurationAccesses() - accesses);
+    printf(" configuration space accesses\n");
+
+    /**
+     * Looks up the last device, the worst case for the table.
+     */
+    PeripheralComponentInterconnectDeviceDescriptor *last = pci->Device(devices - 1);
+    if (last == 0)
+    {
+        return;
+    }
+    start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < PCI_BENCHMARK_LOOKUPS; i++)
+    {
+        pci->FindDevice(last->vendorId, last->deviceId);
+    }
+    PrintBenchmarkResult("PCI device table lookup", ReadTimestampCounter() - start,
+                         PCI_BENCHMARK_LOOKUPS);
+}
+
+/** ATA benchmark */
+
+static const uint32_t ATA_BENCHMARK_SEQUENTIAL_BYTES = 8 * 1024 * 1024;
+static const uint32_t ATA_BENCHMARK_SEQUENTIAL_SECTORS = 128;
+static const uint32_t ATA_BENCHMARK_RANDOM_READS = 256;
+static const uint32_t ATA_BENCHMARK_RANDOM_SECTORS = 8;
+
+/**
+ * @brief Runs the sequential and random read benchmark with the drive's current transfer mode.
+ */
+static void RunAtaReads(AdvancedTechnologyAttachment *drive, uint8_t *buffer, const char *mode)
+{
+    printf(mode);
+
+    uint32_t sectors = ATA_BENCHMARK_SEQUENTIAL_BYTES / 512;
+    if (sectors > drive->SectorCount())
+    {
+        sectors = drive->SectorCount() - drive->SectorCount() % ATA_BENCHMARK_SEQUENTIAL_SECTORS;
+    }
+
+    uint64_t start = ReadTimestampCounter();
+    for (uint32_t sector = 0; sector < sectors; sector += ATA_BENCHMARK_SEQUENTIAL_SECTORS)
+    {
+        drive->Read(sector, ATA_BENCHMARK_SEQUENTIAL_SECTORS, buffer);
+    }
+    PrintThroughputResult(" sequential 64 KiB reads", ReadTimestampCounter() - start,
+                          sectors / ATA_BENCHMARK_SEQUENTIAL_SECTORS, (uint64_t)sectors * 512);
+
+    /**
+     * A linear congruential generator picks the 4 KiB blocks.
+     */
+    uint32_t blocks = drive->SectorCount() / ATA_BENCHMARK_RANDOM_SECTORS;
+    uint32_t seed = 12345;
+    printf(mode);
+    start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < ATA_BENCHMARK_RANDOM_READS; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        uint32_t block = (seed >> 8) % blocks;
+        drive->Read(block * ATA_BENCHMARK_RANDOM_SECTORS, ATA_BENCHMARK_RANDOM_SECTORS, buffer);
+    }
+    PrintThroughputResult(" random 4 KiB reads", ReadTimestampCounter() - start,
+                          ATA_BENCHMARK_RANDOM_READS,
+                          (uint64_t)ATA_BENCHMARK_RANDOM_READS * ATA_BENCHMARK_RANDOM_SECTORS *
+                              512);
+}
+
+void RunAtaBenchmark(AdvancedTechnologyAttachment *drive)
+{
+    if (drive->SectorCount() < ATA_BENCHMARK_SEQUENTIAL_SECTORS)
+    {
+        return;
+    }
+
+    uint8_t *buffer = new uint8_t[ATA_BENCHMARK_SEQUENTIAL_SECTORS * 512];
+    bool dma = drive->DirectMemoryAccessSupported();
+
+    drive->SetDirectMemoryAccess(false);
+    RunAtaReads(drive, buffer, "ATA PIO");
+    if (dma)
+    {
+        drive->SetDirectMemoryAccess(true);
+        RunAtaReads(drive, buffer, "ATA DMA");
+    }
+
+    drive->SetDirectMemoryAccess(dma);
+    delete[] buffer;
+}
+
+/** Virtio block benchmark */
+
+static const uint32_t VIRTIO_BENCHMARK_SEQUENTIAL_BYTES = 8 * 1024 * 1024;
+static const uint32_t VIRTIO_BENCHMARK_SEQUENTIAL_SECTORS = 128;
+static const uint32_t VIRTIO_BENCHMARK_RANDOM_READS = 1024;
+static const uint32_t VIRTIO_BENCHMARK_RANDOM_SECTORS = 8;
+static const uint32_t VIRTIO_BENCHMARK_MAX_DEPTH = 32;
+
+/**
+ * @brief Makes random 4 KiB reads, keeping `depth` of them in flight with one kick per batch.
+ */
+static void RunVirtioRandomReads(VirtioBlockDevice *device, uint8_t *buffer, uint32_t depth,
+                                 const char *name)
+{
+    VirtioBlockRequest requests[VIRTIO_BENCHMARK_MAX_DEPTH];
+    uint32_t blocks = device->SectorCount() / VIRTIO_BENCHMARK_RANDOM_SECTORS;
+    uint32_t seed = 12345;
+    uint32_t kicks = device->Kicks();
+
+    uint64_t start = ReadTimestampCounter();
+    for (uint32_t done = 0; done < VIRTIO_BENCHMARK_RANDOM_READS; done += depth)
+    {
+        for (uint32_t i = 0; i < depth; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            requests[i].sector = (seed >> 8) % blocks * VIRTIO_BENCHMARK_RANDOM_SECTORS;
+            requests[i].count = VIRTIO_BENCHMARK_RANDOM_SECTORS;
+            requests[i].buffer = buffer + i * VIRTIO_BENCHMARK_RANDOM_SECTORS * 512;
+            requests[i].write = false;
+            device->Submit(&requests[i]);
+        }
+        device->Kick();
+        for (uint32_t i = 0; i < depth; i++)
+        {
+            device->Wait(&requests[i]);
+        }
+    }
+    uint64_t cycles = ReadTimestampCounter() - start;
+
+    PrintThroughputResult(name, cycles, VIRTIO_BENCHMARK_RANDOM_READS,
+                          (uint64_t)VIRTIO_BENCHMARK_RANDOM_READS *
+                              VIRTIO_BENCHMARK_RANDOM_SECTORS * 512);
+    printf(name);
+    printf(": ");
+    printfDec(device->Kicks() - kicks);
+    printf(" kicks\n");
+}
+
+void RunVirtioBlockBenchmark(VirtioBlockDevice *device)
+{
+    if (device->SectorCount() < VIRTIO_BENCHMARK_SEQUENTIAL_SECTORS)
+    {
+        return;
+    }
+
+    uint8_t *buffer =
+        new uint8_t[VIRTIO_BENCHMARK_MAX_DEPTH * VIRTIO_BENCHMARK_RANDOM_SECTORS * 512];
+
+    uint32_t sectors = VIRTIO_BENCHMARK_SEQUENTIAL_BYTES / 512;
+    if (sectors > device->SectorCount())
+    {
+        sectors =
+            device->SectorCount() - device->SectorCount() % VIRTIO_BENCHMARK_SEQUENTIAL_SECTORS;
+    }
+    uint64_t start = ReadTimestampCounter();
+    for (uint32_t sector = 0; sector < sectors; sector += VIRTIO_BENCHMARK_SEQUENTIAL_SECTORS)
+    {
+        device->Read(sector, VIRTIO_BENCHMARK_SEQUENTIAL_SECTORS, buffer);
+    }
+    PrintThroughputResult("virtio sequential 64 KiB reads", ReadTimestampCounter() - start,
+                          sectors / VIRTIO_BENCHMARK_SEQUENTIAL_SECTORS, (uint64_t)sectors * 512);
+
+    uint32_t depth = device->QueueDepth();
+    if (depth > VIRTIO_BENCHMARK_MAX_DEPTH)
+    {
+        depth = VIRTIO_BENCHMARK_MAX_DEPTH;
+    }
+    RunVirtioRandomReads(device, buffer, 1, "virtio random 4 KiB reads, depth 1");
+    if (depth > 1)
+    {
+        RunVirtioRandomReads(device, buffer, depth, "virtio random 4 KiB reads, batched");
+    }
+
+    delete[] buffer;
+}
+
+/** Block cache benchmark */
+
+static const uint32_t CACHE_BENCHMARK_SEQUENTIAL_BYTES = 2 * 1024 * 1024;
+static const uint32_t CACHE_BENCHMARK_RANDOM_READS = 4096;
+
+/**
+ * @brief Reads `bytes` from the start of a device through the cache, 4 KiB at a time.
+ */
+static void RunCacheSequentialReads(BlockCache *cache, BlockDevice *device, uint8_t *buffer,
+                                    uint32_t bytes, const char *name)
+{
+    uint32_t sectors = BLOCK_CACHE_BLOCK_SIZE / device->SectorSize();
+    cache->ResetStatistics();
+    uint64_t start = ReadTimestampCounter();
+    for (uint32_t sector = 0; sector < bytes / device->SectorSize(); sector += sectors)
+    {
+        cache->Read(device, sector, sectors, buffer);
+    }
+    PrintThroughputResult(name, ReadTimestampCounter() - start, bytes / BLOCK_CACHE_BLOCK_SIZE,
+                          bytes);
+    printf("  ");
+    cache->PrintStatistics();
+}
+
+void RunBlockCacheBenchmark(BlockCache *cache, BlockDevice *device)
+{
+    uint32_t sectors = BLOCK_CACHE_BLOCK_SIZE / device->SectorSize();
+    uint32_t bytes = CACHE_BENCHMARK_SEQUENTIAL_BYTES;
+    if (bytes > cache->Capacity() * BLOCK_CACHE_BLOCK_SIZE / 2)
+    {
+        bytes = cache->Capacity() * BLOCK_CACHE_BLOCK_SIZE / 2;
+    }
+    if ((uint64_t)device->SectorCount() * device->SectorSize() < bytes)
+    {
+        return;
+    }
+
+    uint8_t *buffer = new uint8_t[BLOCK_CACHE_BLOCK_SIZE];
+
+    RunCacheSequentialReads(cache, device, buffer, bytes, "cache sequential 4 KiB reads, cold");
+    RunCacheSequentialReads(cache, device, buffer, bytes, "cache sequential 4 KiB reads, warm");
+
+    /**
+     * The random reads cover twice the cache, so about half of them hit.
+     */
+    uint32_t blocks = cache->Capacity() * 2;
+    if (blocks > device->SectorCount() / sectors)
+    {
+        blocks = device->SectorCount() / sectors;
+    }
+    uint32_t seed = 12345;
+    cache->ResetStatistics();
+    uint64_t start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < CACHE_BENCHMARK_RANDOM_READS; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        cache->Read(device, (seed >> 8) % blocks * sectors, sectors, buffer);
+    }
+    PrintThroughputResult("cache random 4 KiB reads", ReadTimestampCounter() - start,
+                          CACHE_BENCHMARK_RANDOM_READS,
+                          (uint64_t)CACHE_BENCHMARK_RANDOM_READS * BLOCK_CACHE_BLOCK_SIZE);
+    printf("  ");
+    cache->PrintStatistics();
+
+    delete[] buffer;
+}
+
+/** FAT32 benchmark */
+
+static const uint32_t FAT_BENCHMARK_LOOKUPS = 256;
+
+/**
+ * @brief Reads a whole file in pieces of the given size.
+ */
+static void RunFileReads(FileAllocationTable *fileSystem, const char *path, uint8_t *buffer,
+                         uint32_t size, const char *name)
+{
+    FileAllocationTableFile file;
+    if (!fileSystem->Open(path, &file))
+    {
+        return;
+    }
+
+    uint32_t reads = 0;
+    uint64_t start = ReadTimestampCounter();
+    while (fileSystem->Read(&file, buffer, size) > 0)
+    {
+        reads++;
+    }
+    PrintThroughputResult(name, ReadTimestampCounter() - start, reads, file.size);
+}
+
+void RunFileAllocationTableBenchmark(FileAllocationTable *fileSystem)
+{
+    uint8_t *buffer = new uint8_t[64 * 1024];
+
+    /**
+     * The first read of a file also decodes its cluster chain.
+     */
+    RunFileReads(fileSystem, "data/large.bin", buffer, 64 * 1024, "fat32 large file, 64 KiB, cold");
+    RunFileReads(fileSystem, "data/large.bin", buffer, 64 * 1024, "fat32 large file, 64 KiB");
+    RunFileReads(fileSystem, "data/large.bin", buffer, 512, "fat32 large file, 1 cluster");
+    RunFileReads(fileSystem, "data/fragmented.bin", buffer, 64 * 1024,
+                 "fat32 fragmented file, 64 KiB");
+
+    /**
+     * Lookups of names all over a large directory, i.e., a scan of half of it on average.
+     */
+    char path[] = "many/file0000.txt";
+    uint32_t seed = 12345;
+    uint32_t found = 0;
+    FileAllocationTableFile file;
+    uint64_t start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < FAT_BENCHMARK_LOOKUPS; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        uint32_t number = (seed >> 8) % 1024;
+        for (uint32_t digit = 0; digit < 4; digit++)
+        {
+            path[12 - digit] = '0' + number % 10;
+            number /= 10;
+        }
+        if (fileSystem->Open(path, &file))
+        {
+            found++;
+        }
+    }
+    PrintBenchmarkResult("fat32 lookup, 1024 entries", ReadTimestampCounter() - start,
+                         FAT_BENCHMARK_LOOKUPS);
+    printf("  found ");
+    printfDec(found);
+    printf(", chains decoded ");
+    printfDec(fileSystem->ChainMisses());
+    printf("\n");
+
+    delete[] buffer;
+}
+
+/** Network benchmark */
+
+static const uint32_t NETWORK_BENCHMARK_WAIT_SECONDS = 2;
+static const uint32_t NETWORK_BENCHMARK_RECEIVE_SECONDS = 5;
+static const uint32_t NETWORK_BENCHMARK_FRAMES_SENT = 100000;
+
+/**
+ * @brief Counts the frames handed to it. Being done with them on return, it never copies them.
+ */
+class CountingFrameHandler : public NetworkFrameHandler
+{
+  public:
+    volatile uint32_t framesReceived;
+    volatile uint32_t framesSent;
+
+    CountingFrameHandler()
+    {
+        framesReceived = 0;
+        framesSent = 0;
+    }
+
+    virtual void HandleFrame(NetworkDevice *device, const uint8_t *frame, uint32_t size)
+    {
+        framesReceived++;
+    }
+
+    virtual void FrameSent(NetworkDevice *device, const void *frame) { framesSent++; }
+};
+
+/**
+ * @brief Lets other tasks (the driver's polling task among them) run until the given time stamp
+ * counter value, or until a condition holds.
+ */
+static void YieldUntil(uint64_t end, volatile uint32_t *counter = 0, uint32_t target = 0)
+{
+    while (ReadTimestampCounter() < end && (counter == 0 || *counter < target))
+    {
+        TaskManager::activeTaskManager->Yield();
+    }
+}
+
+/**
+ * @brief Prints "<name> <count> (<count per second>/s)".
+ */
+static void PrintRate(const char *name, uint32_t count, uint64_t cycles)
+{
+    uint32_t milliseconds = Divide(cycles, TimestampCounterFrequency() / 1000);
+    if (milliseconds == 0)
+    {
+        milliseconds = 1;
+    }
+    printf(name);
+    printf(" ");
+    printfDec(count);
+    printf(" (");
+    printfDec(Divide((uint64_t)count * 1000, milliseconds));
+    printf("/s)");
+}
+
+void RunNetworkBenchmark(NetworkDevice *device)
+{
+    CountingFrameHandler handler;
+    device->SetHandler(&handler);
+    uint64_t frequency = TimestampCounterFrequency();
+
+    /**
+     * Only measures receiving if a flood is running.
+     */
+    YieldUntil(ReadTimestampCounter() + NETWORK_BENCHMARK_WAIT_SECONDS * frequency,
+               &handler.framesReceived, 1);
+    if (handler.framesReceived == 0)
+    {
+        printf("net: no frames received, skipping the receive benchmark\n");
+    }
+    else
+    {
+        device->ResetStatistics();
+        uint64_t start = ReadTimestampCounter();
+        YieldUntil(start + NETWORK_BENCHMARK_RECEIVE_SECONDS * frequency);
+        uint64_t cycles = ReadTimestampCounter() - start;
+
+        NetworkDeviceStatistics statistics = device->Statistics();
+        PrintThroughputResult("net receive", cycles, statistics.framesReceived,
+                              statistics.bytesReceived);
+        PrintRate("  interrupts", statistics.interrupts, cycles);
+        PrintRate(", polls", statistics.polls, cycles);
+        printf(", back to interrupts ");
+        printfDec(statistics.interruptModeSwitches);
+        printf(", missed ");
+        printfDec(statistics.framesMissed);
+        printf("\n");
+    }
+
+    /**
+     * The same broadcast frame is sent over and over, which its contents allow.
+     */
+    static uint8_t frame[60];
+    for (uint32_t i = 0; i < 6; i++)
+    {
+        frame[i] = 0xFF;
+    }
+    frame[12] = 0x88;
+    frame[13] = 0xB5;
+
+    device->ResetStatistics();
+    handler.framesSent = 0;
+    uint64_t start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < NETWORK_BENCHMARK_FRAMES_SENT; i++)
+    {
+        while (!device->Send(frame, sizeof(frame)))
+        {
+            TaskManager::activeTaskManager->Yield();
+        }
+    }
+    YieldUntil(start + 10 * frequency, &handler.framesSent, NETWORK_BENCHMARK_FRAMES_SENT);
+    uint64_t cycles = ReadTimestampCounter() - start;
+
+    NetworkDeviceStatistics statistics = device->Statistics();
+    PrintThroughputResult("net send", cycles, statistics.framesSent,
+                          (uint64_t)statistics.framesSent * sizeof(frame));
+    PrintRate("  interrupts", statistics.interrupts, cycles);
+    printf("\n");
+
+    device->SetHandler(0);
+}
+
+/** Input benchmark */
+
+/**
+ * @brief Prints "<name> <average> us (max <max> us)" for latencies in cycles.
+ */
+static void PrintLatency(const char *name, uint64_t cycles, uint32_t count, uint64_t maxCycles)
+{
+    uint32_t cyclesPerMicrosecond = TimestampCounterFrequency() / 1000000;
+    printf(name);
+    printf(" ");
+    printfDec(count > 0 ? Divide(Divide(cycles, count), cyclesPerMicrosecond) : 0);
+    printf(" us (max ");
+    printfDec(Divide(maxCycles, cyclesPerMicrosecond));
+    printf(" us)");
+}
+
+void RunInputBenchmark(PS2Controller *controller, InputTrace *trace, InputEventQueue *queue,
+                       InputConsole *console)
+{
+    InitrdFile *file = InitialRamdisk::activeInitialRamdisk != 0
+                           ? InitialRamdisk::activeInitialRamdisk->Open("input.trace")
+                           : 0;
+    if (file == 0 || !trace->Load(file->data, file->size) || trace->Count() == 0)
+    {
+        printf("input: no input.trace in the initrd, skipping the input benchmark\n");
+        return;
+    }
+    uint64_t frequency = TimestampCounterFrequency();
+
+    /**
+     * At full speed the console gets no chance to run until the whole trace is in, so this is
+     * the cost of the drivers and the queue alone, and the queue coalesces (or drops) the most.
+     */
+    queue->ResetStatistics();
+    uint64_t cycles = trace->Replay(controller, false);
+    InputEventQueueStatistics statistics = queue->Statistics();
+    PrintBenchmarkResult("input replay", cycles, trace->Count());
+    printf("  posted ");
+    printfDec(statistics.posted);
+    printf(", coalesced ");
+    printfDec(statistics.coalesced);
+    printf(", dropped ");
+    printfDec(statistics.dropped);
+    printf("\n");
+    YieldUntil(ReadTimestampCounter() + frequency);
+
+    /**
+     * At the recorded pace, the console draws as the events come in, as it would for a user.
+     */
+    queue->ResetStatistics();
+    console->ResetStatistics();
+    cycles = trace->Replay(controller, true);
+    YieldUntil(ReadTimestampCounter() + TimestampCounterFrequency() / 10);
+
+    statistics = queue->Statistics();
+    InputConsoleStatistics consoleStatistics = console->Statistics();
+    PrintRate("input timed replay: frames", consoleStatistics.frames, cycles);
+    printf(", events ");
+    printfDec(consoleStatistics.events);
+    printf(", coalesced ");
+    printfDec(statistics.coalesced);
+    printf("\n");
+    PrintLatency("  latency", consoleStatistics.latencyCycles, consoleStatistics.events,
+                 consoleStatistics.maxLatencyCycles);
+    printf("\n");
+}
+
+/** SMP benchmark */
+
+static const uint32_t SMP_BENCHMARK_LIMIT = 200000;
+static const uint32_t SMP_BENCHMARK_BLOCK = 1000;
+
+/**
+ * @brief Finds the application processors that have started.
+ *
+ * @return The number of processors running, this one (the bootstrap processor) included.
+ */
+static uint32_t RunningProcessors(ProcessorManager *processors, Processor **others)
+{
+    uint32_t count = 1;
+    for (uint32_t i = 0; i < processors->Count() && count < 16; i++)
+    {
+        Processor *processor = processors->Get(i);
+        if (!processor->Bootstrap() && processor->Started())
+        {
+            others[count++ - 1] = processor;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Runs a function on this processor and the `count - 1` others given, each with an
+ * argument of its own, and waits for all of them.
+ *
+ * @return The cycles until the last one was done.
+ */
+static uint64_t RunOnProcessors(Processor **others, uint32_t count, void (*work)(void *),
+                                void **arguments)
+{
+    uint64_t start = ReadTimestampCounter();
+    for (uint32_t i = 1; i < count; i++)
+    {
+        others[i - 1]->Run(work, arguments[i]);
+    }
+    work(arguments[0]);
+    for (uint32_t i = 1; i < count; i++)
+    {
+        others[i - 1]->Wait();
+    }
+    return ReadTimestampCounter() - start;
+}
+
+/**
+ * @brief The share of the numbers one processor counts the primes of. Each is on a cache line of
+ * its own, so that processors writing their counts don't slow each other down.
+ */
+struct PrimeCountShare
+{
+    uint32_t index;
+    uint32_t count;
+    volatile uint32_t primes;
+} __attribute__((aligned(64)));
+
+/**
+ * @brief Counts the primes of a share. The larger numbers take longer to test, so the processors
+ * take blocks of `SMP_BENCHMARK_BLOCK` numbers in turns rather than one range each.
+ */
+static void CountPrimes(void *argument)
+{
+    PrimeCountShare *share = (PrimeCountShare *)argument;
+    uint32_t primes = 0;
+    for (uint32_t block = share->index * SMP_BENCHMARK_BLOCK; block < SMP_BENCHMARK_LIMIT;
+         block += share->count * SMP_BENCHMARK_BLOCK)
+    {
+        for (uint32_t n = block; n < block + SMP_BENCHMARK_BLOCK; n++)
+        {
+            bool prime = n >= 2;
+            for (uint32_t divisor = 2; prime && divisor * divisor <= n; divisor++)
+            {
+                prime = n % divisor != 0;
+            }
+            primes += prime;
+        }
+    }
+    share->primes = primes;
+}
+
+/**
+ * @brief Counts the primes below `SMP_BENCHMARK_LIMIT` on `count` processors.
+ */
+static uint64_t RunPrimeCount(Processor **others, uint32_t count, uint32_t *primes)
+{
+    static PrimeCountShare shares[16];
+    void *arguments[16];
+    for (uint32_t i = 0; i < count; i++)
+    {
+        shares[i].index = i;
+        shares[i].count = count;
+        shares[i].primes = 0;
+        arguments[i] = &shares[i];
+    }
+
+    uint64_t cycles = RunOnProcessors(others, count, &CountPrimes, arguments);
+
+    *primes = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        *primes += shares[i].primes;
+    }
+    return cycles;
+}
+
+void RunProcessorBenchmark(ProcessorManager *processors)
+{
+    Processor *others[15];
+    uint32_t count = RunningProcessors(processors, others);
+
+    uint32_t primes;
+    uint64_t single = RunPrimeCount(others, 1, &primes);
+    PrintBenchmarkResult("smp: prime count, 1 processor", single, 1);
+
+    uint32_t parallelPrimes;
+    uint64_t parallel = RunPrimeCount(others, count, &parallelPrimes);
+    printf("smp: prime count, ");
+    printfDec(count);
+    printf(" processors: ");
+    printfDec(Divide(parallel, 1));
+    printf(" cycles/op\n");
+
+    printf("smp: ");
+    printfDec(primes);
+    printf(primes == parallelPrimes ? " primes, speedup " : " primes (MISMATCH), speedup ");
+    printfDec(Divide(single, Divide(parallel, 100) + 1));
+    printf("%\n");
+}
+
+/** Scheduler benchmark */
+
+static const uint32_t SCHEDULER_BENCHMARK_TASKS = 16;
+
+static PrimeCountShare schedulerShares[SCHEDULER_BENCHMARK_TASKS];
+static volatile uint32_t schedulerNextShare;
+static volatile uint32_t schedulerFinished;
+
+/**
+ * @brief A kernel task counting the primes of the next share. The last one to finish wakes the
+ * benchmark up.
+ */
+static void CountPrimesTask()
+{
+    uint32_t index = __sync_fetch_and_add(&schedulerNextShare, 1);
+    CountPrimes(&schedulerShares[index]);
+    if (__sync_add_and_fetch(&schedulerFinished, 1) == SCHEDULER_BENCHMARK_TASKS)
+    {
+        TaskManager::activeTaskManager->Wakeup((void *)&schedulerFinished);
+    }
+}
+
+/**
+ * @brief Counts the primes below `SMP_BENCHMARK_LIMIT` in `SCHEDULER_BENCHMARK_TASKS` kernel
+ * tasks, and waits (asleep) for all of them.
+ *
+ * @param affinity The processor the tasks must run on, or `ANY_PROCESSOR`.
+ * @return The cycles until the last one was done.
+ */
+static uint64_t RunPrimeCountTasks(TaskManager *taskManager, int32_t affinity, uint32_t *primes)
+{
+    for (uint32_t i = 0; i < SCHEDULER_BENCHMARK_TASKS; i++)
+    {
+        schedulerShares[i].index = i;
+        schedulerShares[i].count = SCHEDULER_BENCHMARK_TASKS;
+        schedulerShares[i].primes = 0;
+    }
+    schedulerNextShare = 0;
+    schedulerFinished = 0;
+
+    uint64_t start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < SCHEDULER_BENCHMARK_TASKS; i++)
+    {
+        /**
+         * Without room for another task, the share is counted here.
+         */
+        if (taskManager->StartKernelTask(&CountPrimesTask, affinity) == 0)
+        {
+            CountPrimesTask();
+        }
+    }
+
+    asm volatile("cli");
+    while (schedulerFinished < SCHEDULER_BENCHMARK_TASKS)
+    {
+        taskManager->Sleep((void *)&schedulerFinished);
+    }
+    asm volatile("sti");
+    uint64_t cycles = ReadTimestampCounter() - start;
+
+    *primes = 0;
+    for (uint32_t i = 0; i < SCHEDULER_BENCHMARK_TASKS; i++)
+    {
+        *primes += schedulerShares[i].primes;
+    }
+    return cycles;
+}
+
+/**
+ * @brief Adds up the tasks the processors took from each other's run queues.
+ */
+static uint32_t CountSteals(ProcessorManager *processors)
+{
+    uint32_t steals = 0;
+    for (uint32_t i = 0; i < processors->Count(); i++)
+    {
+        ProcessorData *data = processors->Get(i)->Data();
+        if (data != 0)
+        {
+            steals += data->steals;
+        }
+    }
+    return steals;
+}
+
+void RunSchedulerBenchmark(TaskManager *taskManager, ProcessorManager *processors)
+{
+    Processor *others[15];
+    uint32_t count = RunningProcessors(processors, others);
+
+    uint32_t primes;
+    uint64_t pinned = RunPrimeCountTasks(taskManager, 0, &primes);
+    PrintBenchmarkResult("scheduler: prime count, 16 tasks on processor 0", pinned, 1);
+
+    uint32_t steals = CountSteals(processors);
+    uint32_t spreadPrimes;
+    uint64_t spread = RunPrimeCountTasks(taskManager, ANY_PROCESSOR, &spreadPrimes);
+    steals = CountSteals(processors) - steals;
+    printf("scheduler: prime count, 16 tasks on ");
+    printfDec(count);
+    printf(count == 1 ? " processor: " : " processors: ");
+    printfDec(Divide(spread, 1));
+    printf(" cycles/op\n");
+
+    printf("scheduler: ");
+    printfDec(primes);
+    printf(primes == spreadPrimes ? " primes, speedup " : " primes (MISMATCH), speedup ");
+    printfDec(Divide(pinned, Divide(spread, 100) + 1));
+    printf("%, ");
+    printfDec(steals);
+    printf(" tasks stolen\n");
+}
+
+/** Spinlock benchmark */
+
+static const uint32_t SPINLOCK_BENCHMARK_ITERATIONS = 100000;
+
+static LockClass benchmarkLockClass("benchmark");
+static Spinlock benchmarkLock(&benchmarkLockClass);
+static volatile uint32_t benchmarkCounter;
+
+static void IncrementLockedCounter(void *argument)
+{
+    for (uint32_t i = 0; i < SPINLOCK_BENCHMARK_ITERATIONS; i++)
+    {
+        SpinlockGuard guard(&benchmarkLock);
+        benchmarkCounter++;
+    }
+}
+
+/**
+ * @brief Increments the shared counter on `count` processors, and prints the cost per increment
+ * and how often the lock had to be waited for.
+ */
+static void RunLockedIncrements(Processor **others, uint32_t count)
+{
+    void *arguments[16] = {0};
+    benchmarkCounter = 0;
+    benchmarkLockClass.Reset();
+    uint64_t cycles = RunOnProcessors(others, count, &IncrementLockedCounter, arguments);
+
+    printf("spinlock: ");
+    printfDec(count);
+    printf(count == 1 ? " processor: " : " processors: ");
+    printfDec(Divide(cycles, count * SPINLOCK_BENCHMARK_ITERATIONS));
+    printf(" cycles/increment, ");
+    printfDec(benchmarkLockClass.Contended());
+    printf(" of ");
+    printfDec(benchmarkLockClass.Acquires());
+    printf(" contended");
+    if (benchmarkCounter != count * SPINLOCK_BENCHMARK_ITERATIONS)
+    {
+        printf(" (LOST UPDATES)");
+    }
+    printf("\n");
+}
+
+void RunSpinlockBenchmark(ProcessorManager *processors)
+{
+    Processor *others[15];
+    uint32_t count = RunningProcessors(processors, others);
+
+    RunLockedIncrements(others, 1);
+    if (count > 1)
+    {
+        RunLockedIncrements(others, count);
+    }
+
+    /**
+     * The statistics of every lock class since boot, then what each processor counted in its own
+     * data, without any locking.
+     */
+    for (LockClass *lockClass = LockClass::First(); lockClass != 0; lockClass = lockClass->Next())
+    {
+        printf("lock ");
+        printf(lockClass->Name());
+        printf(": ");
+        printfDec(lockClass->Acquires());
+        printf(" acquires, ");
+        printfDec(lockClass->Contended());
+        printf(" contended, ");
+        printfDec(Divide(lockClass->SpinCycles(), 1));
+        printf(" cycles spinning\n");
+    }
+    for (uint32_t i = 0; i < processors->Count(); i++)
+    {
+        ProcessorData *data = processors->Get(i)->Data();
+        if (data == 0)
+        {
+            continue;
+        }
+        printf("cpu ");
+        printfDec(i);
+        printf(": ");
+        printfDec(data->interrupts);
+        printf(" interrupts, ");
+        printfDec(data->taskSwitches);
+        printf(" task switches, ");
+        printfDec(data->systemCalls);
+        printf(" system calls, ");
+        printfDec(data->steals);
+        printf(" steals\n");
+    }
+}
+
+/** Timer benchmark */
+
+static const uint32_t TIMER_BENCHMARK_TICKS = 4096;
+
+/**
+ * The timers are spread over this many ticks, which is beyond the finest wheel, so that the
+ * benchmark includes cascades.
+ */
+static const uint32_t TIMER_BENCHMARK_SPREAD = 65536;
+
+static uint32_t timerBenchmarkFired;
+
+static void CountExpiredTimer(void *argument) { timerBenchmarkFired++; }
+
+/**
+ * @brief Adds `count` timers at random ticks to a wheel of its own, and prints the cost of adding
+ * and cancelling one, and the average and worst cost of a tick.
+ */
+static void RunTimerTicks(uint32_t count)
+{
+    TimerWheel *wheel = new TimerWheel();
+    Timer *timers = new Timer[count + 1];
+
+    uint32_t seed = 12345;
+    uint64_t start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < count; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        timers[i].SetCallback(&CountExpiredTimer, 0);
+        wheel->Add(&timers[i], (seed >> 8) % TIMER_BENCHMARK_SPREAD);
+    }
+    uint64_t addCycles = ReadTimestampCounter() - start;
+
+    /**
+     * One more timer, added and cancelled over and over among the others.
+     */
+    start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < TIMER_BENCHMARK_TICKS; i++)
+    {
+        wheel->Add(&timers[count], i);
+        wheel->Cancel(&timers[count]);
+    }
+    uint64_t cancelCycles = ReadTimestampCounter() - start;
+
+    timerBenchmarkFired = 0;
+    uint64_t tickCycles = 0;
+    uint64_t maxCycles = 0;
+    for (uint32_t i = 0; i < TIMER_BENCHMARK_TICKS; i++)
+    {
+        start = ReadTimestampCounter();
+        wheel->Tick();
+        uint64_t cycles = ReadTimestampCounter() - start;
+        tickCycles += cycles;
+        if (cycles > maxCycles)
+        {
+            maxCycles = cycles;
+        }
+        wheel->RunExpired();
+    }
+
+    printf("timer: ");
+    printfDec(count);
+    printf(" pending: ");
+    printfDec(count != 0 ? Divide(addCycles, count) : 0);
+    printf(" cycles/add, ");
+    printfDec(Divide(cancelCycles, TIMER_BENCHMARK_TICKS));
+    printf(" cycles/add+cancel, ");
+    printfDec(Divide(tickCycles, TIMER_BENCHMARK_TICKS));
+    printf(" cycles/tick (max ");
+    printfDec(Divide(maxCycles, 1));
+    printf("), ");
+    printfDec(timerBenchmarkFired);
+    printf(" expired\n");
+
+    delete[] timers;
+    delete wheel;
+}
+
+void RunTimerBenchmark()
+{
+    RunTimerTicks(0);
+    RunTimerTicks(1000);
+    RunTimerTicks(10000);
+}
+
+/** Graphics benchmark */
+
+static const uint32_t GRAPHICS_BENCHMARK_FULL_FRAMES = 16;
+static const uint32_t GRAPHICS_BENCHMARK_PARTIAL_FRAMES = 256;
+static const int32_t GRAPHICS_BENCHMARK_SPRITE = 64;
+static const uint32_t GRAPHICS_BENCHMARK_BACKGROUND = 0x00203050;
+
+static uint32_t graphicsBenchmarkSprite[GRAPHICS_BENCHMARK_SPRITE * GRAPHICS_BENCHMARK_SPRITE];
+
+/**
+ * @brief Redraws the whole screen each frame, then only a sprite moving over it (erasing it where
+ * it was), and prints the cycles per frame of each.
+ */
+static void RunGraphicsFrames(GraphicsDevice *device, const char *mode)
+{
+    Rectangle screen = {0, 0, (int32_t)device->Width(), (int32_t)device->Height()};
+    uint64_t start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < GRAPHICS_BENCHMARK_FULL_FRAMES; i++)
+    {
+        device->Fill(screen, i & 1 ? GRAPHICS_BENCHMARK_BACKGROUND : 0x00502030);
+        device->Present();
+    }
+    uint64_t full = ReadTimestampCounter() - start;
+
+    device->Fill(screen, GRAPHICS_BENCHMARK_BACKGROUND);
+    device->Present();
+
+    Rectangle sprite = {0, 0, GRAPHICS_BENCHMARK_SPRITE, GRAPHICS_BENCHMARK_SPRITE};
+    uint32_t pixels = 0;
+    start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < GRAPHICS_BENCHMARK_PARTIAL_FRAMES; i++)
+    {
+        device->Fill(sprite, GRAPHICS_BENCHMARK_BACKGROUND);
+        sprite.x = (i * 7) % (screen.width - GRAPHICS_BENCHMARK_SPRITE);
+        sprite.y = (i * 5) % (screen.height - GRAPHICS_BENCHMARK_SPRITE);
+        device->Blit(sprite.x, sprite.y, graphicsBenchmarkSprite, GRAPHICS_BENCHMARK_SPRITE,
+                     GRAPHICS_BENCHMARK_SPRITE, GRAPHICS_BENCHMARK_SPRITE);
+        pixels += device->Present();
+    }
+    uint64_t partial = ReadTimestampCounter() - start;
+
+    printf("graphics: ");
+    printf(mode);
+    printf(": ");
+    printfDec(Divide(full, GRAPHICS_BENCHMARK_FULL_FRAMES));
+    printf(" cycles/full frame, ");
+    printfDec(Divide(partial, GRAPHICS_BENCHMARK_PARTIAL_FRAMES));
+    printf(" cycles/partial frame (");
+    printfDec(pixels / GRAPHICS_BENCHMARK_PARTIAL_FRAMES);
+    printf(" pixels presented)\n");
+}
+
+void RunGraphicsBenchmark(GraphicsDevice *device)
+{
+    for (int32_t i = 0; i < GRAPHICS_BENCHMARK_SPRITE * GRAPHICS_BENCHMARK_SPRITE; i++)
+    {
+        graphicsBenchmarkSprite[i] = (i * 0x010305) & 0x00FFFFFF;
+    }
+
+    uint8_t *memory = 0;
+    GraphicsDevice *offscreen = 0;
+    if (device == 0)
+    {
+        printf("graphics: no framebuffer, drawing to memory\n");
+        memory = new uint8_t[1024 * 768 * 4];
+        if (memory == 0)
+        {
+            return;
+        }
+        device = offscreen = new GraphicsDevice((uint32_t)memory, 1024, 768, 1024 * 4);
+    }
+
+    bool sse2 = device->SSE2();
+    device->SetSSE2(false);
+    RunGraphicsFrames(device, "32 - bit");
+    device->SetSSE2(true);
+    if (device->SSE2())
+    {
+        RunGraphicsFrames(device, "SSE2");
+    }
+    device->SetSSE2(sse2);
+
+    if (offscreen != 0)
+    {
+        delete offscreen;
+        delete[] memory;
+    }
+}
+
+/** Compositor benchmark */
+
+static const uint32_t COMPOSITOR_BENCHMARK_FRAMES = 64;
+
+/**
+ * @brief Changes something on each frame of the compositor benchmark.
+ */
+typedef void (*CompositorBenchmarkUpdate)(Compositor *compositor, Window *window, uint32_t frame);
+
+static void MoveBenchmarkCursor(Compositor *compositor, Window *window, uint32_t frame)
+{
+    compositor->MoveCursor(200 + (frame * 7) % 600, 150 + (frame * 5) % 450);
+}
+
+static void DamageBenchmarkArea(Compositor *compositor, Window *window, uint32_t frame)
+{
+    Rectangle area = {(int32_t)(frame * 3) % (window->Width() - 32), 40, 32, 32};
+    window->Fill(area, 0x00101010 * (frame & 15));
+}
+
+static void DamageBenchmarkWindow(Compositor *compositor, Window *window, uint32_t frame)
+{
+    Rectangle area = {0, 0, window->Width(), window->Height()};
+    window->Fill(area, 0x00101010 * (frame & 15));
+}
+
+static void DamageBenchmarkScreen(Compositor *compositor, Window *window, uint32_t frame)
+{
+    Rectangle screen = {0, 0, 0x10000, 0x10000};
+    compositor->Damage(screen);
+}
+
+static void RunCompositorFrames(Compositor *compositor, Window *window, const char *name,
+                                CompositorBenchmarkUpdate update)
+{
+    uint32_t pixels = 0;
+    uint64_t start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < COMPOSITOR_BENCHMARK_FRAMES; i++)
+    {
+        update(compositor, window, i);
+        pixels += compositor->Render();
+    }
+    uint64_t cycles = ReadTimestampCounter() - start;
+
+    printf("compositor: ");
+    printf(name);
+    printf(": ");
+    printfDec(Divide(cycles, COMPOSITOR_BENCHMARK_FRAMES));
+    printf(" cycles/frame (");
+    printfDec(pixels / COMPOSITOR_BENCHMARK_FRAMES);
+    printf(" pixels presented)\n");
+}
+
+void RunCompositorBenchmark(GraphicsDevice *device)
+{
+    uint8_t *memory = 0;
+    GraphicsDevice *offscreen = 0;
+    Compositor *compositor = Compositor::activeCompositor;
+    if (compositor == 0)
+    {
+        if (device == 0)
+        {
+            printf("compositor: no framebuffer, drawing to memory\n");
+            memory = new uint8_t[1024 * 768 * 4];
+            if (memory == 0)
+            {
+                return;
+            }
+            device = offscreen = new GraphicsDevice((uint32_t)memory, 1024, 768, 1024 * 4);
+        }
+        compositor = new Compositor(device, GRAPHICS_BENCHMARK_BACKGROUND);
+    }
+
+    /**
+     * The graphics benchmark drew over the screen, so it is all redrawn first.
+     */
+    Rectangle screen = {0, 0, 0x10000, 0x10000};
+    compositor->Damage(screen);
+    compositor->Render();
+
+    Window *windows[3] = {new Window(compositor, 100, 100, 400, 300),
+                          new Window(compositor, 300, 200, 400, 300),
+                          new Window(compositor, 550, 50, 300, 500)};
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        Rectangle area = {0, 0, windows[i]->Width(), windows[i]->Height()};
+        windows[i]->Fill(area, 0x00404040 << i);
+    }
+    compositor->Render();
+
+    RunCompositorFrames(compositor, windows[1], "cursor", &MoveBenchmarkCursor);
+    RunCompositorFrames(compositor, windows[1], "32x32 damage", &DamageBenchmarkArea);
+    RunCompositorFrames(compositor, windows[1], "window damage", &DamageBenchmarkWindow);
+    RunCompositorFrames(compositor, windows[1], "screen damage", &DamageBenchmarkScreen);
+
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        delete windows[i];
+    }
+    compositor->Render();
+
+    if (offscreen != 0)
+    {
+        delete compositor;
+        delete offscreen;
+        delete[] memory;
+    }
+}
+
+/** Terminal benchmark */
+
+static const uint32_t TERMINAL_BENCHMARK_LINES = 8192;
+static const uint32_t TERMINAL_BENCHMARK_SWITCHES = 64;
+
+void RunTerminalBenchmark()
+{
+    /**
+     * The last terminal is filled with more lines than its scrollback keeps, out of view.
+     */
+    VirtualTerminal *terminal = VirtualTerminal::Get(VirtualTerminal::COUNT - 1);
+    uint64_t start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < TERMINAL_BENCHMARK_LINES; i++)
+    {
+        terminal->Write("The quick brown fox jumps over the lazy dog.\n");
+    }
+    uint64_t hidden = ReadTimestampCounter() - start;
+
+    uint32_t current = VirtualTerminal::Active()->Index();
+    start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < TERMINAL_BENCHMARK_SWITCHES; i++)
+    {
+        VirtualTerminal::Switch(terminal->Index());
+        VirtualTerminal::Switch(current);
+    }
+    uint64_t switches = ReadTimestampCounter() - start;
+
+    VirtualTerminal::Switch(terminal->Index());
+    start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < TERMINAL_BENCHMARK_LINES; i++)
+    {
+        terminal->Write("The quick brown fox jumps over the lazy dog.\n");
+    }
+    uint64_t shown = ReadTimestampCounter() - start;
+
+    start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < TERMINAL_BENCHMARK_SWITCHES; i++)
+    {
+        terminal->Scroll(VirtualTerminal::ROWS - 1);
+    }
+    for (uint32_t i = 0; i < TERMINAL_BENCHMARK_SWITCHES; i++)
+    {
+        terminal->Scroll(-(int32_t)(VirtualTerminal::ROWS - 1));
+    }
+    uint64_t scrolls = ReadTimestampCounter() - start;
+    VirtualTerminal::Switch(current);
+
+    PrintBenchmarkResult("terminal: line out of view", hidden, TERMINAL_BENCHMARK_LINES);
+    PrintBenchmarkResult("terminal: line on screen", shown, TERMINAL_BENCHMARK_LINES);
+    PrintBenchmarkResult("terminal: switch", switches, 2 * TERMINAL_BENCHMARK_SWITCHES);
+    PrintBenchmarkResult("terminal: scroll by a page", scrolls, 2 * TERMINAL_BENCHMARK_SWITCHES);
+}
+
+/** TTY benchmark */
+
+static const uint32_t TTY_BENCHMARK_LINES = 256;
+
+static volatile uint32_t ttyLinesRead;
+static volatile uint64_t ttyReadReturned;
+
+/**
+ * @brief Reads the lines typed into the last TTY, noting when each read returned.
+ */
+static void ReadTTYLines()
+{
+    TTY *tty = TTY::Get(VirtualTerminal::COUNT - 1);
+    char line[16];
+    for (uint32_t i = 0; i < TTY_BENCHMARK_LINES; i++)
+    {
+        tty->Read(line, sizeof(line));
+        ttyReadReturned = ReadTimestampCounter();
+        ttyLinesRead++;
+        TaskManager::activeTaskManager->Wakeup((void *)&ttyLinesRead);
+    }
+}
+
+void RunTTYBenchmark(TaskManager *taskManager)
+{
+    TTY *tty = TTY::Get(VirtualTerminal::COUNT - 1);
+    uint32_t mode = tty->Mode();
+    tty->SetMode(TTY_CANONICAL);
+
+    ttyLinesRead = 0;
+    if (taskManager->StartKernelTask(&ReadTTYLines) == 0)
+    {
+        tty->SetMode(mode);
+        return;
+    }
+
+    /**
+     * Each line is typed while the reader sleeps, and the time until its read returns is counted.
+     */
+    const char *typed = "hello\n";
+    uint64_t latency = 0;
+    for (uint32_t i = 0; i < TTY_BENCHMARK_LINES; i++)
+    {
+        uint64_t start = ReadTimestampCounter();
+        for (uint32_t j = 0; typed[j] != '\0'; j++)
+        {
+            tty->Input(typed[j]);
+        }
+
+        asm volatile("cli");
+        while (ttyLinesRead <= i)
+        {
+            taskManager->Sleep((void *)&ttyLinesRead);
+        }
+        asm volatile("sti");
+        latency += ttyReadReturned - start;
+    }
+    tty->SetMode(mode);
+
+    PrintBenchmarkResult("tty: line typed to blocked read returning", latency,
+                         TTY_BENCHMARK_LINES);
+}
+
+/** IPC benchmark */
+
+static const uint32_t IPC_BENCHMARK_ROUND_TRIPS = 10000;
+static const uint32_t IPC_BENCHMARK_TRANSFERS = 1000;
+static const uint32_t IPC_BENCHMARK_PAGES = 64;
+
+/**
+ * Where both tasks keep the buffer passed back and forth.
+ */
+static const uint32_t IPC_BENCHMARK_BUFFER = 0x50000000;
+
+/**
+ * The word that ends the round trips.
+ */
+static const uint32_t IPC_BENCHMARK_STOP = 0xFFFFFFFF;
+
+/**
+ * @brief Shared by the kernel and the ring 3 parts of the benchmark, which run in address spaces
+ * of their own, but see the kernel image.
+ */
+static struct
+{
+    bool sysenterSupported;
+    uint32_t serverPort;
+    uint32_t clientPort;
+    uint32_t resultPort;
+    uint64_t roundTripCycles;
+    uint64_t transferCycles;
+    uint32_t errors;
+} ipcBenchmarkResults USER_DATA;
+
+static inline __attribute__((always_inline)) uint32_t IPCBenchmarkCall(uint32_t number,
+                                                                       uint32_t port,
+                                                                       uint32_t *words)
+{
+    if (ipcBenchmarkResults.sysenterSupported)
+    {
+        return FastMessageSystemCall(number, port, words);
+    }
+    return MessageSystemCall(number, port, words);
+}
+
+/**
+ * @brief Answers each call with its word plus 1 until told to stop, then sends back every buffer
+ * it is sent.
+ */
+static void USER_TEXT IPCBenchmarkServer()
+{
+    uint32_t port = ipcBenchmarkResults.serverPort;
+    uint32_t words[2] = {0, 0};
+    uint32_t token = IPCBenchmarkCall(SYSCALL_IPC_RECEIVE, port, words);
+    while (words[0] != IPC_BENCHMARK_STOP)
+    {
+        words[0]++;
+        token = IPCBenchmarkCall(SYSCALL_IPC_REPLY_RECEIVE, port | (token << 16), words);
+    }
+    IPCBenchmarkCall(SYSCALL_IPC_REPLY, port | (token << 16), words);
+
+    for (uint32_t i = 0; i < IPC_BENCHMARK_TRANSFERS; i++)
+    {
+        words[0] = IPC_BENCHMARK_BUFFER;
+        words[1] = IPC_BENCHMARK_PAGES;
+        IPCBenchmarkCall(SYSCALL_IPC_RECEIVE, port, words);
+        words[0] = IPC_BENCHMARK_BUFFER;
+        words[1] = IPC_BENCHMARK_PAGES;
+        IPCBenchmarkCall(SYSCALL_IPC_SEND_PAGES, ipcBenchmarkResults.clientPort, words);
+    }
+
+    SystemCall(SYSCALL_EXIT);
+}
+
+/**
+ * @brief Makes the round trips, then passes its buffer to the server and waits for it to come
+ * back, checking that its contents moved along.
+ */
+static void USER_TEXT IPCBenchmarkClient()
+{
+    uint32_t words[2];
+    uint64_t start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < IPC_BENCHMARK_ROUND_TRIPS; i++)
+    {
+        words[0] = i;
+        words[1] = 0;
+        if (IPCBenchmarkCall(SYSCALL_IPC_CALL, ipcBenchmarkResults.serverPort, words) != 0 ||
+            words[0] != i + 1)
+        {
+            ipcBenchmarkResults.errors++;
+        }
+    }
+    ipcBenchmarkResults.roundTripCycles = ReadTimestampCounter() - start;
+    words[0] = IPC_BENCHMARK_STOP;
+    IPCBenchmarkCall(SYSCALL_IPC_CALL, ipcBenchmarkResults.serverPort, words);
+
+    volatile uint32_t *buffer = (volatile uint32_t *)IPC_BENCHMARK_BUFFER;
+    for (uint32_t page = 0; page < IPC_BENCHMARK_PAGES; page++)
+    {
+        buffer[page * 1024] = page;
+    }
+
+    start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < IPC_BENCHMARK_TRANSFERS; i++)
+    {
+        words[0] = IPC_BENCHMARK_BUFFER;
+        words[1] = IPC_BENCHMARK_PAGES;
+        if (IPCBenchmarkCall(SYSCALL_IPC_SEND_PAGES, ipcBenchmarkResults.serverPort, words) != 0)
+        {
+            ipcBenchmarkResults.errors++;
+            break;
+        }
+        words[0] = IPC_BENCHMARK_BUFFER;
+        words[1] = IPC_BENCHMARK_PAGES;
+        IPCBenchmarkCall(SYSCALL_IPC_RECEIVE, ipcBenchmarkResults.clientPort, words);
+    }
+    ipcBenchmarkResults.transferCycles = ReadTimestampCounter() - start;
+
+    for (uint32_t page = 0; page < IPC_BENCHMARK_PAGES; page++)
+    {
+        if (buffer[page * 1024] != page)
+        {
+            ipcBenchmarkResults.errors++;
+        }
+    }
+
+    IPCBenchmarkCall(SYSCALL_IPC_SEND, ipcBenchmarkResults.resultPort, words);
+    SystemCall(SYSCALL_EXIT);
+}
+
+/**
+ * @brief Starts a ring 3 task running code of the kernel image, in an address space of its own
+ * with a stack and, unless `bufferPages` is 0, a buffer of that many pages at
+ * `IPC_BENCHMARK_BUFFER`.
+ */
+static Task *StartUserBenchmarkTask(GlobalDescriptorTable *gdt, TaskManager *taskManager,
+                                    void (*entry)(), uint32_t bufferPages)
+{
+    AddressSpace *addressSpace = new AddressSpace();
+    uint32_t starts[2] = {USER_SPACE_END - Task::STACK_SIZE, IPC_BENCHMARK_BUFFER};
+    uint32_t ends[2] = {USER_SPACE_END, IPC_BENCHMARK_BUFFER + bufferPages * PAGE_SIZE};
+    for (uint32_t i = 0; i < (bufferPages != 0 ? 2 : 1); i++)
+    {
+        VirtualMemoryArea *area = new VirtualMemoryArea;
+        area->start = starts[i];
+        area->end = ends[i];
+        area->fileStart = 0;
+        area->fileEnd = 0;
+        area->file = 0;
+        area->flags = PAGE_WRITABLE;
+        area->sharedFrames = 0;
+        addressSpace->AddArea(area);
+    }
+
+    Task *task = new Task(gdt, addressSpace, (uint32_t)entry, USER_SPACE_END);
+    if (!taskManager->AddTask(task))
+    {
+        delete task;
+        return 0;
+    }
+    return task;
+}
+
+void RunIPCBenchmark(GlobalDescriptorTable *gdt, TaskManager *taskManager)
+{
+    MessagePort server;
+    MessagePort client;
+    MessagePort result;
+    ipcBenchmarkResults.sysenterSupported = SyscallHandler::FastSystemCallsSupported();
+    ipcBenchmarkResults.serverPort = server.Id();
+    ipcBenchmarkResults.clientPort = client.Id();
+    ipcBenchmarkResults.resultPort = result.Id();
+    ipcBenchmarkResults.errors = 0;
+
+    if (result.Id() == IPC_ERROR ||
+        StartUserBenchmarkTask(gdt, taskManager, &IPCBenchmarkServer, IPC_BENCHMARK_PAGES) == 0 ||
+        StartUserBenchmarkTask(gdt, taskManager, &IPCBenchmarkClient, IPC_BENCHMARK_PAGES) == 0)
+    {
+        printf("ipc: couldn't start the benchmark tasks\n");
+        return;
+    }
+
+    Message message;
+    result.Receive(&message);
+
+    PrintBenchmarkResult("ipc: call round trip", ipcBenchmarkResults.roundTripCycles,
+                         IPC_BENCHMARK_ROUND_TRIPS);
+    PrintThroughputResult("ipc: 256 KiB page grant", ipcBenchmarkResults.transferCycles,
+                          2 * IPC_BENCHMARK_TRANSFERS,
+                          (uint64_t)2 * IPC_BENCHMARK_TRANSFERS * IPC_BENCHMARK_PAGES * PAGE_SIZE);
+    if (ipcBenchmarkResults.errors != 0)
+    {
+        printf("ipc: ");
+        printfDec(ipcBenchmarkResults.errors);
+        printf(" errors\n");
+    }
+}
+
+/** Synchronization benchmark */
+
+static const uint32_t SYNC_BENCHMARK_ITERATIONS = 100000;
+static const uint32_t SYNC_BENCHMARK_PRODUCERS = 4;
+static const uint32_t SYNC_BENCHMARK_CONSUMERS = 4;
+static const uint32_t SYNC_BENCHMARK_ITEMS = 10000;
+static const uint32_t SYNC_BENCHMARK_ITEMS_CONSUMED =
+    SYNC_BENCHMARK_PRODUCERS * SYNC_BENCHMARK_ITEMS / SYNC_BENCHMARK_CONSUMERS;
+static const uint32_t SYNC_BENCHMARK_SLOTS = 16;
+static const uint32_t SYNC_BENCHMARK_USER_TASKS = 4;
+
+/**
+ * A bounded buffer: the semaphores count its free and filled slots, and the mutex guards the
+ * indices, which producers and consumers share.
+ */
+static uint32_t syncBuffer[SYNC_BENCHMARK_SLOTS];
+static uint32_t syncBufferHead;
+static uint32_t syncBufferTail;
+static Semaphore syncFreeSlots(SYNC_BENCHMARK_SLOTS);
+static Semaphore syncFilledSlots;
+static Mutex syncBufferLock;
+
+static Semaphore syncFinished;
+static volatile uint32_t syncNextProducer;
+static volatile uint32_t syncConsumedSum;
+
+/**
+ * @brief A kernel task putting the numbers of its share of the items into the buffer.
+ */
+static void ProduceItems()
+{
+    uint32_t first = __sync_fetch_and_add(&syncNextProducer, 1) * SYNC_BENCHMARK_ITEMS + 1;
+    for (uint32_t i = 0; i < SYNC_BENCHMARK_ITEMS; i++)
+    {
+        syncFreeSlots.Down();
+        syncBufferLock.Lock();
+        syncBuffer[syncBufferTail] = first + i;
+        syncBufferTail = (syncBufferTail + 1) % SYNC_BENCHMARK_SLOTS;
+        syncBufferLock.Unlock();
+        syncFilledSlots.Up();
+    }
+    syncFinished.Up();
+}
+
+/**
+ * @brief A kernel task taking its share of the items out of the buffer, adding them up.
+ */
+static void ConsumeItems()
+{
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < SYNC_BENCHMARK_ITEMS_CONSUMED; i++)
+    {
+        syncFilledSlots.Down();
+        syncBufferLock.Lock();
+        sum += syncBuffer[syncBufferHead];
+        syncBufferHead = (syncBufferHead + 1) % SYNC_BENCHMARK_SLOTS;
+        syncBufferLock.Unlock();
+        syncFreeSlots.Up();
+    }
+    __sync_fetch_and_add(&syncConsumedSum, sum);
+    syncFinished.Up();
+}
+
+/**
+ * @brief Shared by the kernel and ring 3 tasks with address spaces of their own (see
+ * `ipcBenchmarkResults`): a mutex in user memory, the counter it guards, and how many of the tasks
+ * are done.
+ */
+static struct
+{
+    volatile uint32_t mutex;
+    uint32_t counter;
+    volatile uint32_t finished;
+} syncUserShared USER_DATA;
+
+/**
+ * @brief Increments the shared counter under the user mutex, then tells the kernel it is done.
+ */
+static void USER_TEXT IncrementUserCounter()
+{
+    for (uint32_t i = 0; i < SYNC_BENCHMARK_ITEMS; i++)
+    {
+        UserMutexLock(&syncUserShared.mutex);
+        syncUserShared.counter++;
+        UserMutexUnlock(&syncUserShared.mutex);
+    }
+    __sync_fetch_and_add(&syncUserShared.finished, 1);
+    SystemCall(SYSCALL_FUTEX_WAKE, (uint32_t)&syncUserShared.finished, 1);
+    SystemCall(SYSCALL_EXIT);
+}
+
+/**
+ * @brief Times taking and releasing a free mutex, semaphore and spinlock, none of which is waited
+ * for.
+ */
+static void RunUncontendedSync()
+{
+    Mutex mutex;
+    uint64_t start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < SYNC_BENCHMARK_ITERATIONS; i++)
+    {
+        mutex.Lock();
+        mutex.Unlock();
+    }
+    PrintBenchmarkResult("sync: uncontended mutex lock/unlock", ReadTimestampCounter() - start,
+                         SYNC_BENCHMARK_ITERATIONS);
+
+    Semaphore semaphore(1);
+    start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < SYNC_BENCHMARK_ITERATIONS; i++)
+    {
+        semaphore.Down();
+        semaphore.Up();
+    }
+    PrintBenchmarkResult("sync: uncontended semaphore down/up", ReadTimestampCounter() - start,
+                         SYNC_BENCHMARK_ITERATIONS);
+
+    start = ReadTimestampCounter();
+    for (uint32_t i = 0; i < SYNC_BENCHMARK_ITERATIONS; i++)
+    {
+        SpinlockGuard guard(&benchmarkLock);
+    }
+    PrintBenchmarkResult("sync: uncontended spinlock guard", ReadTimestampCounter() - start,
+                         SYNC_BENCHMARK_ITERATIONS);
+}
+
+/**
+ * @brief Moves items from the producers to the consumers through the bounded buffer, and checks
+ * that each arrived once.
+ */
+static void RunProducersAndConsumers(TaskManager *taskManager)
+{
+    syncBufferHead = 0;
+    syncBufferTail = 0;
+    syncNextProducer = 0;
+    syncConsumedSum = 0;
+
+    uint64_t start = ReadTimestampCounter();
+    uint32_t started = 0;
+    for (uint32_t i = 0; i < SYNC_BENCHMARK_PRODUCERS + SYNC_BENCHMARK_CONSUMERS; i++)
+    {
+        if (taskManager->StartKernelTask(i < SYNC_BENCHMARK_PRODUCERS ? &ProduceItems
+                                                                      : &ConsumeItems) != 0)
+        {
+            started++;
+        }
+    }
+    for (uint32_t i = 0; i < started; i++)
+    {
+        syncFinished.Down();
+    }
+    uint64_t cycles = ReadTimestampCounter() - start;
+    if (started != SYNC_BENCHMARK_PRODUCERS + SYNC_BENCHMARK_CONSUMERS)
+    {
+        printf("sync: couldn't start the producers and consumers\n");
+        return;
+    }
+
+    uint32_t items = SYNC_BENCHMARK_PRODUCERS * SYNC_BENCHMARK_ITEMS;
+    PrintBenchmarkResult("sync: item through bounded buffer, 4 producers, 4 consumers", cycles,
+                         items);
+    if (syncConsumedSum != items * (items + 1) / 2)
+    {
+        printf("sync: items lost or duplicated\n");
+    }
+}
+
+/**
+ * @brief Increments a counter in ring 3 tasks of different address spaces, under a mutex that
+ * only makes system calls when it is contended.
+ */
+static void RunUserMutexContention(GlobalDescriptorTable *gdt, TaskManager *taskManager)
+{
+    syncUserShared.mutex = MUTEX_FREE;
+    syncUserShared.counter = 0;
+    syncUserShared.finished = 0;
+
+    uint64_t start = ReadTimestampCounter();
+    uint32_t started = 0;
+    for (uint32_t i = 0; i < SYNC_BENCHMARK_USER_TASKS; i++)
+    {
+        if (StartUserBenchmarkTask(gdt, taskManager, &IncrementUserCounter, 0) != 0)
+        {
+            started++;
+        }
+    }
+    uint32_t finished;
+    while ((finished = syncUserShared.finished) < started)
+    {
+        FutexWait(&syncUserShared.finished, finished);
+    }
+    uint64_t cycles = ReadTimestampCounter() - start;
+    if (started != SYNC_BENCHMARK_USER_TASKS)
+    {
+        printf("sync: couldn't start the ring 3 tasks\n");
+        return;
+    }
+
+    PrintBenchmarkResult("sync: ring 3 futex mutex increment, 4 tasks", cycles,
+                         SYNC_BENCHMARK_USER_TASKS * SYNC_BENCHMARK_ITEMS);
+    if (syncUserShared.counter != SYNC_BENCHMARK_USER_TASKS * SYNC_BENCHMARK_ITEMS)
+    {
+        printf("sync: LOST UPDATES\n");
+    }
+}
+
+void RunSyncBenchmark(GlobalDescriptorTable *gdt, TaskManager *taskManager)
+{
+    RunUncontendedSync();
+    RunProducersAndConsumers(taskManager);
+    RunUserMutexContention(gdt, taskManager);
+}
@@ -0,0 +1,214 @@
+/**
+ * @file benchmark.h
+ * @author rohan843
+ * @brief Contains the in-kernel benchmarks.
+ *
+ * The benchmarks are only run when the kernel is built with `make BENCHMARK=1`. All times are
+ * measured in CPU cycles, using the time stamp counter.
+ */
+
+#ifndef __BENCHMARK_H
+#define __BENCHMARK_H
+
+#include "ata.h"
+#include "blockcache.h"
+#include "compositor.h"
+#include "elf.h"
+#include "fat.h"
+#include "gdt.h"
+#include "graphics.h"
+#include "initrd.h"
+#include "input.h"
+#include "ipc.h"
+#include "multitasking.h"
+#include "netdevice.h"
+#include "pci.h"
+#include "ps2.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "sync.h"
+#include "syscalls.h"
+#include "terminal.h"
+#include "timer.h"
+#include "tty.h"
+#include "types.h"
+#include "virtio.h"
+
+/**
+ * @brief Reads the time stamp counter. (Also works in ring 3, and is always inlined so that ring
+ * 3 code in the kernel image can use it.)
+ */
+static inline __attribute__((always_inline)) uint64_t ReadTimestampCounter()
+{
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+/**
+ * @brief Divides a 64 - bit number by a 32 - bit one.
+ *
+ * There is no libgcc to do 64 - bit divisions for us, but `divl` can do it as long as the result
+ * fits in 32 bits. Larger results are clamped.
+ */
+uint32_t Divide(uint64_t dividend, uint32_t divisor);
+
+/**
+ * @brief Prints a line of the form "<name>: <cycles / operations> cycles/op".
+ *
+ * @param name What was measured.
+ * @param cycles The total number of cycles taken.
+ * @param operations The number of operations done in that time.
+ */
+void PrintBenchmarkResult(const char *name, uint64_t cycles, uint32_t operations);
+
+/**
+ * @brief Returns the number of time stamp counter cycles per second, measured against the PIT the
+ * first time it is called.
+ */
+uint32_t TimestampCounterFrequency();
+
+/**
+ * @brief Prints a line of the form "<name>: <operations per second> ops/s, <KiB per second> KiB/s".
+ *
+ * @param cycles The total number of cycles taken.
+ * @param operations The number of operations done in that time.
+ * @param bytes The number of bytes moved in that time.
+ */
+void PrintThroughputResult(const char *name, uint64_t cycles, uint32_t operations,
+                           uint64_t bytes);
+
+/**
+ * @brief Compares the round trip cost of a null system call through `int $0x80` and through
+ * `sysenter`/`sysexit`, both made from ring 3.
+ */
+void RunSyscallBenchmark(SyscallHandler *syscalls);
+
+/**
+ * @brief Loads many instances of an ELF program, reporting the cost of each and the memory each
+ * instance takes before it runs (frames and heap). The instances are deleted without running.
+ */
+void RunElfLoaderBenchmark(ElfProgram *program, GlobalDescriptorTable *gdt);
+
+/**
+ * @brief Measures indexing an initrd image, opening each of its files for the first time (which
+ * decompresses the compressed ones), and looking files up in it (both existing and not).
+ */
+void RunInitrdBenchmark(const uint8_t *image, uint32_t size);
+
+/**
+ * @brief Compares scanning the PCI bus with looking a device up in the device table built by the
+ * scan. Scans the bus again, so it must run before any PCI driver is set up.
+ */
+void RunPciBenchmark(PeripheralComponentInterconnectController *pci);
+
+/**
+ * @brief Compares the throughput of PIO and DMA transfers of an ATA drive, for sequential 64 KiB
+ * reads from the start of the disk and random 4 KiB reads all over it.
+ */
+void RunAtaBenchmark(AdvancedTechnologyAttachment *drive);
+
+/**
+ * @brief Measures a virtio block device: sequential 64 KiB reads, and random 4 KiB reads made
+ * one at a time and in batches (one kick per batch), reporting IOPS, throughput and kicks.
+ */
+void RunVirtioBlockBenchmark(VirtioBlockDevice *device);
+
+/**
+ * @brief Measures reads through the block cache: a cold sequential pass (served by readahead), the
+ * same pass again warm, and random 4 KiB reads over twice the cache's size, printing the cache's
+ * counters after each.
+ */
+void RunBlockCacheBenchmark(BlockCache *cache, BlockDevice *device);
+
+/**
+ * @brief Measures reading the large files of the FAT32 benchmark data set (see
+ * tools/mkfat32.py) in 64 KiB pieces and one cluster at a time, and looking names up in a
+ * directory of 1024 entries.
+ */
+void RunFileAllocationTableBenchmark(FileAllocationTable *fileSystem);
+
+/**
+ * @brief Measures receiving the frames of a flood (see tools/netflood.py) for a few seconds,
+ * reporting frames per second, interrupts per second and how often the driver switched between
+ * interrupts and polling, then measures sending minimum size frames.
+ */
+void RunNetworkBenchmark(NetworkDevice *device);
+
+/**
+ * @brief Replays the input trace "input.trace" of the initrd (see tools/inputtrace.py): once at
+ * full speed, reporting the cycles per byte and how many events were coalesced or dropped, and once
+ * at its recorded pace, reporting the console's frames and the latency from the interrupt to the
+ * screen.
+ */
+void RunInputBenchmark(PS2Controller *controller, InputTrace *trace, InputEventQueue *queue,
+                       InputConsole *console);
+
+/**
+ * @brief Counts the primes below a bound by trial division, on the bootstrap processor alone and
+ * then split across all the processors running, reporting the cycles of each and the speedup.
+ */
+void RunProcessorBenchmark(ProcessorManager *processors);
+
+/**
+ * @brief Counts the same primes in 16 kernel tasks, first all pinned to the bootstrap processor
+ * and then free to run anywhere, reporting the cycles of each, the speedup, and how many tasks the
+ * idle processors stole from the others' run queues.
+ */
+void RunSchedulerBenchmark(TaskManager *taskManager, ProcessorManager *processors);
+
+/**
+ * @brief Increments a counter behind a spinlock, on one processor and then on all of them,
+ * reporting the cycles per increment and how often the lock was contended. Then prints the
+ * statistics of every lock class, and the counters each processor keeps in its own data.
+ */
+void RunSpinlockBenchmark(ProcessorManager *processors);
+
+/**
+ * @brief Ticks a timing wheel of its own with 0, 1000 and 10000 timers pending, reporting the
+ * cycles to add and cancel a timer, and the average and worst cycles per tick.
+ */
+void RunTimerBenchmark();
+
+/**
+ * @brief Draws full-screen frames, and frames moving a 64x64 sprite, with the 32 - bit and then
+ * the SSE2 fills and copies, reporting the cycles per frame (`Present` included). Without a
+ * framebuffer, it draws to a 1024x768 one in memory.
+ */
+void RunGraphicsBenchmark(GraphicsDevice *device);
+
+/**
+ * @brief Renders frames in which only the cursor moves, a 32x32 area of a window changes, a whole
+ * window changes, and the whole screen is damaged, over three overlapping windows, reporting the
+ * cycles and pixels per frame of each. Uses the active compositor if there is one, and otherwise a
+ * compositor over a 1024x768 framebuffer in memory.
+ */
+void RunCompositorBenchmark(GraphicsDevice *device);
+
+/**
+ * @brief Times writing lines to a terminal out of view and on the screen, switching terminals, and
+ * scrolling back and forward by a page through a full scrollback.
+ */
+void RunTerminalBenchmark();
+
+/**
+ * @brief Types lines into a TTY in canonical mode while a task sleeps reading it, and reports the
+ * cycles from the first character typed until the task's read returned.
+ */
+void RunTTYBenchmark(TaskManager *taskManager);
+
+/**
+ * @brief Runs two ring 3 tasks, each in an address space of its own, that make calls carrying a
+ * word through a port and reply to them (the round trip cost), then pass a 256 KiB buffer back and
+ * forth by moving its pages (the bandwidth).
+ */
+void RunIPCBenchmark(GlobalDescriptorTable *gdt, TaskManager *taskManager);
+
+/**
+ * @brief Times taking free mutexes, semaphores and spinlocks, passing items from 4 producer to 4
+ * consumer tasks through a bounded buffer guarded by semaphores and a mutex, and 4 ring 3 tasks
+ * incrementing a counter under a futex based mutex.
+ */
+void RunSyncBenchmark(GlobalDescriptorTable *gdt, TaskManager *taskManager);
+
+#endif
@@ -0,0 +1,689 @@
+#include "blockcache.h"
+#include "memorymanagement.h"
+#include "multitasking.h"
+#include "stdio.h"
+
+/**
+ * The readahead window starts at this many blocks and doubles up to the largest.
+ */
+const uint32_t READAHEAD_MIN_BLOCKS = 4;
+const uint32_t READAHEAD_MAX_BLOCKS = 32;
+
+/**
+ * How many blocks in a row must be read before a device counts as streamed. Short multi-block
+ * reads at random places shouldn't start readahead.
+ */
+const uint32_t READAHEAD_TRIGGER = 3;
+
+/**
+ * The most blocks moved by a single device transfer, i.e., the size of the staging buffer.
+ */
+const uint32_t BLOCK_CACHE_MAX_RUN = READAHEAD_MAX_BLOCKS + 1;
+
+/** BlockCache Class */
+
+BlockCache *BlockCache::activeBlockCache = 0;
+
+BlockCache::BlockCache(uint32_t capacity)
+{
+    PhysicalMemoryManager *frames = PhysicalMemoryManager::activePhysicalMemoryManager;
+
+    bucketCount = 1;
+    while (bucketCount < capacity)
+    {
+        bucketCount <<= 1;
+    }
+    buckets = new CacheBlock *[bucketCount];
+    for (uint32_t i = 0; i < bucketCount; i++)
+    {
+        buckets[i] = 0;
+    }
+
+    /**
+     * All blocks start out free, in the LRU list but not in the hash table.
+     */
+    blocks = new CacheBlock[capacity];
+    this->capacity = 0;
+    lruHead = 0;
+    lruTail = 0;
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+        uint8_t *data = (uint8_t *)frames->AllocateFrame();
+        if (data == 0)
+        {
+            break;
+        }
+        CacheBlock *cacheBlock = &blocks[this->capacity++];
+        cacheBlock->device = 0;
+        cacheBlock->block = 0;
+        cacheBlock->data = data;
+        cacheBlock->dirty = false;
+        cacheBlock->readahead = false;
+        cacheBlock->hashNext = 0;
+        cacheBlock->lruPrevious = 0;
+        cacheBlock->lruNext = 0;
+        Discard(cacheBlock);
+    }
+
+    staging = (uint8_t *)frames->AllocateFrames(BLOCK_CACHE_MAX_RUN);
+
+    for (uint32_t i = 0; i < MAX_STREAMS; i++)
+    {
+        streams[i].device = 0;
+        streams[i].nextBlock = 0;
+        streams[i].run = 0;
+        streams[i].window = 0;
+    }
+
+    dirtyCount = 0;
+    busy = false;
+    ResetStatistics();
+
+    if (activeBlockCache == 0)
+    {
+        activeBlockCache = this;
+    }
+}
+
+BlockCache::~BlockCache()
+{
+    Sync();
+
+    PhysicalMemoryManager *frames = PhysicalMemoryManager::activePhysicalMemoryManager;
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+        frames->FreeFrame((uint32_t)blocks[i].data);
+    }
+    if (staging != 0)
+    {
+        frames->FreeFrames((uint32_t)staging, BLOCK_CACHE_MAX_RUN);
+    }
+    delete[] blocks;
+    delete[] buckets;
+
+    if (activeBlockCache == this)
+    {
+        activeBlockCache = 0;
+    }
+}
+
+void BlockCache::Lock()
+{
+    uint32_t eflags;
+    asm volatile("pushfl\n"
+                 "popl %0\n"
+                 "cli"
+                 : "=r"(eflags));
+
+    while (busy)
+    {
+        TaskManager::activeTaskManager->Sleep((void *)&busy);
+    }
+    busy = true;
+
+    asm volatile("pushl %0\n"
+                 "popfl"
+                 :
+                 : "r"(eflags)
+                 : "cc");
+}
+
+void BlockCache::Unlock()
+{
+    busy = false;
+    TaskManager::activeTaskManager->Wakeup((void *)&busy);
+}
+
+uint32_t BlockCache::Hash(BlockDevice *device, uint32_t block)
+{
+    /**
+     * Consecutive blocks land in consecutive buckets, and devices are spread apart.
+     */
+    return (block + ((uint32_t)device >> 4) * 2654435761u) & (bucketCount - 1);
+}
+
+CacheBlock *BlockCache::Find(BlockDevice *device, uint32_t block)
+{
+    for (CacheBlock *cacheBlock = buckets[Hash(device, block)]; cacheBlock != 0;
+         cacheBlock = cacheBlock->hashNext)
+    {
+        if (cacheBlock->device == device && cacheBlock->block == block)
+        {
+            return cacheBlock;
+        }
+    }
+    return 0;
+}
+
+void BlockCache::Insert(CacheBlock *cacheBlock, BlockDevice *device, uint32_t block)
+{
+    cacheBlock->device = device;
+    cacheBlock->block = block;
+    cacheBlock->dirty = false;
+    cacheBlock->readahead = false;
+
+    uint32_t bucket = Hash(device, block);
+    cacheBlock->hashNext = buckets[bucket];
+    buckets[bucket] = cacheBlock;
+}
+
+void BlockCache::Remove(CacheBlock *cacheBlock)
+{
+    CacheBlock **link = &buckets[Hash(cacheBlock->device, cacheBlock->block)];
+    while (*link != cacheBlock)
+    {
+        link = &(*link)->hashNext;
+    }
+    *link = cacheBlock->hashNext;
+
+    cacheBlock->hashNext = 0;
+    cacheBlock->device = 0;
+}
+
+void BlockCache::Unlink(CacheBlock *cacheBlock)
+{
+    if (cacheBlock->lruPrevious != 0)
+    {
+        cacheBlock->lruPrevious->lruNext = cacheBlock->lruNext;
+    }
+    else if (lruHead == cacheBlock)
+    {
+        lruHead = cacheBlock->lruNext;
+    }
+    if (cacheBlock->lruNext != 0)
+    {
+        cacheBlock->lruNext->lruPrevious = cacheBlock->lruPrevious;
+    }
+    else if (lruTail == cacheBlock)
+    {
+        lruTail = cacheBlock->lruPrevious;
+    }
+    cacheBlock->lruPrevious = 0;
+    cacheBlock->lruNext = 0;
+}
+
+void BlockCache::Touch(CacheBlock *cacheBlock)
+{
+    if (lruHead == cacheBlock)
+    {
+        return;
+    }
+    Unlink(cacheBlock);
+    cacheBlock->lruNext = lruHead;
+    if (lruHead != 0)
+    {
+        lruHead->lruPrevious = cacheBlock;
+    }
+    lruHead = cacheBlock;
+    if (lruTail == 0)
+    {
+        lruTail = cacheBlock;
+    }
+}
+
+void BlockCache::Discard(CacheBlock *cacheBlock)
+{
+    if (lruTail == cacheBlock)
+    {
+        return;
+    }
+    Unlink(cacheBlock);
+    cacheBlock->lruPrevious = lruTail;
+    if (lruTail != 0)
+    {
+        lruTail->lruNext = cacheBlock;
+    }
+    lruTail = cacheBlock;
+    if (lruHead == 0)
+    {
+        lruHead = cacheBlock;
+    }
+}
+
+CacheBlock *BlockCache::Evict()
+{
+    /**
+     * A dirty block that can't be written back stays cached, moved to the front of the list so
+     * that evictions don't keep starting with it, and the oldest clean block is taken instead.
+     * After a failure, no more blocks are written back for this eviction: the others are most
+     * likely on the same device.
+     */
+    bool writeBackFailed = false;
+    CacheBlock *cacheBlock = lruTail;
+    while (cacheBlock != 0 && cacheBlock->device != 0 && cacheBlock->dirty)
+    {
+        CacheBlock *older = cacheBlock;
+        cacheBlock = cacheBlock->lruPrevious;
+        if (writeBackFailed)
+        {
+            continue;
+        }
+        if (WriteBack(older))
+        {
+            cacheBlock = older;
+            break;
+        }
+        writeBackFailed = true;
+        statistics.writeBackFailures++;
+        Touch(older);
+    }
+    if (cacheBlock == 0)
+    {
+        return 0;
+    }
+
+    if (cacheBlock->device != 0)
+    {
+        /**
+         * Readahead that was never used means the window is too large for how the device is
+         * read.
+         */
+        if (cacheBlock->readahead)
+        {
+            statistics.readaheadWasted++;
+            Stream *stream = FindStream(cacheBlock->device);
+            stream->window >>= 1;
+        }
+
+        Remove(cacheBlock);
+        statistics.evictions++;
+    }
+
+    Touch(cacheBlock);
+    return cacheBlock;
+}
+
+bool BlockCache::WriteBack(CacheBlock *cacheBlock)
+{
+    BlockDevice *device = cacheBlock->device;
+    uint32_t sectorsPerBlock = BLOCK_CACHE_BLOCK_SIZE / device->SectorSize();
+
+    /**
+     * The dirty blocks following this one go along in the same write.
+     */
+    CacheBlock *run[BLOCK_CACHE_MAX_RUN];
+    uint32_t count = 0;
+    run[count++] = cacheBlock;
+    while (staging != 0 && count < BLOCK_CACHE_MAX_RUN)
+    {
+        CacheBlock *next = Find(device, cacheBlock->block + count);
+        if (next == 0 || !next->dirty)
+        {
+            break;
+        }
+        run[count++] = next;
+    }
+
+    const uint8_t *data = cacheBlock->data;
+    if (count > 1)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            memcpy(staging + i * BLOCK_CACHE_BLOCK_SIZE, run[i]->data, BLOCK_CACHE_BLOCK_SIZE);
+        }
+        data = staging;
+    }
+
+    statistics.deviceWrites++;
+    if (!device->Write(cacheBlock->block * sectorsPerBlock, count * sectorsPerBlock, data))
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        run[i]->dirty = false;
+    }
+    dirtyCount -= count;
+    statistics.blocksWritten += count;
+    return true;
+}
+
+BlockCache::Stream *BlockCache::FindStream(BlockDevice *device)
+{
+    for (uint32_t i = 0; i < MAX_STREAMS; i++)
+    {
+        if (streams[i].device == device)
+        {
+            return &streams[i];
+        }
+    }
+
+    /**
+     * Devices beyond the table take over a slot, chosen by their address.
+     */
+    Stream *stream = &streams[0];
+    for (uint32_t i = 0; i < MAX_STREAMS; i++)
+    {
+        if (streams[i].device == 0)
+        {
+            stream = &streams[i];
+            break;
+        }
+        if (i == MAX_STREAMS - 1)
+        {
+            stream = &streams[((uint32_t)device >> 4) % MAX_STREAMS];
+        }
+    }
+    stream->device = device;
+    stream->nextBlock = 0;
+    stream->run = 0;
+    stream->window = 0;
+    return stream;
+}
+
+uint32_t BlockCache::BlockCount(BlockDevice *device)
+{
+    return device->SectorCount() / (BLOCK_CACHE_BLOCK_SIZE / device->SectorSize());
+}
+
+bool BlockCache::Fill(BlockDevice *device, uint32_t first, uint32_t count)
+{
+    uint32_t blockCount = BlockCount(device);
+    if (count > BLOCK_CACHE_MAX_RUN)
+    {
+        count = BLOCK_CACHE_MAX_RUN;
+    }
+    if (staging == 0)
+    {
+        count = 1;
+    }
+
+    /**
+     * A single fill never takes more than a quarter of the cache, so it can't evict blocks it
+     * was called to read next to.
+     */
+    if (count > capacity / 4)
+    {
+        count = capacity / 4 > 0 ? capacity / 4 : 1;
+    }
+
+    CacheBlock *run[BLOCK_CACHE_MAX_RUN];
+    uint32_t n = 0;
+    while (n < count && first + n < blockCount && (n == 0 || Find(device, first + n) == 0))
+    {
+        run[n] = Evict();
+        if (run[n] == 0)
+        {
+            break;
+        }
+        n++;
+    }
+    if (n == 0)
+    {
+        return false;
+    }
+
+    uint32_t sectorsPerBlock = BLOCK_CACHE_BLOCK_SIZE / device->SectorSize();
+    uint8_t *data = n > 1 ? staging : run[0]->data;
+    statistics.deviceReads++;
+    if (!device->Read(first * sectorsPerBlock, n * sectorsPerBlock, data))
+    {
+        for (uint32_t i = 0; i < n; i++)
+        {
+            Discard(run[i]);
+        }
+        return false;
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        if (n > 1)
+        {
+            memcpy(run[i]->data, staging + i * BLOCK_CACHE_BLOCK_SIZE, BLOCK_CACHE_BLOCK_SIZE);
+        }
+        Insert(run[i], device, first + i);
+        run[i]->readahead = i > 0;
+    }
+    statistics.readaheadBlocks += n - 1;
+    return true;
+}
+
+CacheBlock *BlockCache::Get(BlockDevice *device, uint32_t block, bool overwrite)
+{
+    if (block >= BlockCount(device))
+    {
+        return 0;
+    }
+
+    Stream *stream = FindStream(device);
+    if (block == stream->nextBlock)
+    {
+        stream->run++;
+    }
+    else
+    {
+        stream->run = 0;
+        stream->window = 0;
+    }
+    stream->nextBlock = block + 1;
+    bool sequential = stream->run + 1 >= READAHEAD_TRIGGER;
+
+    CacheBlock *cacheBlock = Find(device, block);
+    if (cacheBlock != 0)
+    {
+        statistics.hits++;
+        if (cacheBlock->readahead)
+        {
+            statistics.readaheadHits++;
+            cacheBlock->readahead = false;
+        }
+        Touch(cacheBlock);
+    }
+    else
+    {
+        statistics.misses++;
+    }
+
+    /**
+     * A stream that has reached the end of what is cached reads the next window ahead, each
+     * twice as large as the one before.
+     */
+    uint32_t ahead = 0;
+    if (sequential && !overwrite && Find(device, block + 1) == 0)
+    {
+        if (stream->window < READAHEAD_MIN_BLOCKS)
+        {
+            stream->window = READAHEAD_MIN_BLOCKS;
+        }
+        else if (stream->window < READAHEAD_MAX_BLOCKS)
+        {
+            stream->window <<= 1;
+        }
+        ahead = stream->window;
+    }
+
+    if (cacheBlock == 0)
+    {
+        if (overwrite)
+        {
+            cacheBlock = Evict();
+            if (cacheBlock != 0)
+            {
+                Insert(cacheBlock, device, block);
+            }
+            return cacheBlock;
+        }
+
+        if (!Fill(device, block, 1 + ahead))
+        {
+            return 0;
+        }
+        cacheBlock = Find(device, block);
+        Touch(cacheBlock);
+    }
+    else if (ahead > 0)
+    {
+        /**
+         * A failed readahead isn't the reader's problem.
+         */
+        Fill(device, block + 1, ahead);
+    }
+    return cacheBlock;
+}
+
+bool BlockCache::Read(BlockDevice *device, uint32_t sector, uint32_t count, void *buffer)
+{
+    uint32_t sectorSize = device->SectorSize();
+    uint32_t sectorsPerBlock = BLOCK_CACHE_BLOCK_SIZE / sectorSize;
+    uint8_t *destination = (uint8_t *)buffer;
+
+    Lock();
+    bool success = true;
+    while (success && count > 0)
+    {
+        uint32_t offset = sector % sectorsPerBlock;
+        uint32_t sectors = sectorsPerBlock - offset;
+        if (sectors > count)
+        {
+            sectors = count;
+        }
+
+        CacheBlock *cacheBlock = Get(device, sector / sectorsPerBlock, false);
+        if (cacheBlock == 0)
+        {
+            success = false;
+            break;
+        }
+        memcpy(destination, cacheBlock->data + offset * sectorSize, sectors * sectorSize);
+
+        destination += sectors * sectorSize;
+        sector += sectors;
+        count -= sectors;
+    }
+    Unlock();
+    return success;
+}
+
+bool BlockCache::Write(BlockDevice *device, uint32_t sector, uint32_t count, const void *buffer)
+{
+    uint32_t sectorSize = device->SectorSize();
+    uint32_t sectorsPerBlock = BLOCK_CACHE_BLOCK_SIZE / sectorSize;
+    const uint8_t *source = (const uint8_t *)buffer;
+
+    Lock();
+    bool success = true;
+    while (success && count > 0)
+    {
+        uint32_t offset = sector % sectorsPerBlock;
+        uint32_t sectors = sectorsPerBlock - offset;
+        if (sectors > count)
+        {
+            sectors = count;
+        }
+
+        /**
+         * A block that is overwritten whole needn't be read first.
+         */
+        CacheBlock *cacheBlock =
+            Get(device, sector / sectorsPerBlock, sectors == sectorsPerBlock);
+        if (cacheBlock == 0)
+        {
+            success = false;
+            break;
+        }
+        memcpy(cacheBlock->data + offset * sectorSize, source, sectors * sectorSize);
+        if (!cacheBlock->dirty)
+        {
+            cacheBlock->dirty = true;
+            dirtyCount++;
+        }
+
+        source += sectors * sectorSize;
+        sector += sectors;
+        count -= sectors;
+    }
+
+    /**
+     * Writing back once half the cache is dirty keeps eviction from having to write every time,
+     * and lets the dirty blocks go out in long runs.
+     */
+    if (success && dirtyCount > capacity / 2)
+    {
+        success = SyncLocked();
+    }
+    Unlock();
+    return success;
+}
+
+bool BlockCache::SyncLocked()
+{
+    bool success = true;
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+        CacheBlock *cacheBlock = &blocks[i];
+        if (cacheBlock->device == 0 || !cacheBlock->dirty)
+        {
+            continue;
+        }
+
+        /**
+         * Writing from the start of each run of dirty blocks writes the whole run at once.
+         */
+        while (cacheBlock->block > 0)
+        {
+            CacheBlock *previous = Find(cacheBlock->device, cacheBlock->block - 1);
+            if (previous == 0 || !previous->dirty)
+            {
+                break;
+            }
+            cacheBlock = previous;
+        }
+        if (!WriteBack(cacheBlock))
+        {
+            success = false;
+        }
+    }
+    return success;
+}
+
+bool BlockCache::Sync()
+{
+    Lock();
+    bool success = SyncLocked();
+    Unlock();
+    return success;
+}
+
+uint32_t BlockCache::Capacity() { return capacity; }
+
+BlockCacheStatistics BlockCache::Statistics() { return statistics; }
+
+void BlockCache::ResetStatistics()
+{
+    statistics.hits = 0;
+    statistics.misses = 0;
+    statistics.readaheadBlocks = 0;
+    statistics.readaheadHits = 0;
+    statistics.readaheadWasted = 0;
+    statistics.evictions = 0;
+    statistics.blocksWritten = 0;
+    statistics.deviceWrites = 0;
+    statistics.writeBackFailures = 0;
+    statistics.deviceReads = 0;
+}
+
+void BlockCache::PrintStatistics()
+{
+    printf("hits ");
+    printfDec(statistics.hits);
+    printf(", misses ");
+    printfDec(statistics.misses);
+    printf(", readahead ");
+    printfDec(statistics.readaheadBlocks);
+    printf(" (");
+    printfDec(statistics.readaheadHits);
+    printf(" hit, ");
+    printfDec(statistics.readaheadWasted);
+    printf(" wasted), evictions ");
+    printfDec(statistics.evictions);
+    printf(", device reads ");
+    printfDec(statistics.deviceReads);
+    printf(", written ");
+    printfDec(statistics.blocksWritten);
+    printf(" in ");
+    printfDec(statistics.deviceWrites);
+    printf(", write back failures ");
+    printfDec(statistics.writeBackFailures);
+    printf("\n");
+}
@@ -0,0 +1,223 @@
+/**
+ * @file blockcache.h
+ * @author rohan843
+ * @brief Contains the block cache, which sits between filesystems and block devices.
+ *
+ * The cache holds 4 KiB blocks of any number of devices, looked up by (device, block) in a hash
+ * table and evicted least recently used first.
+ *
+ * - Writes only mark blocks dirty. Dirty blocks reach the device when they are evicted, when too
+ *   many have piled up, or on `Sync`, and neighbouring dirty blocks always go in a single write.
+ * - Reads that follow each other through a device start a readahead window, which doubles while
+ *   the stream continues (and the blocks read ahead get used), and shrinks when they are evicted
+ *   unused.
+ */
+
+#ifndef __BLOCKCACHE_H
+#define __BLOCKCACHE_H
+
+#include "blockdevice.h"
+#include "types.h"
+
+const uint32_t BLOCK_CACHE_BLOCK_SIZE = 4096;
+
+/**
+ * @brief A cached block.
+ */
+struct CacheBlock
+{
+    /**
+     * 0 while the block is free.
+     */
+    BlockDevice *device;
+    uint32_t block;
+
+    /**
+     * A frame of its own, so it can be handed to DMA.
+     */
+    uint8_t *data;
+
+    bool dirty;
+
+    /**
+     * Read ahead, and not used since.
+     */
+    bool readahead;
+
+    CacheBlock *hashNext;
+
+    /**
+     * The LRU list. `lruPrevious` is the more recently used neighbour.
+     */
+    CacheBlock *lruPrevious;
+    CacheBlock *lruNext;
+};
+
+struct BlockCacheStatistics
+{
+    uint32_t hits;
+    uint32_t misses;
+
+    /**
+     * Blocks read ahead, those of them later used (hits), and those evicted without ever being
+     * used.
+     */
+    uint32_t readaheadBlocks;
+    uint32_t readaheadHits;
+    uint32_t readaheadWasted;
+
+    uint32_t evictions;
+
+    /**
+     * Dirty blocks written back, the device writes that took, and the write backs that failed
+     * (leaving the blocks dirty).
+     */
+    uint32_t blocksWritten;
+    uint32_t deviceWrites;
+    uint32_t writeBackFailures;
+
+    /**
+     * Device reads made (a readahead window and the block that triggered it are one read).
+     */
+    uint32_t deviceReads;
+};
+
+class BlockCache
+{
+  protected:
+    CacheBlock *blocks;
+    uint32_t capacity;
+
+    CacheBlock **buckets;
+    uint32_t bucketCount;
+
+    /**
+     * Most and least recently used blocks.
+     */
+    CacheBlock *lruHead;
+    CacheBlock *lruTail;
+
+    uint32_t dirtyCount;
+
+    /**
+     * Where multi-block device transfers are staged.
+     */
+    uint8_t *staging;
+
+    /**
+     * The readahead state of each device seen.
+     */
+    static const uint32_t MAX_STREAMS = 8;
+    struct Stream
+    {
+        BlockDevice *device;
+        uint32_t nextBlock;
+
+        /**
+         * The number of sequential reads in a row.
+         */
+        uint32_t run;
+        uint32_t window;
+    } streams[MAX_STREAMS];
+
+    BlockCacheStatistics statistics;
+
+    /**
+     * Set while a task uses the cache. Device transfers sleep, so the cache can't just disable
+     * interrupts meanwhile.
+     */
+    volatile bool busy;
+
+    void Lock();
+    void Unlock();
+
+    uint32_t Hash(BlockDevice *device, uint32_t block);
+    CacheBlock *Find(BlockDevice *device, uint32_t block);
+    void Insert(CacheBlock *cacheBlock, BlockDevice *device, uint32_t block);
+    void Remove(CacheBlock *cacheBlock);
+    void Unlink(CacheBlock *cacheBlock);
+
+    /**
+     * @brief Makes a block the most recently used one.
+     */
+    void Touch(CacheBlock *cacheBlock);
+
+    /**
+     * @brief Makes a block the next one evicted.
+     */
+    void Discard(CacheBlock *cacheBlock);
+
+    /**
+     * @brief Frees the least recently used block, writing it back first if dirty.
+     *
+     * @return The block, out of the hash table and now the most recently used one, or 0 if every
+     * block is dirty and writing back failed.
+     */
+    CacheBlock *Evict();
+
+    /**
+     * @brief Writes a dirty block back, along with the dirty blocks right after it.
+     */
+    bool WriteBack(CacheBlock *cacheBlock);
+
+    Stream *FindStream(BlockDevice *device);
+
+    /**
+     * @brief Reads blocks into the cache in a single device read.
+     *
+     * Stops early at a block already cached. All but the first are marked as read ahead.
+     *
+     * @return false if the device failed.
+     */
+    bool Fill(BlockDevice *device, uint32_t first, uint32_t count);
+
+    /**
+     * @brief Returns a block, reading it (and maybe a readahead window) if it isn't cached.
+     *
+     * @param overwrite Whether the whole block is about to be overwritten, so needn't be read.
+     */
+    CacheBlock *Get(BlockDevice *device, uint32_t block, bool overwrite);
+
+    /**
+     * @brief The number of whole blocks of a device.
+     */
+    uint32_t BlockCount(BlockDevice *device);
+
+    bool SyncLocked();
+
+  public:
+    static BlockCache *activeBlockCache;
+
+    /**
+     * @param capacity The number of blocks to cache. A frame is allocated for each.
+     */
+    BlockCache(uint32_t capacity);
+    ~BlockCache();
+
+    /**
+     * @brief Reads sectors through the cache.
+     *
+     * @return false if the device failed, or the sectors are out of range.
+     */
+    bool Read(BlockDevice *device, uint32_t sector, uint32_t count, void *buffer);
+
+    /**
+     * @brief Writes sectors into the cache. They reach the device later (see `Sync`).
+     *
+     * @return false if the device failed, or the sectors are out of range.
+     */
+    bool Write(BlockDevice *device, uint32_t sector, uint32_t count, const void *buffer);
+
+    /**
+     * @brief Writes all dirty blocks back.
+     */
+    bool Sync();
+
+    uint32_t Capacity();
+
+    BlockCacheStatistics Statistics();
+    void ResetStatistics();
+    void PrintStatistics();
+};
+
+#endif
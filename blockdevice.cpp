@@ -0,0 +1,38 @@
+#include "blockdevice.h"
+
+BlockDevice *BlockDevice::devices[BlockDevice::MAX_DEVICES];
+uint32_t BlockDevice::deviceCount = 0;
+
+BlockDevice::BlockDevice() {}
+
+BlockDevice::~BlockDevice() {}
+
+const char *BlockDevice::Name() { return "block"; }
+
+uint32_t BlockDevice::SectorSize() { return 512; }
+
+uint32_t BlockDevice::SectorCount() { return 0; }
+
+bool BlockDevice::Read(uint32_t sector, uint32_t count, void *buffer) { return false; }
+
+bool BlockDevice::Write(uint32_t sector, uint32_t count, const void *buffer) { return false; }
+
+void BlockDevice::Register(BlockDevice *device)
+{
+    if (deviceCount < MAX_DEVICES)
+    {
+        devices[deviceCount] = device;
+        deviceCount++;
+    }
+}
+
+uint32_t BlockDevice::Count() { return deviceCount; }
+
+BlockDevice *BlockDevice::Get(uint32_t index)
+{
+    if (index >= deviceCount)
+    {
+        return 0;
+    }
+    return devices[index];
+}
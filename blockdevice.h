@@ -0,0 +1,60 @@
+/**
+ * @file blockdevice.h
+ * @author rohan843
+ * @brief Contains the interface of disks and other devices read and written in whole sectors.
+ *
+ * Drivers register their devices here as they find them, so that the rest of the kernel can look
+ * them up without knowing which driver is behind each.
+ */
+
+#ifndef __BLOCKDEVICE_H
+#define __BLOCKDEVICE_H
+
+#include "types.h"
+
+class BlockDevice
+{
+  protected:
+    static const uint32_t MAX_DEVICES = 16;
+    static BlockDevice *devices[MAX_DEVICES];
+    static uint32_t deviceCount;
+
+  public:
+    BlockDevice();
+    virtual ~BlockDevice();
+
+    /**
+     * @brief A short name for messages, e.g., "ata0".
+     */
+    virtual const char *Name();
+
+    virtual uint32_t SectorSize();
+    virtual uint32_t SectorCount();
+
+    /**
+     * @brief Reads consecutive sectors.
+     *
+     * @param sector The first sector.
+     * @param count The number of sectors.
+     * @param buffer Where to put the data. Must hold `count` sectors.
+     * @return false if the device reported an error, or the sectors are out of range.
+     */
+    virtual bool Read(uint32_t sector, uint32_t count, void *buffer);
+
+    /**
+     * @brief Writes consecutive sectors. The data is on the medium when this returns.
+     *
+     * @return false if the device reported an error, or the sectors are out of range.
+     */
+    virtual bool Write(uint32_t sector, uint32_t count, const void *buffer);
+
+    /**
+     * @brief Makes a device known to the rest of the kernel.
+     */
+    static void Register(BlockDevice *device);
+
+    static uint32_t Count();
+    static BlockDevice *Get(uint32_t index);
+};
+
+#endif
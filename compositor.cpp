@@ -0,0 +1,325 @@
+#include "compositor.h"
+#include "memorymanagement.h"
+#include "stdio.h"
+
+/**
+ * The arrow drawn as the cursor: 'X' is its black outline, '.' its white inside, and the rest
+ * shows what is under it.
+ */
+static const char *const CURSOR_SHAPE[] = {
+    "X           ", "XX          ", "X.X         ", "X..X        ", "X...X       ",
+    "X....X      ", "X.....X     ", "X......X    ", "X.......X   ", "X........X  ",
+    "X.........X ", "X..........X", "X......XXXXX", "X...X..X    ", "X..XX..X    ",
+    "X.X  X..X   ", "XX   X..X   ", "X     X..X  ", "      XXXX  ",
+};
+
+/** Window Class */
+
+Window::Window(Compositor *compositor, int32_t x, int32_t y, int32_t width, int32_t height)
+{
+    this->compositor = compositor;
+    frame.x = x;
+    frame.y = y;
+    frame.width = width;
+    frame.height = height;
+    above = 0;
+    below = 0;
+
+    surface = new uint32_t[width * height];
+    if (surface == 0)
+    {
+        printf("compositor: no memory for a window\n");
+        frame.width = 0;
+        frame.height = 0;
+    }
+    else
+    {
+        memset(surface, 0, width * height * 4);
+    }
+
+    SpinlockGuard guard(&compositor->lock);
+    compositor->Link(this);
+}
+
+Window::~Window()
+{
+    {
+        SpinlockGuard guard(&compositor->lock);
+        compositor->Unlink(this);
+    }
+    if (surface != 0)
+    {
+        delete[] surface;
+    }
+}
+
+uint32_t *Window::Surface() { return surface; }
+
+int32_t Window::Width() { return frame.width; }
+
+int32_t Window::Height() { return frame.height; }
+
+void Window::Fill(Rectangle area, uint32_t color)
+{
+    Rectangle window = {0, 0, frame.width, frame.height};
+    area = RectangleIntersection(area, window);
+    for (int32_t y = area.y; y < area.y + area.height; y++)
+    {
+        uint32_t *pixel = surface + y * frame.width + area.x;
+        for (int32_t x = 0; x < area.width; x++)
+        {
+            pixel[x] = color;
+        }
+    }
+    Damage(area);
+}
+
+void Window::Damage(Rectangle area)
+{
+    SpinlockGuard guard(&compositor->lock);
+    area.x += frame.x;
+    area.y += frame.y;
+    compositor->AddDamage(RectangleIntersection(area, frame));
+}
+
+void Window::Move(int32_t x, int32_t y)
+{
+    SpinlockGuard guard(&compositor->lock);
+    compositor->AddDamage(frame);
+    frame.x = x;
+    frame.y = y;
+    compositor->AddDamage(frame);
+}
+
+void Window::Raise()
+{
+    SpinlockGuard guard(&compositor->lock);
+    if (compositor->top != this)
+    {
+        compositor->Unlink(this);
+        compositor->Link(this);
+    }
+}
+
+/** Compositor Class */
+
+Compositor *Compositor::activeCompositor = 0;
+
+/**
+ * Locked before the graphics device's lock.
+ */
+static LockClass compositorLockClass("compositor");
+
+Compositor::Compositor(GraphicsDevice *device, uint32_t background) : lock(&compositorLockClass)
+{
+    this->device = device;
+    this->background = background;
+    screen.x = 0;
+    screen.y = 0;
+    screen.width = device->Width();
+    screen.height = device->Height();
+    bottom = 0;
+    top = 0;
+
+    cursorX = screen.width / 2;
+    cursorY = screen.height / 2;
+    drawnCursorX = cursorX;
+    drawnCursorY = cursorY;
+    cursorDrawn = false;
+
+    damage.Add(screen);
+    activeCompositor = this;
+}
+
+Compositor::~Compositor()
+{
+    if (activeCompositor == this)
+    {
+        activeCompositor = 0;
+    }
+}
+
+void Compositor::Link(Window *window)
+{
+    window->below = top;
+    window->above = 0;
+    if (top != 0)
+    {
+        top->above = window;
+    }
+    else
+    {
+        bottom = window;
+    }
+    top = window;
+    AddDamage(window->frame);
+}
+
+void Compositor::Unlink(Window *window)
+{
+    if (window->above != 0)
+    {
+        window->above->below = window->below;
+    }
+    else
+    {
+        top = window->below;
+    }
+    if (window->below != 0)
+    {
+        window->below->above = window->above;
+    }
+    else
+    {
+        bottom = window->above;
+    }
+    window->above = 0;
+    window->below = 0;
+    AddDamage(window->frame);
+}
+
+void Compositor::AddDamage(Rectangle area)
+{
+    area = RectangleIntersection(area, screen);
+    if (area.width > 0 && area.height > 0)
+    {
+        damage.Add(area);
+    }
+}
+
+void Compositor::Damage(Rectangle area)
+{
+    SpinlockGuard guard(&lock);
+    AddDamage(area);
+}
+
+void Compositor::Paint(Rectangle area, Window *window)
+{
+    if (area.width <= 0 || area.height <= 0)
+    {
+        return;
+    }
+    while (window != 0 && !RectanglesOverlap(area, window->frame))
+    {
+        window = window->below;
+    }
+    if (window == 0)
+    {
+        device->Fill(area, background);
+        return;
+    }
+
+    /**
+     * The window draws the part of the area it covers, and the strips around that part (above,
+     * below, left and right of it) are left to the windows below.
+     */
+    Rectangle covered = RectangleIntersection(area, window->frame);
+    device->Blit(covered.x, covered.y,
+                 window->surface + (covered.y - window->frame.y) * window->frame.width +
+                     (covered.x - window->frame.x),
+                 covered.width, covered.height, window->frame.width);
+
+    int32_t coveredBottom = covered.y + covered.height;
+    int32_t coveredRight = covered.x + covered.width;
+    Rectangle strips[4] = {
+        {area.x, area.y, area.width, covered.y - area.y},
+        {area.x, coveredBottom, area.width, area.y + area.height - coveredBottom},
+        {area.x, covered.y, covered.x - area.x, covered.height},
+        {coveredRight, covered.y, area.x + area.width - coveredRight, covered.height},
+    };
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        Paint(strips[i], window->below);
+    }
+}
+
+Rectangle Compositor::CursorArea(int32_t x, int32_t y)
+{
+    Rectangle area = {x, y, CURSOR_WIDTH, CURSOR_HEIGHT};
+    return area;
+}
+
+void Compositor::HideCursor()
+{
+    device->Blit(drawnCursorX, drawnCursorY, underCursor, CURSOR_WIDTH, CURSOR_HEIGHT,
+                 CURSOR_WIDTH);
+    cursorDrawn = false;
+}
+
+void Compositor::ShowCursor()
+{
+    /**
+     * Only the pixels on the screen are read and drawn, so those off it needn't be valid.
+     */
+    device->Read(cursorX, cursorY, underCursor, CURSOR_WIDTH, CURSOR_HEIGHT, CURSOR_WIDTH);
+    for (int32_t y = 0; y < CURSOR_HEIGHT; y++)
+    {
+        for (int32_t x = 0; x < CURSOR_WIDTH; x++)
+        {
+            uint32_t *pixel = &cursorImage[y * CURSOR_WIDTH + x];
+            switch (CURSOR_SHAPE[y][x])
+            {
+            case 'X':
+                *pixel = 0x00000000;
+                break;
+            case '.':
+                *pixel = 0x00FFFFFF;
+                break;
+            default:
+                *pixel = underCursor[y * CURSOR_WIDTH + x];
+                break;
+            }
+        }
+    }
+    device->Blit(cursorX, cursorY, cursorImage, CURSOR_WIDTH, CURSOR_HEIGHT, CURSOR_WIDTH);
+    drawnCursorX = cursorX;
+    drawnCursorY = cursorY;
+    cursorDrawn = true;
+}
+
+void Compositor::PlaceCursor(int32_t x, int32_t y)
+{
+    cursorX = x < 0 ? 0 : x >= screen.width ? screen.width - 1 : x;
+    cursorY = y < 0 ? 0 : y >= screen.height ? screen.height - 1 : y;
+}
+
+void Compositor::MoveCursor(int32_t x, int32_t y)
+{
+    SpinlockGuard guard(&lock);
+    PlaceCursor(x, y);
+}
+
+void Compositor::MoveCursorBy(int32_t dx, int32_t dy)
+{
+    SpinlockGuard guard(&lock);
+    PlaceCursor(cursorX + dx, cursorY + dy);
+}
+
+uint32_t Compositor::Render()
+{
+    {
+        SpinlockGuard guard(&lock);
+
+        /**
+         * The cursor is taken off first if it moves, or if something under it is redrawn (which
+         * makes the pixels saved under it stale), and drawn again over the result.
+         */
+        bool redrawCursor = !cursorDrawn || cursorX != drawnCursorX ||
+                            cursorY != drawnCursorY ||
+                            damage.Intersects(CursorArea(drawnCursorX, drawnCursorY));
+        if (redrawCursor && cursorDrawn)
+        {
+            HideCursor();
+        }
+        for (uint32_t i = 0; i < damage.Count(); i++)
+        {
+            Paint(damage.Get(i), top);
+        }
+        damage.Clear();
+        if (redrawCursor)
+        {
+            ShowCursor();
+        }
+    }
+    return device->Present();
+}
@@ -0,0 +1,177 @@
+/**
+ * @file compositor.h
+ * @author rohan843
+ * @brief Contains the window compositor, which draws windows stacked on top of each other, and the
+ * mouse cursor over them.
+ *
+ * Each window draws into a surface of its own and tells the compositor which parts of it changed
+ * (damaged them). The compositor keeps the damaged areas of the screen in a rectangle list, and
+ * `Render` redraws only those: each damaged rectangle is taken from the topmost window down, every
+ * window copying the part of it that it covers and passing on the rest, so hidden parts of windows
+ * are never drawn, and each pixel is drawn once. So a frame costs as much as the area that changed,
+ * whatever the size of the screen.
+ *
+ * The cursor is drawn over everything like a hardware cursor would be: the pixels under it are
+ * saved before it is drawn, and put back when it moves, so moving it redraws no windows.
+ */
+
+#ifndef __COMPOSITOR_H
+#define __COMPOSITOR_H
+
+#include "graphics.h"
+#include "spinlock.h"
+#include "types.h"
+
+class Compositor;
+
+/**
+ * @brief A window, which is opaque and may be partly or completely off the screen.
+ */
+class Window
+{
+    friend class Compositor;
+
+  protected:
+    Compositor *compositor;
+
+    /**
+     * Where the window is on the screen.
+     */
+    Rectangle frame;
+
+    /**
+     * The window's pixels, `frame.width` per line.
+     */
+    uint32_t *surface;
+
+    /**
+     * The windows right above and below this one (0 for the top and the bottom one).
+     */
+    Window *above;
+    Window *below;
+
+  public:
+    /**
+     * @brief Creates a black window on top of the others.
+     */
+    Window(Compositor *compositor, int32_t x, int32_t y, int32_t width, int32_t height);
+    ~Window();
+
+    /**
+     * @brief The window's pixels, `Width()` per line. After drawing into them directly, the parts
+     * changed must be passed to `Damage`.
+     */
+    uint32_t *Surface();
+    int32_t Width();
+    int32_t Height();
+
+    /**
+     * @brief Fills a rectangle of the window (in its own coordinates), and damages it.
+     */
+    void Fill(Rectangle area, uint32_t color);
+
+    /**
+     * @brief Tells the compositor a rectangle of the window (in its own coordinates) changed.
+     */
+    void Damage(Rectangle area);
+
+    void Move(int32_t x, int32_t y);
+
+    /**
+     * @brief Puts the window on top of the others.
+     */
+    void Raise();
+};
+
+class Compositor
+{
+    friend class Window;
+
+  protected:
+    static const int32_t CURSOR_WIDTH = 12;
+    static const int32_t CURSOR_HEIGHT = 19;
+
+    GraphicsDevice *device;
+    Rectangle screen;
+
+    /**
+     * The color where there is no window.
+     */
+    uint32_t background;
+
+    Window *bottom;
+    Window *top;
+
+    /**
+     * The areas of the screen to redraw on the next `Render`.
+     */
+    RectangleList damage;
+
+    /**
+     * Where the cursor is to be drawn, and where it was drawn (if `cursorDrawn`) with the pixels
+     * it covers, which are put back when it moves. `cursorImage` is where it is put together.
+     */
+    int32_t cursorX, cursorY;
+    int32_t drawnCursorX, drawnCursorY;
+    bool cursorDrawn;
+    uint32_t underCursor[CURSOR_WIDTH * CURSOR_HEIGHT];
+    uint32_t cursorImage[CURSOR_WIDTH * CURSOR_HEIGHT];
+
+    Spinlock lock;
+
+    /**
+     * @brief Links a window in on top, or out of the stack, damaging its frame. The lock must be
+     * held.
+     */
+    void Link(Window *window);
+    void Unlink(Window *window);
+
+    /**
+     * @brief Adds a rectangle (clipped to the screen) to the damage. The lock must be held.
+     */
+    void AddDamage(Rectangle area);
+
+    /**
+     * @brief Draws an area from what the windows from `window` down show in it.
+     */
+    void Paint(Rectangle area, Window *window);
+
+    /**
+     * @brief The part of the screen the cursor covers at (x, y).
+     */
+    Rectangle CursorArea(int32_t x, int32_t y);
+
+    /**
+     * @brief Sets where the cursor is to be drawn, kept on the screen. The lock must be held.
+     */
+    void PlaceCursor(int32_t x, int32_t y);
+
+    void HideCursor();
+    void ShowCursor();
+
+  public:
+    static Compositor *activeCompositor;
+
+    Compositor(GraphicsDevice *device, uint32_t background);
+    ~Compositor();
+
+    /**
+     * @brief Marks an area of the screen to redraw.
+     */
+    void Damage(Rectangle area);
+
+    /**
+     * @brief Moves the cursor's tip to a point (kept on the screen), or by an amount.
+     */
+    void MoveCursor(int32_t x, int32_t y);
+    void MoveCursorBy(int32_t dx, int32_t dy);
+
+    /**
+     * @brief Redraws the damaged areas and the cursor, and presents them.
+     *
+     * @return The number of pixels presented.
+     */
+    uint32_t Render();
+};
+
+#endif
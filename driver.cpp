@@ -0,0 +1,36 @@
+#include "driver.h"
+
+/** Driver Class */
+
+Driver::Driver() {}
+
+Driver::~Driver() {}
+
+void Driver::Activate() {}
+
+int Driver::Reset() { return 0; }
+
+void Driver::Deactivate() {}
+
+/** DriverManager Class */
+
+DriverManager::DriverManager() { numDrivers = 0; }
+
+DriverManager::~DriverManager() {}
+
+void DriverManager::AddDriver(Driver *driver)
+{
+    if (numDrivers < 256)
+    {
+        drivers[numDrivers] = driver;
+        numDrivers++;
+    }
+}
+
+void DriverManager::ActivateAll()
+{
+    for (int i = 0; i < numDrivers; i++)
+    {
+        drivers[i]->Activate();
+    }
+}
@@ -0,0 +1,58 @@
+/**
+ * @file driver.h
+ * @author rohan843
+ * @brief Contains the base class of device drivers, and the manager that keeps track of them.
+ *
+ * Constructing a driver only sets up the object. The device itself is set up when the driver is
+ * activated, which the driver manager does for all drivers at once, before interrupts are turned
+ * on.
+ */
+
+#ifndef __DRIVER_H
+#define __DRIVER_H
+
+#include "types.h"
+
+class Driver
+{
+  public:
+    Driver();
+    ~Driver();
+
+    /**
+     * @brief Sets the device up, so that it starts working (and interrupting).
+     */
+    virtual void Activate();
+
+    /**
+     * @brief Puts the device back into its initial state.
+     *
+     * @return 0 on success.
+     */
+    virtual int Reset();
+
+    /**
+     * @brief Stops the device.
+     */
+    virtual void Deactivate();
+};
+
+class DriverManager
+{
+  private:
+    Driver *drivers[256];
+    int numDrivers;
+
+  public:
+    DriverManager();
+    ~DriverManager();
+
+    /**
+     * @brief Adds a driver. It gets activated along with all the others by `ActivateAll`.
+     */
+    void AddDriver(Driver *driver);
+
+    void ActivateAll();
+};
+
+#endif
@@ -0,0 +1,468 @@
+#include "e1000.h"
+#include "memorymanagement.h"
+#include "multitasking.h"
+#include "paging.h"
+#include "stdio.h"
+
+/**
+ * Register offsets.
+ */
+const uint32_t E1000_CONTROL = 0x0000;
+const uint32_t E1000_EEPROM_READ = 0x0014;
+const uint32_t E1000_INTERRUPT_CAUSE = 0x00C0;
+const uint32_t E1000_INTERRUPT_MASK_SET = 0x00D0;
+const uint32_t E1000_INTERRUPT_MASK_CLEAR = 0x00D8;
+const uint32_t E1000_RECEIVE_CONTROL = 0x0100;
+const uint32_t E1000_TRANSMIT_CONTROL = 0x0400;
+const uint32_t E1000_TRANSMIT_GAP = 0x0410;
+const uint32_t E1000_RECEIVE_BASE_LOW = 0x2800;
+const uint32_t E1000_RECEIVE_BASE_HIGH = 0x2804;
+const uint32_t E1000_RECEIVE_LENGTH = 0x2808;
+const uint32_t E1000_RECEIVE_HEAD = 0x2810;
+const uint32_t E1000_RECEIVE_TAIL = 0x2818;
+const uint32_t E1000_TRANSMIT_BASE_LOW = 0x3800;
+const uint32_t E1000_TRANSMIT_BASE_HIGH = 0x3804;
+const uint32_t E1000_TRANSMIT_LENGTH = 0x3808;
+const uint32_t E1000_TRANSMIT_HEAD = 0x3810;
+const uint32_t E1000_TRANSMIT_TAIL = 0x3818;
+const uint32_t E1000_MISSED_PACKETS = 0x4010;
+const uint32_t E1000_MULTICAST_TABLE = 0x5200;
+const uint32_t E1000_RECEIVE_ADDRESS_LOW = 0x5400;
+const uint32_t E1000_RECEIVE_ADDRESS_HIGH = 0x5404;
+
+const uint32_t E1000_CONTROL_AUTO_SPEED = 1 << 5;
+const uint32_t E1000_CONTROL_SET_LINK_UP = 1 << 6;
+const uint32_t E1000_CONTROL_RESET = 1 << 26;
+
+const uint32_t E1000_EEPROM_START = 1 << 0;
+const uint32_t E1000_EEPROM_DONE = 1 << 4;
+
+const uint32_t E1000_RECEIVE_ADDRESS_VALID = 1 << 31;
+
+/**
+ * Interrupt causes. The receive and transmit ones are handled by polling.
+ */
+const uint32_t E1000_INTERRUPT_TRANSMITTED = 1 << 0;
+const uint32_t E1000_INTERRUPT_LINK_CHANGE = 1 << 2;
+const uint32_t E1000_INTERRUPT_RECEIVE_LOW = 1 << 4;
+const uint32_t E1000_INTERRUPT_RECEIVE_OVERRUN = 1 << 6;
+const uint32_t E1000_INTERRUPT_RECEIVED = 1 << 7;
+const uint32_t E1000_INTERRUPT_POLLED = E1000_INTERRUPT_TRANSMITTED | E1000_INTERRUPT_RECEIVE_LOW |
+                                        E1000_INTERRUPT_RECEIVE_OVERRUN | E1000_INTERRUPT_RECEIVED;
+
+/**
+ * Receive control: enabled, accepting every frame (so a flood needn't know the MAC address), in
+ * 2 KiB buffers, without the CRC.
+ */
+const uint32_t E1000_RECEIVE_ENABLE = 1 << 1;
+const uint32_t E1000_RECEIVE_UNICAST_PROMISCUOUS = 1 << 3;
+const uint32_t E1000_RECEIVE_MULTICAST_PROMISCUOUS = 1 << 4;
+const uint32_t E1000_RECEIVE_BROADCAST = 1 << 15;
+const uint32_t E1000_RECEIVE_STRIP_CRC = 1 << 26;
+
+/**
+ * Transmit control: enabled, padding short frames, with the usual collision settings.
+ */
+const uint32_t E1000_TRANSMIT_ENABLE = 1 << 1;
+const uint32_t E1000_TRANSMIT_PAD = 1 << 3;
+const uint32_t E1000_TRANSMIT_COLLISION_THRESHOLD = 15 << 4;
+const uint32_t E1000_TRANSMIT_COLLISION_DISTANCE = 64 << 12;
+const uint32_t E1000_TRANSMIT_GAP_DEFAULT = 0x0060200A;
+
+const uint8_t E1000_DESCRIPTOR_DONE = 1 << 0;
+const uint8_t E1000_DESCRIPTOR_END_OF_PACKET = 1 << 1;
+
+const uint8_t E1000_COMMAND_END_OF_PACKET = 1 << 0;
+const uint8_t E1000_COMMAND_INSERT_CRC = 1 << 1;
+const uint8_t E1000_COMMAND_REPORT_STATUS = 1 << 3;
+
+/**
+ * The largest frame sent, without the CRC.
+ */
+const uint32_t E1000_MAX_FRAME = 1514;
+
+/**
+ * How many times a register is polled before the card is given up on.
+ */
+const uint32_t E1000_TIMEOUT = 1000000;
+
+/** IntelEthernetController Class */
+
+IntelEthernetController *IntelEthernetController::activeIntelEthernetController = 0;
+
+IntelEthernetController::IntelEthernetController(
+    PeripheralComponentInterconnectDeviceDescriptor *device, InterruptManager *interrupts)
+    : InterruptHandler(0x20 + device->interrupt, interrupts)
+{
+    static uint32_t deviceNumber = 0;
+    name[0] = 'e';
+    name[1] = 't';
+    name[2] = 'h';
+    name[3] = '0' + deviceNumber++;
+    name[4] = '\0';
+
+    registers = (volatile uint8_t *)device->bars[0].address;
+    macAddress = 0;
+    receiveDescriptors = 0;
+    receiveBuffers = 0;
+    receiveNext = 0;
+    transmitDescriptors = 0;
+    transmitTail = 0;
+    transmitClean = 0;
+    pollScheduled = false;
+}
+
+IntelEthernetController::~IntelEthernetController()
+{
+    if (activeIntelEthernetController == this)
+    {
+        activeIntelEthernetController = 0;
+    }
+}
+
+uint32_t IntelEthernetController::Read(uint32_t registerOffset)
+{
+    return *(volatile uint32_t *)(registers + registerOffset);
+}
+
+void IntelEthernetController::Write(uint32_t registerOffset, uint32_t value)
+{
+    *(volatile uint32_t *)(registers + registerOffset) = value;
+}
+
+uint16_t IntelEthernetController::ReadEeprom(uint8_t address)
+{
+    Write(E1000_EEPROM_READ, ((uint32_t)address << 8) | E1000_EEPROM_START);
+    for (uint32_t i = 0; i < E1000_TIMEOUT; i++)
+    {
+        uint32_t value = Read(E1000_EEPROM_READ);
+        if (value & E1000_EEPROM_DONE)
+        {
+            return value >> 16;
+        }
+    }
+    return 0;
+}
+
+void IntelEthernetController::Activate()
+{
+    Write(E1000_INTERRUPT_MASK_CLEAR, 0xFFFFFFFF);
+    Write(E1000_CONTROL, Read(E1000_CONTROL) | E1000_CONTROL_RESET);
+    for (uint32_t i = 0; i < E1000_TIMEOUT && (Read(E1000_CONTROL) & E1000_CONTROL_RESET); i++)
+    {
+    }
+    Write(E1000_INTERRUPT_MASK_CLEAR, 0xFFFFFFFF);
+    Read(E1000_INTERRUPT_CAUSE);
+    Write(E1000_CONTROL,
+          Read(E1000_CONTROL) | E1000_CONTROL_SET_LINK_UP | E1000_CONTROL_AUTO_SPEED);
+
+    /**
+     * The address is usually loaded into the first receive address register from the EEPROM by
+     * the reset. If not, it is read from the EEPROM itself.
+     */
+    if (Read(E1000_RECEIVE_ADDRESS_HIGH) & E1000_RECEIVE_ADDRESS_VALID)
+    {
+        macAddress = Read(E1000_RECEIVE_ADDRESS_LOW) |
+                     ((uint64_t)(Read(E1000_RECEIVE_ADDRESS_HIGH) & 0xFFFF) << 32);
+    }
+    else
+    {
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            macAddress |= (uint64_t)ReadEeprom(i) << (16 * i);
+        }
+        Write(E1000_RECEIVE_ADDRESS_LOW, (uint32_t)macAddress);
+        Write(E1000_RECEIVE_ADDRESS_HIGH,
+              (uint32_t)(macAddress >> 32) | E1000_RECEIVE_ADDRESS_VALID);
+    }
+    for (uint32_t i = 0; i < 128; i++)
+    {
+        Write(E1000_MULTICAST_TABLE + 4 * i, 0);
+    }
+
+    /**
+     * A ring of 256 descriptors takes a frame, and its receive buffers take 128 contiguous ones.
+     */
+    PhysicalMemoryManager *frames = PhysicalMemoryManager::activePhysicalMemoryManager;
+    receiveDescriptors = (volatile IntelEthernetReceiveDescriptor *)frames->AllocateFrame();
+    transmitDescriptors = (volatile IntelEthernetTransmitDescriptor *)frames->AllocateFrame();
+    receiveBuffers =
+        (uint8_t *)frames->AllocateFrames(RECEIVE_DESCRIPTORS * RECEIVE_BUFFER_SIZE / PAGE_SIZE);
+    if (receiveDescriptors == 0 || transmitDescriptors == 0 || receiveBuffers == 0)
+    {
+        printf(name);
+        printf(": out of memory\n");
+        return;
+    }
+
+    for (uint32_t i = 0; i < RECEIVE_DESCRIPTORS; i++)
+    {
+        receiveDescriptors[i].address = (uint32_t)(receiveBuffers + i * RECEIVE_BUFFER_SIZE);
+        receiveDescriptors[i].status = 0;
+    }
+    for (uint32_t i = 0; i < TRANSMIT_DESCRIPTORS; i++)
+    {
+        transmitDescriptors[i].address = 0;
+        transmitDescriptors[i].command = 0;
+        transmitDescriptors[i].status = 0;
+        transmitFrames[i] = 0;
+    }
+
+    /**
+     * The card owns the receive descriptors from the head up to (not including) the tail. One is
+     * always left out, as a full ring would look empty.
+     */
+    Write(E1000_RECEIVE_BASE_LOW, (uint32_t)receiveDescriptors);
+    Write(E1000_RECEIVE_BASE_HIGH, 0);
+    Write(E1000_RECEIVE_LENGTH, RECEIVE_DESCRIPTORS * sizeof(IntelEthernetReceiveDescriptor));
+    Write(E1000_RECEIVE_HEAD, 0);
+    Write(E1000_RECEIVE_TAIL, RECEIVE_DESCRIPTORS - 1);
+    Write(E1000_RECEIVE_CONTROL, E1000_RECEIVE_ENABLE | E1000_RECEIVE_UNICAST_PROMISCUOUS |
+                                     E1000_RECEIVE_MULTICAST_PROMISCUOUS |
+                                     E1000_RECEIVE_BROADCAST | E1000_RECEIVE_STRIP_CRC);
+
+    Write(E1000_TRANSMIT_BASE_LOW, (uint32_t)transmitDescriptors);
+    Write(E1000_TRANSMIT_BASE_HIGH, 0);
+    Write(E1000_TRANSMIT_LENGTH, TRANSMIT_DESCRIPTORS * sizeof(IntelEthernetTransmitDescriptor));
+    Write(E1000_TRANSMIT_HEAD, 0);
+    Write(E1000_TRANSMIT_TAIL, 0);
+    Write(E1000_TRANSMIT_CONTROL, E1000_TRANSMIT_ENABLE | E1000_TRANSMIT_PAD |
+                                      E1000_TRANSMIT_COLLISION_THRESHOLD |
+                                      E1000_TRANSMIT_COLLISION_DISTANCE);
+    Write(E1000_TRANSMIT_GAP, E1000_TRANSMIT_GAP_DEFAULT);
+
+    /**
+     * The task shares the rings with the interrupt handler by disabling interrupts, which only
+     * keeps the handler out on the processor the PICs interrupt.
+     */
+    if (TaskManager::activeTaskManager->StartKernelTask(&PollTask, 0) == 0)
+    {
+        printf(name);
+        printf(": no polling task\n");
+        return;
+    }
+    activeIntelEthernetController = this;
+    Write(E1000_INTERRUPT_MASK_SET, E1000_INTERRUPT_POLLED | E1000_INTERRUPT_LINK_CHANGE);
+
+    NetworkDevice::Register(this);
+
+    printf(name);
+    printf(": MAC ");
+    const char *hex = "0123456789ABCDEF";
+    char address[18];
+    for (uint32_t i = 0; i < 6; i++)
+    {
+        uint8_t byte = macAddress >> (8 * i);
+        address[3 * i] = hex[byte >> 4];
+        address[3 * i + 1] = hex[byte & 0xF];
+        address[3 * i + 2] = i < 5 ? ':' : '\0';
+    }
+    printf(address);
+    printf("\n");
+}
+
+bool IntelEthernetController::HandleInterrupt(uint32_t *esp)
+{
+    /**
+     * Reading the causes acknowledges them.
+     */
+    uint32_t causes = Read(E1000_INTERRUPT_CAUSE);
+    if (causes == 0)
+    {
+        return false;
+    }
+    statistics.interrupts++;
+
+    /**
+     * Causes that come in while masked stay set, and raise an interrupt as soon as they are
+     * unmasked. So no frame is missed between the last poll and the unmasking.
+     */
+    if (causes & E1000_INTERRUPT_POLLED)
+    {
+        Write(E1000_INTERRUPT_MASK_CLEAR, E1000_INTERRUPT_POLLED);
+        pollScheduled = true;
+        TaskManager::activeTaskManager->Wakeup((void *)&pollScheduled);
+    }
+    return true;
+}
+
+uint32_t IntelEthernetController::Poll(uint32_t budget)
+{
+    uint32_t count = 0;
+    uint32_t last = RECEIVE_DESCRIPTORS;
+    while (count < budget)
+    {
+        volatile IntelEthernetReceiveDescriptor *descriptor = &receiveDescriptors[receiveNext];
+        uint8_t status = descriptor->status;
+        if (!(status & E1000_DESCRIPTOR_DONE))
+        {
+            break;
+        }
+
+        /**
+         * Frames are never split over several buffers, as no frame is larger than one.
+         */
+        if ((status & E1000_DESCRIPTOR_END_OF_PACKET) && descriptor->errors == 0)
+        {
+            statistics.framesReceived++;
+            statistics.bytesReceived += descriptor->length;
+            if (handler != 0)
+            {
+                handler->HandleFrame(this, receiveBuffers + receiveNext * RECEIVE_BUFFER_SIZE,
+                                     descriptor->length);
+            }
+        }
+        else
+        {
+            statistics.framesDropped++;
+        }
+
+        descriptor->status = 0;
+        last = receiveNext;
+        receiveNext = (receiveNext + 1) % RECEIVE_DESCRIPTORS;
+        count++;
+    }
+
+    /**
+     * The buffers handled go back to the card with a single register write.
+     */
+    if (last != RECEIVE_DESCRIPTORS)
+    {
+        Write(E1000_RECEIVE_TAIL, last);
+    }
+    statistics.framesMissed += Read(E1000_MISSED_PACKETS);
+
+    uint32_t eflags;
+    asm volatile("pushfl\n"
+                 "popl %0\n"
+                 "cli"
+                 : "=r"(eflags));
+    ReclaimTransmitted();
+    asm volatile("pushl %0\n"
+                 "popfl"
+                 :
+                 : "r"(eflags)
+                 : "cc");
+    return count;
+}
+
+void IntelEthernetController::ReclaimTransmitted()
+{
+    while (transmitClean != transmitTail &&
+           (transmitDescriptors[transmitClean].status & E1000_DESCRIPTOR_DONE))
+    {
+        const void *frame = transmitFrames[transmitClean];
+        transmitFrames[transmitClean] = 0;
+        transmitClean = (transmitClean + 1) % TRANSMIT_DESCRIPTORS;
+        statistics.framesSent++;
+        if (handler != 0)
+        {
+            handler->FrameSent(this, frame);
+        }
+    }
+}
+
+void IntelEthernetController::PollLoop()
+{
+    while (1)
+    {
+        asm volatile("cli");
+        while (!pollScheduled)
+        {
+            TaskManager::activeTaskManager->Sleep((void *)&pollScheduled);
+        }
+        asm volatile("sti");
+
+        statistics.polls++;
+        if (Poll(POLL_BUDGET) == POLL_BUDGET)
+        {
+            /**
+             * There may be more: stays in polling mode, after letting other tasks run.
+             */
+            TaskManager::activeTaskManager->Yield();
+            continue;
+        }
+
+        /**
+         * The ring is empty, so it is back to interrupts. Done with interrupts disabled, so that
+         * an interrupt in between can't schedule a poll that is then forgotten.
+         */
+        asm volatile("cli");
+        pollScheduled = false;
+        Write(E1000_INTERRUPT_MASK_SET, E1000_INTERRUPT_POLLED);
+        statistics.interruptModeSwitches++;
+        asm volatile("sti");
+    }
+}
+
+void IntelEthernetController::PollTask() { activeIntelEthernetController->PollLoop(); }
+
+const char *IntelEthernetController::Name() { return name; }
+
+uint64_t IntelEthernetController::MacAddress() { return macAddress; }
+
+bool IntelEthernetController::Send(const void *frame, uint32_t size)
+{
+    if (size == 0 || size > E1000_MAX_FRAME || transmitDescriptors == 0)
+    {
+        return false;
+    }
+
+    uint32_t eflags;
+    asm volatile("pushfl\n"
+                 "popl %0\n"
+                 "cli"
+                 : "=r"(eflags));
+
+    uint32_t next = (transmitTail + 1) % TRANSMIT_DESCRIPTORS;
+    if (next == transmitClean)
+    {
+        ReclaimTransmitted();
+    }
+
+    bool queued = next != transmitClean;
+    if (queued)
+    {
+        volatile IntelEthernetTransmitDescriptor *descriptor = &transmitDescriptors[transmitTail];
+        descriptor->address = (uint32_t)frame;
+        descriptor->length = size;
+        descriptor->command =
+            E1000_COMMAND_END_OF_PACKET | E1000_COMMAND_INSERT_CRC | E1000_COMMAND_REPORT_STATUS;
+        descriptor->status = 0;
+        transmitFrames[transmitTail] = frame;
+        transmitTail = next;
+        Write(E1000_TRANSMIT_TAIL, transmitTail);
+    }
+
+    asm volatile("pushl %0\n"
+                 "popfl"
+                 :
+                 : "r"(eflags)
+                 : "cc");
+    return queued;
+}
+
+/**
+ * @brief Creates the driver for an e1000 card found on the PCI bus.
+ */
+static Driver *CreateIntelEthernetController(
+    PeripheralComponentInterconnectDeviceDescriptor *device,
+    PeripheralComponentInterconnectController *pci, InterruptManager *interrupts)
+{
+    /**
+     * The registers must be in the memory mapped device region, which is mapped in every address
+     * space. Only the first card is driven, as the polling task serves a single one.
+     */
+    static bool created = false;
+    if (device->bars[0].type != MemoryMapping || device->bars[0].address < USER_SPACE_END ||
+        created)
+    {
+        return 0;
+    }
+    created = true;
+    pci->EnableBusMastering(device);
+    return new IntelEthernetController(device, interrupts);
+}
+
+const PeripheralComponentInterconnectDriverEntry IntelEthernetController::DriverEntry = {
+    0x8086, 0x100E, PCI_ANY_CLASS, PCI_ANY_CLASS, &CreateIntelEthernetController};
@@ -0,0 +1,137 @@
+/**
+ * @file e1000.h
+ * @author rohan843
+ * @brief Contains the driver for Intel 8254x gigabit Ethernet cards (the "e1000", as QEMU
+ * emulates with `-device e1000`).
+ *
+ * The card moves frames through two descriptor rings in memory, one to receive into and one to
+ * send from. Received frames are handed to the handler in the buffers the card wrote them to, and
+ * frames are sent from wherever they are.
+ *
+ * Taking an interrupt for every frame doesn't scale, so the driver works like Linux's NAPI: the
+ * first interrupt masks the card's interrupts and wakes a polling task. That task handles up to a
+ * budget of frames at a time, giving other tasks a turn in between, and only unmasks the
+ * interrupts once the ring is empty. Under load, the card is then polled without interrupts.
+ */
+
+#ifndef __E1000_H
+#define __E1000_H
+
+#include "driver.h"
+#include "interrupts.h"
+#include "netdevice.h"
+#include "pci.h"
+#include "types.h"
+
+struct IntelEthernetReceiveDescriptor
+{
+    uint64_t address;
+    uint16_t length;
+    uint16_t checksum;
+    uint8_t status;
+    uint8_t errors;
+    uint16_t special;
+} __attribute__((packed));
+
+struct IntelEthernetTransmitDescriptor
+{
+    uint64_t address;
+    uint16_t length;
+    uint8_t checksumOffset;
+    uint8_t command;
+    uint8_t status;
+    uint8_t checksumStart;
+    uint16_t special;
+} __attribute__((packed));
+
+class IntelEthernetController : public NetworkDevice, public Driver, public InterruptHandler
+{
+  protected:
+    static const uint32_t RECEIVE_DESCRIPTORS = 256;
+    static const uint32_t TRANSMIT_DESCRIPTORS = 256;
+    static const uint32_t RECEIVE_BUFFER_SIZE = 2048;
+
+    /**
+     * The frames handled per poll, before other tasks get a turn.
+     */
+    static const uint32_t POLL_BUDGET = 64;
+
+    /**
+     * The registers, memory mapped.
+     */
+    volatile uint8_t *registers;
+
+    char name[5];
+    uint64_t macAddress;
+
+    volatile IntelEthernetReceiveDescriptor *receiveDescriptors;
+    uint8_t *receiveBuffers;
+
+    /**
+     * The next descriptor the card will fill.
+     */
+    uint32_t receiveNext;
+
+    volatile IntelEthernetTransmitDescriptor *transmitDescriptors;
+    const void *transmitFrames[TRANSMIT_DESCRIPTORS];
+
+    /**
+     * Descriptors from `transmitClean` up to `transmitTail` are with the card.
+     */
+    uint32_t transmitTail;
+    uint32_t transmitClean;
+
+    /**
+     * Set by the interrupt handler, while the card's interrupts are masked and the polling task
+     * runs.
+     */
+    volatile bool pollScheduled;
+
+    uint32_t Read(uint32_t registerOffset);
+    void Write(uint32_t registerOffset, uint32_t value);
+
+    /**
+     * @brief Reads a word of the EEPROM.
+     */
+    uint16_t ReadEeprom(uint8_t address);
+
+    /**
+     * @brief Hands received frames to the handler, and gives their buffers back to the card.
+     *
+     * @return The number of frames taken off the ring.
+     */
+    uint32_t Poll(uint32_t budget);
+
+    /**
+     * @brief Takes the sent frames off the transmit ring. Must be called with interrupts
+     * disabled.
+     */
+    void ReclaimTransmitted();
+
+    /**
+     * @brief The body of the polling task.
+     */
+    void PollLoop();
+    static void PollTask();
+
+  public:
+    static IntelEthernetController *activeIntelEthernetController;
+
+    IntelEthernetController(PeripheralComponentInterconnectDeviceDescriptor *device,
+                            InterruptManager *interrupts);
+    ~IntelEthernetController();
+
+    virtual void Activate();
+    virtual bool HandleInterrupt(uint32_t *esp);
+
+    virtual const char *Name();
+    virtual uint64_t MacAddress();
+    virtual bool Send(const void *frame, uint32_t size);
+
+    /**
+     * The driver registry entry (the 82540EM, which QEMU emulates).
+     */
+    static const PeripheralComponentInterconnectDriverEntry DriverEntry;
+};
+
+#endif
@@ -0,0 +1,149 @@
+#include "elf.h"
+
+ElfProgram::ElfProgram(const uint8_t *image, uint32_t size)
+{
+    this->image = image;
+    this->size = size;
+    this->entry = 0;
+    this->segmentCount = 0;
+    this->valid = Parse();
+}
+
+ElfProgram::~ElfProgram()
+{
+    for (int i = 0; i < segmentCount; i++)
+    {
+        if (segments[i].sharedFrames != 0)
+        {
+            delete[] segments[i].sharedFrames;
+        }
+    }
+}
+
+bool ElfProgram::IsElf(const uint8_t *image, uint32_t size)
+{
+    return size >= sizeof(ElfHeader) && image[0] == 0x7F && image[1] == 'E' && image[2] == 'L' &&
+           image[3] == 'F';
+}
+
+bool ElfProgram::IsValid() { return valid; }
+
+bool ElfProgram::Parse()
+{
+    if (!IsElf(image, size))
+    {
+        return false;
+    }
+
+    const ElfHeader *header = (const ElfHeader *)image;
+
+    /**
+     * 32 - bit (class 1), little endian (data 1), executable (type 2), for the 386 (machine 3).
+     */
+    if (header->ident[4] != 1 || header->ident[5] != 1 || header->type != 2 ||
+        header->machine != 3)
+    {
+        return false;
+    }
+    if (header->programHeaderSize != sizeof(ElfProgramHeader) ||
+        header->programHeaderOffset > size ||
+        (uint64_t)header->programHeaderCount * sizeof(ElfProgramHeader) >
+            size - header->programHeaderOffset)
+    {
+        return false;
+    }
+
+    const ElfProgramHeader *programHeaders =
+        (const ElfProgramHeader *)(image + header->programHeaderOffset);
+
+    for (int i = 0; i < header->programHeaderCount; i++)
+    {
+        const ElfProgramHeader *ph = &programHeaders[i];
+        if (ph->type != ELF_PROGRAM_HEADER_LOAD || ph->memorySize == 0)
+        {
+            continue;
+        }
+
+        /**
+         * The segment has to fit in user space below the stack, and its file data in the file.
+         */
+        if (segmentCount == MAX_SEGMENTS || ph->fileSize > ph->memorySize ||
+            ph->virtualAddress < USER_SPACE_START ||
+            (uint64_t)ph->virtualAddress + ph->memorySize > USER_SPACE_END - STACK_SIZE ||
+            (uint64_t)ph->offset + ph->fileSize > size)
+        {
+            return false;
+        }
+
+        Segment *segment = &segments[segmentCount++];
+        segment->virtualAddress = ph->virtualAddress;
+        segment->memorySize = ph->memorySize;
+        segment->fileOffset = ph->offset;
+        segment->fileSize = ph->fileSize;
+        segment->writable = ph->flags & ELF_SEGMENT_WRITABLE;
+        segment->sharedFrames = 0;
+
+        if (!segment->writable)
+        {
+            uint32_t start = ph->virtualAddress & ~(PAGE_SIZE - 1);
+            uint32_t end = (ph->virtualAddress + ph->memorySize + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+            uint32_t pages = (end - start) / PAGE_SIZE;
+
+            segment->sharedFrames = new uint32_t[pages];
+            memset(segment->sharedFrames, 0, pages * sizeof(uint32_t));
+        }
+    }
+
+    entry = header->entry;
+    return segmentCount > 0 && USER_SPACE_START <= entry && entry < USER_SPACE_END - STACK_SIZE;
+}
+
+Task *ElfProgram::Load(GlobalDescriptorTable *gdt)
+{
+    if (!valid)
+    {
+        return 0;
+    }
+
+    AddressSpace *addressSpace = new AddressSpace();
+
+    for (int i = 0; i < segmentCount; i++)
+    {
+        Segment *segment = &segments[i];
+        VirtualMemoryArea *area = new VirtualMemoryArea;
+
+        area->start = segment->virtualAddress & ~(PAGE_SIZE - 1);
+        area->end = (segment->virtualAddress + segment->memorySize + PAGE_SIZE - 1) &
+                    ~(PAGE_SIZE - 1);
+        area->fileStart = segment->virtualAddress;
+        area->fileEnd = segment->virtualAddress + segment->fileSize;
+        area->file = image + segment->fileOffset;
+        area->flags = segment->writable ? PAGE_WRITABLE : 0;
+        area->sharedFrames = segment->sharedFrames;
+
+        addressSpace->AddArea(area);
+    }
+
+    VirtualMemoryArea *stack = new VirtualMemoryArea;
+    stack->start = USER_SPACE_END - STACK_SIZE;
+    stack->end = USER_SPACE_END;
+    stack->fileStart = 0;
+    stack->fileEnd = 0;
+    stack->file = 0;
+    stack->flags = PAGE_WRITABLE;
+    stack->sharedFrames = 0;
+    addressSpace->AddArea(stack);
+
+    return new Task(gdt, addressSpace, entry, USER_SPACE_END);
+}
+
+Task *ElfProgram::Start(GlobalDescriptorTable *gdt, TaskManager *taskManager)
+{
+    Task *task = Load(gdt);
+    if (task != 0 && !taskManager->AddTask(task))
+    {
+        delete task;
+        return 0;
+    }
+    return task;
+}
@@ -0,0 +1,125 @@
+/**
+ * @file elf.h
+ * @author rohan843
+ * @brief Contains the loader for 32 - bit ELF programs.
+ *
+ * Starting a program copies nothing: it only describes the program's segments to a fresh address
+ * space (see `VirtualMemoryArea`), and the page fault handler fills each page on first access.
+ * Read-only pages are shared by every instance of a program, and where the image allows it they
+ * are the pages of the image itself. So starting another instance costs a page directory, a
+ * kernel stack and a few small objects, no matter how large the program is.
+ */
+
+#ifndef __ELF_H
+#define __ELF_H
+
+#include "gdt.h"
+#include "multitasking.h"
+#include "paging.h"
+#include "types.h"
+
+struct ElfHeader
+{
+    uint8_t ident[16];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint32_t entry;
+    uint32_t programHeaderOffset;
+    uint32_t sectionHeaderOffset;
+    uint32_t flags;
+    uint16_t headerSize;
+    uint16_t programHeaderSize;
+    uint16_t programHeaderCount;
+    uint16_t sectionHeaderSize;
+    uint16_t sectionHeaderCount;
+    uint16_t sectionNameIndex;
+} __attribute__((packed));
+
+struct ElfProgramHeader
+{
+    uint32_t type;
+    uint32_t offset;
+    uint32_t virtualAddress;
+    uint32_t physicalAddress;
+    uint32_t fileSize;
+    uint32_t memorySize;
+    uint32_t flags;
+    uint32_t align;
+} __attribute__((packed));
+
+const uint32_t ELF_PROGRAM_HEADER_LOAD = 1;
+const uint32_t ELF_SEGMENT_WRITABLE = 1 << 1;
+
+class ElfProgram
+{
+  protected:
+    /**
+     * A loadable segment. Read-only ones have a table of the frames shared by all instances.
+     */
+    struct Segment
+    {
+        uint32_t virtualAddress;
+        uint32_t memorySize;
+        uint32_t fileOffset;
+        uint32_t fileSize;
+        bool writable;
+        uint32_t *sharedFrames;
+    };
+
+    static const int MAX_SEGMENTS = 8;
+
+    const uint8_t *image;
+    uint32_t size;
+    uint32_t entry;
+
+    Segment segments[MAX_SEGMENTS];
+    int segmentCount;
+
+    bool valid;
+
+    /**
+     * @brief Reads and checks the program headers.
+     */
+    bool Parse();
+
+  public:
+    /**
+     * The user stack: reserved at the top of user space, filled in on demand like the rest.
+     */
+    static const uint32_t STACK_SIZE = 64 * 1024;
+
+    /**
+     * @param image The ELF file. It must stay in memory, unchanged, as long as this object lives.
+     * @param size The size of the file.
+     */
+    ElfProgram(const uint8_t *image, uint32_t size);
+    ~ElfProgram();
+
+    /**
+     * @brief Tells whether some data starts like an ELF file.
+     */
+    static bool IsElf(const uint8_t *image, uint32_t size);
+
+    /**
+     * @brief Tells whether the file is a 32 - bit x86 executable this loader can start.
+     */
+    bool IsValid();
+
+    /**
+     * @brief Creates a new instance of the program as a task, without starting it.
+     *
+     * @return The task, which the caller owns until it adds it to a `TaskManager`, or 0 if the
+     * program isn't valid.
+     */
+    Task *Load(GlobalDescriptorTable *gdt);
+
+    /**
+     * @brief Starts a new instance of the program as a task.
+     *
+     * @return The task, or 0 if the program isn't valid.
+     */
+    Task *Start(GlobalDescriptorTable *gdt, TaskManager *taskManager);
+};
+
+#endif
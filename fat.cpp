@@ -0,0 +1,644 @@
+#include "fat.h"
+#include "memorymanagement.h"
+
+/**
+ * FAT entries are 28 - bit. Any entry that isn't a cluster of the volume ends a chain.
+ */
+const uint32_t FAT_ENTRY_MASK = 0x0FFFFFFF;
+
+/**
+ * Directory entry attributes. Long name entries have all of the first four set.
+ */
+const uint8_t FAT_ATTRIBUTE_VOLUME_LABEL = 0x08;
+const uint8_t FAT_ATTRIBUTE_DIRECTORY = 0x10;
+const uint8_t FAT_ATTRIBUTE_LONG_NAME = 0x0F;
+
+const uint8_t FAT_ENTRY_END = 0x00;
+const uint8_t FAT_ENTRY_DELETED = 0xE5;
+
+/**
+ * Short names stored in lower case have these flags set instead, in `caseFlags`.
+ */
+const uint8_t FAT_CASE_LOWER_BASE = 0x08;
+const uint8_t FAT_CASE_LOWER_EXTENSION = 0x10;
+
+const uint8_t FAT_LONG_NAME_LAST = 0x40;
+const uint32_t FAT_LONG_NAME_CHARACTERS = 13;
+const uint32_t FAT_MAX_NAME = 255;
+
+/**
+ * Runs of at least this many sectors (64 KiB) are read from the device directly, instead of
+ * through the block cache. A file read in such large pieces is streamed, and would only push
+ * everything else out of the cache.
+ */
+const uint32_t FAT_DIRECT_READ_SECTORS = 128;
+
+/**
+ * Partition types of FAT32 partitions (with CHS and LBA addressing).
+ */
+const uint8_t MBR_TYPE_FAT32 = 0x0B;
+const uint8_t MBR_TYPE_FAT32_LBA = 0x0C;
+const uint32_t MBR_PARTITION_TABLE = 446;
+
+/**
+ * @brief Checks whether a sector is the boot sector of a FAT32 volume this driver can read.
+ */
+static bool IsBootSector(const uint8_t *sector, uint32_t sectorSize)
+{
+    if (sector[510] != 0x55 || sector[511] != 0xAA)
+    {
+        return false;
+    }
+
+    FileAllocationTableBootSector *bootSector = (FileAllocationTableBootSector *)sector;
+    uint8_t sectorsPerCluster = bootSector->sectorsPerCluster;
+
+    /**
+     * FAT12 and FAT16 volumes have a fixed size root directory and 16 - bit FAT sizes instead.
+     */
+    return bootSector->bytesPerSector == sectorSize && sectorsPerCluster != 0 &&
+           (sectorsPerCluster & (sectorsPerCluster - 1)) == 0 &&
+           bootSector->reservedSectors != 0 && bootSector->fatCount != 0 &&
+           bootSector->rootEntryCount == 0 && bootSector->sectorsPerFat16 == 0 &&
+           bootSector->sectorsPerFat32 != 0 && bootSector->totalSectors32 != 0 &&
+           bootSector->rootCluster >= 2;
+}
+
+/**
+ * @brief The checksum of a short name, which the long name entries naming it repeat.
+ */
+static uint8_t ShortNameChecksum(const char *name)
+{
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < 11; i++)
+    {
+        sum = ((sum & 1) << 7) + (sum >> 1) + (uint8_t)name[i];
+    }
+    return sum;
+}
+
+/**
+ * @brief Turns an 11 character short name into "NAME.EXT" form.
+ */
+static void ShortName(FileAllocationTableDirectoryEntry *entry, char *name)
+{
+    uint32_t length = 0;
+    for (uint32_t i = 0; i < 8 && entry->name[i] != ' '; i++)
+    {
+        char c = entry->name[i];
+        if (i == 0 && (uint8_t)c == 0x05)
+        {
+            c = (char)FAT_ENTRY_DELETED;
+        }
+        if ((entry->caseFlags & FAT_CASE_LOWER_BASE) && c >= 'A' && c <= 'Z')
+        {
+            c += 'a' - 'A';
+        }
+        name[length++] = c;
+    }
+
+    if (entry->name[8] != ' ')
+    {
+        name[length++] = '.';
+        for (uint32_t i = 8; i < 11 && entry->name[i] != ' '; i++)
+        {
+            char c = entry->name[i];
+            if ((entry->caseFlags & FAT_CASE_LOWER_EXTENSION) && c >= 'A' && c <= 'Z')
+            {
+                c += 'a' - 'A';
+            }
+            name[length++] = c;
+        }
+    }
+    name[length] = '\0';
+}
+
+/**
+ * @brief Copies the characters of a long name entry into place. Characters outside ASCII become
+ * '?'. The characters aren't 2 byte aligned within the entry, so they are read a byte at a time.
+ */
+static void CopyLongName(const uint8_t *characters, uint32_t count, char *name)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint16_t character = characters[2 * i] | (characters[2 * i + 1] << 8);
+        if (character == 0x0000)
+        {
+            name[i] = '\0';
+            return;
+        }
+        if (character == 0xFFFF)
+        {
+            return;
+        }
+        name[i] = character < 0x80 ? (char)character : '?';
+    }
+}
+
+static char ToUpper(char c) { return c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c; }
+
+/** FileAllocationTable Class */
+
+FileAllocationTable *FileAllocationTable::activeFileAllocationTable = 0;
+
+bool FileAllocationTable::FindVolume(BlockCache *cache, BlockDevice *device,
+                                     uint32_t *firstSector)
+{
+    uint32_t sectorSize = device->SectorSize();
+    uint8_t *sector = new uint8_t[sectorSize];
+    bool found = false;
+
+    if (cache->Read(device, 0, 1, sector))
+    {
+        if (IsBootSector(sector, sectorSize))
+        {
+            *firstSector = 0;
+            found = true;
+        }
+        else if (sector[510] == 0x55 && sector[511] == 0xAA)
+        {
+            /**
+             * An MBR: the first FAT32 partition is used.
+             */
+            uint32_t starts[4];
+            uint32_t count = 0;
+            for (uint32_t i = 0; i < 4; i++)
+            {
+                uint8_t *partition = sector + MBR_PARTITION_TABLE + 16 * i;
+                if (partition[4] == MBR_TYPE_FAT32 || partition[4] == MBR_TYPE_FAT32_LBA)
+                {
+                    starts[count++] = *(uint32_t *)(partition + 8);
+                }
+            }
+            for (uint32_t i = 0; i < count && !found; i++)
+            {
+                if (cache->Read(device, starts[i], 1, sector) &&
+                    IsBootSector(sector, sectorSize))
+                {
+                    *firstSector = starts[i];
+                    found = true;
+                }
+            }
+        }
+    }
+
+    delete[] sector;
+    return found;
+}
+
+FileAllocationTable::FileAllocationTable(BlockCache *cache, BlockDevice *device,
+                                         uint32_t firstSector)
+{
+    this->cache = cache;
+    this->device = device;
+    mounted = false;
+
+    bytesPerSector = device->SectorSize();
+    fatBuffer = new uint8_t[bytesPerSector];
+    fatBufferSector = 0xFFFFFFFF;
+    sectorBuffer = new uint8_t[bytesPerSector];
+    sectorBufferSector = 0xFFFFFFFF;
+
+    for (uint32_t i = 0; i < MAX_CHAINS; i++)
+    {
+        chains[i].firstCluster = 0;
+        chains[i].extents = 0;
+        chains[i].extentCount = 0;
+        chains[i].clusterCount = 0;
+        chains[i].lastUsed = 0;
+    }
+    chainClock = 0;
+    chainHits = 0;
+    chainMisses = 0;
+
+    if (!cache->Read(device, firstSector, 1, sectorBuffer) ||
+        !IsBootSector(sectorBuffer, bytesPerSector))
+    {
+        return;
+    }
+
+    FileAllocationTableBootSector *bootSector = (FileAllocationTableBootSector *)sectorBuffer;
+    sectorsPerCluster = bootSector->sectorsPerCluster;
+    clusterBytes = sectorsPerCluster * bytesPerSector;
+    fatSector = firstSector + bootSector->reservedSectors;
+    dataSector = fatSector + bootSector->fatCount * bootSector->sectorsPerFat32;
+    rootCluster = bootSector->rootCluster;
+
+    uint32_t volumeSectors = bootSector->totalSectors32;
+    if (dataSector - firstSector >= volumeSectors)
+    {
+        return;
+    }
+    clusterCount = (volumeSectors - (dataSector - firstSector)) / sectorsPerCluster;
+
+    /**
+     * The FAT may be too small for the data area. Clusters without an entry can't be used.
+     */
+    uint32_t entries = bootSector->sectorsPerFat32 * (bytesPerSector / 4);
+    if (clusterCount > entries - 2)
+    {
+        clusterCount = entries - 2;
+    }
+
+    mounted = true;
+    if (activeFileAllocationTable == 0)
+    {
+        activeFileAllocationTable = this;
+    }
+}
+
+FileAllocationTable::~FileAllocationTable()
+{
+    for (uint32_t i = 0; i < MAX_CHAINS; i++)
+    {
+        delete[] chains[i].extents;
+    }
+    delete[] fatBuffer;
+    delete[] sectorBuffer;
+
+    if (activeFileAllocationTable == this)
+    {
+        activeFileAllocationTable = 0;
+    }
+}
+
+bool FileAllocationTable::Mounted() { return mounted; }
+
+BlockDevice *FileAllocationTable::Device() { return device; }
+
+uint32_t FileAllocationTable::ChainHits() { return chainHits; }
+
+uint32_t FileAllocationTable::ChainMisses() { return chainMisses; }
+
+uint32_t FileAllocationTable::NextCluster(uint32_t cluster)
+{
+    uint32_t sector = fatSector + cluster / (bytesPerSector / 4);
+    if (sector != fatBufferSector)
+    {
+        if (!cache->Read(device, sector, 1, fatBuffer))
+        {
+            fatBufferSector = 0xFFFFFFFF;
+            return 0;
+        }
+        fatBufferSector = sector;
+    }
+    return ((uint32_t *)fatBuffer)[cluster % (bytesPerSector / 4)] & FAT_ENTRY_MASK;
+}
+
+uint32_t FileAllocationTable::ClusterSector(uint32_t cluster)
+{
+    return dataSector + (cluster - 2) * sectorsPerCluster;
+}
+
+FileAllocationTableChain *FileAllocationTable::Chain(uint32_t firstCluster)
+{
+    FileAllocationTableChain *chain = &chains[0];
+    for (uint32_t i = 0; i < MAX_CHAINS; i++)
+    {
+        if (chains[i].firstCluster == firstCluster)
+        {
+            chainHits++;
+            chains[i].lastUsed = ++chainClock;
+            return &chains[i];
+        }
+        if (chains[i].lastUsed < chain->lastUsed)
+        {
+            chain = &chains[i];
+        }
+    }
+    chainMisses++;
+
+    /**
+     * The least recently used chain makes way.
+     */
+    delete[] chain->extents;
+    chain->firstCluster = firstCluster;
+    chain->lastUsed = ++chainClock;
+    chain->extentCount = 0;
+    chain->clusterCount = 0;
+
+    uint32_t capacity = 4;
+    chain->extents = new FileAllocationTableExtent[capacity];
+
+    /**
+     * A chain longer than the volume has a loop.
+     */
+    uint32_t cluster = firstCluster;
+    while (cluster >= 2 && cluster < clusterCount + 2 && chain->clusterCount < clusterCount)
+    {
+        FileAllocationTableExtent *last =
+            chain->extentCount > 0 ? &chain->extents[chain->extentCount - 1] : 0;
+        if (last != 0 && last->diskCluster + last->length == cluster)
+        {
+            last->length++;
+        }
+        else
+        {
+            if (chain->extentCount == capacity)
+            {
+                capacity *= 2;
+                FileAllocationTableExtent *extents = new FileAllocationTableExtent[capacity];
+                memcpy(extents, chain->extents,
+                       chain->extentCount * sizeof(FileAllocationTableExtent));
+                delete[] chain->extents;
+                chain->extents = extents;
+            }
+            FileAllocationTableExtent *extent = &chain->extents[chain->extentCount++];
+            extent->fileCluster = chain->clusterCount;
+            extent->diskCluster = cluster;
+            extent->length = 1;
+        }
+        chain->clusterCount++;
+        cluster = NextCluster(cluster);
+    }
+    return chain;
+}
+
+bool FileAllocationTable::ReadPartial(uint32_t sector, uint32_t offset, uint32_t size,
+                                      uint8_t *buffer)
+{
+    if (sector != sectorBufferSector)
+    {
+        if (!cache->Read(device, sector, 1, sectorBuffer))
+        {
+            sectorBufferSector = 0xFFFFFFFF;
+            return false;
+        }
+        sectorBufferSector = sector;
+    }
+    memcpy(buffer, sectorBuffer + offset, size);
+    return true;
+}
+
+bool FileAllocationTable::Seek(FileAllocationTableFile *file, uint32_t position)
+{
+    if (position > file->size)
+    {
+        return false;
+    }
+    file->position = position;
+    return true;
+}
+
+int32_t FileAllocationTable::Read(FileAllocationTableFile *file, void *buffer, uint32_t size)
+{
+    if (!mounted || file->firstCluster == 0)
+    {
+        return 0;
+    }
+
+    FileAllocationTableChain *chain = Chain(file->firstCluster);
+    if (file->directory)
+    {
+        file->size = chain->clusterCount * clusterBytes;
+    }
+
+    if (file->position >= file->size)
+    {
+        return 0;
+    }
+    if (size > file->size - file->position)
+    {
+        size = file->size - file->position;
+    }
+
+    uint8_t *destination = (uint8_t *)buffer;
+    uint32_t done = 0;
+    while (done < size)
+    {
+        uint32_t clusterIndex = file->position / clusterBytes;
+        uint32_t offset = file->position % clusterBytes;
+
+        /**
+         * Finds the extent holding the cluster.
+         */
+        uint32_t low = 0;
+        uint32_t high = chain->extentCount;
+        FileAllocationTableExtent *extent = 0;
+        while (low < high)
+        {
+            uint32_t middle = (low + high) / 2;
+            FileAllocationTableExtent *candidate = &chain->extents[middle];
+            if (candidate->fileCluster + candidate->length <= clusterIndex)
+            {
+                low = middle + 1;
+            }
+            else if (candidate->fileCluster > clusterIndex)
+            {
+                high = middle;
+            }
+            else
+            {
+                extent = candidate;
+                break;
+            }
+        }
+
+        /**
+         * The chain ends before the file does.
+         */
+        if (extent == 0)
+        {
+            return -1;
+        }
+
+        /**
+         * Everything up to the end of the extent is contiguous on disk.
+         */
+        uint32_t bytes =
+            (extent->fileCluster + extent->length - clusterIndex) * clusterBytes - offset;
+        if (bytes > size - done)
+        {
+            bytes = size - done;
+        }
+        uint32_t sector =
+            ClusterSector(extent->diskCluster + clusterIndex - extent->fileCluster) +
+            offset / bytesPerSector;
+        uint32_t sectorOffset = offset % bytesPerSector;
+
+        bool success;
+        if (sectorOffset != 0 || bytes < bytesPerSector)
+        {
+            if (bytes > bytesPerSector - sectorOffset)
+            {
+                bytes = bytesPerSector - sectorOffset;
+            }
+            success = ReadPartial(sector, sectorOffset, bytes, destination);
+        }
+        else
+        {
+            uint32_t sectors = bytes / bytesPerSector;
+            bytes = sectors * bytesPerSector;
+            if (sectors >= FAT_DIRECT_READ_SECTORS)
+            {
+                success = device->Read(sector, sectors, destination);
+            }
+            else
+            {
+                success = cache->Read(device, sector, sectors, destination);
+            }
+        }
+        if (!success)
+        {
+            return -1;
+        }
+
+        destination += bytes;
+        done += bytes;
+        file->position += bytes;
+    }
+    return done;
+}
+
+void FileAllocationTable::OpenEntry(FileAllocationTableDirectoryEntry *entry,
+                                    FileAllocationTableFile *file)
+{
+    file->firstCluster = ((uint32_t)entry->clusterHigh << 16) | entry->clusterLow;
+    file->directory = (entry->attributes & FAT_ATTRIBUTE_DIRECTORY) != 0;
+    file->size = entry->size;
+    file->position = 0;
+
+    /**
+     * ".." entries in a directory right under the root point at cluster 0.
+     */
+    if (file->directory && file->firstCluster == 0)
+    {
+        file->firstCluster = rootCluster;
+    }
+}
+
+bool FileAllocationTable::ReadDirectory(FileAllocationTableFile *directory, char *name,
+                                        FileAllocationTableFile *file)
+{
+    char longName[FAT_MAX_NAME + 1];
+    bool longNameValid = false;
+    uint8_t checksum = 0;
+
+    FileAllocationTableDirectoryEntry entry;
+    while (Read(directory, &entry, sizeof(entry)) == sizeof(entry))
+    {
+        uint8_t first = (uint8_t)entry.name[0];
+        if (first == FAT_ENTRY_END)
+        {
+            /**
+             * Stays at the end, so reading again doesn't read past it.
+             */
+            directory->position -= sizeof(entry);
+            return false;
+        }
+        if (first == FAT_ENTRY_DELETED)
+        {
+            longNameValid = false;
+            continue;
+        }
+
+        if (entry.attributes == FAT_ATTRIBUTE_LONG_NAME)
+        {
+            FileAllocationTableLongNameEntry *part = (FileAllocationTableLongNameEntry *)&entry;
+            uint32_t index = (part->sequence & 0x1F) - 1;
+            if (part->sequence & FAT_LONG_NAME_LAST)
+            {
+                longNameValid = true;
+                checksum = part->checksum;
+                if ((index + 1) * FAT_LONG_NAME_CHARACTERS <= FAT_MAX_NAME)
+                {
+                    longName[(index + 1) * FAT_LONG_NAME_CHARACTERS] = '\0';
+                }
+            }
+            if (!longNameValid || part->checksum != checksum ||
+                (index + 1) * FAT_LONG_NAME_CHARACTERS > FAT_MAX_NAME)
+            {
+                longNameValid = false;
+                continue;
+            }
+
+            char *characters = longName + index * FAT_LONG_NAME_CHARACTERS;
+            CopyLongName((uint8_t *)part->name1, 5, characters);
+            CopyLongName((uint8_t *)part->name2, 6, characters + 5);
+            CopyLongName((uint8_t *)part->name3, 2, characters + 11);
+            continue;
+        }
+
+        if (entry.attributes & FAT_ATTRIBUTE_VOLUME_LABEL)
+        {
+            longNameValid = false;
+            continue;
+        }
+
+        /**
+         * A long name left behind by a system that doesn't know about them no longer matches the
+         * short name's checksum.
+         */
+        if (longNameValid && checksum == ShortNameChecksum(entry.name))
+        {
+            memcpy(name, longName, FAT_MAX_NAME + 1);
+        }
+        else
+        {
+            ShortName(&entry, name);
+        }
+        OpenEntry(&entry, file);
+        return true;
+    }
+    return false;
+}
+
+bool FileAllocationTable::Lookup(FileAllocationTableFile *directory, const char *name,
+                                 uint32_t length, FileAllocationTableFile *file)
+{
+    FileAllocationTableFile iterator = *directory;
+    iterator.position = 0;
+
+    char entryName[FAT_MAX_NAME + 1];
+    while (ReadDirectory(&iterator, entryName, file))
+    {
+        uint32_t i = 0;
+        while (i < length && entryName[i] != '\0' && ToUpper(entryName[i]) == ToUpper(name[i]))
+        {
+            i++;
+        }
+        if (i == length && entryName[i] == '\0')
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FileAllocationTable::Open(const char *path, FileAllocationTableFile *file)
+{
+    if (!mounted)
+    {
+        return false;
+    }
+
+    FileAllocationTableFile current;
+    current.firstCluster = rootCluster;
+    current.directory = true;
+    current.size = 0;
+    current.position = 0;
+
+    while (*path != '\0')
+    {
+        uint32_t length = 0;
+        while (path[length] != '\0' && path[length] != '/')
+        {
+            length++;
+        }
+        if (length > 0)
+        {
+            if (!current.directory || !Lookup(&current, path, length, &current))
+            {
+                return false;
+            }
+        }
+        path += length;
+        if (*path == '/')
+        {
+            path++;
+        }
+    }
+
+    *file = current;
+    return true;
+}
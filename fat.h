@@ -0,0 +1,267 @@
+/**
+ * @file fat.h
+ * @author rohan843
+ * @brief Contains a read-only FAT32 filesystem driver.
+ *
+ * The volume is either the whole device, or the first FAT32 partition of an MBR partition table.
+ * All metadata is read through the block cache.
+ *
+ * A file's cluster chain is walked only once: it is decoded into extents (runs of consecutive
+ * clusters), and the chains of recently opened files are kept. Reads then find their clusters with
+ * a binary search, and each read turns into as few multi-sector device requests as the extents
+ * allow.
+ */
+
+#ifndef __FAT_H
+#define __FAT_H
+
+#include "blockcache.h"
+#include "blockdevice.h"
+#include "types.h"
+
+/**
+ * @brief The start of a FAT32 volume's boot sector (the BIOS parameter block).
+ */
+struct FileAllocationTableBootSector
+{
+    uint8_t jump[3];
+    char oemName[8];
+    uint16_t bytesPerSector;
+    uint8_t sectorsPerCluster;
+    uint16_t reservedSectors;
+    uint8_t fatCount;
+    uint16_t rootEntryCount;
+    uint16_t totalSectors16;
+    uint8_t mediaType;
+    uint16_t sectorsPerFat16;
+    uint16_t sectorsPerTrack;
+    uint16_t headCount;
+    uint32_t hiddenSectors;
+    uint32_t totalSectors32;
+
+    uint32_t sectorsPerFat32;
+    uint16_t flags;
+    uint16_t version;
+    uint32_t rootCluster;
+    uint16_t infoSector;
+    uint16_t backupBootSector;
+    uint8_t reserved[12];
+    uint8_t driveNumber;
+    uint8_t reserved1;
+    uint8_t bootSignature;
+    uint32_t volumeId;
+    char volumeLabel[11];
+    char fileSystemType[8];
+} __attribute__((packed));
+
+/**
+ * @brief A directory entry, as stored on disk.
+ */
+struct FileAllocationTableDirectoryEntry
+{
+    char name[11];
+    uint8_t attributes;
+    uint8_t caseFlags;
+    uint8_t createdTenths;
+    uint16_t createdTime;
+    uint16_t createdDate;
+    uint16_t accessedDate;
+    uint16_t clusterHigh;
+    uint16_t modifiedTime;
+    uint16_t modifiedDate;
+    uint16_t clusterLow;
+    uint32_t size;
+} __attribute__((packed));
+
+/**
+ * @brief A long file name entry. Each holds 13 UCS-2 characters of the name, and they come before
+ * the entry they name, last part first.
+ */
+struct FileAllocationTableLongNameEntry
+{
+    uint8_t sequence;
+    uint16_t name1[5];
+    uint8_t attributes;
+    uint8_t type;
+    uint8_t checksum;
+    uint16_t name2[6];
+    uint16_t cluster;
+    uint16_t name3[2];
+} __attribute__((packed));
+
+/**
+ * @brief Consecutive clusters of a file.
+ */
+struct FileAllocationTableExtent
+{
+    /**
+     * The index of the first cluster within the file, and where it is on disk.
+     */
+    uint32_t fileCluster;
+    uint32_t diskCluster;
+    uint32_t length;
+};
+
+/**
+ * @brief A decoded cluster chain.
+ */
+struct FileAllocationTableChain
+{
+    /**
+     * 0 for an unused slot.
+     */
+    uint32_t firstCluster;
+
+    /**
+     * Sorted by `fileCluster`.
+     */
+    FileAllocationTableExtent *extents;
+    uint32_t extentCount;
+    uint32_t clusterCount;
+
+    uint32_t lastUsed;
+};
+
+/**
+ * @brief An open file or directory.
+ */
+struct FileAllocationTableFile
+{
+    /**
+     * 0 for an empty file.
+     */
+    uint32_t firstCluster;
+
+    /**
+     * For directories, the size of the whole chain, set once the directory is first read.
+     */
+    uint32_t size;
+    bool directory;
+
+    uint32_t position;
+};
+
+class FileAllocationTable
+{
+  protected:
+    BlockCache *cache;
+    BlockDevice *device;
+    bool mounted;
+
+    uint32_t bytesPerSector;
+    uint32_t sectorsPerCluster;
+    uint32_t clusterBytes;
+    uint32_t fatSector;
+    uint32_t dataSector;
+    uint32_t clusterCount;
+    uint32_t rootCluster;
+
+    /**
+     * The last FAT sector read, as walking a chain reads the same one many times in a row.
+     */
+    uint8_t *fatBuffer;
+    uint32_t fatBufferSector;
+
+    /**
+     * The last data sector read partially, e.g., while a directory is read entry by entry.
+     */
+    uint8_t *sectorBuffer;
+    uint32_t sectorBufferSector;
+
+    static const uint32_t MAX_CHAINS = 32;
+    FileAllocationTableChain chains[MAX_CHAINS];
+    uint32_t chainClock;
+
+    uint32_t chainHits;
+    uint32_t chainMisses;
+
+    /**
+     * @brief Returns the FAT entry of a cluster (the next cluster of its chain), or 0 if the FAT
+     * couldn't be read.
+     */
+    uint32_t NextCluster(uint32_t cluster);
+
+    uint32_t ClusterSector(uint32_t cluster);
+
+    /**
+     * @brief Returns the decoded chain starting at a cluster, decoding it if it isn't kept.
+     */
+    FileAllocationTableChain *Chain(uint32_t firstCluster);
+
+    /**
+     * @brief Reads part of a sector through `sectorBuffer`.
+     */
+    bool ReadPartial(uint32_t sector, uint32_t offset, uint32_t size, uint8_t *buffer);
+
+    /**
+     * @brief Fills an open file from its directory entry.
+     */
+    void OpenEntry(FileAllocationTableDirectoryEntry *entry, FileAllocationTableFile *file);
+
+    /**
+     * @brief Finds a name in a directory.
+     *
+     * @param name The name. Need not be null terminated.
+     * @param length The length of the name.
+     */
+    bool Lookup(FileAllocationTableFile *directory, const char *name, uint32_t length,
+                FileAllocationTableFile *file);
+
+  public:
+    static FileAllocationTable *activeFileAllocationTable;
+
+    /**
+     * @brief Finds a FAT32 volume on a device.
+     *
+     * @param firstSector Set to the first sector of the volume.
+     * @return Whether the device (or its first FAT32 partition) holds a FAT32 volume.
+     */
+    static bool FindVolume(BlockCache *cache, BlockDevice *device, uint32_t *firstSector);
+
+    /**
+     * @param firstSector The first sector of the volume, as found by `FindVolume`.
+     */
+    FileAllocationTable(BlockCache *cache, BlockDevice *device, uint32_t firstSector);
+    ~FileAllocationTable();
+
+    bool Mounted();
+    BlockDevice *Device();
+
+    /**
+     * @brief Opens a file or directory by path, e.g., "data/large.bin". Names are matched
+     * regardless of case, against both long and short (8.3) names.
+     *
+     * @return false if the path doesn't exist.
+     */
+    bool Open(const char *path, FileAllocationTableFile *file);
+
+    /**
+     * @brief Reads from the current position of a file, moving it forward.
+     *
+     * @return The number of bytes read (0 at the end of the file), or -1 if the device failed.
+     */
+    int32_t Read(FileAllocationTableFile *file, void *buffer, uint32_t size);
+
+    /**
+     * @return false if the position is past the end of the file.
+     */
+    bool Seek(FileAllocationTableFile *file, uint32_t position);
+
+    /**
+     * @brief Reads the next entry of a directory, skipping deleted entries and volume labels.
+     *
+     * @param name Set to the entry's name (the long name, if it has one). Must hold 256 bytes.
+     * @param file Set to the entry, as if opened.
+     * @return false at the end of the directory.
+     */
+    bool ReadDirectory(FileAllocationTableFile *directory, char *name,
+                       FileAllocationTableFile *file);
+
+    /**
+     * @brief The number of times a chain was found decoded, and had to be decoded.
+     */
+    uint32_t ChainHits();
+    uint32_t ChainMisses();
+};
+
+#endif
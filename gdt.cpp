@@ -1,9 +1,35 @@
 #include "gdt.h"
+#include "memorymanagement.h"
 
 GlobalDescriptorTable::GlobalDescriptorTable()
     : nullSegmentSelector(0, 0, 0), unusedSegmentSelector(0, 0, 0),
-      codeSegmentSelector(0, 64 * 1024 * 1024, 0x9A), dataSegmentSelector(0, 64 * 1024 * 1024, 0x92)
+      codeSegmentSelector(0, 0xFFFFFFFF, 0x9A), dataSegmentSelector(0, 0xFFFFFFFF, 0x92),
+      userCodeSegmentSelector(0, 0xFFFFFFFF, 0xFA), userDataSegmentSelector(0, 0xFFFFFFFF, 0xF2),
+      taskStateSegmentSelector((uint32_t)&taskStateSegment, sizeof(TaskStateSegment) - 1, 0x89),
+      processorDataSegmentSelector((uint32_t)&processorData, sizeof(ProcessorData) - 1, 0x92)
 {
+    /**
+     * All the code and data segments are flat (base 0, 4 GiB). SYSENTER and SYSEXIT load CS and SS
+     * with exactly such segments without looking at the GDT, so any other layout would make the
+     * two system call paths disagree.
+     */
+
+    /**
+     * Only `ss0` and `esp0` are used. An I/O map base beyond the limit means there is no I/O
+     * permission bitmap, so ring 3 code can't touch any port.
+     */
+    uint8_t *tss = (uint8_t *)&taskStateSegment;
+    for (uint32_t i = 0; i < sizeof(TaskStateSegment); i++)
+    {
+        tss[i] = 0;
+    }
+    taskStateSegment.ss0 = DataSegmentSelector();
+    taskStateSegment.ioMapBase = sizeof(TaskStateSegment);
+
+    memset(&processorData, 0, sizeof(ProcessorData));
+    processorData.self = &processorData;
+    processorData.gdt = this;
+
     /**
      * @brief A 6-byte struct containing the byte vector to be loaded into the GDTR.
      */
@@ -15,13 +41,37 @@ GlobalDescriptorTable::GlobalDescriptorTable()
 
     GDTPointer ptr;
 
-    ptr.limit = sizeof(GlobalDescriptorTable) - 1;
+    ptr.limit = (uint8_t *)&taskStateSegment - (uint8_t *)this - 1;
     ptr.base = (uint32_t)this;
 
     /**
      * @brief Loads the contents of above GDT Pointer into the GDTR.
      */
     asm volatile("lgdt %0" : : "m"(ptr));
+
+    /**
+     * The CPU keeps using cached copies of the old descriptors until the segment registers are
+     * reloaded. CS can only be reloaded by a far jump.
+     */
+    asm volatile("movw %0, %%ds\n"
+                 "movw %0, %%es\n"
+                 "movw %0, %%fs\n"
+                 "movw %0, %%ss\n"
+                 "movw %2, %%gs\n"
+                 "pushl %1\n"
+                 "pushl $1f\n"
+                 "lret\n"
+                 "1:"
+                 :
+                 : "r"(DataSegmentSelector()), "r"((uint32_t)CodeSegmentSelector()),
+                   "r"(ProcessorDataSegmentSelector())
+                 : "memory");
+
+    /**
+     * Loads the task register. This marks the TSS descriptor busy, so it must be done only once per
+     * table.
+     */
+    asm volatile("ltr %0" : : "r"(TaskStateSegmentSelector()));
 }
 
 GlobalDescriptorTable::~GlobalDescriptorTable() {}
@@ -36,6 +86,28 @@ uint16_t GlobalDescriptorTable::CodeSegmentSelector()
     return (uint8_t *)&codeSegmentSelector - (uint8_t *)this;
 }
 
+uint16_t GlobalDescriptorTable::UserDataSegmentSelector()
+{
+    return (uint8_t *)&userDataSegmentSelector - (uint8_t *)this;
+}
+
+uint16_t GlobalDescriptorTable::UserCodeSegmentSelector()
+{
+    return (uint8_t *)&userCodeSegmentSelector - (uint8_t *)this;
+}
+
+uint16_t GlobalDescriptorTable::TaskStateSegmentSelector()
+{
+    return (uint8_t *)&taskStateSegmentSelector - (uint8_t *)this;
+}
+
+uint16_t GlobalDescriptorTable::ProcessorDataSegmentSelector()
+{
+    return (uint8_t *)&processorDataSegmentSelector - (uint8_t *)this;
+}
+
+void GlobalDescriptorTable::SetKernelStack(uint32_t esp0) { taskStateSegment.esp0 = esp0; }
+
 GlobalDescriptorTable::SegmentDescriptor::SegmentDescriptor(uint32_t base, uint32_t limit,
                                                             uint8_t type)
 {
@@ -124,6 +196,15 @@ GlobalDescriptorTable::SegmentDescriptor::SegmentDescriptor(uint32_t base, uint3
      * Setting the type flags into the descriptor.
      */
     target[5] = type;
+
+    /**
+     * System descriptors (the S bit, bit 4 of type, is 0), such as the TSS, have no D/B flag. That
+     * bit must be left 0 for them.
+     */
+    if (!(type & 0x10))
+    {
+        target[6] &= ~0x40;
+    }
 }
 
 uint32_t GlobalDescriptorTable::SegmentDescriptor::Base()
@@ -1,12 +1,51 @@
 #ifndef __GDT_H
 #define __GDT_H
 
+#include "percpu.h"
 #include "types.h"
 
 /*
 This file contains code related to the global descriptor table.
 */
 
+/**
+ * @brief The 32 - bit task state segment.
+ *
+ * We don't use hardware task switching, so the only fields the CPU reads from here are `esp0` and
+ * `ss0`: the stack it switches to when an interrupt or system call arrives while ring 3 code is
+ * running.
+ */
+struct TaskStateSegment
+{
+    uint32_t previousTask;
+    uint32_t esp0;
+    uint32_t ss0;
+    uint32_t esp1;
+    uint32_t ss1;
+    uint32_t esp2;
+    uint32_t ss2;
+    uint32_t cr3;
+    uint32_t eip;
+    uint32_t eflags;
+    uint32_t eax;
+    uint32_t ecx;
+    uint32_t edx;
+    uint32_t ebx;
+    uint32_t esp;
+    uint32_t ebp;
+    uint32_t esi;
+    uint32_t edi;
+    uint32_t es;
+    uint32_t cs;
+    uint32_t ss;
+    uint32_t ds;
+    uint32_t fs;
+    uint32_t gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t ioMapBase;
+} __attribute__((packed));
+
 class GlobalDescriptorTable
 {
   public:
@@ -50,6 +89,31 @@ class GlobalDescriptorTable
     SegmentDescriptor codeSegmentSelector;
     SegmentDescriptor dataSegmentSelector;
 
+    /**
+     * The ring 3 segments. SYSEXIT expects these right after the kernel code and data segments,
+     * (i.e., at kernel code + 16 and kernel code + 24), so their order must not change.
+     */
+    SegmentDescriptor userCodeSegmentSelector;
+    SegmentDescriptor userDataSegmentSelector;
+    SegmentDescriptor taskStateSegmentSelector;
+
+    /**
+     * The segment GS holds in the kernel. It covers `processorData` only.
+     */
+    SegmentDescriptor processorDataSegmentSelector;
+
+    /**
+     * The TSS referred to by `taskStateSegmentSelector`. It isn't a part of the table itself, and
+     * is excluded from the limit loaded into the GDTR.
+     */
+    TaskStateSegment taskStateSegment;
+
+    /**
+     * The data of the processor the table belongs to (see percpu.h). Like the TSS, every processor
+     * has its own.
+     */
+    ProcessorData processorData;
+
   public:
     GlobalDescriptorTable();
     ~GlobalDescriptorTable();
@@ -67,6 +131,36 @@ class GlobalDescriptorTable
      * at.
      */
     uint16_t DataSegmentSelector();
+
+    /**
+     * @brief Returns the offset of the ring 3 code segment entry in the GDT. The requested
+     * priveledge level (3) still has to be OR-ed in before loading it into CS.
+     */
+    uint16_t UserCodeSegmentSelector();
+
+    /**
+     * @brief Returns the offset of the ring 3 data segment entry in the GDT. The requested
+     * priveledge level (3) still has to be OR-ed in before loading it into a segment register.
+     */
+    uint16_t UserDataSegmentSelector();
+
+    /**
+     * @brief Returns the offset of the task state segment entry in the GDT.
+     */
+    uint16_t TaskStateSegmentSelector();
+
+    /**
+     * @brief Returns the offset of the processor data segment entry in the GDT. It is the same in
+     * every processor's table, so a task's saved GS stays valid on any processor.
+     */
+    uint16_t ProcessorDataSegmentSelector();
+
+    /**
+     * @brief Sets the stack the CPU switches to when ring 3 code gets interrupted.
+     *
+     * @param esp0 The top of the kernel stack.
+     */
+    void SetKernelStack(uint32_t esp0);
 } __attribute__((packed));
 
 #endif
\ No newline at end of file
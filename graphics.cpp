@@ -0,0 +1,452 @@
+#include "graphics.h"
+#include "multitasking.h"
+#include "paging.h"
+#include "stdio.h"
+
+/**
+ * The framebuffer type of RGB (direct color) modes, in the multiboot information.
+ */
+const uint8_t MULTIBOOT_FRAMEBUFFER_RGB = 1;
+
+/**
+ * Control register bits SSE needs: no FPU emulation, `wait` checks the task switched flag, and
+ * the OS saves the SSE state (`fxsave`) and handles SIMD exceptions.
+ */
+const uint32_t CR0_EMULATION = 1 << 2;
+const uint32_t CR0_MONITOR_COPROCESSOR = 1 << 1;
+const uint32_t CR4_OSFXSR = 1 << 9;
+const uint32_t CR4_OSXMMEXCPT = 1 << 10;
+
+/**
+ * CPUID leaf 1 EDX bits.
+ */
+const uint32_t CPUID_FXSR = 1 << 24;
+const uint32_t CPUID_SSE2 = 1 << 26;
+
+static LockClass graphicsLockClass("graphics");
+
+/**
+ * @brief The 32 - bit fill: `rep stosl`.
+ */
+static void FillRow32(uint32_t *destination, uint32_t color, uint32_t count)
+{
+    asm volatile("cld\n"
+                 "rep stosl"
+                 : "+D"(destination), "+c"(count)
+                 : "a"(color)
+                 : "memory", "cc");
+}
+
+/**
+ * @brief The SSE2 fill: the color in all four lanes of XMM0, stored 64 bytes per iteration to a
+ * 16 byte aligned destination.
+ *
+ * The kernel is built without SSE, so the compiler never keeps anything in the XMM registers and
+ * they need no clobbers. Task switches save them (see `TaskManager::SwitchTo`) but interrupt
+ * handlers don't, so this runs in tasks only, never in an interrupt handler.
+ */
+static void FillRowSSE2(uint32_t *destination, uint32_t color, uint32_t count)
+{
+    while (count != 0 && ((uint32_t)destination & 15) != 0)
+    {
+        *destination++ = color;
+        count--;
+    }
+
+    uint32_t blocks = count / 16;
+    if (blocks != 0)
+    {
+        asm volatile("movd %2, %%xmm0\n"
+                     "pshufd $0, %%xmm0, %%xmm0\n"
+                     "1:\n"
+                     "movdqa %%xmm0, (%0)\n"
+                     "movdqa %%xmm0, 16(%0)\n"
+                     "movdqa %%xmm0, 32(%0)\n"
+                     "movdqa %%xmm0, 48(%0)\n"
+                     "addl $64, %0\n"
+                     "decl %1\n"
+                     "jnz 1b"
+                     : "+r"(destination), "+r"(blocks)
+                     : "r"(color)
+                     : "memory", "cc");
+    }
+
+    for (count %= 16; count != 0; count--)
+    {
+        *destination++ = color;
+    }
+}
+
+/**
+ * @brief The 32 - bit copy: `rep movsl`.
+ */
+static void CopyRow32(void *destination, const void *source, uint32_t count)
+{
+    asm volatile("cld\n"
+                 "rep movsl"
+                 : "+D"(destination), "+S"(source), "+c"(count)
+                 :
+                 : "memory", "cc");
+}
+
+/**
+ * @brief The SSE2 copy: unaligned 16 byte loads, and aligned stores, 64 bytes per iteration. See
+ * `FillRowSSE2` about the XMM registers.
+ */
+static void CopyRowSSE2(void *destination, const void *source, uint32_t count)
+{
+    uint32_t *to = (uint32_t *)destination;
+    const uint32_t *from = (const uint32_t *)source;
+    while (count != 0 && ((uint32_t)to & 15) != 0)
+    {
+        *to++ = *from++;
+        count--;
+    }
+
+    uint32_t blocks = count / 16;
+    if (blocks != 0)
+    {
+        asm volatile("1:\n"
+                     "movdqu (%1), %%xmm0\n"
+                     "movdqu 16(%1), %%xmm1\n"
+                     "movdqu 32(%1), %%xmm2\n"
+                     "movdqu 48(%1), %%xmm3\n"
+                     "movdqa %%xmm0, (%0)\n"
+                     "movdqa %%xmm1, 16(%0)\n"
+                     "movdqa %%xmm2, 32(%0)\n"
+                     "movdqa %%xmm3, 48(%0)\n"
+                     "addl $64, %1\n"
+                     "addl $64, %0\n"
+                     "decl %2\n"
+                     "jnz 1b"
+                     : "+r"(to), "+r"(from), "+r"(blocks)
+                     :
+                     : "memory", "cc");
+    }
+
+    for (count %= 16; count != 0; count--)
+    {
+        *to++ = *from++;
+    }
+}
+
+bool RectanglesOverlap(const Rectangle &a, const Rectangle &b)
+{
+    return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height &&
+           b.y < a.y + a.height;
+}
+
+Rectangle RectangleUnion(const Rectangle &a, const Rectangle &b)
+{
+    int32_t left = a.x < b.x ? a.x : b.x;
+    int32_t top = a.y < b.y ? a.y : b.y;
+    int32_t right = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+    int32_t bottom = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+    Rectangle rectangle = {left, top, right - left, bottom - top};
+    return rectangle;
+}
+
+Rectangle RectangleIntersection(const Rectangle &a, const Rectangle &b)
+{
+    int32_t left = a.x > b.x ? a.x : b.x;
+    int32_t top = a.y > b.y ? a.y : b.y;
+    int32_t right = a.x + a.width < b.x + b.width ? a.x + a.width : b.x + b.width;
+    int32_t bottom = a.y + a.height < b.y + b.height ? a.y + a.height : b.y + b.height;
+    Rectangle rectangle = {left, top, right > left ? right - left : 0,
+                           bottom > top ? bottom - top : 0};
+    return rectangle;
+}
+
+/** RectangleList Class */
+
+RectangleList::RectangleList() { count = 0; }
+
+RectangleList::~RectangleList() {}
+
+void RectangleList::Add(Rectangle rectangle)
+{
+    /**
+     * Merging two rectangles can make the result overlap a third, so this goes on until it
+     * overlaps none.
+     */
+    for (uint32_t i = 0; i < count;)
+    {
+        if (RectanglesOverlap(rectangles[i], rectangle))
+        {
+            rectangle = RectangleUnion(rectangles[i], rectangle);
+            rectangles[i] = rectangles[--count];
+            i = 0;
+            continue;
+        }
+        i++;
+    }
+
+    if (count == CAPACITY)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            rectangle = RectangleUnion(rectangles[i], rectangle);
+        }
+        count = 0;
+    }
+    rectangles[count++] = rectangle;
+}
+
+void RectangleList::Clear() { count = 0; }
+
+uint32_t RectangleList::Count() { return count; }
+
+Rectangle RectangleList::Get(uint32_t index) { return rectangles[index]; }
+
+bool RectangleList::Intersects(Rectangle rectangle)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (RectanglesOverlap(rectangles[i], rectangle))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** GraphicsDevice Class */
+
+GraphicsDevice *GraphicsDevice::activeGraphicsDevice = 0;
+
+bool GraphicsDevice::sse2Enabled = false;
+
+GraphicsDevice::GraphicsDevice(uint32_t framebuffer, uint32_t width, uint32_t height,
+                               uint32_t pitch)
+    : lock(&graphicsLockClass)
+{
+    this->framebuffer = (uint8_t *)framebuffer;
+    this->pitch = pitch;
+    this->width = width;
+    this->height = height;
+    useSSE2 = sse2Enabled;
+
+    backBuffer = new uint32_t[width * height];
+    if (backBuffer == 0)
+    {
+        printf("graphics: no memory for the back buffer\n");
+        this->width = 0;
+        this->height = 0;
+        return;
+    }
+    memset(backBuffer, 0, width * height * 4);
+    activeGraphicsDevice = this;
+}
+
+GraphicsDevice::~GraphicsDevice()
+{
+    if (activeGraphicsDevice == this)
+    {
+        activeGraphicsDevice = 0;
+    }
+    if (backBuffer != 0)
+    {
+        delete[] backBuffer;
+    }
+}
+
+GraphicsDevice *GraphicsDevice::FromMultiboot(const MultibootInfo *multibootInfo)
+{
+    if (!(multibootInfo->flags & MULTIBOOT_INFO_FRAMEBUFFER) ||
+        multibootInfo->framebufferType != MULTIBOOT_FRAMEBUFFER_RGB)
+    {
+        return 0;
+    }
+
+    if (multibootInfo->framebufferBitsPerPixel != 32 || multibootInfo->redPosition != 16 ||
+        multibootInfo->greenPosition != 8 || multibootInfo->bluePosition != 0)
+    {
+        printf("graphics: unsupported pixel format\n");
+        return 0;
+    }
+
+    /**
+     * The framebuffer must be where the kernel's page directory maps the physical addresses as
+     * they are: below user space, or in the (uncached) top of the address space.
+     */
+    uint64_t start = multibootInfo->framebufferAddress;
+    uint64_t end =
+        start + (uint64_t)multibootInfo->framebufferPitch * multibootInfo->framebufferHeight;
+    if (end > 0x100000000ULL || (end > USER_SPACE_START && start < USER_SPACE_END))
+    {
+        printf("graphics: the framebuffer is out of reach\n");
+        return 0;
+    }
+
+    GraphicsDevice *device = new GraphicsDevice((uint32_t)start, multibootInfo->framebufferWidth,
+                                                multibootInfo->framebufferHeight,
+                                                multibootInfo->framebufferPitch);
+    printf("graphics: ");
+    printfDec(device->Width());
+    printf("x");
+    printfDec(device->Height());
+    printf(device->SSE2() ? " framebuffer, SSE2\n" : " framebuffer\n");
+    return device;
+}
+
+void GraphicsDevice::EnableSSE2()
+{
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    if (!(edx & CPUID_SSE2) || !(edx & CPUID_FXSR))
+    {
+        return;
+    }
+
+    uint32_t cr0, cr4;
+    asm volatile("movl %%cr0, %0" : "=r"(cr0));
+    cr0 = (cr0 & ~CR0_EMULATION) | CR0_MONITOR_COPROCESSOR;
+    asm volatile("movl %0, %%cr0" : : "r"(cr0));
+    asm volatile("movl %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    asm volatile("movl %0, %%cr4" : : "r"(cr4));
+
+    /**
+     * Tasks drawing at the same time would see each other's SSE registers otherwise.
+     */
+    TaskManager::EnableFPUStateSwitching();
+    sse2Enabled = true;
+}
+
+uint32_t GraphicsDevice::Width() { return width; }
+
+uint32_t GraphicsDevice::Height() { return height; }
+
+void GraphicsDevice::SetSSE2(bool enabled) { useSSE2 = enabled && sse2Enabled; }
+
+bool GraphicsDevice::SSE2() { return useSSE2; }
+
+bool GraphicsDevice::Clip(Rectangle *rectangle)
+{
+    if (rectangle->x < 0)
+    {
+        rectangle->width += rectangle->x;
+        rectangle->x = 0;
+    }
+    if (rectangle->y < 0)
+    {
+        rectangle->height += rectangle->y;
+        rectangle->y = 0;
+    }
+    if (rectangle->x + rectangle->width > (int32_t)width)
+    {
+        rectangle->width = (int32_t)width - rectangle->x;
+    }
+    if (rectangle->y + rectangle->height > (int32_t)height)
+    {
+        rectangle->height = (int32_t)height - rectangle->y;
+    }
+    return rectangle->width > 0 && rectangle->height > 0;
+}
+
+void GraphicsDevice::FillRow(uint32_t *destination, uint32_t color, uint32_t count)
+{
+    if (useSSE2)
+    {
+        FillRowSSE2(destination, color, count);
+    }
+    else
+    {
+        FillRow32(destination, color, count);
+    }
+}
+
+void GraphicsDevice::CopyRow(void *destination, const void *source, uint32_t count)
+{
+    if (useSSE2)
+    {
+        CopyRowSSE2(destination, source, count);
+    }
+    else
+    {
+        CopyRow32(destination, source, count);
+    }
+}
+
+void GraphicsDevice::Fill(Rectangle rectangle, uint32_t color)
+{
+    if (!Clip(&rectangle))
+    {
+        return;
+    }
+
+    SpinlockGuard guard(&lock);
+    for (int32_t y = rectangle.y; y < rectangle.y + rectangle.height; y++)
+    {
+        FillRow(backBuffer + y * width + rectangle.x, color, rectangle.width);
+    }
+    dirty.Add(rectangle);
+}
+
+void GraphicsDevice::Blit(int32_t x, int32_t y, const uint32_t *pixels, int32_t width,
+                          int32_t height, uint32_t stride)
+{
+    Rectangle rectangle = {x, y, width, height};
+    if (!Clip(&rectangle))
+    {
+        return;
+    }
+    pixels += (rectangle.y - y) * stride + (rectangle.x - x);
+
+    SpinlockGuard guard(&lock);
+    for (int32_t row = 0; row < rectangle.height; row++)
+    {
+        CopyRow(backBuffer + (rectangle.y + row) * this->width + rectangle.x,
+                pixels + row * stride, rectangle.width);
+    }
+    dirty.Add(rectangle);
+}
+
+void GraphicsDevice::Read(int32_t x, int32_t y, uint32_t *pixels, int32_t width, int32_t height,
+                          uint32_t stride)
+{
+    Rectangle rectangle = {x, y, width, height};
+    if (!Clip(&rectangle))
+    {
+        return;
+    }
+    pixels += (rectangle.y - y) * stride + (rectangle.x - x);
+
+    SpinlockGuard guard(&lock);
+    for (int32_t row = 0; row < rectangle.height; row++)
+    {
+        CopyRow(pixels + row * stride,
+                backBuffer + (rectangle.y + row) * this->width + rectangle.x, rectangle.width);
+    }
+}
+
+uint32_t GraphicsDevice::Present()
+{
+    RectangleList rectangles;
+    {
+        SpinlockGuard guard(&lock);
+        rectangles = dirty;
+        dirty.Clear();
+    }
+
+    uint32_t pixels = 0;
+    for (uint32_t i = 0; i < rectangles.Count(); i++)
+    {
+        Rectangle rectangle = rectangles.Get(i);
+        for (int32_t y = rectangle.y; y < rectangle.y + rectangle.height; y++)
+        {
+            CopyRow(framebuffer + y * pitch + rectangle.x * 4,
+                    backBuffer + y * width + rectangle.x, rectangle.width);
+        }
+        pixels += rectangle.width * rectangle.height;
+    }
+    return pixels;
+}
+
+void GraphicsDevice::Invalidate()
+{
+    Rectangle screen = {0, 0, (int32_t)width, (int32_t)height};
+    SpinlockGuard guard(&lock);
+    dirty.Clear();
+    dirty.Add(screen);
+}
@@ -0,0 +1,180 @@
+/**
+ * @file graphics.h
+ * @author rohan843
+ * @brief Contains the graphics device, which draws into an off-screen back buffer and copies the
+ * parts that changed to the linear framebuffer.
+ *
+ * The bootloader sets a graphics mode when the multiboot header asks for one (see loader.s), and
+ * reports the framebuffer in the multiboot information. Only 32 - bit pixels (0x00RRGGBB) are
+ * supported.
+ *
+ * All drawing goes to the back buffer, which is in normal (cached) memory, and marks the area it
+ * changed as dirty. `Present` then copies just the dirty rectangles to the framebuffer, which is
+ * uncached, so every write to it is a bus transaction. The fills and copies write 16 bytes at a
+ * time with SSE2 when the CPU has it, and 4 bytes at a time (`rep stosl`/`rep movsl`) otherwise.
+ *
+ * The SSE2 code uses the XMM registers, which task switches save and restore once SSE2 is enabled
+ * (see `TaskManager::EnableFPUStateSwitching`), so drawing can be preempted like any other code.
+ * Interrupt handlers don't save them, so drawing is only done in tasks.
+ */
+
+#ifndef __GRAPHICS_H
+#define __GRAPHICS_H
+
+#include "multiboot.h"
+#include "spinlock.h"
+#include "types.h"
+
+struct Rectangle
+{
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+};
+
+bool RectanglesOverlap(const Rectangle &a, const Rectangle &b);
+
+/**
+ * @brief The smallest rectangle holding both.
+ */
+Rectangle RectangleUnion(const Rectangle &a, const Rectangle &b);
+
+/**
+ * @brief The part the rectangles share (with no width or height if they don't overlap).
+ */
+Rectangle RectangleIntersection(const Rectangle &a, const Rectangle &b);
+
+/**
+ * @brief A set of areas (e.g., the ones that changed), as rectangles that don't overlap.
+ */
+class RectangleList
+{
+  protected:
+    static const uint32_t CAPACITY = 16;
+
+    Rectangle rectangles[CAPACITY];
+    uint32_t count;
+
+  public:
+    RectangleList();
+    ~RectangleList();
+
+    /**
+     * @brief Adds an area, merging it with the rectangles it overlaps into the rectangle holding
+     * them all. When the list is full, everything becomes one rectangle.
+     */
+    void Add(Rectangle rectangle);
+    void Clear();
+
+    uint32_t Count();
+    Rectangle Get(uint32_t index);
+
+    /**
+     * @brief Tells whether any of the rectangles overlaps the given one.
+     */
+    bool Intersects(Rectangle rectangle);
+};
+
+class GraphicsDevice
+{
+  protected:
+    /**
+     * The framebuffer, and its bytes per line (which may be more than 4 bytes per pixel).
+     */
+    uint8_t *framebuffer;
+    uint32_t pitch;
+
+    uint32_t width;
+    uint32_t height;
+
+    /**
+     * The back buffer, `width` pixels per line.
+     */
+    uint32_t *backBuffer;
+
+    /**
+     * The areas changed since the last `Present`.
+     */
+    RectangleList dirty;
+
+    bool useSSE2;
+    Spinlock lock;
+
+    static bool sse2Enabled;
+
+    /**
+     * @brief Clips a rectangle to the screen.
+     *
+     * @return false if nothing of it is on the screen.
+     */
+    bool Clip(Rectangle *rectangle);
+
+    void FillRow(uint32_t *destination, uint32_t color, uint32_t count);
+    void CopyRow(void *destination, const void *source, uint32_t count);
+
+  public:
+    static GraphicsDevice *activeGraphicsDevice;
+
+    /**
+     * @param framebuffer The address of the framebuffer, which must be mapped.
+     * @param pitch The bytes per line of the framebuffer.
+     */
+    GraphicsDevice(uint32_t framebuffer, uint32_t width, uint32_t height, uint32_t pitch);
+    ~GraphicsDevice();
+
+    /**
+     * @brief Creates the graphics device for the framebuffer the bootloader set up.
+     *
+     * @return 0 if there is none (e.g., the bootloader kept the text mode), or it can't be used.
+     */
+    static GraphicsDevice *FromMultiboot(const MultibootInfo *multibootInfo);
+
+    /**
+     * @brief Lets the kernel use SSE2, if the CPU has it. Must be called before the other
+     * processors start, as they take their CR0 and CR4 from this one. Task switches save the SSE
+     * registers from then on.
+     */
+    static void EnableSSE2();
+
+    uint32_t Width();
+    uint32_t Height();
+
+    /**
+     * @brief Chooses between the SSE2 and the 32 - bit fills and copies (SSE2 only if enabled).
+     */
+    void SetSSE2(bool enabled);
+    bool SSE2();
+
+    void Fill(Rectangle rectangle, uint32_t color);
+
+    /**
+     * @brief Copies pixels into the back buffer.
+     *
+     * @param pixels The source, `stride` pixels per line.
+     */
+    void Blit(int32_t x, int32_t y, const uint32_t *pixels, int32_t width, int32_t height,
+              uint32_t stride);
+
+    /**
+     * @brief Copies pixels out of the back buffer (the parts on the screen).
+     *
+     * @param pixels The destination, `stride` pixels per line.
+     */
+    void Read(int32_t x, int32_t y, uint32_t *pixels, int32_t width, int32_t height,
+              uint32_t stride);
+
+    /**
+     * @brief Copies the dirty rectangles to the framebuffer.
+     *
+     * @return The number of pixels copied.
+     */
+    uint32_t Present();
+
+    /**
+     * @brief Marks the whole screen dirty, e.g., to redraw it after something else drew on it.
+     */
+    void Invalidate();
+};
+
+#endif
@@ -0,0 +1,384 @@
+#include "initrd.h"
+#include "lz4.h"
+
+/**
+ * Everything in a tar archive comes in 512 byte blocks.
+ */
+const uint32_t TAR_BLOCK_SIZE = 512;
+
+/**
+ * @brief The header block in front of each archive member. Numbers are octal ASCII.
+ */
+struct TarHeader
+{
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char type;
+    char linkName[100];
+    char magic[6];
+    char version[2];
+    char userName[32];
+    char groupName[32];
+    char deviceMajor[8];
+    char deviceMinor[8];
+    char prefix[155];
+    char padding[12];
+} __attribute__((packed));
+
+/**
+ * Member types of regular files. (Old archives use '\0'.)
+ */
+const char TAR_TYPE_FILE = '0';
+const char TAR_TYPE_FILE_OLD = '\0';
+
+static uint32_t ParseOctal(const char *str, uint32_t length)
+{
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < length && str[i] >= '0' && str[i] <= '7'; i++)
+    {
+        value = value * 8 + (str[i] - '0');
+    }
+    return value;
+}
+
+/**
+ * @brief Skips the leading "/" and "./" of a path, which don't take part in lookups.
+ */
+static const char *SkipRoot(const char *path)
+{
+    while (true)
+    {
+        if (path[0] == '/')
+        {
+            path++;
+        }
+        else if (path[0] == '.' && path[1] == '/')
+        {
+            path += 2;
+        }
+        else
+        {
+            return path;
+        }
+    }
+}
+
+/**
+ * @brief The 32 - bit FNV-1a hash of a string.
+ */
+static uint32_t HashPath(const char *path)
+{
+    uint32_t hash = 2166136261u;
+    for (; *path != '\0'; path++)
+    {
+        hash ^= (uint8_t)*path;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool PathsEqual(const char *a, const char *b)
+{
+    while (*a != '\0' && *a == *b)
+    {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+/**
+ * @brief Copies up to `length` characters of a field that may not be '\0' terminated.
+ *
+ * @return Where the copy ended in `destination`.
+ */
+static char *CopyField(char *destination, const char *field, uint32_t length)
+{
+    for (uint32_t i = 0; i < length && field[i] != '\0'; i++)
+    {
+        *destination++ = field[i];
+    }
+    return destination;
+}
+
+/**
+ * @brief The number of pages a file takes in memory. Even an empty file takes one.
+ */
+static uint32_t PageCount(uint32_t size)
+{
+    uint32_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    return pages > 0 ? pages : 1;
+}
+
+InitialRamdisk *InitialRamdisk::activeInitialRamdisk = 0;
+
+InitialRamdisk::InitialRamdisk(const uint8_t *image, uint32_t size)
+{
+    this->image = image;
+    this->size = size;
+
+    fileCount = Walk(0);
+    files = new InitrdFile[fileCount > 0 ? fileCount : 1];
+    Walk(files);
+
+    bucketCount = 16;
+    while (bucketCount < fileCount * 2)
+    {
+        bucketCount *= 2;
+    }
+    buckets = new int32_t[bucketCount];
+    for (uint32_t i = 0; i < bucketCount; i++)
+    {
+        buckets[i] = -1;
+    }
+
+    for (uint32_t i = 0; i < fileCount; i++)
+    {
+        uint32_t bucket = files[i].hash & (bucketCount - 1);
+        while (buckets[bucket] != -1)
+        {
+            /**
+             * A later member with the same path replaces the earlier one, as with tar itself.
+             */
+            if (files[buckets[bucket]].hash == files[i].hash &&
+                PathsEqual(files[buckets[bucket]].path, files[i].path))
+            {
+                break;
+            }
+            bucket = (bucket + 1) & (bucketCount - 1);
+        }
+        buckets[bucket] = i;
+    }
+
+    activeInitialRamdisk = this;
+}
+
+InitialRamdisk::~InitialRamdisk()
+{
+    if (activeInitialRamdisk == this)
+    {
+        activeInitialRamdisk = 0;
+    }
+
+    for (uint32_t i = 0; i < fileCount; i++)
+    {
+        if (files[i].compressed != 0 && files[i].data != 0)
+        {
+            PhysicalMemoryManager::activePhysicalMemoryManager->FreeFrames(
+                (uint32_t)files[i].data, PageCount(files[i].size));
+        }
+        delete[] files[i].path;
+        if (files[i].sharedFrames != 0)
+        {
+            delete[] files[i].sharedFrames;
+        }
+    }
+    delete[] files;
+    delete[] buckets;
+}
+
+bool InitialRamdisk::IsTar(const uint8_t *image, uint32_t size)
+{
+    if (size < TAR_BLOCK_SIZE)
+    {
+        return false;
+    }
+
+    /**
+     * "ustar\0" for POSIX archives, "ustar " for GNU ones.
+     */
+    const TarHeader *header = (const TarHeader *)image;
+    return header->magic[0] == 'u' && header->magic[1] == 's' && header->magic[2] == 't' &&
+           header->magic[3] == 'a' && header->magic[4] == 'r';
+}
+
+uint32_t InitialRamdisk::Walk(InitrdFile *files)
+{
+    uint32_t count = 0;
+    uint32_t offset = 0;
+
+    while (offset + TAR_BLOCK_SIZE <= size)
+    {
+        const TarHeader *header = (const TarHeader *)(image + offset);
+
+        /**
+         * The archive ends with zero filled blocks.
+         */
+        if (header->name[0] == '\0')
+        {
+            break;
+        }
+
+        uint32_t fileSize = ParseOctal(header->size, sizeof(header->size));
+        uint32_t dataOffset = offset + TAR_BLOCK_SIZE;
+        if (fileSize > size - dataOffset)
+        {
+            break;
+        }
+
+        if (header->type == TAR_TYPE_FILE || header->type == TAR_TYPE_FILE_OLD)
+        {
+            if (files != 0)
+            {
+                /**
+                 * The full name is "<prefix>/<name>" if there is a prefix.
+                 */
+                char full[sizeof(header->prefix) + 1 + sizeof(header->name) + 1];
+                char *end = full;
+                if (header->prefix[0] != '\0')
+                {
+                    end = CopyField(end, header->prefix, sizeof(header->prefix));
+                    *end++ = '/';
+                }
+                end = CopyField(end, header->name, sizeof(header->name));
+                *end = '\0';
+
+                const char *path = SkipRoot(full);
+                uint32_t length = end - path;
+
+                InitrdFile *file = &files[count];
+                file->data = image + dataOffset;
+                file->size = fileSize;
+                file->compressed = 0;
+                file->compressedSize = 0;
+                file->sharedFrames = 0;
+
+                /**
+                 * A compressed file drops the ".lz4" from its name, and its size becomes that of
+                 * the decompressed data.
+                 */
+                uint32_t contentSize;
+                if (length > 4 && PathsEqual(path + length - 4, ".lz4") &&
+                    Lz4ContentSize(file->data, fileSize, &contentSize))
+                {
+                    file->compressed = file->data;
+                    file->compressedSize = fileSize;
+                    file->data = 0;
+                    file->size = contentSize;
+                    length -= 4;
+                }
+
+                file->path = new char[length + 1];
+                memcpy(file->path, path, length);
+                file->path[length] = '\0';
+                file->hash = HashPath(file->path);
+            }
+            count++;
+        }
+
+        offset = dataOffset + ((fileSize + TAR_BLOCK_SIZE - 1) & ~(TAR_BLOCK_SIZE - 1));
+    }
+
+    return count;
+}
+
+InitrdFile *InitialRamdisk::Open(const char *path)
+{
+    path = SkipRoot(path);
+    uint32_t hash = HashPath(path);
+
+    for (uint32_t bucket = hash & (bucketCount - 1); buckets[bucket] != -1;
+         bucket = (bucket + 1) & (bucketCount - 1))
+    {
+        InitrdFile *file = &files[buckets[bucket]];
+        if (file->hash == hash && PathsEqual(file->path, path))
+        {
+            lock.Lock();
+            bool opened = file->data != 0 || Decompress(file);
+            lock.Unlock();
+            return opened ? file : 0;
+        }
+    }
+    return 0;
+}
+
+bool InitialRamdisk::Decompress(InitrdFile *file)
+{
+    /**
+     * The frames are contiguous, so the data can be handed out as a plain pointer. Being page
+     * aligned, every page of it can also be mapped into user space without a copy, the end of the
+     * last one cleared so that nothing but the file shows.
+     */
+    PhysicalMemoryManager *physicalMemory = PhysicalMemoryManager::activePhysicalMemoryManager;
+    uint32_t frames = physicalMemory->AllocateFrames(PageCount(file->size));
+    if (frames == 0)
+    {
+        return false;
+    }
+
+    if (Lz4Decompress(file->compressed, file->compressedSize, (uint8_t *)frames, file->size) !=
+        (int32_t)file->size)
+    {
+        physicalMemory->FreeFrames(frames, PageCount(file->size));
+        return false;
+    }
+    memset((uint8_t *)frames + file->size, 0, PageCount(file->size) * PAGE_SIZE - file->size);
+
+    file->data = (const uint8_t *)frames;
+    return true;
+}
+
+uint32_t InitialRamdisk::FileCount() { return fileCount; }
+
+InitrdFile *InitialRamdisk::File(uint32_t index)
+{
+    if (index >= fileCount)
+    {
+        return 0;
+    }
+    return &files[index];
+}
+
+uint32_t InitialRamdisk::Map(InitrdFile *file, AddressSpace *addressSpace)
+{
+    /**
+     * Tar data is only 512 byte aligned, so the whole pages holding the file are mapped, and the
+     * file starts as far into the mapping as it does into its first page. The bytes around it are
+     * the archive's own (headers, padding and neighbouring files, which any task can map anyway),
+     * or zeros for a decompressed file (see `Decompress`). The module is page aligned; only a
+     * last page running past its end can't be mapped from it, and gets copied.
+     */
+    uint32_t offset = (uint32_t)file->data % PAGE_SIZE;
+    const uint8_t *first = file->data - offset;
+    uint32_t pages = PageCount(offset + file->size);
+    uint32_t mapped = pages * PAGE_SIZE;
+    if (file->compressed == 0 && first + mapped > image + size)
+    {
+        mapped = image + size - first;
+    }
+
+    uint32_t start = addressSpace->FindFreeRange(pages * PAGE_SIZE);
+    if (start == 0)
+    {
+        return 0;
+    }
+
+    /**
+     * The frames mapped are remembered here for every later mapping, so a page copied is copied
+     * only once.
+     */
+    lock.Lock();
+    if (file->sharedFrames == 0)
+    {
+        file->sharedFrames = new uint32_t[pages];
+        memset(file->sharedFrames, 0, pages * sizeof(uint32_t));
+    }
+    lock.Unlock();
+
+    VirtualMemoryArea *area = new VirtualMemoryArea;
+    area->start = start;
+    area->end = start + pages * PAGE_SIZE;
+    area->fileStart = start;
+    area->fileEnd = start + mapped;
+    area->file = first;
+    area->flags = 0;
+    area->sharedFrames = file->sharedFrames;
+    addressSpace->AddArea(area);
+
+    return start + offset;
+}
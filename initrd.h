@@ -0,0 +1,132 @@
+/**
+ * @file initrd.h
+ * @author rohan843
+ * @brief Contains the initial ramdisk: a read-only filesystem in a boot module.
+ *
+ * The module is a tar archive (ustar format). It is indexed once at boot into a hash table keyed
+ * by path, after which opening a file is a single lookup. Files are never copied: their data is
+ * served as pointers into the module, or mapped into user space straight from it.
+ *
+ * Members named "<path>.lz4" are LZ4 frames (see lz4.h), and show up as "<path>". They are only
+ * decompressed when first opened, into frames of their own that stay allocated from then on.
+ */
+
+#ifndef __INITRD_H
+#define __INITRD_H
+
+#include "paging.h"
+#include "sync.h"
+#include "types.h"
+
+/**
+ * @brief A file of the initial ramdisk.
+ */
+struct InitrdFile
+{
+    /**
+     * The path, without any leading "/" or "./".
+     */
+    char *path;
+    uint32_t hash;
+
+    /**
+     * The contents. 0 for a compressed file that hasn't been opened yet.
+     */
+    const uint8_t *data;
+    uint32_t size;
+
+    /**
+     * The LZ4 frame holding the contents, or 0 if the file isn't compressed.
+     */
+    const uint8_t *compressed;
+    uint32_t compressedSize;
+
+    /**
+     * The frames mapped for the file's pages in user space, shared by all address spaces mapping
+     * it. Allocated on the first mapping.
+     */
+    uint32_t *sharedFrames;
+};
+
+class InitialRamdisk
+{
+  protected:
+    const uint8_t *image;
+    uint32_t size;
+
+    /**
+     * The files, in archive order.
+     */
+    InitrdFile *files;
+    uint32_t fileCount;
+
+    /**
+     * The hash table: indices into `files`, or -1 for an empty bucket. Open addressing with linear
+     * probing; the bucket count is a power of 2 at least twice the file count.
+     */
+    int32_t *buckets;
+    uint32_t bucketCount;
+
+    /**
+     * Guards what is set up for a file the first time it is opened or mapped (its decompressed
+     * data and its shared frames), as tasks on different processors may do both at once.
+     */
+    Mutex lock;
+
+    /**
+     * @brief Walks the archive headers, counting the regular files.
+     *
+     * @param files If not 0, also fills this array with the files found.
+     * @return The number of regular files.
+     */
+    uint32_t Walk(InitrdFile *files);
+
+    /**
+     * @brief Decompresses a compressed file into newly allocated frames.
+     *
+     * @return false if there was no memory for it, or the data is corrupt.
+     */
+    bool Decompress(InitrdFile *file);
+
+  public:
+    static InitialRamdisk *activeInitialRamdisk;
+
+    /**
+     * @param image The archive. It must stay in memory, unchanged, as long as this object lives.
+     * @param size The size of the archive.
+     */
+    InitialRamdisk(const uint8_t *image, uint32_t size);
+    ~InitialRamdisk();
+
+    /**
+     * @brief Tells whether some data starts like a ustar archive.
+     */
+    static bool IsTar(const uint8_t *image, uint32_t size);
+
+    /**
+     * @brief Looks a file up, decompressing it if this is the first time it is opened.
+     *
+     * @param path The path, with or without a leading "/".
+     * @return The file, or 0 if there is none with that path (or it couldn't be decompressed).
+     */
+    InitrdFile *Open(const char *path);
+
+    uint32_t FileCount();
+
+    /**
+     * @brief Returns a file by its position in the archive, for listing. The file isn't opened:
+     * its `data` may still be 0.
+     */
+    InitrdFile *File(uint32_t index);
+
+    /**
+     * @brief Maps an opened file read-only into an address space, at an unused address. The pages
+     * holding the file are mapped as they are, not copied.
+     *
+     * @return The address of the file in the mapping (not page aligned, unless the file's data
+     * is), or 0 if there was no room.
+     */
+    uint32_t Map(InitrdFile *file, AddressSpace *addressSpace);
+};
+
+#endif
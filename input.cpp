@@ -0,0 +1,453 @@
+#include "input.h"
+#include "benchmark.h"
+#include "compositor.h"
+#include "multitasking.h"
+#include "ps2.h"
+#include "stdio.h"
+#include "terminal.h"
+#include "tty.h"
+
+/** InputEventQueue Class */
+
+static LockClass inputEventQueueLockClass("input event queue");
+
+InputEventQueue *InputEventQueue::activeInputEventQueue = 0;
+
+InputEventQueue::InputEventQueue() : lock(&inputEventQueueLockClass)
+{
+    head = 0;
+    count = 0;
+    buttons = 0;
+    ResetStatistics();
+    activeInputEventQueue = this;
+}
+
+InputEventQueue::~InputEventQueue()
+{
+    if (activeInputEventQueue == this)
+    {
+        activeInputEventQueue = 0;
+    }
+}
+
+void InputEventQueue::Post(InputEvent *event)
+{
+    SpinlockGuard guard(&lock);
+    statistics.posted++;
+    InputEvent *last = count > 0 ? &events[(head + count - 1) % CAPACITY] : 0;
+    if (event->type == INPUT_EVENT_MOTION && last != 0 && last->type == INPUT_EVENT_MOTION)
+    {
+        last->timestamp = event->timestamp;
+        last->count++;
+        last->mouse.dx += event->mouse.dx;
+        last->mouse.dy += event->mouse.dy;
+        last->mouse.wheel += event->mouse.wheel;
+        statistics.coalesced++;
+    }
+    else if (count == CAPACITY)
+    {
+        statistics.dropped++;
+    }
+    else
+    {
+        events[(head + count) % CAPACITY] = *event;
+        count++;
+        readers.Wake();
+    }
+}
+
+void InputEventQueue::OnKeyEvent(KeyboardEvent key)
+{
+    InputEvent event;
+    event.timestamp = ReadTimestampCounter();
+    event.type = INPUT_EVENT_KEY;
+    event.count = 1;
+    event.key = key;
+    Post(&event);
+}
+
+void InputEventQueue::OnMouseEvent(MouseEvent mouse)
+{
+    InputEvent event;
+    event.timestamp = ReadTimestampCounter();
+    event.count = 1;
+    event.mouse = mouse;
+
+    /**
+     * A packet may both move the mouse and change the buttons. The movement is queued first, so
+     * that a click lands where the pointer ended up.
+     */
+    if (mouse.dx != 0 || mouse.dy != 0 || mouse.wheel != 0)
+    {
+        event.type = INPUT_EVENT_MOTION;
+        Post(&event);
+    }
+    if (mouse.buttons != buttons)
+    {
+        buttons = mouse.buttons;
+        event.type = INPUT_EVENT_BUTTONS;
+        event.mouse.dx = 0;
+        event.mouse.dy = 0;
+        event.mouse.wheel = 0;
+        Post(&event);
+    }
+}
+
+uint32_t InputEventQueue::ReadEvents(InputEvent *buffer, uint32_t max)
+{
+    SpinlockGuard guard(&lock);
+    while (count == 0)
+    {
+        readers.Wait(&lock);
+    }
+
+    uint32_t taken = count < max ? count : max;
+    for (uint32_t i = 0; i < taken; i++)
+    {
+        buffer[i] = events[head];
+        head = (head + 1) % CAPACITY;
+    }
+    count -= taken;
+    statistics.read += taken;
+    statistics.reads++;
+    return taken;
+}
+
+uint32_t InputEventQueue::Pending() { return count; }
+
+InputEventQueueStatistics InputEventQueue::Statistics() { return statistics; }
+
+void InputEventQueue::ResetStatistics()
+{
+    statistics.posted = 0;
+    statistics.coalesced = 0;
+    statistics.dropped = 0;
+    statistics.read = 0;
+    statistics.reads = 0;
+}
+
+/** InputConsole Class */
+
+InputConsole *InputConsole::activeInputConsole = 0;
+
+InputConsole::InputConsole(InputEventQueue *queue, InputTrace *trace)
+{
+    this->queue = queue;
+    this->trace = trace;
+    x = 40;
+    y = 12;
+    remainderX = 0;
+    remainderY = 0;
+    buttons = 0;
+    scrollLock = false;
+    ResetStatistics();
+}
+
+InputConsole::~InputConsole()
+{
+    if (activeInputConsole == this)
+    {
+        activeInputConsole = 0;
+    }
+}
+
+void InputConsole::Start()
+{
+    /**
+     * Displaying the mouse at the center of the screen initially.
+     */
+    InvertPointer();
+
+    activeInputConsole = this;
+
+    /**
+     * Like the keyboard and mouse handlers, the task runs on the bootstrap processor, as it
+     * disables interrupts to keep them out of the queue.
+     */
+    if (TaskManager::activeTaskManager->StartKernelTask(&Task, 0) == 0)
+    {
+        printf("input: couldn't start the console task\n");
+    }
+}
+
+void InputConsole::Task() { activeInputConsole->Run(); }
+
+InputConsoleStatistics InputConsole::Statistics() { return statistics; }
+
+void InputConsole::ResetStatistics()
+{
+    statistics.frames = 0;
+    statistics.events = 0;
+    statistics.latencyCycles = 0;
+    statistics.maxLatencyCycles = 0;
+}
+
+void InputConsole::InvertPointer()
+{
+    uint16_t *VideoMemory = (uint16_t *)0xb8000;
+    VideoMemory[80 * y + x] = ((VideoMemory[80 * y + x] & 0xF000) >> 4) |
+                              ((VideoMemory[80 * y + x] & 0x0F00) << 4) |
+                              (VideoMemory[80 * y + x] & 0x00FF);
+}
+
+void InputConsole::Move(int32_t dx, int32_t dy)
+{
+    /**
+     * Counts that don't make a whole cell are kept for the next movement, so slow movements
+     * still add up, in both directions.
+     */
+    remainderX += dx;
+    remainderY += dy;
+    x += remainderX / COUNTS_PER_COLUMN;
+    y += remainderY / COUNTS_PER_ROW;
+    remainderX %= COUNTS_PER_COLUMN;
+    remainderY %= COUNTS_PER_ROW;
+
+    if (x < 0)
+    {
+        x = 0;
+        remainderX = 0;
+    }
+    if (x >= 80)
+    {
+        x = 79;
+        remainderX = 0;
+    }
+    if (y < 0)
+    {
+        y = 0;
+        remainderY = 0;
+    }
+    if (y >= 25)
+    {
+        y = 24;
+        remainderY = 0;
+    }
+}
+
+void InputConsole::CheckRecording(KeyboardEvent *key)
+{
+    bool on = (key->modifiers & MODIFIER_SCROLL_LOCK) != 0;
+    if (on == scrollLock)
+    {
+        return;
+    }
+    scrollLock = on;
+
+    /**
+     * A replayed trace may toggle Scroll Lock too, which doesn't count.
+     */
+    if (trace == 0 || trace->Replaying())
+    {
+        return;
+    }
+    if (trace->Recording())
+    {
+        trace->StopRecording();
+        trace->Dump();
+    }
+    else
+    {
+        trace->StartRecording();
+    }
+}
+
+void InputConsole::Run()
+{
+    InputEvent batch[32];
+    while (true)
+    {
+        uint32_t count = queue->ReadEvents(batch, 32);
+        uint64_t now = ReadTimestampCounter();
+
+        /**
+         * The pointer is drawn once per batch, wherever the batch's movements took it.
+         */
+        InvertPointer();
+        for (uint32_t i = 0; i < count; i++)
+        {
+            InputEvent *event = &batch[i];
+            switch (event->type)
+            {
+            case INPUT_EVENT_KEY:
+                CheckRecording(&event->key);
+                if (VirtualTerminal::HandleKey(&event->key))
+                {
+                    break;
+                }
+                if (event->key.pressed && event->key.character != '\0')
+                {
+                    TTY::Get(VirtualTerminal::Active()->Index())->Input(event->key.character);
+                }
+                break;
+            case INPUT_EVENT_MOTION:
+                Move(event->mouse.dx, event->mouse.dy);
+                if (Compositor::activeCompositor != 0)
+                {
+                    Compositor::activeCompositor->MoveCursorBy(event->mouse.dx,
+                                                               event->mouse.dy);
+                }
+                break;
+            case INPUT_EVENT_BUTTONS:
+                /**
+                 * Each button pressed or released flips the pointer's highlight once more.
+                 */
+                for (uint8_t button = 0; button < 3; button++)
+                {
+                    if ((event->mouse.buttons ^ buttons) & (1 << button))
+                    {
+                        InvertPointer();
+                    }
+                }
+                buttons = event->mouse.buttons;
+                break;
+            }
+
+            uint64_t latency = now - event->timestamp;
+            statistics.latencyCycles += latency;
+            if (latency > statistics.maxLatencyCycles)
+            {
+                statistics.maxLatencyCycles = latency;
+            }
+        }
+        InvertPointer();
+        if (Compositor::activeCompositor != 0)
+        {
+            Compositor::activeCompositor->Render();
+        }
+        statistics.frames++;
+        statistics.events += count;
+    }
+}
+
+/** InputTrace Class */
+
+InputTrace::InputTrace(MouseDriver *mouse, uint32_t capacity)
+{
+    this->mouse = mouse;
+    this->capacity = capacity;
+    entries = new InputTraceEntry[capacity];
+    count = 0;
+    mousePacketSize = mouse != 0 ? mouse->PacketSize() : 0;
+    recording = false;
+    replaying = false;
+    lastTimestamp = 0;
+    cyclesPerMicrosecond = 1;
+}
+
+InputTrace::~InputTrace() { delete[] entries; }
+
+void InputTrace::StartRecording()
+{
+    cyclesPerMicrosecond = TimestampCounterFrequency() / 1000000;
+    mousePacketSize = mouse != 0 ? mouse->PacketSize() : 0;
+    count = 0;
+    lastTimestamp = ReadTimestampCounter();
+    recording = true;
+}
+
+void InputTrace::StopRecording() { recording = false; }
+
+bool InputTrace::Recording() { return recording; }
+
+bool InputTrace::Replaying() { return replaying; }
+
+uint32_t InputTrace::Count() { return count; }
+
+void InputTrace::Record(uint8_t port, uint8_t data)
+{
+    if (!recording || count == capacity)
+    {
+        return;
+    }
+
+    /**
+     * Delays are stored in microseconds, so that a trace replays at the same pace on a CPU with
+     * another time stamp counter frequency.
+     */
+    uint64_t now = ReadTimestampCounter();
+    InputTraceEntry *entry = &entries[count];
+    entry->delay = Divide(now - lastTimestamp, cyclesPerMicrosecond);
+    lastTimestamp = now;
+
+    entry->port = port;
+    entry->data = data;
+    entry->reserved = 0;
+    count++;
+}
+
+bool InputTrace::Load(const uint8_t *data, uint32_t size)
+{
+    InputTraceHeader *header = (InputTraceHeader *)data;
+    if (size < sizeof(InputTraceHeader) || header->magic[0] != 'I' || header->magic[1] != 'T' ||
+        header->magic[2] != 'R' || header->magic[3] != 'C')
+    {
+        return false;
+    }
+
+    uint32_t available = (size - sizeof(InputTraceHeader)) / sizeof(InputTraceEntry);
+    count = header->count;
+    if (count > available)
+    {
+        count = available;
+    }
+    if (count > capacity)
+    {
+        count = capacity;
+    }
+
+    const InputTraceEntry *source = (const InputTraceEntry *)(data + sizeof(InputTraceHeader));
+    for (uint32_t i = 0; i < count; i++)
+    {
+        entries[i] = source[i];
+    }
+    mousePacketSize = header->mousePacketSize;
+    return true;
+}
+
+void InputTrace::Dump()
+{
+    printf("inputtrace: begin ");
+    printfDec(mousePacketSize);
+    printf("\n");
+    for (uint32_t i = 0; i < count; i++)
+    {
+        printf("inputtrace: ");
+        printfHex(entries[i].delay);
+        printf(" ");
+        printfHex((entries[i].port << 8) | entries[i].data);
+        printf("\n");
+    }
+    printf("inputtrace: end\n");
+}
+
+uint64_t InputTrace::Replay(PS2Controller *controller, bool timed)
+{
+    bool skipMouse = mouse == 0 || mousePacketSize != mouse->PacketSize();
+    uint32_t cycles = TimestampCounterFrequency() / 1000000;
+
+    replaying = true;
+    uint64_t start = ReadTimestampCounter();
+    uint64_t due = start;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        InputTraceEntry *entry = &entries[i];
+        if (entry->port == 1 && skipMouse)
+        {
+            continue;
+        }
+
+        if (timed)
+        {
+            due += (uint64_t)entry->delay * cycles;
+            while (ReadTimestampCounter() < due)
+            {
+                TaskManager::activeTaskManager->Yield();
+            }
+        }
+        controller->Inject(entry->port, entry->data);
+    }
+    uint64_t elapsed = ReadTimestampCounter() - start;
+    replaying = false;
+    return elapsed;
+}
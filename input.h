@@ -0,0 +1,319 @@
+/**
+ * @file input.h
+ * @author rohan843
+ * @brief Contains the input event queue, which the keyboard and mouse drivers post their events to,
+ * and the console that reads them.
+ *
+ * The drivers run in the interrupt handlers, so they only queue the events, each stamped with the
+ * time stamp counter. Readers block until there are events, and take all of them at once. A mouse
+ * sends up to 200 packets a second: while the reader is behind, a movement is added to the one
+ * still queued before it, instead of queueing another. So a reader that draws once per batch draws
+ * no more often than it can, however fast the mouse moves.
+ *
+ * Input can also be recorded and replayed: a trace holds the bytes the PS/2 devices sent, with
+ * the time between them, and replaying it hands them to the drivers as if the devices had sent
+ * them. So the input path can be benchmarked without anyone typing.
+ */
+
+#ifndef __INPUT_H
+#define __INPUT_H
+
+#include "keyboard.h"
+#include "mouse.h"
+#include "spinlock.h"
+#include "sync.h"
+#include "types.h"
+
+enum InputEventType
+{
+    INPUT_EVENT_KEY = 1,
+
+    /**
+     * The mouse moved, or its wheel turned.
+     */
+    INPUT_EVENT_MOTION = 2,
+
+    /**
+     * A mouse button was pressed or released (the event holds all the buttons held).
+     */
+    INPUT_EVENT_BUTTONS = 3,
+};
+
+struct InputEvent
+{
+    /**
+     * The time stamp counter when the event (or the last one coalesced into it) came in.
+     */
+    uint64_t timestamp;
+    uint32_t type;
+
+    /**
+     * The number of mouse events added up in this one (1 if none were coalesced).
+     */
+    uint32_t count;
+
+    /**
+     * Set for key events.
+     */
+    KeyboardEvent key;
+
+    /**
+     * Set for motion and button events.
+     */
+    MouseEvent mouse;
+};
+
+/**
+ * @brief An entry of an input trace: a byte one of the PS/2 devices sent.
+ */
+struct InputTraceEntry
+{
+    /**
+     * The microseconds since the previous byte (or since recording started).
+     */
+    uint32_t delay;
+
+    /**
+     * 0 for the keyboard, 1 for the mouse.
+     */
+    uint8_t port;
+    uint8_t data;
+    uint16_t reserved;
+} __attribute__((packed));
+
+/**
+ * @brief The start of an input trace file, followed by its entries.
+ */
+struct InputTraceHeader
+{
+    /**
+     * "ITRC".
+     */
+    char magic[4];
+    uint32_t count;
+
+    /**
+     * The mouse's packet size when the trace was recorded.
+     */
+    uint8_t mousePacketSize;
+    uint8_t reserved[3];
+} __attribute__((packed));
+
+struct InputEventQueueStatistics
+{
+    uint32_t posted;
+    uint32_t coalesced;
+    uint32_t dropped;
+    uint32_t read;
+    uint32_t reads;
+};
+
+class InputEventQueue : public KeyboardEventHandler, public MouseEventHandler
+{
+  protected:
+    static const uint32_t CAPACITY = 256;
+
+    InputEvent events[CAPACITY];
+
+    /**
+     * The oldest event is at `head`.
+     */
+    uint32_t head;
+    uint32_t count;
+
+    /**
+     * Guards the events and the statistics. Interrupt handlers post on one processor while tasks
+     * (e.g., through `SYSCALL_READ_EVENTS`) read on others.
+     */
+    Spinlock lock;
+
+    /**
+     * The readers waiting for events.
+     */
+    WaitQueue readers;
+
+    /**
+     * The mouse buttons held, as of the last mouse event.
+     */
+    uint8_t buttons;
+
+    InputEventQueueStatistics statistics;
+
+    /**
+     * @brief Queues an event, or adds it to the last one queued if both are movements.
+     */
+    void Post(InputEvent *event);
+
+  public:
+    static InputEventQueue *activeInputEventQueue;
+
+    InputEventQueue();
+    ~InputEventQueue();
+
+    virtual void OnKeyEvent(KeyboardEvent event);
+    virtual void OnMouseEvent(MouseEvent event);
+
+    /**
+     * @brief Takes the queued events, waiting for some if there are none.
+     *
+     * @param max The number of events the buffer holds.
+     * @return The number of events taken (at least 1).
+     */
+    uint32_t ReadEvents(InputEvent *buffer, uint32_t max);
+
+    /**
+     * @brief The number of events queued.
+     */
+    uint32_t Pending();
+
+    InputEventQueueStatistics Statistics();
+    void ResetStatistics();
+};
+
+class InputTrace
+{
+  protected:
+    MouseDriver *mouse;
+
+    InputTraceEntry *entries;
+    uint32_t capacity;
+    uint32_t count;
+    uint8_t mousePacketSize;
+
+    volatile bool recording;
+    volatile bool replaying;
+
+    /**
+     * When the last byte was recorded, and the time stamp counter cycles per microsecond.
+     */
+    uint64_t lastTimestamp;
+    uint32_t cyclesPerMicrosecond;
+
+  public:
+    /**
+     * @param mouse The mouse whose packet size is recorded, and checked on replay (may be 0).
+     * @param capacity The number of bytes a trace holds.
+     */
+    InputTrace(MouseDriver *mouse, uint32_t capacity);
+    ~InputTrace();
+
+    /**
+     * @brief Empties the trace, and records the bytes from now on.
+     */
+    void StartRecording();
+    void StopRecording();
+    bool Recording();
+    bool Replaying();
+
+    /**
+     * @brief Adds a byte, if recording. Called in the interrupt handler.
+     */
+    void Record(uint8_t port, uint8_t data);
+
+    /**
+     * @brief Replaces the trace with one read from a trace file.
+     *
+     * @return false if the data isn't a trace file. A trace longer than the capacity is cut.
+     */
+    bool Load(const uint8_t *data, uint32_t size);
+
+    /**
+     * @brief Prints the trace as "inputtrace:" lines, which `tools/inputtrace.py` turns back into
+     * a trace file (e.g., from the debug console of a benchmark kernel).
+     */
+    void Dump();
+
+    uint32_t Count();
+
+    /**
+     * @brief Hands the bytes to the devices' drivers through the controller.
+     *
+     * The mouse bytes are skipped if the trace was recorded with another packet size than the
+     * mouse's, as they wouldn't make sense to the driver.
+     *
+     * @param timed Whether to wait the recorded time before each byte, letting other tasks run,
+     * or to hand them over back to back.
+     * @return The time stamp counter cycles taken.
+     */
+    uint64_t Replay(PS2Controller *controller, bool timed);
+};
+
+struct InputConsoleStatistics
+{
+    /**
+     * The batches of events drawn, and the events in them.
+     */
+    uint32_t frames;
+    uint32_t events;
+
+    /**
+     * The time stamp counter cycles from when each event was queued to when it was drawn.
+     */
+    uint64_t latencyCycles;
+    uint64_t maxLatencyCycles;
+};
+
+/**
+ * @brief Reads the input events in a task of its own, printing the characters typed and moving the
+ * mouse pointer, a highlighted character cell.
+ *
+ * Scroll Lock starts recording the input into a trace, and stops it again, printing the trace.
+ */
+class InputConsole
+{
+  protected:
+    /**
+     * The mouse counts that make a move by a character cell (a cell is 8 by 16 pixels in the 640
+     * by 400 text mode).
+     */
+    static const int32_t COUNTS_PER_COLUMN = 8;
+    static const int32_t COUNTS_PER_ROW = 16;
+
+    InputEventQueue *queue;
+    InputTrace *trace;
+
+    /**
+     * The pointer's cell, and the counts moved towards the next one.
+     */
+    int32_t x, y;
+    int32_t remainderX, remainderY;
+
+    uint8_t buttons;
+    bool scrollLock;
+
+    InputConsoleStatistics statistics;
+
+    /**
+     * @brief Highlights the pointer's cell, or removes the highlight.
+     */
+    void InvertPointer();
+
+    void Move(int32_t dx, int32_t dy);
+
+    /**
+     * @brief Starts or stops recording when Scroll Lock toggles.
+     */
+    void CheckRecording(KeyboardEvent *key);
+
+    void Run();
+    static void Task();
+
+  public:
+    static InputConsole *activeInputConsole;
+
+    /**
+     * @param trace The trace Scroll Lock records into (may be 0).
+     */
+    InputConsole(InputEventQueue *queue, InputTrace *trace);
+    ~InputConsole();
+
+    /**
+     * @brief Draws the pointer in the middle of the screen and starts the task.
+     */
+    void Start();
+
+    InputConsoleStatistics Statistics();
+    void ResetStatistics();
+};
+
+#endif
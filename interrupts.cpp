@@ -1,23 +1,20 @@
 #include "interrupts.h"
+#include "multitasking.h"
+#include "percpu.h"
 #include "stdio.h"
 
 InterruptHandler::InterruptHandler(uint8_t interruptNumber, InterruptManager *interruptManager)
 {
     this->interruptNumber = interruptNumber;
     this->interruptManager = interruptManager;
+    this->next = 0;
 
-    this->interruptManager->handlers[interruptNumber] = this;
+    this->interruptManager->AddHandler(this);
 }
 
-InterruptHandler::~InterruptHandler()
-{
-    if (this->interruptManager->handlers[interruptNumber] == this)
-    {
-        this->interruptManager->handlers[interruptNumber] = 0;
-    }
-}
+InterruptHandler::~InterruptHandler() { this->interruptManager->RemoveHandler(this); }
 
-uint32_t InterruptHandler::HandleInterrupt(uint32_t esp) { return esp; }
+bool InterruptHandler::HandleInterrupt(uint32_t *esp) { return false; }
 
 InterruptManager::GateDescriptor InterruptManager::interruptDescriptorTable[256];
 
@@ -45,9 +42,12 @@ void InterruptManager::SetInterruptDescriptorTableEntry(uint8_t interruptNumber,
         IDT_DESC_PRESENT | DescriptorType | ((DescriptorPriveledgeLevel & 0b11) << 5);
 }
 
-InterruptManager::InterruptManager(GlobalDescriptorTable *gdt)
+InterruptManager::InterruptManager(GlobalDescriptorTable *gdt, TaskManager *taskManager)
     : picMasterCommand(0x20), picMasterData(0x21), picSlaveCommand(0xA0), picSlaveData(0xA1)
 {
+    this->taskManager = taskManager;
+    this->spuriousInterrupts = 0;
+
     uint16_t CodeSegment = gdt->CodeSegmentSelector();
     /**
      * Flag marking a gate as an interrupt gate.
@@ -65,21 +65,59 @@ InterruptManager::InterruptManager(GlobalDescriptorTable *gdt)
     }
 
     /**
-     * Timer interrupt.
+     * Exceptions.
      */
-    this->SetInterruptDescriptorTableEntry(0x20, CodeSegment, &this->HandleInterruptRequest0x00, 0,
+    void (*exceptionHandlers[])() = {
+        &this->HandleException0x00, &this->HandleException0x01, &this->HandleException0x02,
+        &this->HandleException0x03, &this->HandleException0x04, &this->HandleException0x05,
+        &this->HandleException0x06, &this->HandleException0x07, &this->HandleException0x08,
+        &this->HandleException0x09, &this->HandleException0x0A, &this->HandleException0x0B,
+        &this->HandleException0x0C, &this->HandleException0x0D, &this->HandleException0x0E,
+        &this->HandleException0x0F, &this->HandleException0x10, &this->HandleException0x11,
+        &this->HandleException0x12, &this->HandleException0x13};
+    for (uint8_t i = 0; i <= 0x13; i++)
+    {
+        this->SetInterruptDescriptorTableEntry(i, CodeSegment, exceptionHandlers[i], 0,
+                                               IDT_INTERRUPT_GATE);
+    }
+
+    /**
+     * Hardware interrupts, remapped to 0x20 - 0x2F by the PIC setup below.
+     */
+    void (*interruptRequestHandlers[])() = {
+        &this->HandleInterruptRequest0x00, &this->HandleInterruptRequest0x01,
+        &this->HandleInterruptRequest0x02, &this->HandleInterruptRequest0x03,
+        &this->HandleInterruptRequest0x04, &this->HandleInterruptRequest0x05,
+        &this->HandleInterruptRequest0x06, &this->HandleInterruptRequest0x07,
+        &this->HandleInterruptRequest0x08, &this->HandleInterruptRequest0x09,
+        &this->HandleInterruptRequest0x0A, &this->HandleInterruptRequest0x0B,
+        &this->HandleInterruptRequest0x0C, &this->HandleInterruptRequest0x0D,
+        &this->HandleInterruptRequest0x0E, &this->HandleInterruptRequest0x0F};
+    for (uint8_t i = 0; i <= 0x0F; i++)
+    {
+        this->SetInterruptDescriptorTableEntry(0x20 + i, CodeSegment, interruptRequestHandlers[i],
+                                               0, IDT_INTERRUPT_GATE);
+    }
+
+    /**
+     * System call interrupt. Its priveledge level is 3, so that ring 3 code may raise it with
+     * `int $0x80` (a lower DPL would turn that into a general protection fault).
+     */
+    this->SetInterruptDescriptorTableEntry(0x80, CodeSegment, &this->HandleSoftwareInterrupt0x80, 3,
                                            IDT_INTERRUPT_GATE);
 
     /**
-     * Keyboard interrupt.
+     * Reschedule interrupt. Only the kernel may raise it.
      */
-    this->SetInterruptDescriptorTableEntry(0x21, CodeSegment, &this->HandleInterruptRequest0x01, 0,
+    this->SetInterruptDescriptorTableEntry(0x81, CodeSegment, &this->HandleSoftwareInterrupt0x81, 0,
                                            IDT_INTERRUPT_GATE);
 
     /**
-     * Mouse interrupt.
+     * Local APIC interrupts: the wakeup interrupt one processor sends another, and the timer.
      */
-    this->SetInterruptDescriptorTableEntry(0x2C, CodeSegment, &this->HandleInterruptRequest0x0C, 0,
+    this->SetInterruptDescriptorTableEntry(0xF0, CodeSegment, &this->HandleLocalInterrupt0xF0, 0,
+                                           IDT_INTERRUPT_GATE);
+    this->SetInterruptDescriptorTableEntry(0xF1, CodeSegment, &this->HandleLocalInterrupt0xF1, 0,
                                            IDT_INTERRUPT_GATE);
 
     /**
@@ -113,11 +151,20 @@ InterruptManager::InterruptManager(GlobalDescriptorTable *gdt)
     picSlaveData.Write(0x01);
 
     /**
-     * Unmasks all IRQ lines, enabling all interrupts.
+     * Masks all IRQ lines but the timer's (IRQ0, which schedules tasks) and the slave's (IRQ2).
+     * Registering a handler unmasks its line.
      */
-    picMasterData.Write(0x00);
-    picSlaveData.Write(0x00);
+    interruptMask = ~((1 << 0) | (1 << 2));
+    picMasterData.Write(interruptMask & 0xFF);
+    picSlaveData.Write(interruptMask >> 8);
+
+    LoadDescriptorTable();
+}
+
+InterruptManager::~InterruptManager() {}
 
+void InterruptManager::LoadDescriptorTable()
+{
     InterruptDescriptorTablePointer idt;
 
     // Why "-1"?: See comment of InterruptDescriptorTablePointer::size
@@ -128,8 +175,6 @@ InterruptManager::InterruptManager(GlobalDescriptorTable *gdt)
     asm volatile("lidt %0" : : "m"(idt));
 }
 
-InterruptManager::~InterruptManager() {}
-
 void InterruptManager::Activate()
 {
     /**
@@ -157,6 +202,105 @@ void InterruptManager::Deactivate()
     }
 }
 
+uint32_t InterruptManager::SpuriousInterrupts() { return spuriousInterrupts; }
+
+void InterruptManager::AddHandler(InterruptHandler *handler)
+{
+    uint32_t eflags;
+    asm volatile("pushfl\n"
+                 "popl %0\n"
+                 "cli"
+                 : "=r"(eflags));
+
+    InterruptHandler **link = &handlers[handler->interruptNumber];
+    while (*link != 0)
+    {
+        link = &(*link)->next;
+    }
+    *link = handler;
+
+    if (0x20 <= handler->interruptNumber && handler->interruptNumber <= 0x2F)
+    {
+        SetMasked(handler->interruptNumber - 0x20, false);
+    }
+
+    asm volatile("pushl %0\n"
+                 "popfl"
+                 :
+                 : "r"(eflags)
+                 : "cc");
+}
+
+void InterruptManager::RemoveHandler(InterruptHandler *handler)
+{
+    uint32_t eflags;
+    asm volatile("pushfl\n"
+                 "popl %0\n"
+                 "cli"
+                 : "=r"(eflags));
+
+    InterruptHandler **link = &handlers[handler->interruptNumber];
+    while (*link != 0 && *link != handler)
+    {
+        link = &(*link)->next;
+    }
+    if (*link != 0)
+    {
+        *link = handler->next;
+    }
+
+    if (0x20 <= handler->interruptNumber && handler->interruptNumber <= 0x2F &&
+        handlers[handler->interruptNumber] == 0)
+    {
+        SetMasked(handler->interruptNumber - 0x20, true);
+    }
+
+    asm volatile("pushl %0\n"
+                 "popfl"
+                 :
+                 : "r"(eflags)
+                 : "cc");
+}
+
+void InterruptManager::SetMasked(uint8_t interruptRequest, bool masked)
+{
+    /**
+     * The timer and the cascade stay unmasked.
+     */
+    if (interruptRequest == 0 || interruptRequest == 2)
+    {
+        return;
+    }
+
+    if (masked)
+    {
+        interruptMask |= 1 << interruptRequest;
+    }
+    else
+    {
+        interruptMask &= ~(1 << interruptRequest);
+    }
+
+    if (interruptRequest < 8)
+    {
+        picMasterData.Write(interruptMask & 0xFF);
+    }
+    else
+    {
+        picSlaveData.Write(interruptMask >> 8);
+    }
+}
+
+bool InterruptManager::Spurious(uint8_t interruptNumber)
+{
+    /**
+     * OCW3 0x0B selects the in-service register for the next read of the command port.
+     */
+    Port8BitSlow *command = interruptNumber == 0x27 ? &picMasterCommand : &picSlaveCommand;
+    command->Write(0x0B);
+    return !(command->Read() & 0x80);
+}
+
 uint32_t InterruptManager::handleInterrupt(uint8_t interruptNumber, uint32_t esp)
 {
     /**
@@ -176,16 +320,98 @@ uint32_t InterruptManager::handleInterrupt(uint8_t interruptNumber, uint32_t esp
     return esp;
 }
 
+/**
+ * The names of the exceptions there are stubs for.
+ */
+static const char *exceptionNames[] = {"divide error",
+                                       "debug",
+                                       "non-maskable interrupt",
+                                       "breakpoint",
+                                       "overflow",
+                                       "bound range exceeded",
+                                       "invalid opcode",
+                                       "device not available",
+                                       "double fault",
+                                       "coprocessor segment overrun",
+                                       "invalid TSS",
+                                       "segment not present",
+                                       "stack fault",
+                                       "general protection fault",
+                                       "page fault",
+                                       "reserved exception",
+                                       "x87 floating point error",
+                                       "alignment check",
+                                       "machine check",
+                                       "SIMD floating point error"};
+
+uint32_t InterruptManager::HandleFault(uint8_t interruptNumber, uint32_t esp)
+{
+    CPUState *cpu = (CPUState *)esp;
+
+    printf("\n");
+    printf(interruptNumber <= 0x13 ? exceptionNames[interruptNumber] : "exception");
+    printf(" (");
+    printfDec(interruptNumber);
+    printf(") at eip 0x");
+    printfHex(cpu->eip);
+    printf(", error 0x");
+    printfHex(cpu->error);
+
+    if (cpu->cs & 3)
+    {
+        printf(": task ");
+        printfDec(taskManager->CurrentTask()->Id());
+        printf(" killed\n");
+        return (uint32_t)taskManager->ExitCurrentTask(cpu);
+    }
+
+    printf(" in the kernel\n");
+    while (1)
+    {
+        asm volatile("cli\n"
+                     "hlt");
+    }
+}
+
 uint32_t InterruptManager::DoHandleInterrupt(uint8_t interruptNumber, uint32_t esp)
 {
+    ThisProcessor()->interrupts++;
+
+    if ((interruptNumber == 0x27 || interruptNumber == 0x2F) && Spurious(interruptNumber))
+    {
+        spuriousInterrupts++;
+
+        /**
+         * A spurious IRQ 15 is still a real IRQ2 to the master.
+         */
+        if (interruptNumber == 0x2F)
+        {
+            this->picMasterCommand.Write(0x20);
+        }
+        return esp;
+    }
+
     /**
-     * Use an interrupt handler if one exists, otherwise print a message.
+     * Use the interrupt's handlers if any exist, otherwise print a message.
      */
     if (this->handlers[interruptNumber] != 0)
     {
-        esp = this->handlers[interruptNumber]->HandleInterrupt(esp);
+        bool handled = false;
+        for (InterruptHandler *handler = this->handlers[interruptNumber]; handler != 0;
+             handler = handler->next)
+        {
+            handled |= handler->HandleInterrupt(&esp);
+        }
+        if (!handled)
+        {
+            spuriousInterrupts++;
+        }
+    }
+    else if (interruptNumber < 0x20)
+    {
+        esp = HandleFault(interruptNumber, esp);
     }
-    else if (interruptNumber != 0x20)
+    else if (interruptNumber != 0x20 && interruptNumber != 0x81)
     {
         char *str = "\nUnhandled Interrupt 0x__";
         char *hex = "0123456789ABCDEF";
@@ -194,6 +420,17 @@ uint32_t InterruptManager::DoHandleInterrupt(uint8_t interruptNumber, uint32_t e
         printf(str);
     }
 
+    /**
+     * Time slice over (the PIT's IRQ0 on the bootstrap processor, the local APIC timer on the
+     * others), the running task gave up the CPU, another processor queued a task for this one
+     * (the wakeup IPI), or the handler woke a task up while the CPU was idle.
+     */
+    if (interruptNumber == 0x20 || interruptNumber == 0x81 || interruptNumber == 0xF0 ||
+        interruptNumber == 0xF1 || taskManager->RescheduleRequested())
+    {
+        esp = (uint32_t)taskManager->Schedule((CPUState *)esp);
+    }
+
     /**
      * Sending end of interrupt messages to the PICs.
      */
@@ -6,19 +6,67 @@
 #include "types.h"
 
 class InterruptManager;
+class TaskManager;
+
+/**
+ * @brief The register state pushed on the stack by the interrupt stubs in "interruptstubs.s".
+ *
+ * The `esp` passed to the handlers points to this structure. The last two fields are only present
+ * if the interrupt arrived while ring 3 code was running.
+ */
+struct CPUState
+{
+    uint32_t gs;
+    uint32_t fs;
+    uint32_t es;
+    uint32_t ds;
+
+    uint32_t edi;
+    uint32_t esi;
+    uint32_t ebp;
+    uint32_t kernelEsp;
+    uint32_t ebx;
+    uint32_t edx;
+    uint32_t ecx;
+    uint32_t eax;
+
+    /**
+     * The interrupt being handled (0x80 for `sysenter`).
+     */
+    uint32_t interruptNumber;
+
+    /**
+     * The error code of the exception, or 0 if it has none.
+     */
+    uint32_t error;
+
+    uint32_t eip;
+    uint32_t cs;
+    uint32_t eflags;
+    uint32_t esp;
+    uint32_t ss;
+} __attribute__((packed));
 
 class InterruptHandler
 {
+    friend class InterruptManager;
+
   protected:
     uint8_t interruptNumber;
     InterruptManager *interruptManager;
 
+    /**
+     * The next handler sharing the interrupt (PCI devices often share an IRQ line).
+     */
+    InterruptHandler *next;
+
     /**
      * @brief Construct a new Interrupt Handler object
      *
      * Made protected to ensure this class never gets instantiated directly. When a child's
      * constructor calls this constructor, it automatically registers it with the InterruptManager
-     * provided, for the interrupt whose number is provided.
+     * provided, for the interrupt whose number is provided, after any handlers already registered
+     * for it.
      *
      */
     InterruptHandler(uint8_t interruptNumber, InterruptManager *interruptManager);
@@ -28,10 +76,14 @@ class InterruptHandler
     /**
      * @brief Handles the interrupt associated with an inherited object.
      *
-     * @param esp The value of the stack pointer before the interrupt handling began.
-     * @return The value of the stack pointer before the interrupt handling began.
+     * All the handlers of an interrupt are called, as more than one of the devices sharing a line
+     * may be raising it at once.
+     *
+     * @param esp Points to the value of the stack pointer before the interrupt handling began. A
+     * handler switching stacks (e.g., to another task) replaces it.
+     * @return Whether the interrupt came from the handler's device.
      */
-    virtual uint32_t HandleInterrupt(uint32_t esp);
+    virtual bool HandleInterrupt(uint32_t *esp);
 };
 
 /**
@@ -55,6 +107,9 @@ class InterruptManager
      */
     static InterruptManager *ActiveInterruptManager;
 
+    /**
+     * The first handler of each interrupt. The others follow through `InterruptHandler::next`.
+     */
     InterruptHandler *handlers[256];
 
     /**
@@ -121,10 +176,63 @@ class InterruptManager
     Port8BitSlow picSlaveCommand;
     Port8BitSlow picSlaveData;
 
+    /**
+     * The masked IRQ lines, the slave's in the high byte. A line is masked while no handler is
+     * registered for it, so a device nothing drives can't keep interrupting.
+     */
+    uint16_t interruptMask;
+
+    uint32_t spuriousInterrupts;
+
+    /**
+     * @brief Adds a handler to the end of its interrupt's chain, unmasking the IRQ line.
+     */
+    void AddHandler(InterruptHandler *handler);
+
+    /**
+     * @brief Removes a handler from its interrupt's chain, masking the IRQ line if it was the last
+     * one.
+     */
+    void RemoveHandler(InterruptHandler *handler);
+
+    /**
+     * @brief Masks or unmasks an IRQ line.
+     */
+    void SetMasked(uint8_t interruptRequest, bool masked);
+
+    /**
+     * @brief Tells whether an IRQ 7 or IRQ 15 is spurious.
+     *
+     * The PICs raise IRQ 7 (or IRQ 15, on the slave) when a line drops before the CPU acknowledges
+     * its interrupt. Such an interrupt isn't marked in the PIC's in-service register, and must not
+     * get an EOI, as that would end some other interrupt being handled.
+     */
+    bool Spurious(uint8_t interruptNumber);
+
+    /**
+     * @brief Handles an exception no handler took. Ring 3 code can't get past the faulting
+     * instruction, so its task is ended. A fault in the kernel can't be recovered from, so the
+     * processor is halted.
+     *
+     * @return The stack pointer to continue with.
+     */
+    uint32_t HandleFault(uint8_t interruptNumber, uint32_t esp);
+
+    /**
+     * Switches tasks on the timer interrupt and on `int $0x81`.
+     */
+    TaskManager *taskManager;
+
   public:
-    InterruptManager(GlobalDescriptorTable *gdt);
+    InterruptManager(GlobalDescriptorTable *gdt, TaskManager *taskManager);
     ~InterruptManager();
 
+    /**
+     * @brief Loads the IDT into the IDTR of the processor this runs on. The constructor does so for
+     * the bootstrap processor, and every other processor does when it starts.
+     */
+    static void LoadDescriptorTable();
+
     /**
      * @brief Tells the processor to begin processing interrupts.
      */
@@ -135,6 +243,12 @@ class InterruptManager
      */
     void Deactivate();
 
+    /**
+     * @brief The number of spurious interrupts so far: IRQ 7 and IRQ 15 ones the PICs raised, and
+     * ones none of the handlers claimed.
+     */
+    uint32_t SpuriousInterrupts();
+
     /**
      * @brief A static method that handles interrupts. Calls the `DoHandleInterrupt` method of the
      * currently active interrupt manager object.
@@ -158,24 +272,77 @@ class InterruptManager
     uint32_t DoHandleInterrupt(uint8_t interruptNumber, uint32_t esp);
 
     /**
-     * @brief The timer interrupt handler.
-     * This is defined in assembly in the file "interruptstubs.s"
+     * @brief The exception handlers, one for each of the exceptions 0x00 - 0x13.
+     *
+     * These are defined in assembly in the file "interruptstubs.s"
+     */
+    static void HandleException0x00();
+    static void HandleException0x01();
+    static void HandleException0x02();
+    static void HandleException0x03();
+    static void HandleException0x04();
+    static void HandleException0x05();
+    static void HandleException0x06();
+    static void HandleException0x07();
+    static void HandleException0x08();
+    static void HandleException0x09();
+    static void HandleException0x0A();
+    static void HandleException0x0B();
+    static void HandleException0x0C();
+    static void HandleException0x0D();
+    static void HandleException0x0E();
+    static void HandleException0x0F();
+    static void HandleException0x10();
+    static void HandleException0x11();
+    static void HandleException0x12();
+    static void HandleException0x13();
+
+    /**
+     * @brief The hardware interrupt handlers, one for each of the IRQs 0x00 - 0x0F. (IRQ 0x00 is
+     * the timer, 0x01 the keyboard and 0x0C the mouse; the others go to whatever devices, e.g. PCI
+     * ones, the PICs have them wired to.)
+     *
+     * These are defined in assembly in the file "interruptstubs.s"
      */
     static void HandleInterruptRequest0x00();
+    static void HandleInterruptRequest0x01();
+    static void HandleInterruptRequest0x02();
+    static void HandleInterruptRequest0x03();
+    static void HandleInterruptRequest0x04();
+    static void HandleInterruptRequest0x05();
+    static void HandleInterruptRequest0x06();
+    static void HandleInterruptRequest0x07();
+    static void HandleInterruptRequest0x08();
+    static void HandleInterruptRequest0x09();
+    static void HandleInterruptRequest0x0A();
+    static void HandleInterruptRequest0x0B();
+    static void HandleInterruptRequest0x0C();
+    static void HandleInterruptRequest0x0D();
+    static void HandleInterruptRequest0x0E();
+    static void HandleInterruptRequest0x0F();
 
     /**
-     * @brief The keyboard interrupt handler.
+     * @brief The system call interrupt (int 0x80) handler.
      *
      * This is defined in assembly in the file "interruptstubs.s"
      */
-    static void HandleInterruptRequest0x01();
+    static void HandleSoftwareInterrupt0x80();
 
     /**
-     * @brief The mouse interrupt handler.
+     * @brief The reschedule interrupt (int 0x81) handler. See `TaskManager::Yield`.
      *
      * This is defined in assembly in the file "interruptstubs.s"
      */
-    static void HandleInterruptRequest0x0C();
+    static void HandleSoftwareInterrupt0x81();
+
+    /**
+     * @brief The local APIC interrupt handlers (see smp.h): the wakeup interrupt (0xF0), which
+     * processors send each other, and the timer (0xF1).
+     *
+     * These are defined in assembly in the file "interruptstubs.s"
+     */
+    static void HandleLocalInterrupt0xF0();
+    static void HandleLocalInterrupt0xF1();
 
     /**
      * @brief Ignores a given interrupt.
@@ -6,27 +6,103 @@
 # The following variable essentially says IRQs (interrupt requests) begin 0x20, or, 32 onwards.
 .set IRQ_BASE, 0x20
 
+# The offsets of the kernel data segment and the processor data segment in the GDT (see gdt.cpp).
+.set KERNEL_DATA_SEGMENT, 0x18
+.set PROCESSOR_DATA_SEGMENT, 0x38
+
+# The offset of `switchedFrom` in `ProcessorData` (see percpu.h).
+.set PROCESSOR_SWITCHED_FROM, 4
+
 .section .text
 
 .extern _ZN16InterruptManager15handleInterruptEhj # Comes from `nm interrupts.o`
 
+# Exceptions 0x08, 0x0A - 0x0E and 0x11 come with an error code the CPU pushes. For everything else
+# a 0 is pushed in its place, so that the stack always looks the same (see `CPUState`). The
+# interrupt number goes on the stack too, as every processor may be handling an interrupt at once.
 .macro HandleException num
-.global _ZN16InterruptManager16handleException\num\()Ev
-_ZN16InterruptManager16handleException\num\()Ev:
-    movb $\num, (interruptnumber)
+.global _ZN16InterruptManager19HandleException\num\()Ev
+_ZN16InterruptManager19HandleException\num\()Ev:
+    pushl $0
+    pushl $\num
+    jmp int_bottom
+.endm
+
+.macro HandleExceptionWithErrorCode num
+.global _ZN16InterruptManager19HandleException\num\()Ev
+_ZN16InterruptManager19HandleException\num\()Ev:
+    pushl $\num
     jmp int_bottom
 .endm
 
 .macro HandleInterruptRequest num
 .global _ZN16InterruptManager26HandleInterruptRequest\num\()Ev
 _ZN16InterruptManager26HandleInterruptRequest\num\()Ev:
-    movb $\num + IRQ_BASE, (interruptnumber)
+    pushl $0
+    pushl $\num + IRQ_BASE
+    jmp int_bottom
+.endm
+
+.macro HandleSoftwareInterrupt num
+.global _ZN16InterruptManager27HandleSoftwareInterrupt\num\()Ev
+_ZN16InterruptManager27HandleSoftwareInterrupt\num\()Ev:
+    pushl $0
+    pushl $\num
+    jmp int_bottom
+.endm
+
+# Interrupts from the local APIC: the ones processors send each other, and its timer.
+.macro HandleLocalInterrupt num
+.global _ZN16InterruptManager24HandleLocalInterrupt\num\()Ev
+_ZN16InterruptManager24HandleLocalInterrupt\num\()Ev:
+    pushl $0
+    pushl $\num
     jmp int_bottom
 .endm
 
+HandleException 0x00
+HandleException 0x01
+HandleException 0x02
+HandleException 0x03
+HandleException 0x04
+HandleException 0x05
+HandleException 0x06
+HandleException 0x07
+HandleExceptionWithErrorCode 0x08
+HandleException 0x09
+HandleExceptionWithErrorCode 0x0A
+HandleExceptionWithErrorCode 0x0B
+HandleExceptionWithErrorCode 0x0C
+HandleExceptionWithErrorCode 0x0D
+HandleExceptionWithErrorCode 0x0E
+HandleException 0x0F
+HandleException 0x10
+HandleExceptionWithErrorCode 0x11
+HandleException 0x12
+HandleException 0x13
+
 HandleInterruptRequest 0x00
 HandleInterruptRequest 0x01
+HandleInterruptRequest 0x02
+HandleInterruptRequest 0x03
+HandleInterruptRequest 0x04
+HandleInterruptRequest 0x05
+HandleInterruptRequest 0x06
+HandleInterruptRequest 0x07
+HandleInterruptRequest 0x08
+HandleInterruptRequest 0x09
+HandleInterruptRequest 0x0A
+HandleInterruptRequest 0x0B
 HandleInterruptRequest 0x0C
+HandleInterruptRequest 0x0D
+HandleInterruptRequest 0x0E
+HandleInterruptRequest 0x0F
+
+HandleSoftwareInterrupt 0x80
+HandleSoftwareInterrupt 0x81
+
+HandleLocalInterrupt 0xF0
+HandleLocalInterrupt 0xF1
 
 int_bottom:
     pusha
@@ -35,25 +111,41 @@ int_bottom:
     pushl %fs
     pushl %gs
 
+    # If we came from ring 3, the data segment registers hold the user data segment, and GS
+    # whatever the program left in it.
+    movw $KERNEL_DATA_SEGMENT, %ax
+    movw %ax, %ds
+    movw %ax, %es
+    movw $PROCESSOR_DATA_SEGMENT, %ax
+    movw %ax, %gs
+
+    # The interrupt number is right above the registers pushed (12 of them).
     pushl %esp
-    push (interruptnumber)
+    pushl 52(%esp)
     call _ZN16InterruptManager15handleInterruptEhj
     # Normally, we would restore the stack pointer here, but we don't need to
     # because we are going to overwrite it below.
     movl %eax, %esp
 
+    # If that was a task switch, the task switched away from may now run on other processors, as
+    # its stack is no longer in use.
+    movl %gs:PROCESSOR_SWITCHED_FROM, %eax
+    testl %eax, %eax
+    jz 1f
+    movb $0, (%eax)
+    movl $0, %gs:PROCESSOR_SWITCHED_FROM
+1:
     popl %gs
     popl %fs
     popl %es
     popl %ds
     popa
 
+    # Drops the interrupt number and the error code.
+    addl $8, %esp
+
 # .extern <symbol> -> This symbol is defined elsewhere.
 # .global <symbol> -> This symbol is defined here.
 .global _ZN16InterruptManager22IgnoreInterruptRequestEv
 _ZN16InterruptManager22IgnoreInterruptRequestEv:
     iret
-
-.data
-interruptnumber: .byte 0
-
@@ -0,0 +1,219 @@
+#include "ipc.h"
+#include "memorymanagement.h"
+#include "multitasking.h"
+
+/** MessagePort Class */
+
+static LockClass messagePortLockClass("message port");
+static LockClass portTableLockClass("port table");
+
+MessagePort *MessagePort::ports[MessagePort::MAX_PORTS];
+Spinlock MessagePort::portsLock(&portTableLockClass);
+
+MessagePort::MessagePort() : lock(&messagePortLockClass)
+{
+    head = 0;
+    count = 0;
+    for (uint32_t i = 0; i < MAX_CALLS; i++)
+    {
+        calls[i] = 0;
+    }
+
+    id = IPC_ERROR;
+    SpinlockGuard guard(&portsLock);
+    for (uint32_t i = 0; i < MAX_PORTS; i++)
+    {
+        if (ports[i] == 0)
+        {
+            ports[i] = this;
+            id = i;
+            break;
+        }
+    }
+}
+
+MessagePort::~MessagePort()
+{
+    if (id != IPC_ERROR)
+    {
+        SpinlockGuard guard(&portsLock);
+        ports[id] = 0;
+    }
+
+    Message none = {{0, 0}, 0, 0};
+    for (uint32_t i = 0; i < count; i++)
+    {
+        QueuedMessage *entry = &queue[(head + i) % QUEUE_SIZE];
+        if (entry->call != 0)
+        {
+            Finish(entry->call, &none, false);
+        }
+        if (entry->message.frames != 0)
+        {
+            for (uint32_t j = 0; j < entry->message.pages; j++)
+            {
+                PhysicalMemoryManager::activePhysicalMemoryManager->FreeFrame(
+                    entry->message.frames[j]);
+            }
+            delete[] entry->message.frames;
+        }
+    }
+    for (uint32_t i = 0; i < MAX_CALLS; i++)
+    {
+        if (calls[i] != 0)
+        {
+            Finish(calls[i], &none, false);
+        }
+    }
+}
+
+MessagePort *MessagePort::Get(uint32_t id)
+{
+    if (id >= MAX_PORTS)
+    {
+        return 0;
+    }
+    SpinlockGuard guard(&portsLock);
+    return ports[id];
+}
+
+uint32_t MessagePort::Id() { return id; }
+
+bool MessagePort::Enqueue(const Message *message, PendingCall *call)
+{
+    {
+        SpinlockGuard guard(&lock);
+        if (count == QUEUE_SIZE)
+        {
+            return false;
+        }
+        QueuedMessage *entry = &queue[(head + count) % QUEUE_SIZE];
+        entry->message = *message;
+        entry->call = call;
+        count++;
+    }
+    TaskManager::activeTaskManager->Wakeup(this);
+    return true;
+}
+
+void MessagePort::Finish(PendingCall *call, const Message *reply, bool succeeded)
+{
+    call->reply = *reply;
+    call->succeeded = succeeded;
+    call->done = true;
+    TaskManager::activeTaskManager->Wakeup(call);
+}
+
+bool MessagePort::Send(const Message *message) { return Enqueue(message, 0); }
+
+bool MessagePort::Call(Message *message)
+{
+    PendingCall call;
+    call.succeeded = false;
+    call.done = false;
+
+    uint32_t eflags;
+    asm volatile("pushfl\n"
+                 "popl %0\n"
+                 "cli"
+                 : "=r"(eflags));
+
+    bool queued = Enqueue(message, &call);
+    while (queued && !call.done)
+    {
+        TaskManager::activeTaskManager->Sleep(&call);
+    }
+
+    asm volatile("pushl %0\n"
+                 "popfl"
+                 :
+                 : "r"(eflags)
+                 : "cc");
+
+    if (!queued || !call.succeeded)
+    {
+        return false;
+    }
+    *message = call.reply;
+    return true;
+}
+
+uint32_t MessagePort::Receive(Message *message)
+{
+    uint32_t eflags;
+    asm volatile("pushfl\n"
+                 "popl %0\n"
+                 "cli"
+                 : "=r"(eflags));
+
+    uint32_t token = 0;
+    while (true)
+    {
+        bool received = false;
+        PendingCall *dropped = 0;
+        {
+            SpinlockGuard guard(&lock);
+            if (count != 0)
+            {
+                QueuedMessage *entry = &queue[head];
+                head = (head + 1) % QUEUE_SIZE;
+                count--;
+                *message = entry->message;
+                received = true;
+
+                /**
+                 * A call that can't be kept track of (too many are waiting for replies) is
+                 * dropped, and the next message taken instead.
+                 */
+                if (entry->call != 0)
+                {
+                    dropped = entry->call;
+                    for (uint32_t i = 0; i < MAX_CALLS; i++)
+                    {
+                        if (calls[i] == 0)
+                        {
+                            calls[i] = entry->call;
+                            token = i + 1;
+                            dropped = 0;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (dropped != 0)
+        {
+            Finish(dropped, message, false);
+            continue;
+        }
+        if (received)
+        {
+            break;
+        }
+        TaskManager::activeTaskManager->Sleep(this);
+    }
+
+    asm volatile("pushl %0\n"
+                 "popfl"
+                 :
+                 : "r"(eflags)
+                 : "cc");
+    return token;
+}
+
+bool MessagePort::Reply(uint32_t token, const Message *message)
+{
+    PendingCall *call;
+    {
+        SpinlockGuard guard(&lock);
+        if (token == 0 || token > MAX_CALLS || calls[token - 1] == 0)
+        {
+            return false;
+        }
+        call = calls[token - 1];
+        calls[token - 1] = 0;
+    }
+    Finish(call, message, true);
+    return true;
+}
@@ -0,0 +1,153 @@
+/**
+ * @file ipc.h
+ * @author rohan843
+ * @brief Contains the message ports tasks exchange messages through.
+ *
+ * A message is 2 words, which system calls pass in registers (`esi` and `edi`, both ways), so
+ * small messages never touch memory on the `sysenter` path. A message may instead carry pages: the
+ * sender's frames are unmapped and mapped into the receiver's address space, so a buffer of any
+ * size moves without being copied.
+ *
+ * Messages are sent to a port, and received from it by whichever task asks first. `Send` queues
+ * a message and returns (asynchronous); `Call` sends one and sleeps until the receiver replies to
+ * it (synchronous). Receivers sleep until a message comes.
+ */
+
+#ifndef __IPC_H
+#define __IPC_H
+
+#include "spinlock.h"
+#include "types.h"
+
+const uint32_t IPC_MESSAGE_WORDS = 2;
+
+/**
+ * What the IPC system calls return when they fail.
+ */
+const uint32_t IPC_ERROR = 0xFFFFFFFF;
+
+/**
+ * Set in what `SYSCALL_IPC_RECEIVE` returns when the message carried pages, in which case the
+ * words are the address they were mapped at and their number.
+ */
+const uint32_t IPC_RECEIVED_PAGES = 0x80000000;
+
+/**
+ * The most pages a message may carry (4 MiB).
+ */
+const uint32_t IPC_MAX_PAGES = 1024;
+
+struct Message
+{
+    uint32_t words[IPC_MESSAGE_WORDS];
+
+    /**
+     * The frames of the pages the message carries, and how many (`frames` is 0 if none). The
+     * array is allocated with `new[]`, and belongs to the message.
+     */
+    uint32_t *frames;
+    uint32_t pages;
+};
+
+/**
+ * @brief A `Call` waiting for its reply, on the caller's stack.
+ */
+struct PendingCall
+{
+    Message reply;
+    bool succeeded;
+    volatile bool done;
+};
+
+struct QueuedMessage
+{
+    Message message;
+
+    /**
+     * The call the message was sent by, or 0 if it was sent by `Send`.
+     */
+    PendingCall *call;
+};
+
+class MessagePort
+{
+  protected:
+    static const uint32_t MAX_PORTS = 64;
+    static const uint32_t QUEUE_SIZE = 32;
+    static const uint32_t MAX_CALLS = 16;
+
+    uint32_t id;
+
+    QueuedMessage queue[QUEUE_SIZE];
+    uint32_t head;
+    uint32_t count;
+
+    /**
+     * The calls received and not replied to yet. A reply token is an index into this, plus 1.
+     */
+    PendingCall *calls[MAX_CALLS];
+
+    Spinlock lock;
+
+    static MessagePort *ports[MAX_PORTS];
+    static Spinlock portsLock;
+
+    /**
+     * @brief Queues a message and wakes up the receivers.
+     */
+    bool Enqueue(const Message *message, PendingCall *call);
+
+    /**
+     * @brief Ends a call, waking up its caller.
+     */
+    static void Finish(PendingCall *call, const Message *reply, bool succeeded);
+
+  public:
+    /**
+     * @brief Creates a port, and gives it the first free number (`IPC_ERROR` if there is none).
+     */
+    MessagePort();
+
+    /**
+     * @brief Fails the calls waiting on the port, and frees the pages queued messages carry. No
+     * task may be receiving from it any more.
+     */
+    ~MessagePort();
+
+    /**
+     * @return The port with a number, or 0 if there is none.
+     */
+    static MessagePort *Get(uint32_t id);
+    uint32_t Id();
+
+    /**
+     * @brief Queues a message. The pages it carries belong to the port from then on.
+     *
+     * @return false if the queue is full.
+     */
+    bool Send(const Message *message);
+
+    /**
+     * @brief Sends a message (that carries no pages) and waits for the reply, which replaces it.
+     *
+     * @return false if the queue is full, or the call was dropped.
+     */
+    bool Call(Message *message);
+
+    /**
+     * @brief Takes the oldest message, waiting for one if there is none. The pages it carries
+     * belong to the caller then.
+     *
+     * @return The token to reply with, or 0 if the message needs no reply.
+     */
+    uint32_t Receive(Message *message);
+
+    /**
+     * @brief Replies to a call received (with a message that carries no pages).
+     *
+     * @return false if the token isn't one of a call waiting for its reply.
+     */
+    bool Reply(uint32_t token, const Message *message);
+};
+
+#endif
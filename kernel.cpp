@@ -1,9 +1,32 @@
+#include "acpi.h"
+#include "ata.h"
+#include "benchmark.h"
+#include "blockcache.h"
+#include "compositor.h"
+#include "driver.h"
+#include "e1000.h"
+#include "elf.h"
+#include "fat.h"
 #include "gdt.h"
+#include "graphics.h"
+#include "initrd.h"
+#include "input.h"
 #include "interrupts.h"
 #include "keyboard.h"
+#include "memorymanagement.h"
 #include "mouse.h"
+#include "multiboot.h"
+#include "multitasking.h"
+#include "pci.h"
+#include "paging.h"
+#include "ps2.h"
+#include "smp.h"
 #include "stdio.h"
+#include "syscalls.h"
+#include "timer.h"
+#include "tty.h"
 #include "types.h"
+#include "virtio.h"
 
 /**
  * This piece of code runs all the C++ constructors for any global or static objects.
@@ -30,11 +53,54 @@ extern "C" void callConstructors()
     }
 }
 
+/**
+ * @brief Starts a program loaded at boot, reporting if that fails.
+ *
+ * @param name What to call the program in messages.
+ */
+static void StartProgram(ElfProgram *program, const char *name, GlobalDescriptorTable *gdt,
+                         TaskManager *taskManager)
+{
+#ifdef BENCHMARK
+    RunElfLoaderBenchmark(program, gdt);
+#endif
+    if (program->Start(gdt, taskManager) == 0)
+    {
+        printf("Could not start ");
+        printf(name);
+        printf("\n");
+    }
+}
+
+/**
+ * @brief Writes back each line typed on the second terminal (Alt+F2). It sleeps while waiting.
+ */
+static void EchoLines()
+{
+    TTY *tty = TTY::Get(1);
+    tty->Write("Lines typed here are written back.\n");
+    char line[81];
+    while (true)
+    {
+        uint32_t length = tty->Read(line, 80);
+        line[length] = '\0';
+        tty->Write("> ");
+        tty->Write(line);
+    }
+}
+
 /**
  * @brief The main kernel function. This is the entry point into the OS program.
  */
 extern "C" void kernelMain(const void *multiboot_structure, uint32_t magicnumber)
 {
+#ifdef BENCHMARK
+    /**
+     * The time stamp counter starts at 0 on reset, so this is the time the bootloader took
+     * (loading the boot modules included).
+     */
+    uint64_t bootloaderCycles = ReadTimestampCounter();
+#endif
 
     printf("Code runs like a flowing stream,\n");
     printf("Bits and bytes weave the dream,\n");
@@ -43,14 +109,214 @@ extern "C" void kernelMain(const void *multiboot_structure, uint32_t magicnumber
     printf("~ Copilot\n");
     printf("Run #1\n");
 
+    if (magicnumber != MULTIBOOT_BOOTLOADER_MAGIC)
+    {
+        printf("Not loaded by a multiboot bootloader.\n");
+        return;
+    }
+    const MultibootInfo *multibootInfo = (const MultibootInfo *)multiboot_structure;
+
     GlobalDescriptorTable gdt;
-    InterruptManager interrupts(&gdt);
-    KeyboardDriver keyboard(&interrupts);
-    MouseDriver mouse(&interrupts);
+
+    /**
+     * The heap takes a quarter of the free memory, up to 16 MiB.
+     */
+    PhysicalMemoryManager physicalMemory(multibootInfo);
+    uint32_t heapSize = physicalMemory.FreeFrameCount() / 4 * PAGE_SIZE;
+    if (heapSize > 16 * 1024 * 1024)
+    {
+        heapSize = 16 * 1024 * 1024;
+    }
+    MemoryManager memoryManager(physicalMemory.AllocateFrames(heapSize / PAGE_SIZE), heapSize);
+    AddressSpace::InitializeKernel();
+
+    TaskManager taskManager(&gdt);
+    InterruptManager interrupts(&gdt, &taskManager);
+    PageFaultHandler pageFaults(&interrupts, &taskManager);
+    SyscallHandler syscalls(&interrupts, &gdt, &taskManager);
+    SystemTimer timer(&interrupts, &taskManager);
+
+    DriverManager drivers;
+    PS2Controller ps2(&interrupts);
+    InputEventQueue inputEvents;
+    KeyboardDriver keyboard(&inputEvents);
+    ps2.Attach(0, &keyboard);
+    MouseDriver mouse(&inputEvents);
+    ps2.Attach(1, &mouse);
+    drivers.AddDriver(&ps2);
+
+    /**
+     * Records the PS/2 bytes while Scroll Lock is on (up to 16384 of them).
+     */
+    InputTrace inputTrace(&mouse, 16384);
+    ps2.SetRecorder(&inputTrace);
+
+    /**
+     * Scans the PCI bus once, then gives each device found to the first registered driver that
+     * matches it.
+     */
+    PeripheralComponentInterconnectController pci;
+    pci.RegisterDriver(&IntegratedDriveElectronicsController::DriverEntry);
+    pci.RegisterDriver(&VirtioBlockDevice::DriverEntry);
+    pci.RegisterDriver(&IntelEthernetController::DriverEntry);
+    pci.EnumerateDevices();
+    pci.PrintDevices();
+#ifdef BENCHMARK
+    RunPciBenchmark(&pci);
+#endif
+    pci.SelectDrivers(&drivers, &interrupts);
+
+    drivers.ActivateAll();
 
     // Begin processing interrupts, once the hardware has been initialized above.
     interrupts.Activate();
 
-    while (1)
-        ;
-}
\ No newline at end of file
+    /**
+     * Starts the other processors listed in the ACPI tables. They run tasks too, and the work
+     * handed to them when they have none.
+     */
+    GraphicsDevice::EnableSSE2();
+    ACPITables acpi;
+    ProcessorManager processors(&acpi, &interrupts, &gdt);
+    processors.StartApplicationProcessors();
+
+    /**
+     * In a graphics mode, the compositor draws the desktop (for now, just the background and the
+     * mouse cursor). Without one (QEMU's `-kernel` can't set one), the kernel keeps printing to the
+     * VGA text buffer.
+     */
+    GraphicsDevice *graphics = GraphicsDevice::FromMultiboot(multibootInfo);
+    if (graphics != 0)
+    {
+        Compositor *compositor = new Compositor(graphics, 0x00203050);
+        compositor->Render();
+    }
+
+    /**
+     * The console task hands the keys typed to the TTY of the terminal shown, and moves the mouse
+     * pointer (the compositor's cursor, if there is one). A task on the second terminal writes back
+     * the lines typed there.
+     */
+    InputConsole inputConsole(&inputEvents, &inputTrace);
+    inputConsole.Start();
+    taskManager.StartKernelTask(&EchoLines);
+
+    /**
+     * Filesystems read their devices through a 4 MiB block cache.
+     */
+    BlockCache blockCache(1024);
+
+    for (uint32_t i = 0; i < BlockDevice::Count(); i++)
+    {
+        BlockDevice *device = BlockDevice::Get(i);
+        uint32_t firstSector;
+        if (FileAllocationTable::FindVolume(&blockCache, device, &firstSector) &&
+            (new FileAllocationTable(&blockCache, device, firstSector))->Mounted())
+        {
+            printf("fat32: ");
+            printf(device->Name());
+            printf("\n");
+        }
+    }
+
+#ifdef BENCHMARK
+    PrintBenchmarkResult("boot: reset to kernelMain", bootloaderCycles, 1);
+    RunSyscallBenchmark(&syscalls);
+    if (IntegratedDriveElectronicsController::activeController != 0)
+    {
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            AdvancedTechnologyAttachment *drive =
+                IntegratedDriveElectronicsController::activeController->Drive(i);
+            if (drive != 0)
+            {
+                RunAtaBenchmark(drive);
+            }
+        }
+    }
+    if (VirtioBlockDevice::activeVirtioBlockDevice != 0)
+    {
+        RunVirtioBlockBenchmark(VirtioBlockDevice::activeVirtioBlockDevice);
+    }
+    if (BlockDevice::Count() > 0)
+    {
+        RunBlockCacheBenchmark(&blockCache, BlockDevice::Get(0));
+    }
+    if (FileAllocationTable::activeFileAllocationTable != 0)
+    {
+        RunFileAllocationTableBenchmark(FileAllocationTable::activeFileAllocationTable);
+    }
+    if (NetworkDevice::Count() > 0)
+    {
+        RunNetworkBenchmark(NetworkDevice::Get(0));
+    }
+#endif
+
+    /**
+     * Every boot module that is an ELF program gets started, and so does every ELF program in the
+     * `bin` directory of an initrd. The program objects are never freed, as they hold the text
+     * pages shared by all instances.
+     */
+    if (multibootInfo->flags & MULTIBOOT_INFO_MODULES)
+    {
+        MultibootModule *modules = (MultibootModule *)multibootInfo->moduleAddress;
+        for (uint32_t i = 0; i < multibootInfo->moduleCount; i++)
+        {
+            const uint8_t *image = (const uint8_t *)modules[i].start;
+            uint32_t size = modules[i].end - modules[i].start;
+
+            if (InitialRamdisk::IsTar(image, size))
+            {
+#ifdef BENCHMARK
+                RunInitrdBenchmark(image, size);
+#endif
+                InitialRamdisk *initrd = new InitialRamdisk(image, size);
+                printf("initrd: ");
+                printfDec(initrd->FileCount());
+                printf(" files\n");
+
+                for (uint32_t j = 0; j < initrd->FileCount(); j++)
+                {
+                    const char *path = initrd->File(j)->path;
+                    if (path[0] != 'b' || path[1] != 'i' || path[2] != 'n' || path[3] != '/')
+                    {
+                        continue;
+                    }
+                    InitrdFile *file = initrd->Open(path);
+                    if (file == 0 || !ElfProgram::IsElf(file->data, file->size))
+                    {
+                        continue;
+                    }
+                    StartProgram(new ElfProgram(file->data, file->size), path, &gdt,
+                                 &taskManager);
+                }
+                continue;
+            }
+
+            if (ElfProgram::IsElf(image, size))
+            {
+                StartProgram(new ElfProgram(image, size), (const char *)modules[i].string, &gdt,
+                             &taskManager);
+            }
+        }
+    }
+
+#ifdef BENCHMARK
+    RunInputBenchmark(&ps2, &inputTrace, &inputEvents, &inputConsole);
+    RunProcessorBenchmark(&processors);
+    RunSchedulerBenchmark(&taskManager, &processors);
+    RunSpinlockBenchmark(&processors);
+    RunTimerBenchmark();
+    RunGraphicsBenchmark(graphics);
+    RunCompositorBenchmark(graphics);
+    RunTerminalBenchmark();
+    RunTTYBenchmark(&taskManager);
+    RunIPCBenchmark(&gdt, &taskManager);
+    RunSyncBenchmark(&gdt, &taskManager);
+#endif
+
+    /**
+     * The boot task is done. The objects above stay valid, as the boot stack is never freed.
+     */
+    taskManager.Exit();
+}
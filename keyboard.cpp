@@ -1,217 +1,304 @@
 #include "keyboard.h"
 #include "stdio.h"
 
-KeyboardDriver::KeyboardDriver(InterruptManager *manager)
-    : InterruptHandler(0x21, manager), dataport(0x60), commandport(0x64)
+/**
+ * Bytes the keyboard sends that aren't keys: acknowledgement, resend request, and errors.
+ */
+const uint8_t KEYBOARD_ACK = 0xFA;
+const uint8_t KEYBOARD_RESEND = 0xFE;
+const uint8_t KEYBOARD_ERROR = 0x00;
+const uint8_t KEYBOARD_OVERRUN = 0xFF;
+
+const uint8_t KEYBOARD_EXTENDED = 0xE0;
+const uint8_t KEYBOARD_PAUSE = 0xE1;
+
+/**
+ * An 0xE0 byte before a Shift make or break code marks a "fake" Shift, which the keyboard sends
+ * around Print Screen and the keys it shares the keypad's navigation keys with. They are ignored.
+ */
+const uint8_t KEY_FAKE_LEFT_SHIFT = 0x80 | KEY_LEFT_SHIFT;
+const uint8_t KEY_FAKE_RIGHT_SHIFT = 0x80 | KEY_RIGHT_SHIFT;
+
+/**
+ * The characters of the keypad keys (0x47 - 0x53), without and with Num Lock. Without it, they are
+ * the navigation keys, which type nothing.
+ */
+constexpr char keypadCharacters[2][KEY_KEYPAD_PERIOD - KEY_KEYPAD_7 + 1] = {
+    {0, 0, 0, '-', 0, 0, 0, '+', 0, 0, 0, 0, 0},
+    {'7', '8', '9', '-', '4', '5', '6', '+', '1', '2', '3', '0', '.'}};
+
+/**
+ * @brief Returns the bits of the table indexes from `first` to `last`.
+ */
+constexpr uint64_t KeyRange(uint32_t first, uint32_t last)
 {
-    /**
-     * Flushes the keyboard controller's output buffer before the keyboard driver starts.
-     *
-     * The condition below checks the bit 0 of the command port. If it is set, that means data is
-     * present in the keyboard's output buffer.
-     */
-    while (commandport.Read() & 0x1)
+    return ((2ULL << last) - 1) & ~((1ULL << first) - 1);
+}
+
+/** KeyboardLayout Class */
+
+const KeyboardLayout KeyboardLayout::UnitedStates = {
+    "us",
+    {"\0\x1B"
+     "1234567890-="
+     "\b\t"
+     "qwertyuiop[]"
+     "\n\0"
+     "asdfghjkl;'`"
+     "\0\\"
+     "zxcvbnm,./"
+     "\0*\0 "
+     "\0",
+     "\0\x1B"
+     "!@#$%^&*()_+"
+     "\b\t"
+     "QWERTYUIOP{}"
+     "\n\0"
+     "ASDFGHJKL:\"~"
+     "\0|"
+     "ZXCVBNM<>?"
+     "\0*\0 "
+     "\0",
+     "", ""},
+    KeyRange(0x10, 0x19) | KeyRange(0x1E, 0x26) | KeyRange(0x2C, 0x32)};
+
+/**
+ * The German layout swaps Y and Z, and has the umlauts and ß. Its dead keys type their accent
+ * straight away (^ and `), but for ´, which code page 437 has no character for.
+ */
+const KeyboardLayout KeyboardLayout::German = {
+    "de",
+    {"\0\x1B"
+     "1234567890\xE1"
+     "\0"
+     "\b\t"
+     "qwertzuiop\x81+"
+     "\n\0"
+     "asdfghjkl\x94\x84^"
+     "\0#"
+     "yxcvbnm,.-"
+     "\0*\0 "
+     "<",
+     "\0\x1B"
+     "!\"\x15$%&/()=?`"
+     "\b\t"
+     "QWERTZUIOP\x9A*"
+     "\n\0"
+     "ASDFGHJKL\x99\x8E\xF8"
+     "\0'"
+     "YXCVBNM;:_"
+     "\0*\0 "
+     ">",
+     "\0\0\0"
+     "\xFD"
+     "\0\0\0\0"
+     "{[]}\\"
+     "\0\0\0"
+     "@"
+     "\0\0\0\0\0\0\0\0\0\0"
+     "~"
+     "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0"
+     "\xE6"
+     "\0\0\0\0\0\0\0"
+     "|",
+     ""},
+    KeyRange(0x10, 0x1A) | KeyRange(0x1E, 0x28) | KeyRange(0x2C, 0x32)};
+
+/** KeyboardEventHandler Class */
+
+KeyboardEventHandler::KeyboardEventHandler() {}
+
+KeyboardEventHandler::~KeyboardEventHandler() {}
+
+void KeyboardEventHandler::OnKeyEvent(KeyboardEvent event)
+{
+    if (event.pressed && event.character != '\0')
     {
-        dataport.Read();
+        char str[2] = {event.character, '\0'};
+        printf(str);
     }
+}
 
-    /**
-     * Tells the keyboard controller to start sending data to the CPU (through the PIC interrupts).
-     */
-    commandport.Write(0xAE);
-
-    /**
-     * Gets the current state of the keyboard controller's status byte on the data port.
-     */
-    commandport.Write(0x20);
+/** KeyboardDriver Class */
 
-    /**
-     * Stores the state of the PS/2 controller, and:
-     *
-     * 1. Sets the bit 0 to 1. This enables keyboard interrupts (IRQ1).
-     * 2. Unsets the bit 4 to 0. This enables keyboard clock.
-     */
-    uint8_t status = (dataport.Read() | 0b1) & (~0x10);
+KeyboardDriver::KeyboardDriver(KeyboardEventHandler *handler)
+{
+    this->handler = handler;
+    this->layout = &KeyboardLayout::UnitedStates;
 
     /**
-     * Change the status byte and write the new one to the controller.
+     * The firmware usually turns Num Lock on at boot.
      */
-    commandport.Write(0x60);
-    dataport.Write(status);
+    modifiers = MODIFIER_NUM_LOCK;
+    extended = false;
+    pauseBytes = 0;
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        keysDown[i] = 0;
+    }
+}
 
+bool KeyboardDriver::Activate(PS2Controller *controller)
+{
     /**
      * Asks the keyboard to begin sending keypress scan codes.
      */
-    dataport.Write(0xF4);
+    return controller->CommandDevice(0, 0xF4);
 }
 
 KeyboardDriver::~KeyboardDriver() {}
 
-char us_qwerty_scancode_to_char(uint8_t scancode)
-{
-    static bool shift = false;
-    static bool capslock = false;
+void KeyboardDriver::SetLayout(const KeyboardLayout *layout) { this->layout = layout; }
 
-    if (scancode == 0x2A || scancode == 0x36)
+char KeyboardDriver::Translate(uint8_t keyCode, uint16_t modifiers)
+{
+    if (keyCode == KEY_KEYPAD_ENTER)
     {
-        shift = true;
-        return '\0';
+        return '\n';
     }
-    else if (scancode == 0xAA || scancode == 0xB6)
+    if (keyCode == KEY_KEYPAD_SLASH)
     {
-        shift = false;
-        return '\0';
+        return '/';
+    }
+    if (KEY_KEYPAD_7 <= keyCode && keyCode <= KEY_KEYPAD_PERIOD)
+    {
+        return keypadCharacters[(modifiers & MODIFIER_NUM_LOCK) ? 1 : 0][keyCode - KEY_KEYPAD_7];
     }
 
-    if (scancode == 0x3A)
+    uint32_t index = keyCode == KEY_102ND ? KeyboardLayout::KEYS - 1 : keyCode;
+    if (index >= KeyboardLayout::KEYS)
     {
-        capslock = !capslock;
         return '\0';
     }
 
-    bool uppercase = shift xor capslock;
-
-    switch (scancode)
-    {
-    case 0x02:
-        return shift ? '!' : '1';
-    case 0x03:
-        return shift ? '@' : '2';
-    case 0x04:
-        return shift ? '#' : '3';
-    case 0x05:
-        return shift ? '$' : '4';
-    case 0x06:
-        return shift ? '%' : '5';
-    case 0x07:
-        return shift ? '^' : '6';
-    case 0x08:
-        return shift ? '&' : '7';
-    case 0x09:
-        return shift ? '*' : '8';
-    case 0x0A:
-        return shift ? '(' : '9';
-    case 0x0B:
-        return shift ? ')' : '0';
-    case 0x0C:
-        return shift ? '_' : '-';
-    case 0x0D:
-        return shift ? '+' : '=';
-    case 0x0E:
-        return '\b'; // Backspace
-    case 0x0F:
-        return '\t'; // Tab
-    case 0x10:
-        return uppercase ? 'Q' : 'q';
-    case 0x11:
-        return uppercase ? 'W' : 'w';
-    case 0x12:
-        return uppercase ? 'E' : 'e';
-    case 0x13:
-        return uppercase ? 'R' : 'r';
-    case 0x14:
-        return uppercase ? 'T' : 't';
-    case 0x15:
-        return uppercase ? 'Y' : 'y';
-    case 0x16:
-        return uppercase ? 'U' : 'u';
-    case 0x17:
-        return uppercase ? 'I' : 'i';
-    case 0x18:
-        return uppercase ? 'O' : 'o';
-    case 0x19:
-        return uppercase ? 'P' : 'p';
-    case 0x1A:
-        return shift ? '{' : '[';
-    case 0x1B:
-        return shift ? '}' : ']';
-    case 0x1C:
-        return '\n'; // Enter
-    case 0x1E:
-        return uppercase ? 'A' : 'a';
-    case 0x1F:
-        return uppercase ? 'S' : 's';
-    case 0x20:
-        return uppercase ? 'D' : 'd';
-    case 0x21:
-        return uppercase ? 'F' : 'f';
-    case 0x22:
-        return uppercase ? 'G' : 'g';
-    case 0x23:
-        return uppercase ? 'H' : 'h';
-    case 0x24:
-        return uppercase ? 'J' : 'j';
-    case 0x25:
-        return uppercase ? 'K' : 'k';
-    case 0x26:
-        return uppercase ? 'L' : 'l';
-    case 0x27:
-        return shift ? ':' : ';';
-    case 0x28:
-        return shift ? '"' : '\'';
-    case 0x29:
-        return shift ? '~' : '`';
-    case 0x2C:
-        return uppercase ? 'Z' : 'z';
-    case 0x2D:
-        return uppercase ? 'X' : 'x';
-    case 0x2E:
-        return uppercase ? 'C' : 'c';
-    case 0x2F:
-        return uppercase ? 'V' : 'v';
-    case 0x30:
-        return uppercase ? 'B' : 'b';
-    case 0x31:
-        return uppercase ? 'N' : 'n';
-    case 0x32:
-        return uppercase ? 'M' : 'm';
-    case 0x33:
-        return shift ? '<' : ',';
-    case 0x34:
-        return shift ? '>' : '.';
-    case 0x35:
-        return shift ? '?' : '/';
-    case 0x39:
-        return ' '; // Space
-    default:
-        return '\0';
+    /**
+     * Caps Lock only works on the letters, so not along with AltGr.
+     */
+    bool shift = (modifiers & MODIFIER_SHIFT) != 0;
+    bool altGr = (modifiers & MODIFIER_ALT_GR) != 0;
+    if ((modifiers & MODIFIER_CAPS_LOCK) && !altGr && ((layout->capsLockKeys >> index) & 1))
+    {
+        shift = !shift;
     }
+    char character = layout->characters[(shift ? 1 : 0) | (altGr ? 2 : 0)][index];
+
+    /**
+     * Ctrl with a letter types its control character, e.g., Ctrl + C is 0x03.
+     */
+    if ((modifiers & MODIFIER_CTRL) &&
+        (('a' <= character && character <= 'z') || ('A' <= character && character <= 'Z')))
+    {
+        character &= 0x1F;
+    }
+    return character;
 }
 
-uint32_t KeyboardDriver::HandleInterrupt(uint32_t esp)
+void KeyboardDriver::HandleKey(uint8_t keyCode, bool pressed)
 {
-    uint8_t key = dataport.Read();
+    uint32_t bit = 1 << (keyCode % 32);
+    bool repeat = pressed && (keysDown[keyCode / 32] & bit);
+    if (pressed)
+    {
+        keysDown[keyCode / 32] |= bit;
+    }
+    else
+    {
+        keysDown[keyCode / 32] &= ~bit;
+    }
 
-    switch (key)
+    uint16_t modifier = 0;
+    uint16_t lock = 0;
+    switch (keyCode)
     {
-    /**
-     * Ignoring Num lock.
-     */
-    case 0x45:
+    case KEY_LEFT_SHIFT:
+        modifier = MODIFIER_LEFT_SHIFT;
+        break;
+    case KEY_RIGHT_SHIFT:
+        modifier = MODIFIER_RIGHT_SHIFT;
         break;
+    case KEY_LEFT_CTRL:
+        modifier = MODIFIER_LEFT_CTRL;
+        break;
+    case KEY_RIGHT_CTRL:
+        modifier = MODIFIER_RIGHT_CTRL;
+        break;
+    case KEY_LEFT_ALT:
+        modifier = MODIFIER_LEFT_ALT;
+        break;
+    case KEY_RIGHT_ALT:
+        modifier = MODIFIER_RIGHT_ALT;
+        break;
+    case KEY_CAPS_LOCK:
+        lock = MODIFIER_CAPS_LOCK;
+        break;
+    case KEY_NUM_LOCK:
+        lock = MODIFIER_NUM_LOCK;
+        break;
+    case KEY_SCROLL_LOCK:
+        lock = MODIFIER_SCROLL_LOCK;
+        break;
+    }
+
+    if (pressed)
+    {
+        modifiers |= modifier;
+    }
+    else
+    {
+        modifiers &= ~modifier;
+    }
+    if (pressed && !repeat)
+    {
+        modifiers ^= lock;
+    }
+
+    if (handler != 0)
+    {
+        KeyboardEvent event;
+        event.keyCode = keyCode;
+        event.pressed = pressed;
+        event.modifiers = modifiers;
+        event.character = Translate(keyCode, modifiers);
+        handler->OnKeyEvent(event);
+    }
+}
+
+void KeyboardDriver::HandleByte(uint8_t byte)
+{
     /**
-     * Ignoring ACK messages.
+     * Pause has no break code: pressing it sends 0xE1 0x1D 0x45 (press) and 0xE1 0x9D 0xC5
+     * (release) at once.
      */
-    case 0xFA:
-        break;
-    default:
-        char result = us_qwerty_scancode_to_char(key);
-        if (result != '\0')
+    if (pauseBytes > 0)
+    {
+        pauseBytes--;
+        if (pauseBytes == 0)
         {
-            char *str = " ";
-            str[0] = result;
-            printf(str);
+            HandleKey(KEY_PAUSE, !(byte & 0x80));
         }
-        // else
-        // {
-        //     char *str = "\nKeyboard: 0x__";
-        //     char *hex = "0123456789ABCDEF";
-        //     str[13] = hex[(key >> 4) & 0xF];
-        //     str[14] = hex[key & 0xF];
-        //     printf(str);
-        // }
-        break;
+        return;
     }
 
-    return esp;
+    switch (byte)
+    {
+    case KEYBOARD_ACK:
+    case KEYBOARD_RESEND:
+    case KEYBOARD_ERROR:
+    case KEYBOARD_OVERRUN:
+        return;
+    case KEYBOARD_EXTENDED:
+        extended = true;
+        return;
+    case KEYBOARD_PAUSE:
+        pauseBytes = 2;
+        return;
+    }
+
+    uint8_t keyCode = (byte & 0x7F) | (extended ? 0x80 : 0);
+    extended = false;
+    if (keyCode == KEY_FAKE_LEFT_SHIFT || keyCode == KEY_FAKE_RIGHT_SHIFT)
+    {
+        return;
+    }
+    HandleKey(keyCode, !(byte & 0x80));
 }
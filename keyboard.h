@@ -3,10 +3,16 @@
  * @author rohan843
  * @brief Contains the driver for the keyboard.
  *
- * This driver will setup the keyboard in such a manner that any byte sent to the data port of the
- * keyboard will interrupt the CPU. It is the handler's responsibility to appropriately interpret
- * the byte. (For e.g., the byte could be a key scan code, an acknowledgement from the keyboard,
- * or something else.)
+ * The keyboard is connected to the first port of the PS/2 controller, which hands this driver every
+ * byte the keyboard sends. It is the driver's responsibility to appropriately interpret the byte.
+ * (For e.g., the byte could be a key scan code, an acknowledgement from the keyboard, or something
+ * else.)
+ *
+ * The controller translates scan codes to set 1, where a key sends its make code when pressed and
+ * the make code with bit 7 set when released. Keys added after the original PC keyboard (arrows,
+ * right Ctrl and Alt, the keypad's Enter and /, etc.) send an 0xE0 byte first, and Pause sends a
+ * sequence of its own starting with 0xE1. The driver turns these into key events, and looks the
+ * characters up in the tables of a keyboard layout.
  *
  * @note In actual hardware, we have a different set of connections that reach the keyboard. There
  * might be USB connections or other connections, and this driver currently doesn't consider them.
@@ -16,19 +22,174 @@
 #ifndef __KEYBOARD_H
 #define __KEYBOARD_H
 
-#include "interrupts.h"
-#include "port.h"
+#include "ps2.h"
 #include "types.h"
 
-class KeyboardDriver : public InterruptHandler
+/**
+ * Key codes: the set 1 make code, with bit 7 set for keys sent after an 0xE0 byte.
+ */
+const uint8_t KEY_ESCAPE = 0x01;
+const uint8_t KEY_BACKSPACE = 0x0E;
+const uint8_t KEY_TAB = 0x0F;
+const uint8_t KEY_ENTER = 0x1C;
+const uint8_t KEY_LEFT_CTRL = 0x1D;
+const uint8_t KEY_LEFT_SHIFT = 0x2A;
+const uint8_t KEY_RIGHT_SHIFT = 0x36;
+const uint8_t KEY_LEFT_ALT = 0x38;
+const uint8_t KEY_SPACE = 0x39;
+const uint8_t KEY_CAPS_LOCK = 0x3A;
+const uint8_t KEY_F1 = 0x3B;
+const uint8_t KEY_F10 = 0x44;
+const uint8_t KEY_NUM_LOCK = 0x45;
+const uint8_t KEY_SCROLL_LOCK = 0x46;
+const uint8_t KEY_KEYPAD_7 = 0x47;
+const uint8_t KEY_KEYPAD_PERIOD = 0x53;
+const uint8_t KEY_102ND = 0x56;
+const uint8_t KEY_F11 = 0x57;
+const uint8_t KEY_F12 = 0x58;
+const uint8_t KEY_KEYPAD_ENTER = 0x9C;
+const uint8_t KEY_RIGHT_CTRL = 0x9D;
+const uint8_t KEY_KEYPAD_SLASH = 0xB5;
+const uint8_t KEY_PRINT_SCREEN = 0xB7;
+const uint8_t KEY_RIGHT_ALT = 0xB8;
+const uint8_t KEY_PAUSE = 0xC5;
+const uint8_t KEY_HOME = 0xC7;
+const uint8_t KEY_UP = 0xC8;
+const uint8_t KEY_PAGE_UP = 0xC9;
+const uint8_t KEY_LEFT = 0xCB;
+const uint8_t KEY_RIGHT = 0xCD;
+const uint8_t KEY_END = 0xCF;
+const uint8_t KEY_DOWN = 0xD0;
+const uint8_t KEY_PAGE_DOWN = 0xD1;
+const uint8_t KEY_INSERT = 0xD2;
+const uint8_t KEY_DELETE = 0xD3;
+
+/**
+ * Modifier bits, of the modifier keys held and the locks on.
+ */
+const uint16_t MODIFIER_LEFT_SHIFT = 0x001;
+const uint16_t MODIFIER_RIGHT_SHIFT = 0x002;
+const uint16_t MODIFIER_LEFT_CTRL = 0x004;
+const uint16_t MODIFIER_RIGHT_CTRL = 0x008;
+const uint16_t MODIFIER_LEFT_ALT = 0x010;
+const uint16_t MODIFIER_RIGHT_ALT = 0x020;
+const uint16_t MODIFIER_CAPS_LOCK = 0x040;
+const uint16_t MODIFIER_NUM_LOCK = 0x080;
+const uint16_t MODIFIER_SCROLL_LOCK = 0x100;
+
+const uint16_t MODIFIER_SHIFT = MODIFIER_LEFT_SHIFT | MODIFIER_RIGHT_SHIFT;
+const uint16_t MODIFIER_CTRL = MODIFIER_LEFT_CTRL | MODIFIER_RIGHT_CTRL;
+const uint16_t MODIFIER_ALT = MODIFIER_LEFT_ALT | MODIFIER_RIGHT_ALT;
+
+/**
+ * The right Alt key is AltGr on most layouts, selecting the 3rd character of a key.
+ */
+const uint16_t MODIFIER_ALT_GR = MODIFIER_RIGHT_ALT;
+
+struct KeyboardEvent
+{
+    uint8_t keyCode;
+    bool pressed;
+
+    /**
+     * The modifiers after the key was handled (so pressing Shift gives an event with Shift set).
+     */
+    uint16_t modifiers;
+
+    /**
+     * The character the key types with these modifiers, in code page 437 (the VGA text mode's
+     * characters), or 0 if it types none.
+     */
+    char character;
+};
+
+/**
+ * @brief The characters each key types, for one keyboard layout.
+ *
+ * The tables are indexed by the set 1 scan code, from 0x00 up to the space bar (0x39), followed by
+ * the 102nd key (0x56, next to the left Shift on ISO keyboards). The keypad's keys type the same on
+ * every layout, so they aren't in the tables.
+ */
+struct KeyboardLayout
+{
+    static const uint32_t KEYS = 0x3B;
+
+    const char *name;
+
+    /**
+     * The characters without modifiers, with Shift, with AltGr, and with Shift and AltGr. (One more
+     * than `KEYS`, for the null of the string literals they are written as.)
+     */
+    char characters[4][KEYS + 1];
+
+    /**
+     * The keys Caps Lock works on, one bit per table index.
+     */
+    uint64_t capsLockKeys;
+
+    static const KeyboardLayout UnitedStates;
+    static const KeyboardLayout German;
+};
+
+/**
+ * @brief Gets the keyboard's events. The default one prints the characters typed.
+ */
+class KeyboardEventHandler
+{
+  public:
+    KeyboardEventHandler();
+    ~KeyboardEventHandler();
+
+    /**
+     * @brief Handles a key event. Called in the interrupt handler.
+     */
+    virtual void OnKeyEvent(KeyboardEvent event);
+};
+
+class KeyboardDriver : public PS2Device
 {
-    Port8Bit dataport;
-    Port8Bit commandport;
+    KeyboardEventHandler *handler;
+    const KeyboardLayout *layout;
+
+    uint16_t modifiers;
+
+    /**
+     * Set after an 0xE0 byte, for the byte that follows.
+     */
+    bool extended;
+
+    /**
+     * The bytes of a Pause sequence still to come, after an 0xE1 byte.
+     */
+    uint8_t pauseBytes;
+
+    /**
+     * The keys held, one bit per key code, so that the repeats of a held lock key don't toggle
+     * it.
+     */
+    uint32_t keysDown[8];
+
+    /**
+     * @brief Updates the key and modifier state and sends the event for a key.
+     */
+    void HandleKey(uint8_t keyCode, bool pressed);
 
   public:
-    KeyboardDriver(InterruptManager *manager);
+    KeyboardDriver(KeyboardEventHandler *handler);
     ~KeyboardDriver();
-    virtual uint32_t HandleInterrupt(uint32_t esp);
+    virtual bool Activate(PS2Controller *controller);
+    virtual void HandleByte(uint8_t byte);
+
+    /**
+     * @brief Switches to another layout. Takes effect from the next key.
+     */
+    void SetLayout(const KeyboardLayout *layout);
+
+    /**
+     * @brief Returns the character a key types with some modifiers (0 if none), on the current
+     * layout.
+     */
+    char Translate(uint8_t keyCode, uint16_t modifiers);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -1,5 +1,9 @@
 .set MAGIC, 0x1badb002
-.set FLAGS, (1 << 0 | 1 << 1)
+# Bit 0: load boot modules page aligned, so their pages can be mapped into user space as they are.
+# Bit 1: pass the memory map. Modules (like the initrd) are always reported in the info structure.
+# Bit 2: set the video mode below, if the bootloader can (GRUB can, QEMU's `-kernel` can't). The
+# framebuffer is then reported in the info structure.
+.set FLAGS, (1 << 0 | 1 << 1 | 1 << 2)
 .set CHECKSUM, -(MAGIC + FLAGS)
 
 .section .multiboot
@@ -7,6 +11,15 @@
     .long FLAGS
     .long CHECKSUM
 
+    # The load addresses, only used with bit 16 (for kernels that aren't ELF files).
+    .long 0, 0, 0, 0, 0
+
+    # The video mode: linear graphics (0), width, height and bits per pixel.
+    .long 0
+    .long 1024
+    .long 768
+    .long 32
+
 .section .text
 .extern kernelMain
 .extern callConstructors
@@ -16,10 +29,13 @@ loader:
     # Initialize the stack pointer to the top of the kernel stack.
     mov $kernel_stack, %esp
 
-    call callConstructors
-
+    # The bootloader's magic number (eax) and info structure (ebx) are kernelMain's arguments. They
+    # are pushed before the constructors run, which may change any of eax, ecx and edx.
     push %eax
     push %ebx
+
+    call callConstructors
+
     call kernelMain
 
 _stop:
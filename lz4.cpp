@@ -0,0 +1,271 @@
+#include "lz4.h"
+#include "memorymanagement.h"
+
+const uint32_t LZ4_FRAME_MAGIC = 0x184D2204;
+
+/**
+ * Bits of the frame descriptor's FLG byte.
+ */
+const uint8_t LZ4_FLAG_VERSION_MASK = 0xC0;
+const uint8_t LZ4_FLAG_VERSION = 0x40;
+const uint8_t LZ4_FLAG_BLOCK_CHECKSUM = 1 << 4;
+const uint8_t LZ4_FLAG_CONTENT_SIZE = 1 << 3;
+const uint8_t LZ4_FLAG_CONTENT_CHECKSUM = 1 << 2;
+const uint8_t LZ4_FLAG_DICTIONARY_ID = 1 << 0;
+
+/**
+ * A block size with this bit set means the block is stored uncompressed.
+ */
+const uint32_t LZ4_BLOCK_UNCOMPRESSED = 0x80000000;
+
+/**
+ * Every match is at least this long; the token only stores the length beyond it.
+ */
+const uint32_t LZ4_MIN_MATCH = 4;
+
+static uint32_t ReadLittleEndian32(const uint8_t *data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/**
+ * @brief Parses the frame header.
+ *
+ * @param headerSize Where to store the size of the header (magic number included).
+ * @param contentSize Where to store the content size, or 0 if the frame doesn't record it.
+ * @return false if this isn't a frame this decompressor can handle.
+ */
+static bool ReadFrameHeader(const uint8_t *frame, uint32_t size, uint32_t *headerSize,
+                            uint64_t *contentSize)
+{
+    if (size < 7 || ReadLittleEndian32(frame) != LZ4_FRAME_MAGIC)
+    {
+        return false;
+    }
+
+    uint8_t flags = frame[4];
+    if ((flags & LZ4_FLAG_VERSION_MASK) != LZ4_FLAG_VERSION)
+    {
+        return false;
+    }
+
+    /**
+     * Magic number, FLG and BD bytes, the optional fields, then the header checksum byte.
+     */
+    uint32_t length = 6;
+    *contentSize = 0;
+    if (flags & LZ4_FLAG_CONTENT_SIZE)
+    {
+        if (size < length + 8)
+        {
+            return false;
+        }
+        *contentSize = ReadLittleEndian32(frame + length) |
+                       ((uint64_t)ReadLittleEndian32(frame + length + 4) << 32);
+        length += 8;
+    }
+    if (flags & LZ4_FLAG_DICTIONARY_ID)
+    {
+        /**
+         * Frames compressed against a dictionary can't be decompressed without it.
+         */
+        return false;
+    }
+    length++;
+
+    if (size < length)
+    {
+        return false;
+    }
+    *headerSize = length;
+    return true;
+}
+
+bool Lz4IsFrame(const uint8_t *frame, uint32_t size)
+{
+    return size >= 4 && ReadLittleEndian32(frame) == LZ4_FRAME_MAGIC;
+}
+
+bool Lz4ContentSize(const uint8_t *frame, uint32_t size, uint32_t *contentSize)
+{
+    uint32_t headerSize;
+    uint64_t content;
+    if (!ReadFrameHeader(frame, size, &headerSize, &content) ||
+        !(frame[4] & LZ4_FLAG_CONTENT_SIZE) || (content >> 32) != 0)
+    {
+        return false;
+    }
+    *contentSize = (uint32_t)content;
+    return true;
+}
+
+/**
+ * @brief Reads a length that continues in extra bytes when its 4 bit field is all ones: each
+ * extra byte is added to it, until one is below 255.
+ *
+ * @return false if the input ran out.
+ */
+static bool ReadLength(const uint8_t **input, const uint8_t *inputEnd, uint32_t *length)
+{
+    if (*length != 15)
+    {
+        return true;
+    }
+    while (true)
+    {
+        if (*input >= inputEnd)
+        {
+            return false;
+        }
+        uint8_t byte = *(*input)++;
+        *length += byte;
+        if (byte != 255)
+        {
+            return true;
+        }
+    }
+}
+
+/**
+ * @brief Decompresses a single block.
+ *
+ * @param outputStart The start of the whole output, as far back as matches may reach.
+ * @param output Where the block's data goes.
+ * @return The end of the data written, or 0 if the block is corrupt.
+ */
+static uint8_t *DecompressBlock(const uint8_t *input, uint32_t size, uint8_t *outputStart,
+                                uint8_t *output, uint8_t *outputEnd)
+{
+    const uint8_t *inputEnd = input + size;
+
+    /**
+     * A block is a series of sequences: a token, literals, then a match. The last sequence has no
+     * match.
+     */
+    while (input < inputEnd)
+    {
+        uint8_t token = *input++;
+
+        uint32_t literalLength = token >> 4;
+        if (!ReadLength(&input, inputEnd, &literalLength) ||
+            literalLength > (uint32_t)(inputEnd - input) ||
+            literalLength > (uint32_t)(outputEnd - output))
+        {
+            return 0;
+        }
+        memcpy(output, input, literalLength);
+        input += literalLength;
+        output += literalLength;
+
+        if (input == inputEnd)
+        {
+            break;
+        }
+
+        if (inputEnd - input < 2)
+        {
+            return 0;
+        }
+        uint32_t offset = input[0] | (input[1] << 8);
+        input += 2;
+        if (offset == 0 || offset > (uint32_t)(output - outputStart))
+        {
+            return 0;
+        }
+
+        uint32_t matchLength = token & 0x0F;
+        if (!ReadLength(&input, inputEnd, &matchLength))
+        {
+            return 0;
+        }
+        matchLength += LZ4_MIN_MATCH;
+        if (matchLength > (uint32_t)(outputEnd - output))
+        {
+            return 0;
+        }
+
+        /**
+         * The match may overlap the bytes it produces (an offset of 1 repeats a single byte), so
+         * it has to be copied front to back, one byte at a time.
+         */
+        const uint8_t *match = output - offset;
+        for (uint32_t i = 0; i < matchLength; i++)
+        {
+            output[i] = match[i];
+        }
+        output += matchLength;
+    }
+
+    return output;
+}
+
+int32_t Lz4Decompress(const uint8_t *frame, uint32_t size, uint8_t *output, uint32_t capacity)
+{
+    uint32_t headerSize;
+    uint64_t contentSize;
+    if (!ReadFrameHeader(frame, size, &headerSize, &contentSize))
+    {
+        return -1;
+    }
+
+    uint8_t flags = frame[4];
+    const uint8_t *input = frame + headerSize;
+    const uint8_t *inputEnd = frame + size;
+    uint8_t *written = output;
+    uint8_t *outputEnd = output + capacity;
+
+    while (true)
+    {
+        if (inputEnd - input < 4)
+        {
+            return -1;
+        }
+        uint32_t blockSize = ReadLittleEndian32(input);
+        input += 4;
+
+        /**
+         * A block size of 0 marks the end of the frame.
+         */
+        if (blockSize == 0)
+        {
+            break;
+        }
+
+        bool compressed = !(blockSize & LZ4_BLOCK_UNCOMPRESSED);
+        blockSize &= ~LZ4_BLOCK_UNCOMPRESSED;
+        if (blockSize > (uint32_t)(inputEnd - input))
+        {
+            return -1;
+        }
+
+        if (compressed)
+        {
+            written = DecompressBlock(input, blockSize, output, written, outputEnd);
+            if (written == 0)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            if (blockSize > (uint32_t)(outputEnd - written))
+            {
+                return -1;
+            }
+            memcpy(written, input, blockSize);
+            written += blockSize;
+        }
+        input += blockSize;
+
+        if (flags & LZ4_FLAG_BLOCK_CHECKSUM)
+        {
+            input += 4;
+        }
+    }
+
+    if ((flags & LZ4_FLAG_CONTENT_SIZE) && contentSize != (uint64_t)(written - output))
+    {
+        return -1;
+    }
+    return written - output;
+}
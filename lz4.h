@@ -0,0 +1,41 @@
+/**
+ * @file lz4.h
+ * @author rohan843
+ * @brief Contains a decompressor for the LZ4 frame format (what the `lz4` tool writes).
+ *
+ * A frame is a small header followed by blocks of at most 4 MiB each, compressed or stored. The
+ * decompressor works block by block, writing each straight into the output buffer, so it needs no
+ * memory of its own: matches (even ones reaching back into earlier blocks) are copied from the
+ * output written so far.
+ *
+ * Only frames that record their content size (`lz4 --content-size`) are accepted, since the output
+ * buffer must be allocated up front. Checksums are skipped over, not verified.
+ */
+
+#ifndef __LZ4_H
+#define __LZ4_H
+
+#include "types.h"
+
+/**
+ * @brief Tells whether some data starts with an LZ4 frame.
+ */
+bool Lz4IsFrame(const uint8_t *frame, uint32_t size);
+
+/**
+ * @brief Reads the size of the data an LZ4 frame decompresses to.
+ *
+ * @param contentSize Where to store the size.
+ * @return false if the frame is invalid, or doesn't record its content size (or it is >= 4 GiB).
+ */
+bool Lz4ContentSize(const uint8_t *frame, uint32_t size, uint32_t *contentSize);
+
+/**
+ * @brief Decompresses an LZ4 frame.
+ *
+ * @param output Where to put the data. Must hold `capacity` bytes.
+ * @return The number of bytes written, or -1 if the frame is corrupt or doesn't fit.
+ */
+int32_t Lz4Decompress(const uint8_t *frame, uint32_t size, uint8_t *output, uint32_t capacity);
+
+#endif
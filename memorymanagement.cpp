@@ -0,0 +1,458 @@
+#include "memorymanagement.h"
+
+/**
+ * The first and the last address of the kernel image. These are labels defined in linker.ld.
+ */
+extern "C" uint8_t kernel_start;
+extern "C" uint8_t kernel_end;
+
+/**
+ * The allocators are shared by all processors, and used from interrupt handlers.
+ */
+static LockClass frameLockClass("frames");
+static LockClass heapLockClass("heap");
+
+/**
+ * @brief Returns the size of a string, including the terminating '\0'.
+ */
+static uint32_t StringSize(const char *str)
+{
+    uint32_t size = 1;
+    while (str[size - 1] != '\0')
+    {
+        size++;
+    }
+    return size;
+}
+
+/** PhysicalMemoryManager Class */
+
+PhysicalMemoryManager *PhysicalMemoryManager::activePhysicalMemoryManager = 0;
+
+PhysicalMemoryManager::PhysicalMemoryManager(const MultibootInfo *multibootInfo)
+    : lock(&frameLockClass)
+{
+    totalFrames = 0;
+    freeFrames = 0;
+    searchHint = 0;
+
+    for (uint32_t i = 0; i < MAX_FRAMES / 32; i++)
+    {
+        bitmap[i] = 0xFFFFFFFF;
+    }
+
+    if (multibootInfo->flags & MULTIBOOT_INFO_MEMORY_MAP)
+    {
+        uint32_t address = multibootInfo->memoryMapAddress;
+        uint32_t end = address + multibootInfo->memoryMapLength;
+        while (address < end)
+        {
+            MultibootMemoryMapEntry *entry = (MultibootMemoryMapEntry *)address;
+            if (entry->type == MULTIBOOT_MEMORY_AVAILABLE && entry->address < PHYSICAL_MEMORY_LIMIT)
+            {
+                uint64_t length = entry->length;
+                if (entry->address + length > PHYSICAL_MEMORY_LIMIT)
+                {
+                    length = PHYSICAL_MEMORY_LIMIT - entry->address;
+                }
+                MarkFree((uint32_t)entry->address, (uint32_t)length);
+            }
+            address += entry->size + 4;
+        }
+    }
+    else if (multibootInfo->flags & MULTIBOOT_INFO_MEMORY)
+    {
+        /**
+         * Without a memory map, all we know is how much contiguous memory there is above 1 MiB.
+         */
+        uint64_t size = (uint64_t)multibootInfo->memoryUpper * 1024;
+        if (0x100000 + size > PHYSICAL_MEMORY_LIMIT)
+        {
+            size = PHYSICAL_MEMORY_LIMIT - 0x100000;
+        }
+        MarkFree(0x100000, (uint32_t)size);
+    }
+    totalFrames = freeFrames;
+
+    /**
+     * The first MiB holds the BIOS data, the video memory and the multiboot structures, and it
+     * will be needed again for things like starting other processors.
+     */
+    MarkUsed(0, 0x100000);
+    MarkUsed((uint32_t)&kernel_start, (uint32_t)&kernel_end - (uint32_t)&kernel_start);
+
+    /**
+     * The bootloader may have put its own structures anywhere, and they are read after the heap
+     * has been set up.
+     */
+    MarkUsed((uint32_t)multibootInfo, sizeof(MultibootInfo));
+    if (multibootInfo->flags & MULTIBOOT_INFO_CMDLINE)
+    {
+        MarkUsed(multibootInfo->commandLine, StringSize((const char *)multibootInfo->commandLine));
+    }
+    if (multibootInfo->flags & MULTIBOOT_INFO_MEMORY_MAP)
+    {
+        MarkUsed(multibootInfo->memoryMapAddress, multibootInfo->memoryMapLength);
+    }
+    if (multibootInfo->flags & MULTIBOOT_INFO_MODULES)
+    {
+        MultibootModule *modules = (MultibootModule *)multibootInfo->moduleAddress;
+        MarkUsed((uint32_t)modules, multibootInfo->moduleCount * sizeof(MultibootModule));
+        for (uint32_t i = 0; i < multibootInfo->moduleCount; i++)
+        {
+            MarkUsed(modules[i].start, modules[i].end - modules[i].start);
+            MarkUsed(modules[i].string, StringSize((const char *)modules[i].string));
+        }
+    }
+
+    activePhysicalMemoryManager = this;
+}
+
+PhysicalMemoryManager::~PhysicalMemoryManager()
+{
+    if (activePhysicalMemoryManager == this)
+    {
+        activePhysicalMemoryManager = 0;
+    }
+}
+
+void PhysicalMemoryManager::MarkUsed(uint32_t address, uint32_t size)
+{
+    /**
+     * Any frame the range touches, even partially, becomes used.
+     */
+    uint32_t first = address / PAGE_SIZE;
+    uint32_t last = ((uint64_t)address + size + PAGE_SIZE - 1) / PAGE_SIZE;
+    for (uint32_t frame = first; frame < last && frame < MAX_FRAMES; frame++)
+    {
+        if (!(bitmap[frame / 32] & (1 << (frame % 32))))
+        {
+            bitmap[frame / 32] |= 1 << (frame % 32);
+            freeFrames--;
+        }
+    }
+}
+
+void PhysicalMemoryManager::MarkFree(uint32_t address, uint32_t size)
+{
+    /**
+     * Only frames that lie entirely inside the range become free.
+     */
+    uint32_t first = ((uint64_t)address + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t last = ((uint64_t)address + size) / PAGE_SIZE;
+    for (uint32_t frame = first; frame < last && frame < MAX_FRAMES; frame++)
+    {
+        if (bitmap[frame / 32] & (1 << (frame % 32)))
+        {
+            bitmap[frame / 32] &= ~(1 << (frame % 32));
+            freeFrames++;
+        }
+    }
+    if (first / 32 < searchHint)
+    {
+        searchHint = first / 32;
+    }
+}
+
+uint32_t PhysicalMemoryManager::AllocateFrame()
+{
+    SpinlockGuard guard(&lock);
+
+    /**
+     * Skip over full words, 32 frames at a time, then pick the lowest clear bit of the first word
+     * that has one.
+     */
+    for (uint32_t word = searchHint; word < MAX_FRAMES / 32; word++)
+    {
+        if (bitmap[word] != 0xFFFFFFFF)
+        {
+            uint32_t bit;
+            asm("bsfl %1, %0" : "=r"(bit) : "r"(~bitmap[word]));
+            bitmap[word] |= 1 << bit;
+            freeFrames--;
+            searchHint = word;
+
+            return (word * 32 + bit) * PAGE_SIZE;
+        }
+    }
+
+    searchHint = MAX_FRAMES / 32;
+    return 0;
+}
+
+uint32_t PhysicalMemoryManager::AllocateFrames(uint32_t count)
+{
+    if (count == 1)
+    {
+        return AllocateFrame();
+    }
+
+    SpinlockGuard guard(&lock);
+
+    uint32_t runStart = 0;
+    uint32_t runLength = 0;
+    for (uint32_t frame = searchHint * 32; frame < MAX_FRAMES; frame++)
+    {
+        if (bitmap[frame / 32] & (1 << (frame % 32)))
+        {
+            runLength = 0;
+            continue;
+        }
+
+        if (runLength == 0)
+        {
+            runStart = frame;
+        }
+        runLength++;
+
+        if (runLength == count)
+        {
+            for (uint32_t i = runStart; i < runStart + count; i++)
+            {
+                bitmap[i / 32] |= 1 << (i % 32);
+            }
+            freeFrames -= count;
+
+            return runStart * PAGE_SIZE;
+        }
+    }
+
+    return 0;
+}
+
+void PhysicalMemoryManager::FreeFrame(uint32_t address) { FreeFrames(address, 1); }
+
+void PhysicalMemoryManager::FreeFrames(uint32_t address, uint32_t count)
+{
+    SpinlockGuard guard(&lock);
+    MarkFree(address, count * PAGE_SIZE);
+}
+
+uint32_t PhysicalMemoryManager::FreeFrameCount() { return freeFrames; }
+
+uint32_t PhysicalMemoryManager::TotalFrameCount() { return totalFrames; }
+
+/** MemoryManager Class */
+
+MemoryManager *MemoryManager::activeMemoryManager = 0;
+
+MemoryManager::MemoryManager(size_t start, size_t size) : lock(&heapLockClass)
+{
+    activeMemoryManager = this;
+    usedBytes = 0;
+
+    if (size < sizeof(MemoryChunk))
+    {
+        first = 0;
+        return;
+    }
+
+    first = (MemoryChunk *)start;
+    first->allocated = false;
+    first->prev = 0;
+    first->next = 0;
+    first->size = size - sizeof(MemoryChunk);
+}
+
+MemoryManager::~MemoryManager()
+{
+    if (activeMemoryManager == this)
+    {
+        activeMemoryManager = 0;
+    }
+}
+
+void *MemoryManager::malloc(size_t size)
+{
+    /**
+     * Keeps every chunk (and so every returned pointer) 16 byte aligned.
+     */
+    size = (size + 15) & ~15;
+
+    SpinlockGuard guard(&lock);
+
+    MemoryChunk *result = 0;
+    for (MemoryChunk *chunk = first; chunk != 0 && result == 0; chunk = chunk->next)
+    {
+        if (chunk->size >= size && !chunk->allocated)
+        {
+            result = chunk;
+        }
+    }
+
+    if (result == 0)
+    {
+        return 0;
+    }
+
+    /**
+     * Split off the rest of the chunk, unless it's too small to hold anything.
+     */
+    if (result->size >= size + sizeof(MemoryChunk) + 16)
+    {
+        MemoryChunk *temp = (MemoryChunk *)((size_t)result + sizeof(MemoryChunk) + size);
+
+        temp->allocated = false;
+        temp->size = result->size - size - sizeof(MemoryChunk);
+        temp->prev = result;
+        temp->next = result->next;
+        if (temp->next != 0)
+        {
+            temp->next->prev = temp;
+        }
+
+        result->size = size;
+        result->next = temp;
+    }
+
+    result->allocated = true;
+    usedBytes += result->size + sizeof(MemoryChunk);
+
+    return (void *)((size_t)result + sizeof(MemoryChunk));
+}
+
+void MemoryManager::free(void *ptr)
+{
+    if (ptr == 0)
+    {
+        return;
+    }
+
+    SpinlockGuard guard(&lock);
+
+    MemoryChunk *chunk = (MemoryChunk *)((size_t)ptr - sizeof(MemoryChunk));
+    chunk->allocated = false;
+    usedBytes -= chunk->size + sizeof(MemoryChunk);
+
+    /**
+     * Merge with the free neighbours, so that the list doesn't fill up with fragments.
+     */
+    if (chunk->prev != 0 && !chunk->prev->allocated)
+    {
+        chunk->prev->next = chunk->next;
+        chunk->prev->size += chunk->size + sizeof(MemoryChunk);
+        if (chunk->next != 0)
+        {
+            chunk->next->prev = chunk->prev;
+        }
+        chunk = chunk->prev;
+    }
+
+    if (chunk->next != 0 && !chunk->next->allocated)
+    {
+        chunk->size += chunk->next->size + sizeof(MemoryChunk);
+        chunk->next = chunk->next->next;
+        if (chunk->next != 0)
+        {
+            chunk->next->prev = chunk;
+        }
+    }
+
+}
+
+size_t MemoryManager::UsedBytes() { return usedBytes; }
+
+void *operator new(size_t size) { return MemoryManager::activeMemoryManager->malloc(size); }
+
+void *operator new[](size_t size) { return MemoryManager::activeMemoryManager->malloc(size); }
+
+void *operator new(size_t size, void *ptr) { return ptr; }
+
+void *operator new[](size_t size, void *ptr) { return ptr; }
+
+void operator delete(void *ptr)
+{
+    if (MemoryManager::activeMemoryManager != 0)
+    {
+        MemoryManager::activeMemoryManager->free(ptr);
+    }
+}
+
+void operator delete[](void *ptr)
+{
+    if (MemoryManager::activeMemoryManager != 0)
+    {
+        MemoryManager::activeMemoryManager->free(ptr);
+    }
+}
+
+void operator delete(void *ptr, size_t size) { operator delete(ptr); }
+
+void operator delete[](void *ptr, size_t size) { operator delete[](ptr); }
+
+extern "C" void *memset(void *destination, int value, size_t size)
+{
+    /**
+     * Same as `memcpy`: `rep stosl` stores 4 copies of the byte per step.
+     */
+    uint32_t pattern = (uint8_t)value * 0x01010101;
+    uint32_t edi, ecx;
+    asm volatile("rep stosl\n"
+                 "movl %5, %%ecx\n"
+                 "rep stosb"
+                 : "=&D"(edi), "=&c"(ecx)
+                 : "0"(destination), "1"(size / 4), "a"(pattern), "r"(size % 4)
+                 : "memory");
+    return destination;
+}
+
+extern "C" void *memcpy(void *destination, const void *source, size_t size)
+{
+    /**
+     * `rep movsl` moves 4 bytes per step. The remaining 0 to 3 bytes are moved one at a time.
+     */
+    uint32_t edi, esi, ecx;
+    asm volatile("rep movsl\n"
+                 "movl %6, %%ecx\n"
+                 "rep movsb"
+                 : "=&D"(edi), "=&S"(esi), "=&c"(ecx)
+                 : "0"(destination), "1"(source), "2"(size / 4), "r"(size % 4)
+                 : "memory");
+    return destination;
+}
+
+extern "C" void *memmove(void *destination, const void *source, size_t size)
+{
+    uint8_t *to = (uint8_t *)destination;
+    const uint8_t *from = (const uint8_t *)source;
+    uint32_t edi, esi, ecx;
+
+    /**
+     * Copying forwards is safe unless the destination starts inside the source. Then the bytes are
+     * moved backwards from the end, with the direction flag set (and cleared again, as the
+     * compiler expects).
+     */
+    if (to <= from || to >= from + size)
+    {
+        asm volatile("rep movsl\n"
+                     "movl %6, %%ecx\n"
+                     "rep movsb"
+                     : "=&D"(edi), "=&S"(esi), "=&c"(ecx)
+                     : "0"(to), "1"(from), "2"(size / 4), "r"(size % 4)
+                     : "memory");
+    }
+    else
+    {
+        asm volatile("std\n"
+                     "rep movsb\n"
+                     "cld"
+                     : "=&D"(edi), "=&S"(esi), "=&c"(ecx)
+                     : "0"(to + size - 1), "1"(from + size - 1), "2"(size)
+                     : "memory", "cc");
+    }
+    return destination;
+}
+
+extern "C" int memcmp(const void *a, const void *b, size_t size)
+{
+    const uint8_t *x = (const uint8_t *)a;
+    const uint8_t *y = (const uint8_t *)b;
+    for (size_t i = 0; i < size; i++)
+    {
+        if (x[i] != y[i])
+        {
+            return x[i] < y[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
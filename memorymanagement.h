@@ -0,0 +1,153 @@
+/**
+ * @file memorymanagement.h
+ * @author rohan843
+ * @brief Contains the physical frame allocator and the kernel heap.
+ *
+ * The kernel can use physical memory directly, as the lowest 1 GiB is identity mapped (see
+ * paging.h). So a physical address returned by the frame allocator is also a valid pointer.
+ */
+
+#ifndef __MEMORYMANAGEMENT_H
+#define __MEMORYMANAGEMENT_H
+
+#include "multiboot.h"
+#include "spinlock.h"
+#include "types.h"
+
+const uint32_t PAGE_SIZE = 4096;
+
+/**
+ * The frame allocator only hands out memory below this address, which is what the kernel has
+ * identity mapped.
+ */
+const uint32_t PHYSICAL_MEMORY_LIMIT = 0x40000000;
+
+/**
+ * @brief Keeps track of which 4 KiB frames of physical memory are free, with one bit per frame.
+ */
+class PhysicalMemoryManager
+{
+  protected:
+    static const uint32_t MAX_FRAMES = PHYSICAL_MEMORY_LIMIT / PAGE_SIZE;
+
+    /**
+     * A set bit means the frame is used (or doesn't exist).
+     */
+    uint32_t bitmap[MAX_FRAMES / 32];
+
+    uint32_t totalFrames;
+    uint32_t freeFrames;
+
+    /**
+     * The bitmap word the next single frame search starts at. Everything before it is known to be
+     * used.
+     */
+    uint32_t searchHint;
+
+    Spinlock lock;
+
+    void MarkUsed(uint32_t address, uint32_t size);
+    void MarkFree(uint32_t address, uint32_t size);
+
+  public:
+    static PhysicalMemoryManager *activePhysicalMemoryManager;
+
+    /**
+     * @brief Builds the free frame map from the bootloader's memory map. Memory below 1 MiB, the
+     * kernel image and the boot modules are kept reserved.
+     */
+    PhysicalMemoryManager(const MultibootInfo *multibootInfo);
+    ~PhysicalMemoryManager();
+
+    /**
+     * @brief Allocates a single frame.
+     *
+     * @return The physical address of the frame, or 0 if there's no free memory left.
+     */
+    uint32_t AllocateFrame();
+
+    /**
+     * @brief Allocates physically contiguous frames, e.g., for DMA.
+     *
+     * @param count The number of frames.
+     * @return The physical address of the first frame, or 0 if no such run is free.
+     */
+    uint32_t AllocateFrames(uint32_t count);
+
+    void FreeFrame(uint32_t address);
+    void FreeFrames(uint32_t address, uint32_t count);
+
+    uint32_t FreeFrameCount();
+    uint32_t TotalFrameCount();
+};
+
+/**
+ * @brief The header placed in front of every block of the kernel heap.
+ */
+struct MemoryChunk
+{
+    MemoryChunk *next;
+    MemoryChunk *prev;
+    bool allocated;
+    size_t size;
+};
+
+/**
+ * @brief The kernel heap. A first-fit allocator over a list of chunks, merging free neighbours.
+ */
+class MemoryManager
+{
+  protected:
+    MemoryChunk *first;
+
+    /**
+     * The bytes taken by allocated chunks, headers included.
+     */
+    size_t usedBytes;
+
+    Spinlock lock;
+
+  public:
+    static MemoryManager *activeMemoryManager;
+
+    /**
+     * @param start The start of the memory region the heap manages.
+     * @param size The size of that region.
+     */
+    MemoryManager(size_t start, size_t size);
+    ~MemoryManager();
+
+    void *malloc(size_t size);
+    void free(void *ptr);
+
+    size_t UsedBytes();
+};
+
+void *operator new(size_t size);
+void *operator new[](size_t size);
+
+/**
+ * Placement new.
+ */
+void *operator new(size_t size, void *ptr);
+void *operator new[](size_t size, void *ptr);
+
+void operator delete(void *ptr);
+void operator delete[](void *ptr);
+void operator delete(void *ptr, size_t size);
+void operator delete[](void *ptr, size_t size);
+
+/**
+ * The compiler may emit calls to these on its own (e.g., for copying structures), so they use the
+ * standard C names.
+ */
+extern "C" void *memset(void *destination, int value, size_t size);
+extern "C" void *memcpy(void *destination, const void *source, size_t size);
+
+/**
+ * @brief Copies between ranges that may overlap, unlike `memcpy`.
+ */
+extern "C" void *memmove(void *destination, const void *source, size_t size);
+extern "C" int memcmp(const void *a, const void *b, size_t size);
+
+#endif
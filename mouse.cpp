@@ -1,137 +1,112 @@
 #include "mouse.h"
 
-MouseDriver::MouseDriver(InterruptManager *manager)
-    : InterruptHandler(0x2C, manager), dataport(0x60), commandport(0x64)
+/** MouseEventHandler Class */
+
+MouseEventHandler::MouseEventHandler() {}
+
+MouseEventHandler::~MouseEventHandler() {}
+
+void MouseEventHandler::OnMouseEvent(MouseEvent event) {}
+
+/** MouseDriver Class */
+
+MouseDriver::MouseDriver(MouseEventHandler *handler)
 {
+    this->handler = handler;
+    controller = 0;
     offset = 0;
-    buttons = 0;
-
-    /**
-     * Displaying the mouse at the center of the screen initially.
-     */
-    uint16_t *VideoMemory = (uint16_t *)0xb8000;
-    VideoMemory[80 * 12 + 40] = ((VideoMemory[80 * 12 + 40] & 0xF000) >> 4) |
-                                ((VideoMemory[80 * 12 + 40] & 0x0F00) << 4) |
-                                (VideoMemory[80 * 12 + 40] & 0x00FF);
+    packetSize = 3;
+}
 
-    /**
-     * Tests the mouse port of the PS/2 controller.
-     */
-    commandport.Write(0xAB);
+bool MouseDriver::SetSampleRate(uint8_t rate)
+{
+    return controller->CommandDevice(1, 0xF3) && controller->CommandDevice(1, rate);
+}
 
-    /**
-     * Gets the current state of the mouse controller's status byte on the data port.
-     */
-    commandport.Write(0x20);
+bool MouseDriver::Activate(PS2Controller *controller)
+{
+    this->controller = controller;
 
     /**
-     * Stores the state of the PS/2 controller, and:
-     *
-     * 1. Sets the bit 1 to 1. This enables mouse interrupts (IRQ12).
-     * 2. Sets bit 5 to 1. This enables the mouse clock.
+     * Sets the mouse to its defaults (which also stops it from reporting).
      */
-    uint8_t status = (dataport.Read() | 0b10) & (~0x20);
+    if (!controller->CommandDevice(1, 0xF6))
+    {
+        return false;
+    }
 
     /**
-     * Change the status byte and write the new one to the controller.
+     * An IntelliMouse turns on its wheel (and 4 byte packets) when the sample rate is set to 200,
+     * 100 and 80 in a row, after which its ID is 3 instead of 0.
      */
-    commandport.Write(0x60);
-    dataport.Write(status);
+    uint8_t id = 0;
+    if (SetSampleRate(200) && SetSampleRate(100) && SetSampleRate(80) &&
+        controller->CommandDevice(1, 0xF2) && controller->ReadData(&id) && id == 3)
+    {
+        packetSize = 4;
+    }
 
     /**
-     * Tells the PS/2 to route the next byte sent to the data port to the mouse instead of the
-     * keyboard.
+     * More packets per second means smaller movements in each, and smoother motion.
      */
-    commandport.Write(0xD4);
+    SetSampleRate(SAMPLE_RATE);
 
     /**
      * Enables data reporting by mouse.
      */
-    dataport.Write(0xF4);
-
-    /**
-     * Reads and ignores the ACK from mouse.
-     */
-    dataport.Read();
+    return controller->CommandDevice(1, 0xF4);
 }
 
 MouseDriver::~MouseDriver() {}
 
-uint32_t MouseDriver::HandleInterrupt(uint32_t esp)
+void MouseDriver::HandleByte(uint8_t byte)
 {
-    uint8_t status = commandport.Read();
     /**
-     * Checks if the data came from the mouse or keyboard. If bit 5 is set, then it was the mouse.
+     * Bit 3 of a packet's first byte is always set. A first byte without it means a byte got lost
+     * and the packets are out of step, so bytes are thrown away until one could start a packet.
      */
-    if (!(status & 0x20))
+    if (offset == 0 && !(byte & 0x08))
     {
-        /**
-         * If there's no data from the mouse.
-         */
-        return esp;
+        return;
     }
 
     /**
-     * Initial location of the mouse pointer.
+     * Each movement of the mouse generates a packet, whose bytes come one by one. Once all are in
+     * the buffer, the pointer moves.
      */
-    static int8_t x = 40, y = 12;
+    buff[offset] = byte;
+    offset++;
+    if (offset == packetSize)
+    {
+        offset = 0;
+        HandlePacket();
+    }
+}
 
-    buff[offset] = dataport.Read();
-    offset = (offset + 1) % 3;
+uint8_t MouseDriver::PacketSize() { return packetSize; }
 
+void MouseDriver::HandlePacket()
+{
     /**
-     * Each movement of the mouse generates a 3 byte packet. This goes to the PS/2 controller. The
-     * controller generates a separate IRQ12 for each byte. Here, we are placing these bytes in the
-     * buffer one by one.
-     *
-     * If we have all the 3 bytes and the buff array is full, we change the coordinates of the
-     * pointer.
+     * Movements too large to report (bits 6 and 7) are ignored.
      */
-    if (offset == 0)
+    if (buff[0] & 0xC0)
     {
-        uint16_t *VideoMemory = (uint16_t *)0xb8000;
-
-        VideoMemory[80 * y + x] = ((VideoMemory[80 * y + x] & 0xF000) >> 4) |
-                                  ((VideoMemory[80 * y + x] & 0x0F00) << 4) |
-                                  (VideoMemory[80 * y + x] & 0x00FF);
-
-        x += buff[1];
-        if (x < 0)
-        {
-            x = 0;
-        }
-        if (x >= 80)
-        {
-            x = 79;
-        }
-
-        y -= buff[2];
-
-        if (y < 0)
-        {
-            y = 0;
-        }
-        if (y >= 25)
-        {
-            y = 24;
-        }
-
-        VideoMemory[80 * y + x] = ((VideoMemory[80 * y + x] & 0xF000) >> 4) |
-                                  ((VideoMemory[80 * y + x] & 0x0F00) << 4) |
-                                  (VideoMemory[80 * y + x] & 0x00FF);
-
-        for (uint8_t i = 0; i < 3; i++)
-        {
-            if ((buff[0] & (1 << i)) != (buttons & (1 << i)))
-            {
-                VideoMemory[80 * y + x] = ((VideoMemory[80 * y + x] & 0xF000) >> 4) |
-                                          ((VideoMemory[80 * y + x] & 0x0F00) << 4) |
-                                          (VideoMemory[80 * y + x] & 0x00FF);
-            }
-        }
-
-        buttons = buff[0];
+        return;
     }
 
-    return esp;
+    /**
+     * The movements are 9 - bit numbers, with their sign bits (bits 4 and 5) in the first byte. The
+     * mouse counts y upwards.
+     */
+    MouseEvent event;
+    event.dx = buff[1] - ((buff[0] << 4) & 0x100);
+    event.dy = ((buff[0] << 3) & 0x100) - buff[2];
+    event.wheel = packetSize == 4 ? (int8_t)buff[3] : 0;
+    event.buttons = buff[0] & 0x07;
+
+    if (handler != 0)
+    {
+        handler->OnMouseEvent(event);
+    }
 }
@@ -2,28 +2,80 @@
  * @file mouse.h
  * @author rohan843
  * @brief Contains the driver for the mouse.
+ *
+ * The mouse is connected to the second port of the PS/2 controller, and reports each movement as a
+ * packet of 3 bytes, or of 4 if it is an IntelliMouse (which adds the wheel). The bytes come one at
+ * a time, so the driver collects them into packets, and hands each packet to its handler as a
+ * mouse event.
  */
 
 #ifndef __MOUSE_H
 #define __MOUSE_H
 
-#include "interrupts.h"
-#include "port.h"
+#include "ps2.h"
 #include "types.h"
 
-class MouseDriver : public InterruptHandler
+struct MouseEvent
 {
-    Port8Bit dataport;
-    Port8Bit commandport;
+    /**
+     * The movement in mouse counts, with y growing downwards (like the screen's rows), and the
+     * wheel's.
+     */
+    int32_t dx, dy;
+    int32_t wheel;
 
-    uint8_t buff[3];
-    uint8_t offset;
+    /**
+     * The buttons held: bit 0 for the left, 1 for the right and 2 for the middle one.
+     */
     uint8_t buttons;
+};
 
+/**
+ * @brief Gets the mouse's events. The default one ignores them.
+ */
+class MouseEventHandler
+{
   public:
-    MouseDriver(InterruptManager *manager);
+    MouseEventHandler();
+    ~MouseEventHandler();
+
+    /**
+     * @brief Handles a mouse event. Called in the interrupt handler.
+     */
+    virtual void OnMouseEvent(MouseEvent event);
+};
+
+class MouseDriver : public PS2Device
+{
+    /**
+     * The sample rate asked for, in packets per second (the default is 100).
+     */
+    static const uint8_t SAMPLE_RATE = 200;
+
+    PS2Controller *controller;
+    MouseEventHandler *handler;
+
+    uint8_t buff[4];
+    uint8_t offset;
+    uint8_t packetSize;
+
+    bool SetSampleRate(uint8_t rate);
+
+    /**
+     * @brief Decodes a complete packet into an event.
+     */
+    void HandlePacket();
+
+  public:
+    MouseDriver(MouseEventHandler *handler);
     ~MouseDriver();
-    virtual uint32_t HandleInterrupt(uint32_t esp);
+    virtual bool Activate(PS2Controller *controller);
+    virtual void HandleByte(uint8_t byte);
+
+    /**
+     * @brief The size of the mouse's packets: 3, or 4 for an IntelliMouse.
+     */
+    uint8_t PacketSize();
 };
 
-#endif
\ No newline at end of file
+#endif
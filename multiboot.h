@@ -0,0 +1,111 @@
+/**
+ * @file multiboot.h
+ * @author rohan843
+ * @brief Contains the layout of the information structure the bootloader passes to `kernelMain`.
+ *
+ * See the Multiboot Specification (version 0.6.96). Each group of fields is only valid if the
+ * matching bit of `flags` is set.
+ */
+
+#ifndef __MULTIBOOT_H
+#define __MULTIBOOT_H
+
+#include "types.h"
+
+/**
+ * The value the bootloader leaves in EAX (passed to `kernelMain` as `magicnumber`).
+ */
+const uint32_t MULTIBOOT_BOOTLOADER_MAGIC = 0x2BADB002;
+
+const uint32_t MULTIBOOT_INFO_MEMORY = 1 << 0;
+const uint32_t MULTIBOOT_INFO_CMDLINE = 1 << 2;
+const uint32_t MULTIBOOT_INFO_MODULES = 1 << 3;
+const uint32_t MULTIBOOT_INFO_MEMORY_MAP = 1 << 6;
+const uint32_t MULTIBOOT_INFO_FRAMEBUFFER = 1 << 12;
+
+struct MultibootInfo
+{
+    uint32_t flags;
+
+    /**
+     * KiB of memory below 1 MiB and above 1 MiB.
+     */
+    uint32_t memoryLower;
+    uint32_t memoryUpper;
+
+    uint32_t bootDevice;
+    uint32_t commandLine;
+
+    uint32_t moduleCount;
+    uint32_t moduleAddress;
+
+    uint32_t symbols[4];
+
+    uint32_t memoryMapLength;
+    uint32_t memoryMapAddress;
+
+    uint32_t drivesLength;
+    uint32_t drivesAddress;
+    uint32_t configTable;
+    uint32_t bootLoaderName;
+    uint32_t apmTable;
+
+    uint32_t vbeControlInfo;
+    uint32_t vbeModeInfo;
+    uint16_t vbeMode;
+    uint16_t vbeInterfaceSegment;
+    uint16_t vbeInterfaceOffset;
+    uint16_t vbeInterfaceLength;
+
+    /**
+     * The framebuffer the bootloader set up (if the multiboot header asked for a video mode), and
+     * its bytes per line.
+     */
+    uint64_t framebufferAddress;
+    uint32_t framebufferPitch;
+    uint32_t framebufferWidth;
+    uint32_t framebufferHeight;
+    uint8_t framebufferBitsPerPixel;
+    uint8_t framebufferType;
+
+    /**
+     * The bit position and size of each color in a pixel (for the RGB framebuffer type).
+     */
+    uint8_t redPosition;
+    uint8_t redMaskSize;
+    uint8_t greenPosition;
+    uint8_t greenMaskSize;
+    uint8_t bluePosition;
+    uint8_t blueMaskSize;
+} __attribute__((packed));
+
+/**
+ * @brief A boot module. `start` and `end` are physical addresses (`end` is exclusive), and
+ * `string` points to the module's command line.
+ */
+struct MultibootModule
+{
+    uint32_t start;
+    uint32_t end;
+    uint32_t string;
+    uint32_t reserved;
+} __attribute__((packed));
+
+/**
+ * A memory map entry type marking RAM that is free to use.
+ */
+const uint32_t MULTIBOOT_MEMORY_AVAILABLE = 1;
+
+/**
+ * @brief An entry of the BIOS memory map. `size` doesn't count itself, so the next entry starts
+ * `size + 4` bytes after this one.
+ */
+struct MultibootMemoryMapEntry
+{
+    uint32_t size;
+    uint64_t address;
+    uint64_t length;
+    uint32_t type;
+} __attribute__((packed));
+
+#endif
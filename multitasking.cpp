@@ -0,0 +1,681 @@
+#include "multitasking.h"
+#include "percpu.h"
+#include "smp.h"
+
+/**
+ * EFLAGS of a new task: interrupts enabled (bit 9), plus bit 1, which is always set.
+ */
+const uint32_t TASK_INITIAL_EFLAGS = 0x202;
+
+/**
+ * The most tasks a processor takes from another at once.
+ */
+const uint32_t MAX_STOLEN_TASKS = 32;
+
+/**
+ * The x87 control word and the MXCSR of a new task: all exceptions masked, round to nearest, and
+ * 64 - bit x87 precision (what `fninit` sets up).
+ */
+const uint16_t FPU_INITIAL_CONTROL_WORD = 0x037F;
+const uint32_t FPU_INITIAL_MXCSR = 0x1F80;
+
+/**
+ * Offsets into the `fxsave` layout.
+ */
+const uint32_t FPU_STATE_CONTROL_WORD = 0;
+const uint32_t FPU_STATE_MXCSR = 24;
+
+static uint32_t nextTaskId = 0;
+
+static LockClass taskLockClass("task");
+static LockClass taskListLockClass("task list");
+static LockClass runQueueLockClass("run queue");
+
+/** Task Class */
+
+Task::Task() : lock(&taskLockClass)
+{
+    Initialize();
+    stack = 0;
+    kernelStack = 0;
+    cpustate = 0;
+    addressSpace = AddressSpace::Kernel();
+    userTask = false;
+
+    onProcessor = true;
+    running = true;
+}
+
+Task::Task(GlobalDescriptorTable *gdt, void (*entry)(), int32_t affinity) : lock(&taskLockClass)
+{
+    Initialize();
+    this->affinity = affinity;
+    stack = new uint8_t[STACK_SIZE];
+    kernelStack = (uint32_t)stack + STACK_SIZE;
+    addressSpace = AddressSpace::Kernel();
+    userTask = false;
+
+    cpustate = (CPUState *)(kernelStack - sizeof(CPUState));
+    memset(cpustate, 0, sizeof(CPUState));
+
+    cpustate->gs = gdt->ProcessorDataSegmentSelector();
+    cpustate->fs = gdt->DataSegmentSelector();
+    cpustate->es = gdt->DataSegmentSelector();
+    cpustate->ds = gdt->DataSegmentSelector();
+    cpustate->eip = (uint32_t)entry;
+    cpustate->cs = gdt->CodeSegmentSelector();
+    cpustate->eflags = TASK_INITIAL_EFLAGS;
+
+    /**
+     * An `iret` to ring 0 doesn't pop `esp` and `ss`, so the task starts with its stack pointer at
+     * the `esp` field. That makes the field the return address of `entry`.
+     */
+    cpustate->esp = (uint32_t)&TaskManager::TaskReturned;
+}
+
+Task::Task(GlobalDescriptorTable *gdt, AddressSpace *addressSpace, uint32_t entry,
+           uint32_t userStack)
+    : lock(&taskLockClass)
+{
+    Initialize();
+    stack = new uint8_t[STACK_SIZE];
+    kernelStack = (uint32_t)stack + STACK_SIZE;
+    this->addressSpace = addressSpace;
+    userTask = true;
+
+    cpustate = (CPUState *)(kernelStack - sizeof(CPUState));
+    memset(cpustate, 0, sizeof(CPUState));
+
+    uint32_t userData = gdt->UserDataSegmentSelector() | 3;
+    cpustate->gs = userData;
+    cpustate->fs = userData;
+    cpustate->es = userData;
+    cpustate->ds = userData;
+    cpustate->eip = entry;
+    cpustate->cs = gdt->UserCodeSegmentSelector() | 3;
+    cpustate->eflags = TASK_INITIAL_EFLAGS;
+    cpustate->esp = userStack;
+    cpustate->ss = userData;
+}
+
+void Task::Initialize()
+{
+    id = __sync_fetch_and_add(&nextTaskId, 1);
+    state = TASK_RUNNABLE;
+    sleepChannel = 0;
+    waitNext = 0;
+    waitKey = 0;
+    onProcessor = false;
+    running = false;
+    processor = 0;
+    affinity = ANY_PROCESSOR;
+    wakeupStamp = 0;
+
+    fpuState = (uint8_t *)(((uint32_t)fpuStateStorage + 15) & ~15);
+    for (uint32_t i = 0; i < FPU_STATE_SIZE; i++)
+    {
+        fpuState[i] = 0;
+    }
+    *(uint16_t *)&fpuState[FPU_STATE_CONTROL_WORD] = FPU_INITIAL_CONTROL_WORD;
+    *(uint32_t *)&fpuState[FPU_STATE_MXCSR] = FPU_INITIAL_MXCSR;
+}
+
+Task::~Task()
+{
+    if (stack != 0)
+    {
+        delete[] stack;
+    }
+    if (userTask)
+    {
+        delete addressSpace;
+    }
+}
+
+uint32_t Task::Id() { return id; }
+
+bool Task::IsUserTask() { return userTask; }
+
+AddressSpace *Task::GetAddressSpace() { return addressSpace; }
+
+/** RunQueue Class */
+
+RunQueue::RunQueue() : lock(&runQueueLockClass)
+{
+    head = 0;
+    count = 0;
+}
+
+RunQueue::~RunQueue() {}
+
+void RunQueue::Push(Task *task)
+{
+    SpinlockGuard guard(&lock);
+    tasks[(head + count) % CAPACITY] = task;
+    count++;
+}
+
+Task *RunQueue::Pop()
+{
+    SpinlockGuard guard(&lock);
+    if (count == 0)
+    {
+        return 0;
+    }
+    Task *task = tasks[head];
+    head = (head + 1) % CAPACITY;
+    count--;
+    return task;
+}
+
+uint32_t RunQueue::StealHalf(Task **stolen, uint32_t max)
+{
+    SpinlockGuard guard(&lock);
+
+    uint32_t movable = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (tasks[(head + i) % CAPACITY]->affinity == ANY_PROCESSOR)
+        {
+            movable++;
+        }
+    }
+    uint32_t wanted = (movable + 1) / 2;
+    if (wanted > max)
+    {
+        wanted = max;
+    }
+
+    /**
+     * Walks from the tail, moving the tasks kept towards it, so that they stay in order.
+     */
+    uint32_t taken = 0;
+    uint32_t kept = count;
+    for (uint32_t i = count; i-- > 0;)
+    {
+        Task *task = tasks[(head + i) % CAPACITY];
+        if (taken < wanted && task->affinity == ANY_PROCESSOR)
+        {
+            stolen[taken++] = task;
+        }
+        else
+        {
+            tasks[(head + --kept) % CAPACITY] = task;
+        }
+    }
+    head = (head + kept) % CAPACITY;
+    count -= taken;
+    return taken;
+}
+
+uint32_t RunQueue::Count() { return count; }
+
+/** TaskManager Class */
+
+TaskManager *TaskManager::activeTaskManager = 0;
+bool TaskManager::fpuStateSwitching = false;
+
+TaskManager::TaskManager(GlobalDescriptorTable *gdt) : tasksLock(&taskListLockClass)
+{
+    this->gdt = gdt;
+    activeTaskManager = this;
+    numTasks = 0;
+    deadTasks = 0;
+    processorCount = 0;
+    for (uint32_t i = 0; i < MAX_PROCESSORS; i++)
+    {
+        processors[i] = 0;
+    }
+    wakeupClock = 0;
+    for (uint32_t i = 0; i < WAKEUP_BUCKETS; i++)
+    {
+        wakeupStamps[i] = 0;
+    }
+
+    /**
+     * The boot task stays on the bootstrap processor, as it hands work to the other processors.
+     */
+    Task *boot = new Task();
+    boot->affinity = 0;
+    tasks[numTasks++] = boot;
+
+    AddProcessor(boot, new Task(gdt, &Idle, 0));
+}
+
+TaskManager::~TaskManager()
+{
+    if (activeTaskManager == this)
+    {
+        activeTaskManager = 0;
+    }
+}
+
+void TaskManager::EnableFPUStateSwitching() { fpuStateSwitching = true; }
+
+void TaskManager::AddProcessor(Task *current, Task *idle)
+{
+    ProcessorData *processor = ThisProcessor();
+    if (processor->index >= MAX_PROCESSORS)
+    {
+        return;
+    }
+
+    processor->currentTask = current;
+    processor->idleTask = idle;
+    processor->runQueue = new RunQueue();
+    current->processor = processor->index;
+    idle->processor = processor->index;
+    idle->affinity = processor->index;
+
+    processors[processor->index] = processor;
+    if (processor->index >= processorCount)
+    {
+        processorCount = processor->index + 1;
+    }
+}
+
+void TaskManager::AddProcessor()
+{
+    Task *idle = new Task();
+    AddProcessor(idle, idle);
+}
+
+void TaskManager::Idle()
+{
+    while (1)
+    {
+        activeTaskManager->Halt();
+    }
+}
+
+void TaskManager::TaskReturned() { activeTaskManager->Exit(); }
+
+bool TaskManager::AddTask(Task *task)
+{
+    SpinlockGuard guard(&tasksLock);
+    if (numTasks >= 256)
+    {
+        return false;
+    }
+    tasks[numTasks++] = task;
+
+    SpinlockGuard taskGuard(&task->lock);
+    task->processor = ThisProcessor()->index;
+    Enqueue(task);
+    return true;
+}
+
+Task *TaskManager::StartKernelTask(void (*entry)(), int32_t affinity)
+{
+    Task *task = new Task(gdt, entry, affinity);
+    if (!AddTask(task))
+    {
+        delete task;
+        return 0;
+    }
+    return task;
+}
+
+Task *TaskManager::CurrentTask()
+{
+    /**
+     * A single instruction, so that the task can't move to another processor halfway.
+     */
+    Task *task;
+    asm volatile("movl %%gs:%c1, %0"
+                 : "=r"(task)
+                 : "i"(__builtin_offsetof(ProcessorData, currentTask)));
+    return task;
+}
+
+uint32_t TaskManager::WakeupBucket(void *channel)
+{
+    return ((uint32_t)channel >> 2) % WAKEUP_BUCKETS;
+}
+
+void TaskManager::Enqueue(Task *task)
+{
+    ProcessorData *self = ThisProcessor();
+    uint32_t index = task->affinity != ANY_PROCESSOR ? task->affinity : task->processor;
+    ProcessorData *target = self;
+    if (index < processorCount && processors[index] != 0)
+    {
+        target = processors[index];
+    }
+    target->runQueue->Push(task);
+
+    ProcessorData *wake = 0;
+    if (target == self)
+    {
+        if (self->currentTask == self->idleTask)
+        {
+            self->rescheduleRequested = true;
+            return;
+        }
+    }
+    else if (target->idle)
+    {
+        wake = target;
+    }
+
+    /**
+     * The processor the task is queued for is busy. An idle one can steal it.
+     */
+    for (uint32_t i = 0; wake == 0 && task->affinity == ANY_PROCESSOR && i < processorCount; i++)
+    {
+        if (processors[i] != 0 && processors[i] != self && processors[i]->idle)
+        {
+            wake = processors[i];
+        }
+    }
+    if (wake != 0 && wake->processor != 0)
+    {
+        wake->processor->WakeUp();
+    }
+}
+
+Task *TaskManager::Steal(ProcessorData *thief)
+{
+    ProcessorData *victim = 0;
+    uint32_t most = 0;
+    for (uint32_t i = 0; i < processorCount; i++)
+    {
+        ProcessorData *processor = processors[i];
+        if (processor != 0 && processor != thief && processor->runQueue->Count() > most)
+        {
+            victim = processor;
+            most = processor->runQueue->Count();
+        }
+    }
+    if (victim == 0)
+    {
+        return 0;
+    }
+
+    Task *stolen[MAX_STOLEN_TASKS];
+    uint32_t count = victim->runQueue->StealHalf(stolen, MAX_STOLEN_TASKS);
+    if (count == 0)
+    {
+        return 0;
+    }
+    thief->steals += count;
+    for (uint32_t i = 1; i < count; i++)
+    {
+        thief->runQueue->Push(stolen[i]);
+    }
+    return stolen[0];
+}
+
+void TaskManager::ReapDeadTasks()
+{
+    SpinlockGuard guard(&tasksLock);
+
+    int kept = 0;
+    for (int i = 0; i < numTasks; i++)
+    {
+        Task *task = tasks[i];
+        bool unused;
+        {
+            SpinlockGuard taskGuard(&task->lock);
+            unused = task->state == TASK_DEAD && !task->onProcessor && !task->running;
+        }
+        if (unused)
+        {
+            delete task;
+            __sync_fetch_and_sub(&deadTasks, 1);
+            continue;
+        }
+        tasks[kept++] = task;
+    }
+    numTasks = kept;
+}
+
+CPUState *TaskManager::Schedule(CPUState *cpustate)
+{
+    ProcessorData *processor = ThisProcessor();
+    Task *previous = processor->currentTask;
+    previous->cpustate = cpustate;
+    previous->kernelStack = processor->gdt->taskStateSegment.esp0;
+    processor->rescheduleRequested = false;
+
+    if (deadTasks != 0)
+    {
+        ReapDeadTasks();
+    }
+
+    Task *next = processor->runQueue->Pop();
+    if (next == 0)
+    {
+        next = Steal(processor);
+    }
+
+    /**
+     * A task still runnable goes to the back of the queue, or keeps running if nothing else
+     * waits.
+     */
+    if (previous != processor->idleTask)
+    {
+        SpinlockGuard guard(&previous->lock);
+        if (previous->state == TASK_RUNNABLE && next == 0)
+        {
+            next = previous;
+        }
+        else
+        {
+            previous->onProcessor = false;
+            if (previous->state == TASK_RUNNABLE)
+            {
+                processor->runQueue->Push(previous);
+            }
+        }
+    }
+
+    if (next == 0)
+    {
+        next = processor->idleTask;
+    }
+    return SwitchTo(next);
+}
+
+CPUState *TaskManager::SwitchTo(Task *task)
+{
+    ProcessorData *processor = ThisProcessor();
+    Task *previous = processor->currentTask;
+    if (task != previous)
+    {
+        /**
+         * Another processor may have just switched away from the task, and still be on its stack.
+         */
+        while (task->running)
+        {
+            asm volatile("pause" : : : "memory");
+        }
+        task->running = true;
+        processor->switchedFrom = &previous->running;
+        processor->taskSwitches++;
+
+        /**
+         * The previous task's registers are saved while it is still marked running, so no other
+         * processor restores them before they are complete.
+         */
+        if (fpuStateSwitching)
+        {
+            asm volatile("fxsave (%0)\n"
+                         "fxrstor (%1)"
+                         :
+                         : "r"(previous->fpuState), "r"(task->fpuState)
+                         : "memory");
+        }
+    }
+
+    {
+        SpinlockGuard guard(&task->lock);
+        task->onProcessor = true;
+    }
+    task->processor = processor->index;
+    task->wakeupStamp = wakeupClock;
+
+    if (task->addressSpace != AddressSpace::Current())
+    {
+        task->addressSpace->Activate();
+    }
+    processor->gdt->SetKernelStack(task->kernelStack);
+
+    processor->currentTask = task;
+    return task->cpustate;
+}
+
+CPUState *TaskManager::ExitCurrentTask(CPUState *cpustate)
+{
+    Task *current = ThisProcessor()->currentTask;
+    {
+        SpinlockGuard guard(&current->lock);
+        current->state = TASK_DEAD;
+    }
+    __sync_fetch_and_add(&deadTasks, 1);
+    return Schedule(cpustate);
+}
+
+void TaskManager::Yield() { asm volatile("int $0x81" : : : "memory"); }
+
+void TaskManager::Exit()
+{
+    /**
+     * With interrupts disabled, the task can't move to another processor while it looks itself up.
+     */
+    asm volatile("cli");
+    Task *current = ThisProcessor()->currentTask;
+    {
+        SpinlockGuard guard(&current->lock);
+        current->state = TASK_DEAD;
+    }
+    __sync_fetch_and_add(&deadTasks, 1);
+    while (1)
+    {
+        Yield();
+    }
+}
+
+void TaskManager::Halt()
+{
+    ProcessorData *processor = ThisProcessor();
+
+    /**
+     * `idle` is set before the queue is checked, and whoever queues a task checks `idle` after
+     * queueing it. So either the task is seen here, or the queueing processor sends a wakeup.
+     */
+    asm volatile("cli");
+    processor->idle = true;
+    __sync_synchronize();
+    if (processor->runQueue->Count() == 0)
+    {
+        /**
+         * `sti` only takes effect after the instruction following it, so a wakeup sent after the
+         * check still ends the `hlt`, instead of being taken before it.
+         */
+        asm volatile("sti\n"
+                     "hlt"
+                     :
+                     :
+                     : "memory");
+        processor->idle = false;
+        return;
+    }
+    processor->idle = false;
+    asm volatile("sti");
+    Yield();
+}
+
+void TaskManager::Sleep(void *channel)
+{
+    Task *current = ThisProcessor()->currentTask;
+    {
+        SpinlockGuard guard(&tasksLock);
+
+        /**
+         * Interrupts are disabled, so no wakeup from this processor came after the caller's check.
+         * One from another processor may have, though, unless nothing woke the channel's bucket
+         * since the task was switched to (before the check).
+         */
+        if ((int32_t)(wakeupStamps[WakeupBucket(channel)] - current->wakeupStamp) > 0)
+        {
+            current->wakeupStamp = wakeupClock;
+            return;
+        }
+
+        SpinlockGuard taskGuard(&current->lock);
+        current->sleepChannel = channel;
+        current->state = TASK_SLEEPING;
+    }
+
+    /**
+     * `int $0x81` works with interrupts disabled, and the task we switch to runs with its own
+     * flags. Ours (interrupts disabled) come back when we are woken up and scheduled again.
+     */
+    Yield();
+}
+
+void TaskManager::Wakeup(void *channel)
+{
+    SpinlockGuard guard(&tasksLock);
+
+    wakeupClock++;
+    wakeupStamps[WakeupBucket(channel)] = wakeupClock;
+
+    for (int i = 0; i < numTasks; i++)
+    {
+        Task *task = tasks[i];
+        SpinlockGuard taskGuard(&task->lock);
+        if (task->state == TASK_SLEEPING && task->sleepChannel == channel)
+        {
+            task->state = TASK_RUNNABLE;
+            task->sleepChannel = 0;
+
+            /**
+             * A task that isn't switched away from yet gets queued by the processor switching.
+             */
+            if (!task->onProcessor)
+            {
+                Enqueue(task);
+            }
+        }
+    }
+}
+
+void TaskManager::Block(Spinlock *lock)
+{
+    Task *current = ThisProcessor()->currentTask;
+    {
+        SpinlockGuard guard(&current->lock);
+        current->state = TASK_BLOCKED;
+    }
+    lock->Release();
+
+    /**
+     * Like in `Sleep`, interrupts stay disabled until the task is switched away from, so it can't
+     * be preempted while marked as blocked but still queued nowhere.
+     */
+    Yield();
+    lock->Acquire();
+}
+
+void TaskManager::Unblock(Task *task)
+{
+    SpinlockGuard guard(&task->lock);
+    if (task->state == TASK_BLOCKED)
+    {
+        task->state = TASK_RUNNABLE;
+        if (!task->onProcessor)
+        {
+            Enqueue(task);
+        }
+    }
+}
+
+bool TaskManager::RescheduleRequested()
+{
+    ProcessorData *processor = ThisProcessor();
+    bool requested = processor->rescheduleRequested;
+    processor->rescheduleRequested = false;
+    return requested;
+}
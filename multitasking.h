@@ -0,0 +1,393 @@
+/**
+ * @file multitasking.h
+ * @author rohan843
+ * @brief Contains the tasks and the scheduler.
+ *
+ * Tasks are switched by swapping stack pointers: every interrupt saves the interrupted task's
+ * registers on its kernel stack as a `CPUState`, and whichever `CPUState` the interrupt handling
+ * returns is what `iret` resumes. The scheduler runs on the timer interrupt (IRQ0, or the local
+ * APIC timer on the other processors) and on `int $0x81`, which is how a task gives up the CPU on
+ * its own.
+ *
+ * Every processor has a run queue of its own. A task that wakes up goes back to the processor that
+ * ran it last, whose caches may still hold its data, and a processor with nothing to run steals
+ * half of the tasks waiting for another one.
+ */
+
+#ifndef __MULTITASKING_H
+#define __MULTITASKING_H
+
+#include "gdt.h"
+#include "interrupts.h"
+#include "paging.h"
+#include "percpu.h"
+#include "spinlock.h"
+#include "types.h"
+
+enum TaskState
+{
+    TASK_RUNNABLE,
+
+    /**
+     * Waiting in `TaskManager::Sleep` until a `Wakeup` on its channel.
+     */
+    TASK_SLEEPING,
+
+    /**
+     * Waiting in a `WaitQueue` (see "sync.h") until woken through it.
+     */
+    TASK_BLOCKED,
+    TASK_DEAD,
+};
+
+/**
+ * The affinity of a task that may run on any processor.
+ */
+const int32_t ANY_PROCESSOR = -1;
+
+class Task
+{
+    friend class TaskManager;
+    friend class RunQueue;
+    friend class WaitQueue;
+
+  protected:
+    uint32_t id;
+    TaskState state;
+
+    /**
+     * The kernel stack, or 0 for tasks that keep running on the stack they were created on (the
+     * boot task, and the idle tasks of the application processors).
+     */
+    uint8_t *stack;
+
+    /**
+     * The TSS `esp0` while this task runs: where the CPU switches to when ring 3 code of this task
+     * gets interrupted.
+     */
+    uint32_t kernelStack;
+
+    CPUState *cpustate;
+
+    /**
+     * What the task sleeps on, while it is `TASK_SLEEPING`.
+     */
+    void *sleepChannel;
+
+    /**
+     * The next task in the `WaitQueue` the task waits in, and what it waits for there.
+     */
+    Task *waitNext;
+    uint32_t waitKey;
+
+    AddressSpace *addressSpace;
+
+    /**
+     * Whether the task started in ring 3 with an address space of its own, which it owns.
+     */
+    bool userTask;
+
+    /**
+     * Guards `state`, `sleepChannel` and `onProcessor`, which other processors change (e.g., in
+     * `Wakeup`).
+     */
+    Spinlock lock;
+
+    /**
+     * Set while a processor has the task as its current task. A task is either on a processor, or
+     * in at most one run queue, or neither (when it sleeps or is dead).
+     */
+    bool onProcessor;
+
+    /**
+     * Set while a processor runs on the task's stack. A processor switching away from the task
+     * still does for a moment after `onProcessor` is cleared, so another one must wait for this to
+     * be cleared before it switches to the task (see `ProcessorData::switchedFrom`).
+     */
+    volatile bool running;
+
+    /**
+     * The index of the processor that ran the task last.
+     */
+    uint32_t processor;
+
+    /**
+     * The index of the processor the task must run on, or `ANY_PROCESSOR`.
+     */
+    int32_t affinity;
+
+    /**
+     * The wakeup clock when the task was last switched to (see `TaskManager::Sleep`).
+     */
+    uint32_t wakeupStamp;
+
+    /**
+     * The x87, MMX and SSE registers while the task doesn't run, in the layout `fxsave` stores
+     * (see `TaskManager::EnableFPUStateSwitching`). `fpuState` is the 16 byte aligned part of the
+     * storage, which `fxsave` needs.
+     */
+    static const uint32_t FPU_STATE_SIZE = 512;
+    uint8_t fpuStateStorage[FPU_STATE_SIZE + 15];
+    uint8_t *fpuState;
+
+    /**
+     * @brief Creates the task object for the code that is already running, e.g., at boot.
+     */
+    Task();
+
+    /**
+     * @brief Sets up what all the constructors set up the same way.
+     */
+    void Initialize();
+
+  public:
+    static const uint32_t STACK_SIZE = 16 * 1024;
+
+    /**
+     * @brief Creates a kernel task.
+     *
+     * @param entry The function the task runs. The task ends when it returns.
+     * @param affinity The index of the processor it must run on, or `ANY_PROCESSOR`.
+     */
+    Task(GlobalDescriptorTable *gdt, void (*entry)(), int32_t affinity = ANY_PROCESSOR);
+
+    /**
+     * @brief Creates a task that starts in ring 3.
+     *
+     * @param addressSpace The address space it runs in. The task takes ownership of it.
+     * @param entry The address the task starts at.
+     * @param userStack The initial (ring 3) stack pointer.
+     */
+    Task(GlobalDescriptorTable *gdt, AddressSpace *addressSpace, uint32_t entry,
+         uint32_t userStack);
+    ~Task();
+
+    uint32_t Id();
+    bool IsUserTask();
+    AddressSpace *GetAddressSpace();
+};
+
+/**
+ * @brief The runnable tasks waiting for one processor, oldest first. The processor takes tasks from
+ * the front, and others steal from the back, under the queue's lock.
+ */
+class RunQueue
+{
+  protected:
+    static const uint32_t CAPACITY = 256;
+
+    Task *tasks[CAPACITY];
+    uint32_t head;
+    volatile uint32_t count;
+    Spinlock lock;
+
+  public:
+    RunQueue();
+    ~RunQueue();
+
+    void Push(Task *task);
+
+    /**
+     * @return The oldest task, or 0 if the queue is empty.
+     */
+    Task *Pop();
+
+    /**
+     * @brief Takes half of the tasks that may run on any processor (rounded up), from the back.
+     *
+     * @param stolen Where the tasks taken go.
+     * @param max The most tasks to take.
+     * @return How many tasks were taken.
+     */
+    uint32_t StealHalf(Task **stolen, uint32_t max);
+
+    uint32_t Count();
+};
+
+class TaskManager
+{
+  protected:
+    static const uint32_t MAX_PROCESSORS = 16;
+
+    /**
+     * All the tasks but the idle tasks, runnable or not, so that `Wakeup` can find the sleeping
+     * ones and dead ones can be deleted.
+     */
+    Task *tasks[256];
+    int numTasks;
+    Spinlock tasksLock;
+
+    /**
+     * How many tasks died and are still in `tasks`.
+     */
+    volatile uint32_t deadTasks;
+
+    /**
+     * The processors that run tasks, by index.
+     */
+    ProcessorData *processors[MAX_PROCESSORS];
+    volatile uint32_t processorCount;
+
+    /**
+     * Counts the wakeups. Each wakeup stamps the bucket of its channel with the new time, so that
+     * `Sleep` can tell whether a wakeup for its channel came since the task last checked (see
+     * `Sleep`).
+     */
+    static const uint32_t WAKEUP_BUCKETS = 64;
+    volatile uint32_t wakeupClock;
+    uint32_t wakeupStamps[WAKEUP_BUCKETS];
+
+    GlobalDescriptorTable *gdt;
+
+    static bool fpuStateSwitching;
+
+    static void Idle();
+
+    /**
+     * @brief Makes the given task the running one.
+     *
+     * @return The state to resume.
+     */
+    CPUState *SwitchTo(Task *task);
+
+    /**
+     * @brief Queues a runnable task for the processor it has to, or last did, run on, and wakes
+     * that processor (or an idle one, to steal it) up.
+     */
+    void Enqueue(Task *task);
+
+    /**
+     * @brief Takes half of the queued tasks of the processor with the most of them.
+     *
+     * @return One of the tasks taken (the others are queued for this processor), or 0.
+     */
+    Task *Steal(ProcessorData *thief);
+
+    /**
+     * @brief Deletes the dead tasks no processor uses anymore.
+     */
+    void ReapDeadTasks();
+
+    /**
+     * @brief Registers the processor this runs on, with the task running and its idle task.
+     */
+    void AddProcessor(Task *current, Task *idle);
+
+    static uint32_t WakeupBucket(void *channel);
+
+  public:
+    static TaskManager *activeTaskManager;
+
+    /**
+     * The code that is running when this is constructed becomes the first task. It stays on the
+     * bootstrap processor.
+     */
+    TaskManager(GlobalDescriptorTable *gdt);
+    ~TaskManager();
+
+    /**
+     * @brief Has task switches save and restore the x87, MMX and SSE registers, which interrupts
+     * leave alone, from then on. Must be called once the kernel uses SSE (see
+     * `GraphicsDevice::EnableSSE2`), as `fxsave` needs CR4.OSFXSR to save the SSE registers.
+     */
+    static void EnableFPUStateSwitching();
+
+    /**
+     * @brief Lets the processor this runs on run tasks. The code running becomes its idle task,
+     * and must call `Halt` whenever it has nothing else to do.
+     */
+    void AddProcessor();
+
+    /**
+     * @brief Adds a task, and queues it on the processor this runs on. Idle processors steal it
+     * from there.
+     */
+    bool AddTask(Task *task);
+
+    /**
+     * @brief Creates and adds a kernel task, e.g., for a driver's deferred work.
+     *
+     * @param affinity The index of the processor it must run on, or `ANY_PROCESSOR`.
+     * @return The task, or 0 if there are too many tasks.
+     */
+    Task *StartKernelTask(void (*entry)(), int32_t affinity = ANY_PROCESSOR);
+
+    Task *CurrentTask();
+
+    /**
+     * @brief Saves the state of the running task and picks the next one: the first task of this
+     * processor's run queue, or one stolen from another processor, or the idle task.
+     *
+     * @param cpustate The state of the running task.
+     * @return The state of the task to continue with.
+     */
+    CPUState *Schedule(CPUState *cpustate);
+
+    /**
+     * @brief Ends the running task. For use in interrupt handlers.
+     *
+     * @return The state of the task to continue with.
+     */
+    CPUState *ExitCurrentTask(CPUState *cpustate);
+
+    /**
+     * @brief Gives up the CPU to the next runnable task.
+     */
+    void Yield();
+
+    /**
+     * @brief Ends the running task. Doesn't return.
+     */
+    void Exit();
+
+    /**
+     * @brief Halts the processor until an interrupt comes, unless a task is queued for it, which
+     * it then switches to. For the idle tasks.
+     */
+    void Halt();
+
+    /**
+     * @brief Blocks the running task until `Wakeup` is called with the same channel.
+     *
+     * Must be called with interrupts disabled, after checking the condition being waited for, so
+     * that a wakeup from an interrupt handler can't slip in between. Callers should check the
+     * condition again on return, in a loop: a wakeup for the channel (or one sharing its bucket)
+     * that came on another processor since the task was last switched to makes it return right
+     * away, as it may have come between the check and the call.
+     *
+     * @param channel Any address identifying what is waited for.
+     */
+    void Sleep(void *channel);
+
+    /**
+     * @brief Makes all tasks sleeping on a channel runnable. Can be called from interrupt handlers.
+     */
+    void Wakeup(void *channel);
+
+    /**
+     * @brief Blocks the running task until `Unblock` is called with it. For `WaitQueue`.
+     *
+     * Must be called with interrupts disabled, holding the lock that whoever calls `Unblock` holds.
+     * It is released once the task is marked as blocked (so the call can't be missed), and taken
+     * again before this returns.
+     */
+    void Block(Spinlock *lock);
+
+    /**
+     * @brief Makes a task blocked by `Block` runnable. Can be called from interrupt handlers.
+     */
+    void Unblock(Task *task);
+
+    /**
+     * @brief Tells whether a task became runnable on this processor while it was idle. Clears the
+     * request.
+     */
+    bool RescheduleRequested();
+
+    /**
+     * @brief Where the entry function of a kernel task returns to.
+     */
+    static void TaskReturned();
+};
+
+#endif
@@ -0,0 +1,68 @@
+#include "netdevice.h"
+
+/** NetworkFrameHandler Class */
+
+NetworkFrameHandler::NetworkFrameHandler() {}
+
+NetworkFrameHandler::~NetworkFrameHandler() {}
+
+void NetworkFrameHandler::HandleFrame(NetworkDevice *device, const uint8_t *frame, uint32_t size)
+{
+}
+
+void NetworkFrameHandler::FrameSent(NetworkDevice *device, const void *frame) {}
+
+/** NetworkDevice Class */
+
+NetworkDevice *NetworkDevice::devices[NetworkDevice::MAX_DEVICES];
+uint32_t NetworkDevice::deviceCount = 0;
+
+NetworkDevice::NetworkDevice()
+{
+    handler = 0;
+    ResetStatistics();
+}
+
+NetworkDevice::~NetworkDevice() {}
+
+const char *NetworkDevice::Name() { return "net"; }
+
+uint64_t NetworkDevice::MacAddress() { return 0; }
+
+bool NetworkDevice::Send(const void *frame, uint32_t size) { return false; }
+
+void NetworkDevice::SetHandler(NetworkFrameHandler *handler) { this->handler = handler; }
+
+NetworkDeviceStatistics NetworkDevice::Statistics() { return statistics; }
+
+void NetworkDevice::ResetStatistics()
+{
+    statistics.framesReceived = 0;
+    statistics.bytesReceived = 0;
+    statistics.framesSent = 0;
+    statistics.framesMissed = 0;
+    statistics.framesDropped = 0;
+    statistics.interrupts = 0;
+    statistics.polls = 0;
+    statistics.interruptModeSwitches = 0;
+}
+
+void NetworkDevice::Register(NetworkDevice *device)
+{
+    if (deviceCount < MAX_DEVICES)
+    {
+        devices[deviceCount] = device;
+        deviceCount++;
+    }
+}
+
+uint32_t NetworkDevice::Count() { return deviceCount; }
+
+NetworkDevice *NetworkDevice::Get(uint32_t index)
+{
+    if (index >= deviceCount)
+    {
+        return 0;
+    }
+    return devices[index];
+}
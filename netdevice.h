@@ -0,0 +1,109 @@
+/**
+ * @file netdevice.h
+ * @author rohan843
+ * @brief Contains the interface of network cards, which send and receive Ethernet frames.
+ *
+ * Frames are never copied on their way through a device:
+ *
+ * - A received frame is handed to the device's handler right where the card put it. The handler
+ *   must be done with it when it returns, as the buffer then goes back to the card.
+ * - A frame to send is given to the card where it is. It must stay untouched until the handler
+ *   is told that it has been sent.
+ */
+
+#ifndef __NETDEVICE_H
+#define __NETDEVICE_H
+
+#include "types.h"
+
+class NetworkDevice;
+
+class NetworkFrameHandler
+{
+  public:
+    NetworkFrameHandler();
+    virtual ~NetworkFrameHandler();
+
+    /**
+     * @brief Called for each frame received, from the device's polling task.
+     *
+     * @param frame The frame, from the destination address on (without the CRC). Only valid
+     * during the call.
+     */
+    virtual void HandleFrame(NetworkDevice *device, const uint8_t *frame, uint32_t size);
+
+    /**
+     * @brief Called once a frame given to `NetworkDevice::Send` has been sent, and may be reused.
+     */
+    virtual void FrameSent(NetworkDevice *device, const void *frame);
+};
+
+struct NetworkDeviceStatistics
+{
+    uint32_t framesReceived;
+    uint64_t bytesReceived;
+    uint32_t framesSent;
+
+    /**
+     * Frames the card had no buffer for, and frames received with errors.
+     */
+    uint32_t framesMissed;
+    uint32_t framesDropped;
+
+    uint32_t interrupts;
+
+    /**
+     * The times the device was polled, and the times it went back from polling to interrupts.
+     */
+    uint32_t polls;
+    uint32_t interruptModeSwitches;
+};
+
+class NetworkDevice
+{
+  protected:
+    static const uint32_t MAX_DEVICES = 8;
+    static NetworkDevice *devices[MAX_DEVICES];
+    static uint32_t deviceCount;
+
+    NetworkFrameHandler *handler;
+    NetworkDeviceStatistics statistics;
+
+  public:
+    NetworkDevice();
+    virtual ~NetworkDevice();
+
+    /**
+     * @brief A short name for messages, e.g., "eth0".
+     */
+    virtual const char *Name();
+
+    /**
+     * @brief The MAC address, in the low 48 bits (first byte lowest).
+     */
+    virtual uint64_t MacAddress();
+
+    /**
+     * @brief Queues a frame for sending, without copying it.
+     *
+     * @param frame The frame, from the destination address on. The card adds the CRC. Must be in
+     * kernel memory (below 1 GiB), as the card uses physical addresses.
+     * @return false if the transmit ring is full.
+     */
+    virtual bool Send(const void *frame, uint32_t size);
+
+    void SetHandler(NetworkFrameHandler *handler);
+
+    NetworkDeviceStatistics Statistics();
+    void ResetStatistics();
+
+    /**
+     * @brief Makes a device known to the rest of the kernel.
+     */
+    static void Register(NetworkDevice *device);
+
+    static uint32_t Count();
+    static NetworkDevice *Get(uint32_t index);
+};
+
+#endif
@@ -0,0 +1,625 @@
+#include "paging.h"
+#include "multitasking.h"
+#include "percpu.h"
+#include "stdio.h"
+
+/**
+ * The part of the kernel image ring 3 may access, and the end of the kernel image. These are
+ * labels defined in linker.ld.
+ */
+extern "C" uint8_t user_start;
+extern "C" uint8_t user_end;
+extern "C" uint8_t kernel_end;
+
+/**
+ * The routine `CopyFromUser` and `CopyToUser` copy with, and the addresses of its copying
+ * instruction and of where it goes on once that is done (see syscallstubs.s).
+ */
+extern "C" uint32_t copyUserBytes(void *destination, const void *source, uint32_t size);
+extern "C" uint8_t copyUserBytesAccess;
+extern "C" uint8_t copyUserBytesDone;
+
+/**
+ * Guards the filling of shared frames (see `VirtualMemoryArea::sharedFrames`). Address spaces on
+ * different processors may fault on the same page of a shared area at once.
+ */
+static LockClass sharedFramesLockClass("shared frames");
+static Spinlock sharedFramesLock(&sharedFramesLockClass);
+
+/**
+ * Each page directory entry covers 4 MiB.
+ */
+const uint32_t LARGE_PAGE_SIZE = 0x400000;
+
+/**
+ * Control register bits.
+ */
+const uint32_t CR0_WRITE_PROTECT = 1 << 16;
+const uint32_t CR0_PAGING = 1 << 31;
+const uint32_t CR4_PAGE_SIZE_EXTENSION = 1 << 4;
+const uint32_t CR4_GLOBAL_PAGES = 1 << 7;
+
+static inline void InvalidatePage(uint32_t virtualAddress)
+{
+    asm volatile("invlpg (%0)" : : "r"(virtualAddress) : "memory");
+}
+
+AddressSpace *AddressSpace::kernelAddressSpace = 0;
+
+AddressSpace::AddressSpace(uint32_t *pageDirectory)
+{
+    this->pageDirectory = pageDirectory;
+    this->areas = 0;
+}
+
+AddressSpace::AddressSpace()
+{
+    areas = 0;
+    pageDirectory = (uint32_t *)PhysicalMemoryManager::activePhysicalMemoryManager->AllocateFrame();
+
+    /**
+     * Only the user space entries are private. The kernel entries point to the same page tables
+     * (or large pages) as the kernel's own directory, which never changes after boot.
+     */
+    for (uint32_t i = 0; i < 1024; i++)
+    {
+        pageDirectory[i] = kernelAddressSpace->pageDirectory[i];
+    }
+    for (uint32_t i = USER_SPACE_START / LARGE_PAGE_SIZE; i < USER_SPACE_END / LARGE_PAGE_SIZE; i++)
+    {
+        pageDirectory[i] = 0;
+    }
+}
+
+AddressSpace::~AddressSpace()
+{
+    PhysicalMemoryManager *frames = PhysicalMemoryManager::activePhysicalMemoryManager;
+
+    for (uint32_t i = USER_SPACE_START / LARGE_PAGE_SIZE; i < USER_SPACE_END / LARGE_PAGE_SIZE; i++)
+    {
+        if (!(pageDirectory[i] & PAGE_PRESENT))
+        {
+            continue;
+        }
+
+        uint32_t *pageTable = (uint32_t *)(pageDirectory[i] & ~0xFFF);
+        for (uint32_t j = 0; j < 1024; j++)
+        {
+            if ((pageTable[j] & PAGE_PRESENT) && (pageTable[j] & PAGE_PRIVATE))
+            {
+                frames->FreeFrame(pageTable[j] & ~0xFFF);
+            }
+        }
+        frames->FreeFrame((uint32_t)pageTable);
+    }
+    frames->FreeFrame((uint32_t)pageDirectory);
+
+    while (areas != 0)
+    {
+        VirtualMemoryArea *next = areas->next;
+        delete areas;
+        areas = next;
+    }
+
+    if (ThisProcessor()->addressSpace == this)
+    {
+        kernelAddressSpace->Activate();
+    }
+}
+
+void AddressSpace::InitializeKernel()
+{
+    PhysicalMemoryManager *frames = PhysicalMemoryManager::activePhysicalMemoryManager;
+    uint32_t *directory = (uint32_t *)frames->AllocateFrame();
+
+    /**
+     * The part of the kernel that holds the kernel image is mapped with 4 KiB pages, so that the
+     * pages ring 3 may use can be told apart. Everything else uses 4 MiB pages, which need no page
+     * tables and take fewer TLB entries.
+     */
+    uint32_t userStart = (uint32_t)&user_start;
+    uint32_t userEnd = (uint32_t)&user_end;
+    uint32_t smallPagesEnd = ((uint32_t)&kernel_end + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+
+    for (uint32_t i = 0; i < 1024; i++)
+    {
+        uint32_t address = i * LARGE_PAGE_SIZE;
+
+        if (address < smallPagesEnd)
+        {
+            uint32_t *pageTable = (uint32_t *)frames->AllocateFrame();
+            for (uint32_t j = 0; j < 1024; j++)
+            {
+                uint32_t page = address + j * PAGE_SIZE;
+                pageTable[j] = page | PAGE_PRESENT | PAGE_WRITABLE | PAGE_GLOBAL;
+                if (userStart <= page && page < userEnd)
+                {
+                    pageTable[j] |= PAGE_USER;
+                }
+            }
+
+            /**
+             * The directory entry must allow ring 3 as well, or the page table entries saying so
+             * wouldn't matter.
+             */
+            directory[i] = (uint32_t)pageTable | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+        }
+        else if (address < USER_SPACE_START)
+        {
+            directory[i] = address | PAGE_PRESENT | PAGE_WRITABLE | PAGE_LARGE | PAGE_GLOBAL;
+        }
+        else if (address < USER_SPACE_END)
+        {
+            directory[i] = 0;
+        }
+        else
+        {
+            directory[i] = address | PAGE_PRESENT | PAGE_WRITABLE | PAGE_LARGE | PAGE_GLOBAL |
+                           PAGE_CACHE_DISABLE | PAGE_WRITE_THROUGH;
+        }
+    }
+
+    kernelAddressSpace = new AddressSpace(directory);
+
+    uint32_t cr4;
+    asm volatile("movl %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_PAGE_SIZE_EXTENSION | CR4_GLOBAL_PAGES;
+    asm volatile("movl %0, %%cr4" : : "r"(cr4));
+
+    kernelAddressSpace->Activate();
+
+    /**
+     * Write protect makes read-only pages read-only for the kernel too.
+     */
+    uint32_t cr0;
+    asm volatile("movl %%cr0, %0" : "=r"(cr0));
+    cr0 |= CR0_PAGING | CR0_WRITE_PROTECT;
+    asm volatile("movl %0, %%cr0" : : "r"(cr0) : "memory");
+}
+
+AddressSpace *AddressSpace::Kernel() { return kernelAddressSpace; }
+
+AddressSpace *AddressSpace::Current() { return ThisProcessor()->addressSpace; }
+
+void AddressSpace::Activate()
+{
+    ThisProcessor()->addressSpace = this;
+    asm volatile("movl %0, %%cr3" : : "r"(pageDirectory) : "memory");
+}
+
+uint32_t AddressSpace::PageDirectoryAddress() { return (uint32_t)pageDirectory; }
+
+uint32_t *AddressSpace::PageTable(uint32_t virtualAddress, bool create)
+{
+    uint32_t index = virtualAddress / LARGE_PAGE_SIZE;
+    if (pageDirectory[index] & PAGE_PRESENT)
+    {
+        if (pageDirectory[index] & PAGE_LARGE)
+        {
+            return 0;
+        }
+        return (uint32_t *)(pageDirectory[index] & ~0xFFF);
+    }
+
+    if (!create)
+    {
+        return 0;
+    }
+
+    uint32_t *pageTable =
+        (uint32_t *)PhysicalMemoryManager::activePhysicalMemoryManager->AllocateFrame();
+    if (pageTable == 0)
+    {
+        return 0;
+    }
+    memset(pageTable, 0, PAGE_SIZE);
+    pageDirectory[index] = (uint32_t)pageTable | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+    return pageTable;
+}
+
+bool AddressSpace::Map(uint32_t virtualAddress, uint32_t physicalAddress, uint32_t flags)
+{
+    uint32_t *pageTable = PageTable(virtualAddress, true);
+    if (pageTable == 0)
+    {
+        return false;
+    }
+
+    pageTable[(virtualAddress / PAGE_SIZE) % 1024] = (physicalAddress & ~0xFFF) | flags;
+    if (ThisProcessor()->addressSpace == this)
+    {
+        InvalidatePage(virtualAddress);
+    }
+    return true;
+}
+
+uint32_t AddressSpace::Unmap(uint32_t virtualAddress)
+{
+    uint32_t *pageTable = PageTable(virtualAddress, false);
+    if (pageTable == 0)
+    {
+        return 0;
+    }
+
+    uint32_t entry = pageTable[(virtualAddress / PAGE_SIZE) % 1024];
+    pageTable[(virtualAddress / PAGE_SIZE) % 1024] = 0;
+    if (ThisProcessor()->addressSpace == this)
+    {
+        InvalidatePage(virtualAddress);
+    }
+    return entry;
+}
+
+uint32_t AddressSpace::Translate(uint32_t virtualAddress)
+{
+    uint32_t directoryEntry = pageDirectory[virtualAddress / LARGE_PAGE_SIZE];
+    if (!(directoryEntry & PAGE_PRESENT))
+    {
+        return 0;
+    }
+    if (directoryEntry & PAGE_LARGE)
+    {
+        return (directoryEntry & ~(LARGE_PAGE_SIZE - 1)) | (virtualAddress % LARGE_PAGE_SIZE);
+    }
+
+    uint32_t entry = ((uint32_t *)(directoryEntry & ~0xFFF))[(virtualAddress / PAGE_SIZE) % 1024];
+    if (!(entry & PAGE_PRESENT))
+    {
+        return 0;
+    }
+    return (entry & ~0xFFF) | (virtualAddress % PAGE_SIZE);
+}
+
+void AddressSpace::AddArea(VirtualMemoryArea *area)
+{
+    VirtualMemoryArea **link = &areas;
+    while (*link != 0 && (*link)->start < area->start)
+    {
+        link = &(*link)->next;
+    }
+    area->next = *link;
+    *link = area;
+}
+
+VirtualMemoryArea *AddressSpace::FindArea(uint32_t virtualAddress)
+{
+    for (VirtualMemoryArea *area = areas; area != 0 && area->start <= virtualAddress;
+         area = area->next)
+    {
+        if (virtualAddress < area->end)
+        {
+            return area;
+        }
+    }
+    return 0;
+}
+
+uint32_t AddressSpace::FindFreeRange(uint32_t size)
+{
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    uint32_t start = USER_SPACE_START + (USER_SPACE_END - USER_SPACE_START) / 2;
+    for (VirtualMemoryArea *area = areas; area != 0; area = area->next)
+    {
+        if (area->end <= start)
+        {
+            continue;
+        }
+        if (area->start >= start && area->start - start >= size)
+        {
+            break;
+        }
+        start = area->end;
+    }
+
+    if (start >= USER_SPACE_END || USER_SPACE_END - start < size)
+    {
+        return 0;
+    }
+    return start;
+}
+
+void AddressSpace::FillFrame(VirtualMemoryArea *area, uint32_t page, uint32_t frame)
+{
+    memset((void *)frame, 0, PAGE_SIZE);
+
+    uint32_t from = page < area->fileStart ? area->fileStart : page;
+    uint32_t to = page + PAGE_SIZE > area->fileEnd ? area->fileEnd : page + PAGE_SIZE;
+    if (from < to)
+    {
+        memcpy((void *)(frame + (from - page)), area->file + (from - area->fileStart), to - from);
+    }
+}
+
+uint32_t *AddressSpace::TakePages(uint32_t address, uint32_t pages)
+{
+    if (address % PAGE_SIZE != 0 || address < USER_SPACE_START || pages == 0 ||
+        pages > (USER_SPACE_END - address) / PAGE_SIZE)
+    {
+        return 0;
+    }
+
+    /**
+     * Every page is checked (and filled in) before any is taken, so that nothing changes if one
+     * of them can't be.
+     */
+    for (uint32_t i = 0; i < pages; i++)
+    {
+        uint32_t page = address + i * PAGE_SIZE;
+        VirtualMemoryArea *area = FindArea(page);
+        if (area == 0 || !(area->flags & PAGE_WRITABLE) || area->sharedFrames != 0)
+        {
+            return 0;
+        }
+        if (Translate(page) == 0 && !HandlePageFault(page, PAGE_FAULT_WRITE | PAGE_FAULT_USER))
+        {
+            return 0;
+        }
+    }
+
+    uint32_t *frames = new uint32_t[pages];
+    if (frames == 0)
+    {
+        return 0;
+    }
+    for (uint32_t i = 0; i < pages; i++)
+    {
+        frames[i] = Unmap(address + i * PAGE_SIZE) & ~0xFFF;
+    }
+    return frames;
+}
+
+uint32_t AddressSpace::GivePages(uint32_t address, const uint32_t *frames, uint32_t pages)
+{
+    if (pages == 0 || pages > (USER_SPACE_END - USER_SPACE_START) / PAGE_SIZE)
+    {
+        return 0;
+    }
+
+    if (address == 0)
+    {
+        address = FindFreeRange(pages * PAGE_SIZE);
+        if (address == 0)
+        {
+            return 0;
+        }
+        VirtualMemoryArea *area = new VirtualMemoryArea;
+        area->start = address;
+        area->end = address + pages * PAGE_SIZE;
+        area->fileStart = 0;
+        area->fileEnd = 0;
+        area->file = 0;
+        area->flags = PAGE_WRITABLE;
+        area->sharedFrames = 0;
+        AddArea(area);
+    }
+    if (address % PAGE_SIZE != 0 || address < USER_SPACE_START ||
+        pages > (USER_SPACE_END - address) / PAGE_SIZE)
+    {
+        return 0;
+    }
+
+    /**
+     * The page tables are allocated up front, so that mapping can't fail half way.
+     */
+    for (uint32_t i = 0; i < pages; i++)
+    {
+        uint32_t page = address + i * PAGE_SIZE;
+        VirtualMemoryArea *area = FindArea(page);
+        if (area == 0 || !(area->flags & PAGE_WRITABLE) || area->sharedFrames != 0 ||
+            PageTable(page, true) == 0)
+        {
+            return 0;
+        }
+    }
+
+    PhysicalMemoryManager *frameManager = PhysicalMemoryManager::activePhysicalMemoryManager;
+    for (uint32_t i = 0; i < pages; i++)
+    {
+        uint32_t page = address + i * PAGE_SIZE;
+        uint32_t entry = Unmap(page);
+        if ((entry & PAGE_PRESENT) && (entry & PAGE_PRIVATE))
+        {
+            frameManager->FreeFrame(entry & ~0xFFF);
+        }
+        Map(page, frames[i], PAGE_PRESENT | PAGE_USER | PAGE_WRITABLE | PAGE_PRIVATE);
+    }
+    return address;
+}
+
+bool AddressSpace::HandlePageFault(uint32_t address, uint32_t error)
+{
+    VirtualMemoryArea *area = FindArea(address);
+
+    /**
+     * A fault on a present page is a protection violation, never a page we still have to fill.
+     */
+    if (area == 0 || (error & PAGE_FAULT_PRESENT))
+    {
+        return false;
+    }
+    if ((error & PAGE_FAULT_WRITE) && !(area->flags & PAGE_WRITABLE))
+    {
+        return false;
+    }
+
+    PhysicalMemoryManager *frames = PhysicalMemoryManager::activePhysicalMemoryManager;
+    uint32_t page = address & ~(PAGE_SIZE - 1);
+    uint32_t flags = PAGE_PRESENT | PAGE_USER | (area->flags & PAGE_WRITABLE);
+
+    if (area->sharedFrames != 0)
+    {
+        uint32_t index = (page - area->start) / PAGE_SIZE;
+        uint32_t shared;
+        {
+            SpinlockGuard guard(&sharedFramesLock);
+            if (area->sharedFrames[index] == 0)
+            {
+                /**
+                 * A page lying entirely inside the file data, at a page aligned spot of the
+                 * image, needs no frame at all: the image itself gets mapped. Only the partial
+                 * pages at the ends of an area are copied (once, for all address spaces).
+                 */
+                uint32_t source = (uint32_t)area->file + (page - area->fileStart);
+                if (page >= area->fileStart && page + PAGE_SIZE <= area->fileEnd &&
+                    source % PAGE_SIZE == 0)
+                {
+                    area->sharedFrames[index] = source;
+                }
+                else
+                {
+                    uint32_t frame = frames->AllocateFrame();
+                    if (frame == 0)
+                    {
+                        return false;
+                    }
+                    FillFrame(area, page, frame);
+                    area->sharedFrames[index] = frame;
+                }
+            }
+            shared = area->sharedFrames[index];
+        }
+        return Map(page, shared, flags);
+    }
+
+    uint32_t frame = frames->AllocateFrame();
+    if (frame == 0)
+    {
+        return false;
+    }
+    FillFrame(area, page, frame);
+    if (!Map(page, frame, flags | PAGE_PRIVATE))
+    {
+        frames->FreeFrame(frame);
+        return false;
+    }
+    return true;
+}
+
+/** PageFaultHandler Class */
+
+PageFaultHandler::PageFaultHandler(InterruptManager *manager, TaskManager *taskManager)
+    : InterruptHandler(0x0E, manager)
+{
+    this->taskManager = taskManager;
+}
+
+PageFaultHandler::~PageFaultHandler() {}
+
+bool PageFaultHandler::HandleInterrupt(uint32_t *esp)
+{
+    CPUState *cpu = (CPUState *)*esp;
+
+    uint32_t address;
+    asm volatile("movl %%cr2, %0" : "=r"(address));
+
+    if (AddressSpace::Current()->HandlePageFault(address, cpu->error))
+    {
+        return true;
+    }
+
+    /**
+     * A system call copying from or to memory ring 3 handed it gets the copy cut short, and
+     * fails it, instead of taking the kernel down.
+     */
+    if (!(cpu->cs & 3) && cpu->eip == (uint32_t)&copyUserBytesAccess)
+    {
+        cpu->eip = (uint32_t)&copyUserBytesDone;
+        return true;
+    }
+
+    printf("\nPage fault at 0x");
+    printfHex(address);
+    printf(", eip 0x");
+    printfHex(cpu->eip);
+
+    if (cpu->cs & 3)
+    {
+        printf(": task ");
+        printfDec(taskManager->CurrentTask()->Id());
+        printf(" killed\n");
+        *esp = (uint32_t)taskManager->ExitCurrentTask(cpu);
+        return true;
+    }
+
+    /**
+     * There's no way to recover from a bad access by the kernel itself.
+     */
+    printf(" in the kernel\n");
+    while (1)
+    {
+        asm volatile("cli\n"
+                     "hlt");
+    }
+}
+
+/** User Memory Access */
+
+bool IsUserRange(uint32_t address, uint32_t size)
+{
+    uint32_t end = address + size;
+    if (end < address)
+    {
+        return false;
+    }
+    if (USER_SPACE_START <= address && end <= USER_SPACE_END)
+    {
+        return true;
+    }
+    return (uint32_t)&user_start <= address && end <= (uint32_t)&user_end;
+}
+
+bool CopyFromUser(void *destination, uint32_t source, uint32_t size)
+{
+    if (!IsUserRange(source, size))
+    {
+        return false;
+    }
+    return copyUserBytes(destination, (const void *)source, size) == 0;
+}
+
+bool CopyToUser(uint32_t destination, const void *source, uint32_t size)
+{
+    if (!IsUserRange(destination, size))
+    {
+        return false;
+    }
+    return copyUserBytes((void *)destination, source, size) == 0;
+}
+
+uint32_t CopyStringFromUser(char *destination, uint32_t source, uint32_t size)
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    /**
+     * The string is copied up to a page at a time, so that one ending right before a page that
+     * can't be accessed is still copied.
+     */
+    uint32_t length = 0;
+    while (length < size - 1)
+    {
+        uint32_t chunk = PAGE_SIZE - (source + length) % PAGE_SIZE;
+        if (chunk > size - 1 - length)
+        {
+            chunk = size - 1 - length;
+        }
+        if (!CopyFromUser(destination + length, source + length, chunk))
+        {
+            destination[length] = 0;
+            return (uint32_t)-1;
+        }
+        for (uint32_t i = 0; i < chunk; i++)
+        {
+            if (destination[length + i] == 0)
+            {
+                return length + i;
+            }
+        }
+        length += chunk;
+    }
+    destination[length] = 0;
+    return size;
+}
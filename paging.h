@@ -0,0 +1,256 @@
+/**
+ * @file paging.h
+ * @author rohan843
+ * @brief Contains the page tables, address spaces and demand paging of user memory.
+ *
+ * Every address space has the same layout:
+ *
+ * 1. 0x00000000 - 0x3FFFFFFF: The kernel. Identity mapped, shared by all address spaces.
+ * 2. 0x40000000 - 0xBFFFFFFF: User space. Private to each address space. Nothing here is mapped
+ *    up front: pages are filled in by the page fault handler on first access.
+ * 3. 0xC0000000 - 0xFFFFFFFF: Memory mapped devices. Identity mapped with caching disabled, shared
+ *    by all address spaces.
+ */
+
+#ifndef __PAGING_H
+#define __PAGING_H
+
+#include "interrupts.h"
+#include "memorymanagement.h"
+#include "types.h"
+
+class TaskManager;
+
+const uint32_t USER_SPACE_START = 0x40000000;
+const uint32_t USER_SPACE_END = 0xC0000000;
+
+/**
+ * Page directory and page table entry flags.
+ */
+const uint32_t PAGE_PRESENT = 1 << 0;
+const uint32_t PAGE_WRITABLE = 1 << 1;
+const uint32_t PAGE_USER = 1 << 2;
+const uint32_t PAGE_WRITE_THROUGH = 1 << 3;
+const uint32_t PAGE_CACHE_DISABLE = 1 << 4;
+const uint32_t PAGE_LARGE = 1 << 7;
+const uint32_t PAGE_GLOBAL = 1 << 8;
+
+/**
+ * One of the bits the CPU leaves to the OS. Marks a frame that belongs to the address space it is
+ * mapped in, so it gets freed along with it. Frames without it (shared program text) are owned by
+ * someone else.
+ */
+const uint32_t PAGE_PRIVATE = 1 << 9;
+
+/**
+ * Bits of the error code the CPU pushes for a page fault.
+ */
+const uint32_t PAGE_FAULT_PRESENT = 1 << 0;
+const uint32_t PAGE_FAULT_WRITE = 1 << 1;
+const uint32_t PAGE_FAULT_USER = 1 << 2;
+
+/**
+ * Places code or data in the part of the kernel image that ring 3 may access, for things like the
+ * system call benchmark that drop to ring 3 without a program of their own. Anything such code
+ * calls must be inlined.
+ */
+#define USER_TEXT __attribute__((section(".user.text")))
+#define USER_DATA __attribute__((section(".user.data")))
+
+/**
+ * @brief A range of user space and what it should be filled with.
+ *
+ * The bytes between `fileStart` and `fileEnd` come from `file` (`file` points to the byte that
+ * belongs at `fileStart`). Everything else in the range reads as 0.
+ */
+struct VirtualMemoryArea
+{
+    /**
+     * The page aligned range covered, `end` being exclusive.
+     */
+    uint32_t start;
+    uint32_t end;
+
+    uint32_t fileStart;
+    uint32_t fileEnd;
+    const uint8_t *file;
+
+    /**
+     * Either 0 or `PAGE_WRITABLE`.
+     */
+    uint32_t flags;
+
+    /**
+     * If not 0, the area is read-only and shared: one entry per page with the frame mapped for it,
+     * or 0 if no address space has touched that page yet. The array belongs to whoever created
+     * the area, and is shared by every address space mapping it.
+     */
+    uint32_t *sharedFrames;
+
+    VirtualMemoryArea *next;
+};
+
+class AddressSpace
+{
+  protected:
+    /**
+     * The page directory. Being below 1 GiB, its physical address is also a valid pointer.
+     */
+    uint32_t *pageDirectory;
+
+    /**
+     * The user space areas, sorted by address.
+     */
+    VirtualMemoryArea *areas;
+
+    static AddressSpace *kernelAddressSpace;
+
+    AddressSpace(uint32_t *pageDirectory);
+
+    /**
+     * @brief Returns the page table covering an address, or 0 if there is none.
+     *
+     * @param create Whether to allocate the page table if it doesn't exist yet.
+     */
+    uint32_t *PageTable(uint32_t virtualAddress, bool create);
+
+    /**
+     * @brief Fills a frame with the contents a page of an area should have.
+     */
+    void FillFrame(VirtualMemoryArea *area, uint32_t page, uint32_t frame);
+
+  public:
+    /**
+     * @brief Creates an empty user address space. The kernel part is shared with all others.
+     */
+    AddressSpace();
+    ~AddressSpace();
+
+    /**
+     * @brief Builds the kernel page directory and turns paging on. Needs the frame allocator.
+     */
+    static void InitializeKernel();
+
+    static AddressSpace *Kernel();
+
+    /**
+     * @brief Returns the address space loaded on the processor this runs on.
+     */
+    static AddressSpace *Current();
+
+    /**
+     * @brief Loads this address space into CR3.
+     */
+    void Activate();
+
+    /**
+     * @brief Returns the physical address of the page directory, the value CR3 holds while this
+     * address space is active.
+     */
+    uint32_t PageDirectoryAddress();
+
+    /**
+     * @brief Maps a 4 KiB page.
+     *
+     * @return false if a page table couldn't be allocated.
+     */
+    bool Map(uint32_t virtualAddress, uint32_t physicalAddress, uint32_t flags);
+
+    /**
+     * @brief Removes the mapping of a page.
+     *
+     * @return The page table entry the page had (0 if it wasn't mapped).
+     */
+    uint32_t Unmap(uint32_t virtualAddress);
+
+    /**
+     * @brief Returns the physical address an address maps to, or 0 if it isn't mapped.
+     */
+    uint32_t Translate(uint32_t virtualAddress);
+
+    /**
+     * @brief Adds an area. The address space takes ownership of the object.
+     */
+    void AddArea(VirtualMemoryArea *area);
+
+    VirtualMemoryArea *FindArea(uint32_t virtualAddress);
+
+    /**
+     * @brief Finds an unused, page aligned range of user space for mappings made at run time.
+     *
+     * The search starts in the middle of user space, keeping clear of program images (at the
+     * bottom) and the stack (at the top).
+     *
+     * @return The start of the range, or 0 if there is no room.
+     */
+    uint32_t FindFreeRange(uint32_t size);
+
+    /**
+     * @brief Takes pages out of the address space, to hand their frames to another one (see
+     * "ipc.h"). Pages not touched yet are filled in first. Only pages of writable areas with
+     * frames of their own can be taken; afterwards, they read as 0 again, like untouched pages.
+     *
+     * @param address The page aligned start of the pages.
+     * @return The frames (an array the caller owns), or 0 if some page can't be taken.
+     */
+    uint32_t *TakePages(uint32_t address, uint32_t pages);
+
+    /**
+     * @brief Maps frames taken out of another address space, which then belong to this one.
+     *
+     * @param address Where to map them, replacing the pages there, which must be in writable
+     * areas. If 0, they are mapped in a new area, wherever there is room.
+     * @return The address they were mapped at, or 0 if they couldn't be (the frames are then
+     * still the caller's).
+     */
+    uint32_t GivePages(uint32_t address, const uint32_t *frames, uint32_t pages);
+
+    /**
+     * @brief Fills in the page a fault happened on, if it belongs to an area.
+     *
+     * @param address The faulting address (CR2).
+     * @param error The error code of the fault.
+     * @return false if the access was invalid.
+     */
+    bool HandlePageFault(uint32_t address, uint32_t error);
+};
+
+class PageFaultHandler : public InterruptHandler
+{
+    TaskManager *taskManager;
+
+  public:
+    PageFaultHandler(InterruptManager *manager, TaskManager *taskManager);
+    ~PageFaultHandler();
+    virtual bool HandleInterrupt(uint32_t *esp);
+};
+
+/**
+ * @brief Whether a range is memory ring 3 may use: it lies in user space, or in the part of the
+ * kernel image placed there with `USER_TEXT` and `USER_DATA`. System calls check the addresses
+ * they are given with this, so ring 3 can't have the kernel touch anything it couldn't itself.
+ */
+bool IsUserRange(uint32_t address, uint32_t size);
+
+/**
+ * @brief Copy between the kernel and memory handed to a system call by ring 3. Pages of user space
+ * not touched yet are filled in, like on an access from ring 3; an access that can't be served
+ * makes the copy fail instead of halting the kernel (see `PageFaultHandler`).
+ *
+ * @return false if the range isn't ring 3's (see `IsUserRange`) or not all of it could be accessed,
+ * in which case only part of the bytes may have been copied.
+ */
+bool CopyFromUser(void *destination, uint32_t source, uint32_t size);
+bool CopyToUser(uint32_t destination, const void *source, uint32_t size);
+
+/**
+ * @brief Copies a 0 terminated string handed to a system call by ring 3 (see `CopyFromUser`). The
+ * copy is always terminated.
+ *
+ * @param size The size of `destination`. At most `size` - 1 characters are copied.
+ * @return The length of the string, `size` if it didn't fit (the copy holds the start of it), or
+ * (uint32_t)-1 if it couldn't be read.
+ */
+uint32_t CopyStringFromUser(char *destination, uint32_t source, uint32_t size);
+
+#endif
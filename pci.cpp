@@ -0,0 +1,388 @@
+#include "pci.h"
+#include "memorymanagement.h"
+#include "stdio.h"
+
+/**
+ * Bits of the header type register, and the layouts it selects.
+ */
+const uint8_t PCI_HEADER_MULTIFUNCTION = 0x80;
+const uint8_t PCI_HEADER_GENERAL = 0x00;
+const uint8_t PCI_HEADER_BRIDGE = 0x01;
+
+/**
+ * The status register bit telling that the capability list exists.
+ */
+const uint16_t PCI_STATUS_CAPABILITIES = 1 << 4;
+
+PeripheralComponentInterconnectController::PeripheralComponentInterconnectController()
+    : dataPort(0xCFC), commandPort(0xCF8)
+{
+    deviceCount = 0;
+    driverEntryCount = 0;
+    configurationAccesses = 0;
+}
+
+PeripheralComponentInterconnectController::~PeripheralComponentInterconnectController() {}
+
+uint32_t PeripheralComponentInterconnectController::Read(uint8_t bus, uint8_t device,
+                                                         uint8_t function, uint8_t registerOffset)
+{
+    /**
+     * Bit 31 enables the access. The offset selects a 32 - bit register, so its low 2 bits are 0.
+     */
+    uint32_t id = 1 << 31 | ((bus & 0xFF) << 16) | ((device & 0x1F) << 11) |
+                  ((function & 0x07) << 8) | (registerOffset & 0xFC);
+    commandPort.Write(id);
+    configurationAccesses++;
+    return dataPort.Read();
+}
+
+void PeripheralComponentInterconnectController::Write(uint8_t bus, uint8_t device,
+                                                      uint8_t function, uint8_t registerOffset,
+                                                      uint32_t value)
+{
+    uint32_t id = 1 << 31 | ((bus & 0xFF) << 16) | ((device & 0x1F) << 11) |
+                  ((function & 0x07) << 8) | (registerOffset & 0xFC);
+    commandPort.Write(id);
+    configurationAccesses++;
+    dataPort.Write(value);
+}
+
+uint8_t PeripheralComponentInterconnectController::Read8(uint8_t bus, uint8_t device,
+                                                         uint8_t function, uint8_t registerOffset)
+{
+    return Read(bus, device, function, registerOffset) >> (8 * (registerOffset % 4));
+}
+
+uint16_t PeripheralComponentInterconnectController::Read16(uint8_t bus, uint8_t device,
+                                                           uint8_t function,
+                                                           uint8_t registerOffset)
+{
+    return Read(bus, device, function, registerOffset) >> (8 * (registerOffset % 4));
+}
+
+void PeripheralComponentInterconnectController::Write16(uint8_t bus, uint8_t device,
+                                                        uint8_t function, uint8_t registerOffset,
+                                                        uint16_t value)
+{
+    /**
+     * Configuration space is written 32 bits at a time, so the other half is written back as read.
+     */
+    uint32_t shift = 8 * (registerOffset % 4);
+    uint32_t old = Read(bus, device, function, registerOffset);
+    Write(bus, device, function, registerOffset, (old & ~(0xFFFF << shift)) | (value << shift));
+}
+
+uint32_t PeripheralComponentInterconnectController::EnumerateDevices()
+{
+    deviceCount = 0;
+
+    /**
+     * If the host bridge is a multifunction device, each of its functions is the host bridge of
+     * another bus (numbered after the function). Otherwise, everything hangs off bus 0.
+     */
+    if (Read8(0, 0, 0, PCI_HEADER_TYPE) & PCI_HEADER_MULTIFUNCTION)
+    {
+        for (uint8_t function = 0; function < 8; function++)
+        {
+            if (Read16(0, 0, function, PCI_VENDOR_ID) != 0xFFFF)
+            {
+                ScanBus(function);
+            }
+        }
+    }
+    else
+    {
+        ScanBus(0);
+    }
+
+    return deviceCount;
+}
+
+void PeripheralComponentInterconnectController::ScanBus(uint8_t bus)
+{
+    for (uint8_t device = 0; device < 32; device++)
+    {
+        /**
+         * A vendor ID of 0xFFFF means nothing answered.
+         */
+        if (Read16(bus, device, 0, PCI_VENDOR_ID) == 0xFFFF)
+        {
+            continue;
+        }
+
+        uint8_t headerType = Read8(bus, device, 0, PCI_HEADER_TYPE);
+        uint8_t functions = headerType & PCI_HEADER_MULTIFUNCTION ? 8 : 1;
+        for (uint8_t function = 0; function < functions; function++)
+        {
+            if (function == 0 || Read16(bus, device, function, PCI_VENDOR_ID) != 0xFFFF)
+            {
+                AddFunction(bus, device, function);
+            }
+        }
+    }
+}
+
+void PeripheralComponentInterconnectController::AddFunction(uint8_t bus, uint8_t device,
+                                                            uint8_t function)
+{
+    /**
+     * Reading the first 16 bytes as whole registers takes 4 accesses instead of one per field.
+     */
+    uint32_t ids = Read(bus, device, function, PCI_VENDOR_ID);
+    uint32_t status = Read(bus, device, function, PCI_COMMAND) >> 16;
+    uint32_t classes = Read(bus, device, function, PCI_REVISION);
+    uint8_t headerType = Read(bus, device, function, 0x0C) >> 16;
+
+    if ((headerType & ~PCI_HEADER_MULTIFUNCTION) == PCI_HEADER_BRIDGE)
+    {
+        /**
+         * Bridges aren't listed themselves; the bus behind them is scanned instead.
+         */
+        ScanBus(Read8(bus, device, function, PCI_SECONDARY_BUS));
+        return;
+    }
+
+    if (deviceCount == MAX_DEVICES)
+    {
+        return;
+    }
+
+    PeripheralComponentInterconnectDeviceDescriptor *result = &devices[deviceCount];
+    memset(result, 0, sizeof(PeripheralComponentInterconnectDeviceDescriptor));
+
+    result->bus = bus;
+    result->device = device;
+    result->function = function;
+
+    result->vendorId = ids & 0xFFFF;
+    result->deviceId = ids >> 16;
+
+    result->revision = classes & 0xFF;
+    result->interfaceId = (classes >> 8) & 0xFF;
+    result->subclassId = (classes >> 16) & 0xFF;
+    result->classId = classes >> 24;
+
+    if ((headerType & ~PCI_HEADER_MULTIFUNCTION) == PCI_HEADER_GENERAL)
+    {
+        uint32_t interrupt = Read(bus, device, function, PCI_INTERRUPT_LINE);
+        result->interrupt = interrupt & 0xFF;
+        result->interruptPin = (interrupt >> 8) & 0xFF;
+
+        ReadBaseAddressRegisters(result, 6);
+
+        if (status & PCI_STATUS_CAPABILITIES)
+        {
+            result->msiCapability = FindCapability(result, PCI_CAPABILITY_MSI);
+            result->msixCapability = FindCapability(result, PCI_CAPABILITY_MSIX);
+        }
+    }
+
+    deviceCount++;
+}
+
+void PeripheralComponentInterconnectController::ReadBaseAddressRegisters(
+    PeripheralComponentInterconnectDeviceDescriptor *device, uint8_t count)
+{
+    uint8_t bus = device->bus, slot = device->device, function = device->function;
+
+    /**
+     * The size of a resource is found by writing all ones to its register and reading back which
+     * bits stuck. The device mustn't decode its resources at the bogus address meanwhile.
+     */
+    uint16_t command = Read16(bus, slot, function, PCI_COMMAND);
+    Write16(bus, slot, function, PCI_COMMAND, command & ~(PCI_COMMAND_IO | PCI_COMMAND_MEMORY));
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        uint8_t offset = PCI_BASE_ADDRESS_0 + 4 * i;
+        uint32_t value = Read(bus, slot, function, offset);
+        Write(bus, slot, function, offset, 0xFFFFFFFF);
+        uint32_t mask = Read(bus, slot, function, offset);
+        Write(bus, slot, function, offset, value);
+
+        if (mask == 0 || mask == 0xFFFFFFFF)
+        {
+            continue;
+        }
+
+        BaseAddressRegister *bar = &device->bars[i];
+        if (value & 0x1)
+        {
+            bar->type = InputOutput;
+            bar->address = value & ~0x3;
+            bar->size = ~(mask & ~0x3) + 1;
+            bar->size &= 0xFFFF;
+        }
+        else
+        {
+            bar->type = MemoryMapping;
+            bar->prefetchable = (value & 0x8) != 0;
+            bar->address = value & ~0xF;
+            bar->size = ~(mask & ~0xF) + 1;
+
+            /**
+             * A 64 - bit resource takes the next register too, for the high half of the address.
+             * Memory above 4 GiB can't be reached, so such a resource is left unused.
+             */
+            if (((value >> 1) & 0x3) == 0x2)
+            {
+                i++;
+                if (i < count && Read(bus, slot, function, offset + 4) != 0)
+                {
+                    bar->address = 0;
+                    bar->size = 0;
+                }
+            }
+        }
+    }
+
+    Write16(bus, slot, function, PCI_COMMAND, command);
+}
+
+uint32_t PeripheralComponentInterconnectController::DeviceCount() { return deviceCount; }
+
+PeripheralComponentInterconnectDeviceDescriptor *
+PeripheralComponentInterconnectController::Device(uint32_t index)
+{
+    if (index >= deviceCount)
+    {
+        return 0;
+    }
+    return &devices[index];
+}
+
+PeripheralComponentInterconnectDeviceDescriptor *
+PeripheralComponentInterconnectController::FindDevice(uint16_t vendorId, uint16_t deviceId,
+                                                      uint32_t start)
+{
+    for (uint32_t i = start; i < deviceCount; i++)
+    {
+        if (devices[i].vendorId == vendorId && devices[i].deviceId == deviceId)
+        {
+            return &devices[i];
+        }
+    }
+    return 0;
+}
+
+uint8_t PeripheralComponentInterconnectController::FindCapability(
+    PeripheralComponentInterconnectDeviceDescriptor *device, uint8_t id, uint8_t start)
+{
+    uint8_t bus = device->bus, slot = device->device, function = device->function;
+
+    /**
+     * The capabilities form a list: each starts with its ID and the offset of the next one.
+     * Following at most 48 entries guards against a list that loops.
+     */
+    uint8_t offset = start == 0 ? Read8(bus, slot, function, PCI_CAPABILITIES)
+                                : Read8(bus, slot, function, start + 1);
+    for (uint32_t i = 0; i < 48 && offset >= 0x40; i++)
+    {
+        offset &= 0xFC;
+        uint16_t header = Read16(bus, slot, function, offset);
+        if ((header & 0xFF) == id)
+        {
+            return offset;
+        }
+        offset = header >> 8;
+    }
+    return 0;
+}
+
+void PeripheralComponentInterconnectController::EnableBusMastering(
+    PeripheralComponentInterconnectDeviceDescriptor *device)
+{
+    uint16_t command = Read16(device->bus, device->device, device->function, PCI_COMMAND);
+    command |= PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER;
+    Write16(device->bus, device->device, device->function, PCI_COMMAND, command);
+}
+
+uint32_t PeripheralComponentInterconnectController::ConfigurationAccesses()
+{
+    return configurationAccesses;
+}
+
+void PeripheralComponentInterconnectController::RegisterDriver(
+    const PeripheralComponentInterconnectDriverEntry *entry)
+{
+    if (driverEntryCount < MAX_DRIVERS)
+    {
+        driverEntries[driverEntryCount] = entry;
+        driverEntryCount++;
+    }
+}
+
+void PeripheralComponentInterconnectController::SelectDrivers(DriverManager *driverManager,
+                                                              InterruptManager *interrupts)
+{
+    for (uint32_t i = 0; i < deviceCount; i++)
+    {
+        PeripheralComponentInterconnectDeviceDescriptor *device = &devices[i];
+        for (uint32_t j = 0; j < driverEntryCount; j++)
+        {
+            const PeripheralComponentInterconnectDriverEntry *entry = driverEntries[j];
+            if ((entry->vendorId != PCI_ANY_ID && entry->vendorId != device->vendorId) ||
+                (entry->deviceId != PCI_ANY_ID && entry->deviceId != device->deviceId) ||
+                (entry->classId != PCI_ANY_CLASS && entry->classId != device->classId) ||
+                (entry->subclassId != PCI_ANY_CLASS && entry->subclassId != device->subclassId))
+            {
+                continue;
+            }
+
+            Driver *driver = entry->create(device, this, interrupts);
+            if (driver != 0)
+            {
+                driverManager->AddDriver(driver);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Prints a number as 2 (or 4) hexadecimal digits.
+ */
+static void PrintHex(uint32_t number, uint32_t digits)
+{
+    const char *hex = "0123456789ABCDEF";
+    char str[5];
+    for (uint32_t i = 0; i < digits; i++)
+    {
+        str[i] = hex[(number >> (4 * (digits - 1 - i))) & 0xF];
+    }
+    str[digits] = '\0';
+    printf(str);
+}
+
+void PeripheralComponentInterconnectController::PrintDevices()
+{
+    for (uint32_t i = 0; i < deviceCount; i++)
+    {
+        PeripheralComponentInterconnectDeviceDescriptor *device = &devices[i];
+        printf("PCI ");
+        PrintHex(device->bus, 2);
+        printf(":");
+        PrintHex(device->device, 2);
+        printf(".");
+        PrintHex(device->function, 1);
+        printf(" ");
+        PrintHex(device->vendorId, 4);
+        printf(":");
+        PrintHex(device->deviceId, 4);
+        printf(" class ");
+        PrintHex(device->classId, 2);
+        printf(".");
+        PrintHex(device->subclassId, 2);
+        if (device->interruptPin != 0)
+        {
+            printf(" irq ");
+            printfDec(device->interrupt);
+        }
+        if (device->msiCapability != 0)
+        {
+            printf(" msi");
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,236 @@
+/**
+ * @file pci.h
+ * @author rohan843
+ * @brief Contains the PCI bus driver, and the registry matching PCI devices to their drivers.
+ *
+ * Every PCI function has a 256 byte configuration space, reached through 2 ports: the address of
+ * a 32 - bit register (bus, device, function and offset) is written to 0xCF8, after which the
+ * register can be read or written through 0xCFC.
+ *
+ * Configuration space accesses are slow (each is a pair of port accesses, and a VM exit under
+ * virtualization), so the bus is scanned exactly once, at boot. Everything the drivers need from
+ * configuration space is read then and kept in a device table.
+ */
+
+#ifndef __PCI_H
+#define __PCI_H
+
+#include "driver.h"
+#include "interrupts.h"
+#include "port.h"
+#include "types.h"
+
+/**
+ * Offsets of registers in configuration space.
+ */
+const uint8_t PCI_VENDOR_ID = 0x00;
+const uint8_t PCI_DEVICE_ID = 0x02;
+const uint8_t PCI_COMMAND = 0x04;
+const uint8_t PCI_STATUS = 0x06;
+const uint8_t PCI_REVISION = 0x08;
+const uint8_t PCI_INTERFACE = 0x09;
+const uint8_t PCI_SUBCLASS = 0x0A;
+const uint8_t PCI_CLASS = 0x0B;
+const uint8_t PCI_HEADER_TYPE = 0x0E;
+const uint8_t PCI_BASE_ADDRESS_0 = 0x10;
+const uint8_t PCI_SECONDARY_BUS = 0x19;
+const uint8_t PCI_CAPABILITIES = 0x34;
+const uint8_t PCI_INTERRUPT_LINE = 0x3C;
+const uint8_t PCI_INTERRUPT_PIN = 0x3D;
+
+/**
+ * Bits of the command register.
+ */
+const uint16_t PCI_COMMAND_IO = 1 << 0;
+const uint16_t PCI_COMMAND_MEMORY = 1 << 1;
+const uint16_t PCI_COMMAND_BUS_MASTER = 1 << 2;
+const uint16_t PCI_COMMAND_INTERRUPT_DISABLE = 1 << 10;
+
+/**
+ * Capability IDs.
+ */
+const uint8_t PCI_CAPABILITY_MSI = 0x05;
+const uint8_t PCI_CAPABILITY_VENDOR = 0x09;
+const uint8_t PCI_CAPABILITY_MSIX = 0x11;
+
+/**
+ * Matches any vendor/device ID, or any class/subclass, in a driver entry.
+ */
+const uint16_t PCI_ANY_ID = 0xFFFF;
+const uint8_t PCI_ANY_CLASS = 0xFF;
+
+enum BaseAddressRegisterType
+{
+    MemoryMapping = 0,
+    InputOutput = 1
+};
+
+/**
+ * @brief A resource (a range of ports, or of memory) a device decodes.
+ */
+struct BaseAddressRegister
+{
+    /**
+     * The first port or physical address. 0 if the register is unused.
+     */
+    uint32_t address;
+    uint32_t size;
+    BaseAddressRegisterType type;
+    bool prefetchable;
+};
+
+/**
+ * @brief What the device table keeps about one PCI function.
+ */
+struct PeripheralComponentInterconnectDeviceDescriptor
+{
+    uint8_t bus;
+    uint8_t device;
+    uint8_t function;
+
+    uint16_t vendorId;
+    uint16_t deviceId;
+
+    uint8_t classId;
+    uint8_t subclassId;
+    uint8_t interfaceId;
+    uint8_t revision;
+
+    /**
+     * The IRQ the device is wired to (as set up by the firmware), and its interrupt pin (1 - 4 for
+     * INTA# - INTD#, 0 if it doesn't interrupt).
+     */
+    uint8_t interrupt;
+    uint8_t interruptPin;
+
+    BaseAddressRegister bars[6];
+
+    /**
+     * Offsets of the MSI and MSI-X capabilities in configuration space, 0 if missing.
+     */
+    uint8_t msiCapability;
+    uint8_t msixCapability;
+};
+
+class PeripheralComponentInterconnectController;
+
+/**
+ * @brief An entry of the driver registry: which devices a driver handles, and how to create it.
+ */
+struct PeripheralComponentInterconnectDriverEntry
+{
+    /**
+     * Either of these can be `PCI_ANY_ID`.
+     */
+    uint16_t vendorId;
+    uint16_t deviceId;
+
+    /**
+     * Either of these can be `PCI_ANY_CLASS`.
+     */
+    uint8_t classId;
+    uint8_t subclassId;
+
+    /**
+     * @brief Creates the driver for a matching device.
+     *
+     * @return The driver, or 0 if the device turns out not to be usable after all.
+     */
+    Driver *(*create)(PeripheralComponentInterconnectDeviceDescriptor *device,
+                      PeripheralComponentInterconnectController *pci, InterruptManager *interrupts);
+};
+
+class PeripheralComponentInterconnectController
+{
+  protected:
+    Port32Bit dataPort;
+    Port32Bit commandPort;
+
+    static const uint32_t MAX_DEVICES = 64;
+    PeripheralComponentInterconnectDeviceDescriptor devices[MAX_DEVICES];
+    uint32_t deviceCount;
+
+    static const uint32_t MAX_DRIVERS = 32;
+    const PeripheralComponentInterconnectDriverEntry *driverEntries[MAX_DRIVERS];
+    uint32_t driverEntryCount;
+
+    /**
+     * The configuration space accesses made so far.
+     */
+    uint32_t configurationAccesses;
+
+    void ScanBus(uint8_t bus);
+    void AddFunction(uint8_t bus, uint8_t device, uint8_t function);
+    void ReadBaseAddressRegisters(PeripheralComponentInterconnectDeviceDescriptor *device,
+                                  uint8_t count);
+
+  public:
+    PeripheralComponentInterconnectController();
+    ~PeripheralComponentInterconnectController();
+
+    uint32_t Read(uint8_t bus, uint8_t device, uint8_t function, uint8_t registerOffset);
+    void Write(uint8_t bus, uint8_t device, uint8_t function, uint8_t registerOffset,
+               uint32_t value);
+
+    /**
+     * @brief 8 and 16 - bit accesses. The offset must be aligned to the access size.
+     */
+    uint8_t Read8(uint8_t bus, uint8_t device, uint8_t function, uint8_t registerOffset);
+    uint16_t Read16(uint8_t bus, uint8_t device, uint8_t function, uint8_t registerOffset);
+    void Write16(uint8_t bus, uint8_t device, uint8_t function, uint8_t registerOffset,
+                 uint16_t value);
+
+    /**
+     * @brief Scans all buses (following PCI-to-PCI bridges), filling the device table.
+     *
+     * @return The number of functions found.
+     */
+    uint32_t EnumerateDevices();
+
+    uint32_t DeviceCount();
+    PeripheralComponentInterconnectDeviceDescriptor *Device(uint32_t index);
+
+    /**
+     * @brief Finds a device in the table.
+     *
+     * @param start The index to start from, to find further devices with the same IDs.
+     * @return The device, or 0 if there is none.
+     */
+    PeripheralComponentInterconnectDeviceDescriptor *FindDevice(uint16_t vendorId,
+                                                                uint16_t deviceId,
+                                                                uint32_t start = 0);
+
+    /**
+     * @brief Finds a capability of a device.
+     *
+     * @return Its offset in configuration space, or 0 if the device doesn't have it.
+     */
+    uint8_t FindCapability(PeripheralComponentInterconnectDeviceDescriptor *device, uint8_t id,
+                           uint8_t start = 0);
+
+    /**
+     * @brief Lets the device access memory on its own (DMA), and respond to its port and memory
+     * resources.
+     */
+    void EnableBusMastering(PeripheralComponentInterconnectDeviceDescriptor *device);
+
+    uint32_t ConfigurationAccesses();
+
+    /**
+     * @brief Adds a driver to the registry. The entry must stay valid.
+     */
+    void RegisterDriver(const PeripheralComponentInterconnectDriverEntry *entry);
+
+    /**
+     * @brief Creates the driver for every device in the table that one in the registry matches
+     * (the first match wins), adding it to the driver manager.
+     */
+    void SelectDrivers(DriverManager *driverManager, InterruptManager *interrupts);
+
+    /**
+     * @brief Prints the device table, one line per device.
+     */
+    void PrintDevices();
+};
+
+#endif
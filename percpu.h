@@ -0,0 +1,103 @@
+/**
+ * @file percpu.h
+ * @author rohan843
+ * @brief Contains the data each processor keeps for itself, reached through GS.
+ *
+ * Every processor's GDT holds a `ProcessorData` block, and a segment covering just that block. GS
+ * always holds that segment while the kernel runs (the interrupt and system call entry points load
+ * it), so `%gs:` addresses the block of whichever processor the code runs on. Apart from the run
+ * queue, which has a lock of its own, only that processor writes its block, so nothing in it needs
+ * a lock.
+ */
+
+#ifndef __PERCPU_H
+#define __PERCPU_H
+
+#include "types.h"
+
+class AddressSpace;
+class GlobalDescriptorTable;
+class Processor;
+class RunQueue;
+class Task;
+
+struct ProcessorData
+{
+    /**
+     * The block's own address, which turns `%gs:0` into a normal pointer. It must come first.
+     */
+    ProcessorData *self;
+
+    /**
+     * Where the `running` flag of the task switched away from is. The interrupt entry points clear
+     * it once they have left that task's stack (see `Task`). Its offset is used in
+     * interruptstubs.s and syscallstubs.s.
+     */
+    volatile bool *switchedFrom;
+
+    /**
+     * The processor's index in the `ProcessorManager` (0 for the bootstrap processor).
+     */
+    uint32_t index;
+
+    GlobalDescriptorTable *gdt;
+
+    /**
+     * The processor's entry in the `ProcessorManager`, or 0 before there is one.
+     */
+    Processor *processor;
+
+    /**
+     * The address space whose page directory is loaded.
+     */
+    AddressSpace *addressSpace;
+
+    /**
+     * The task running on the processor, and the one it runs when nothing else is runnable.
+     */
+    Task *currentTask;
+    Task *idleTask;
+
+    /**
+     * The tasks waiting for the processor. Other processors add to it and steal from it, under its
+     * lock.
+     */
+    RunQueue *runQueue;
+
+    /**
+     * Set while the processor is halted (or about to halt) in its idle task, so that whoever
+     * queues a task for it knows to wake it up.
+     */
+    volatile bool idle;
+
+    /**
+     * Set when a task became runnable while the idle task ran, so that it gets the processor right
+     * away instead of at the next timer interrupt.
+     */
+    bool rescheduleRequested;
+
+    /**
+     * Counters. Interrupt handlers update them with interrupts disabled, so plain increments are
+     * safe.
+     */
+    uint32_t interrupts;
+    uint32_t taskSwitches;
+    uint32_t systemCalls;
+
+    /**
+     * The tasks the processor took from other processors' run queues.
+     */
+    uint32_t steals;
+} __attribute__((packed));
+
+/**
+ * @brief Returns the data of the processor this runs on.
+ */
+static inline __attribute__((always_inline)) ProcessorData *ThisProcessor()
+{
+    ProcessorData *data;
+    asm volatile("movl %%gs:0, %0" : "=r"(data));
+    return data;
+}
+
+#endif
@@ -53,6 +53,22 @@ uint16_t Port16Bit::Read()
     return result;
 }
 
+void Port16Bit::ReadString(uint16_t *buffer, uint32_t count)
+{
+    __asm__ volatile("rep insw"
+                     : "+D"(buffer), "+c"(count)
+                     : "d"(this->portnumber)
+                     : "memory");
+}
+
+void Port16Bit::WriteString(const uint16_t *buffer, uint32_t count)
+{
+    __asm__ volatile("rep outsw"
+                     : "+S"(buffer), "+c"(count)
+                     : "d"(this->portnumber)
+                     : "memory");
+}
+
 /** Port32Bit Class */
 
 Port32Bit::Port32Bit(uint16_t portnumber) : Port(portnumber) {}
@@ -111,6 +111,20 @@ class Port16Bit : public Port
      * @return uint16_t The data read from the port.
      */
     virtual uint16_t Read();
+    /**
+     * @brief Reads a block of 16 - bit words from the port with a single `rep insw`.
+     *
+     * @param buffer Where to store the words.
+     * @param count The number of words to read.
+     */
+    void ReadString(uint16_t *buffer, uint32_t count);
+    /**
+     * @brief Writes a block of 16 - bit words to the port with a single `rep outsw`.
+     *
+     * @param buffer The words to write.
+     * @param count The number of words to write.
+     */
+    void WriteString(const uint16_t *buffer, uint32_t count);
 };
 
 /**
@@ -0,0 +1,260 @@
+#include "ps2.h"
+#include "input.h"
+#include "stdio.h"
+
+/**
+ * Status register bits.
+ */
+const uint8_t PS2_STATUS_OUTPUT_FULL = 0x01;
+const uint8_t PS2_STATUS_INPUT_FULL = 0x02;
+const uint8_t PS2_STATUS_MOUSE_DATA = 0x20;
+
+/**
+ * Configuration byte bits.
+ */
+const uint8_t PS2_CONFIG_KEYBOARD_INTERRUPT = 0x01;
+const uint8_t PS2_CONFIG_MOUSE_INTERRUPT = 0x02;
+const uint8_t PS2_CONFIG_KEYBOARD_CLOCK_OFF = 0x10;
+const uint8_t PS2_CONFIG_MOUSE_CLOCK_OFF = 0x20;
+
+/**
+ * Controller commands.
+ */
+const uint8_t PS2_READ_CONFIG = 0x20;
+const uint8_t PS2_WRITE_CONFIG = 0x60;
+const uint8_t PS2_DISABLE_MOUSE = 0xA7;
+const uint8_t PS2_ENABLE_MOUSE = 0xA8;
+const uint8_t PS2_TEST_MOUSE = 0xA9;
+const uint8_t PS2_SELF_TEST = 0xAA;
+const uint8_t PS2_TEST_KEYBOARD = 0xAB;
+const uint8_t PS2_DISABLE_KEYBOARD = 0xAD;
+const uint8_t PS2_ENABLE_KEYBOARD = 0xAE;
+const uint8_t PS2_WRITE_MOUSE = 0xD4;
+
+const uint8_t PS2_SELF_TEST_PASSED = 0x55;
+const uint8_t PS2_DEVICE_ACK = 0xFA;
+
+/**
+ * The number of status register reads to wait for, about a microsecond each.
+ */
+const uint32_t PS2_TIMEOUT = 100000;
+
+/** PS2Device Class */
+
+PS2Device::PS2Device() {}
+
+PS2Device::~PS2Device() {}
+
+bool PS2Device::Activate(PS2Controller *controller) { return true; }
+
+void PS2Device::HandleByte(uint8_t byte) {}
+
+/** PS2InterruptHandler Class */
+
+PS2InterruptHandler::PS2InterruptHandler(InterruptManager *manager, uint8_t interruptNumber,
+                                         PS2Controller *controller)
+    : InterruptHandler(interruptNumber, manager)
+{
+    this->controller = controller;
+}
+
+PS2InterruptHandler::~PS2InterruptHandler() {}
+
+bool PS2InterruptHandler::HandleInterrupt(uint32_t *esp) { return controller->HandleInterrupt(); }
+
+/** PS2Controller Class */
+
+PS2Controller *PS2Controller::activePS2Controller = 0;
+
+PS2Controller::PS2Controller(InterruptManager *manager)
+    : dataPort(0x60), commandPort(0x64), keyboardInterrupt(manager, 0x21, this),
+      mouseInterrupt(manager, 0x2C, this)
+{
+    devices[0] = 0;
+    devices[1] = 0;
+    recorder = 0;
+}
+
+PS2Controller::~PS2Controller()
+{
+    if (activePS2Controller == this)
+    {
+        activePS2Controller = 0;
+    }
+}
+
+void PS2Controller::Attach(uint8_t port, PS2Device *device)
+{
+    if (port < 2)
+    {
+        devices[port] = device;
+    }
+}
+
+void PS2Controller::SetRecorder(InputTrace *recorder) { this->recorder = recorder; }
+
+void PS2Controller::Inject(uint8_t port, uint8_t data)
+{
+    uint32_t eflags;
+    asm volatile("pushfl\n"
+                 "popl %0\n"
+                 "cli"
+                 : "=r"(eflags));
+
+    if (port < 2 && devices[port] != 0)
+    {
+        devices[port]->HandleByte(data);
+    }
+
+    asm volatile("pushl %0\n"
+                 "popfl"
+                 :
+                 : "r"(eflags)
+                 : "cc");
+}
+
+bool PS2Controller::WaitWritable()
+{
+    for (uint32_t i = 0; i < PS2_TIMEOUT; i++)
+    {
+        if (!(commandPort.Read() & PS2_STATUS_INPUT_FULL))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void PS2Controller::Command(uint8_t command)
+{
+    WaitWritable();
+    commandPort.Write(command);
+}
+
+bool PS2Controller::ReadData(uint8_t *data)
+{
+    for (uint32_t i = 0; i < PS2_TIMEOUT; i++)
+    {
+        if (commandPort.Read() & PS2_STATUS_OUTPUT_FULL)
+        {
+            *data = dataPort.Read();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PS2Controller::WriteDevice(uint8_t port, uint8_t data)
+{
+    if (port == 1)
+    {
+        Command(PS2_WRITE_MOUSE);
+    }
+    if (!WaitWritable())
+    {
+        return false;
+    }
+    dataPort.Write(data);
+    return true;
+}
+
+bool PS2Controller::CommandDevice(uint8_t port, uint8_t command)
+{
+    uint8_t reply;
+    return WriteDevice(port, command) && ReadData(&reply) && reply == PS2_DEVICE_ACK;
+}
+
+void PS2Controller::Activate()
+{
+    /**
+     * Stops both devices from sending anything while the controller is set up, and throws away
+     * whatever they sent before.
+     */
+    Command(PS2_DISABLE_KEYBOARD);
+    Command(PS2_DISABLE_MOUSE);
+    while (commandPort.Read() & PS2_STATUS_OUTPUT_FULL)
+    {
+        dataPort.Read();
+    }
+
+    /**
+     * The configuration is kept as the firmware left it (e.g., the translation of keyboard scan
+     * codes to set 1), but for the interrupts and clocks, which are set once at the end.
+     */
+    uint8_t config = 0;
+    Command(PS2_READ_CONFIG);
+    ReadData(&config);
+    config &= ~(PS2_CONFIG_KEYBOARD_INTERRUPT | PS2_CONFIG_MOUSE_INTERRUPT);
+    config |= PS2_CONFIG_KEYBOARD_CLOCK_OFF | PS2_CONFIG_MOUSE_CLOCK_OFF;
+
+    uint8_t result = 0;
+    Command(PS2_SELF_TEST);
+    if (!ReadData(&result) || result != PS2_SELF_TEST_PASSED)
+    {
+        printf("ps2: controller self test failed\n");
+        return;
+    }
+
+    const uint8_t tests[2] = {PS2_TEST_KEYBOARD, PS2_TEST_MOUSE};
+    const uint8_t enables[2] = {PS2_ENABLE_KEYBOARD, PS2_ENABLE_MOUSE};
+    const uint8_t interrupts[2] = {PS2_CONFIG_KEYBOARD_INTERRUPT, PS2_CONFIG_MOUSE_INTERRUPT};
+    const uint8_t clocks[2] = {PS2_CONFIG_KEYBOARD_CLOCK_OFF, PS2_CONFIG_MOUSE_CLOCK_OFF};
+    for (uint8_t port = 0; port < 2; port++)
+    {
+        if (devices[port] == 0)
+        {
+            continue;
+        }
+
+        /**
+         * A port test answers 0 if the port works.
+         */
+        Command(tests[port]);
+        if (!ReadData(&result) || result != 0)
+        {
+            devices[port] = 0;
+            continue;
+        }
+
+        Command(enables[port]);
+        if (!devices[port]->Activate(this))
+        {
+            Command(port == 0 ? PS2_DISABLE_KEYBOARD : PS2_DISABLE_MOUSE);
+            devices[port] = 0;
+            continue;
+        }
+        config = (config | interrupts[port]) & ~clocks[port];
+    }
+
+    Command(PS2_WRITE_CONFIG);
+    WaitWritable();
+    dataPort.Write(config);
+
+    activePS2Controller = this;
+}
+
+bool PS2Controller::HandleInterrupt()
+{
+    /**
+     * Both IRQs come here, and a byte is handed to the device its status says it came from, not
+     * the one whose IRQ it is. A byte may be waiting already when the other device's IRQ comes.
+     */
+    bool handled = false;
+    uint8_t status;
+    while ((status = commandPort.Read()) & PS2_STATUS_OUTPUT_FULL)
+    {
+        uint8_t data = dataPort.Read();
+        uint8_t port = (status & PS2_STATUS_MOUSE_DATA) ? 1 : 0;
+        if (recorder != 0)
+        {
+            recorder->Record(port, data);
+        }
+        PS2Device *device = devices[port];
+        if (device != 0)
+        {
+            device->HandleByte(data);
+        }
+        handled = true;
+    }
+    return handled;
+}
@@ -0,0 +1,150 @@
+/**
+ * @file ps2.h
+ * @author rohan843
+ * @brief Contains the driver for the PS/2 controller (the "8042"), which the keyboard and the mouse
+ * are connected to.
+ *
+ * Both devices share the controller's data port (0x60): the controller raises IRQ1 when it holds a
+ * byte from the keyboard and IRQ12 when it holds one from the mouse, and bit 5 of its status
+ * register tells which one it is. So the controller owns the ports, sets itself up once at boot,
+ * and both IRQs go to the same handler. That handler reads every byte waiting and hands each to
+ * the device it came from.
+ */
+
+#ifndef __PS2_H
+#define __PS2_H
+
+#include "driver.h"
+#include "interrupts.h"
+#include "port.h"
+#include "types.h"
+
+class PS2Controller;
+class InputTrace;
+
+/**
+ * @brief A device connected to one of the PS/2 controller's ports.
+ */
+class PS2Device
+{
+  public:
+    PS2Device();
+    ~PS2Device();
+
+    /**
+     * @brief Sets the device up, once the controller has been. The device's interrupts are not
+     * enabled yet, so replies to commands are read with `PS2Controller::ReadData`.
+     *
+     * @return false if the device doesn't respond.
+     */
+    virtual bool Activate(PS2Controller *controller);
+
+    /**
+     * @brief Handles a byte the device sent. Called in the interrupt handler.
+     */
+    virtual void HandleByte(uint8_t byte);
+};
+
+/**
+ * @brief Takes one of the controller's IRQs, and passes it on to the controller.
+ */
+class PS2InterruptHandler : public InterruptHandler
+{
+    PS2Controller *controller;
+
+  public:
+    PS2InterruptHandler(InterruptManager *manager, uint8_t interruptNumber,
+                        PS2Controller *controller);
+    ~PS2InterruptHandler();
+
+    virtual bool HandleInterrupt(uint32_t *esp);
+};
+
+class PS2Controller : public Driver
+{
+  protected:
+    Port8Bit dataPort;
+    Port8Bit commandPort;
+
+    PS2InterruptHandler keyboardInterrupt;
+    PS2InterruptHandler mouseInterrupt;
+
+    /**
+     * The devices on the first (keyboard) and second (mouse) ports, or 0.
+     */
+    PS2Device *devices[2];
+
+    /**
+     * Gets every byte the devices send, or 0.
+     */
+    InputTrace *recorder;
+
+    /**
+     * @brief Waits until the controller can take another byte.
+     *
+     * @return false if it doesn't within a while.
+     */
+    bool WaitWritable();
+
+    /**
+     * @brief Sends a command to the controller itself.
+     */
+    void Command(uint8_t command);
+
+  public:
+    static PS2Controller *activePS2Controller;
+
+    PS2Controller(InterruptManager *manager);
+    ~PS2Controller();
+
+    /**
+     * @brief Attaches a device to a port (0 for the keyboard, 1 for the mouse). Must be done before
+     * the controller is activated.
+     */
+    void Attach(uint8_t port, PS2Device *device);
+
+    /**
+     * @brief Tests the controller and its ports, then activates the attached devices that
+     * respond, and enables their interrupts.
+     */
+    virtual void Activate();
+
+    /**
+     * @brief Hands every byte the controller holds to the device it came from.
+     *
+     * @return Whether there was any.
+     */
+    bool HandleInterrupt();
+
+    /**
+     * @brief Has every byte the devices send recorded into a trace (0 to stop).
+     */
+    void SetRecorder(InputTrace *recorder);
+
+    /**
+     * @brief Hands a byte to the device on a port as if the device had sent it, e.g., to replay a
+     * trace. The byte goes through the same handling as real ones, with interrupts disabled.
+     */
+    void Inject(uint8_t port, uint8_t data);
+
+    /**
+     * @brief Sends a byte to the device on a port.
+     *
+     * @return false if the controller doesn't take it.
+     */
+    bool WriteDevice(uint8_t port, uint8_t data);
+
+    /**
+     * @brief Sends a command to the device on a port, and waits for its acknowledgement (0xFA).
+     */
+    bool CommandDevice(uint8_t port, uint8_t command);
+
+    /**
+     * @brief Waits for a byte from the controller (from either device), with interrupts off.
+     *
+     * @return false if none comes within a while.
+     */
+    bool ReadData(uint8_t *data);
+};
+
+#endif
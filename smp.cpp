@@ -0,0 +1,585 @@
+#include "smp.h"
+#include "benchmark.h"
+#include "memorymanagement.h"
+#include "multitasking.h"
+#include "paging.h"
+#include "stdio.h"
+#include "syscalls.h"
+
+/**
+ * Local APIC registers, as offsets from its base address.
+ */
+const uint32_t APIC_ID = 0x020;
+const uint32_t APIC_END_OF_INTERRUPT = 0x0B0;
+const uint32_t APIC_SPURIOUS_VECTOR = 0x0F0;
+const uint32_t APIC_INTERRUPT_COMMAND_LOW = 0x300;
+const uint32_t APIC_INTERRUPT_COMMAND_HIGH = 0x310;
+const uint32_t APIC_LVT_TIMER = 0x320;
+const uint32_t APIC_LVT_LINT0 = 0x350;
+const uint32_t APIC_LVT_LINT1 = 0x360;
+const uint32_t APIC_TIMER_INITIAL_COUNT = 0x380;
+const uint32_t APIC_TIMER_CURRENT_COUNT = 0x390;
+const uint32_t APIC_TIMER_DIVIDE = 0x3E0;
+
+/**
+ * The software enable bit of the spurious interrupt vector register.
+ */
+const uint32_t APIC_SOFTWARE_ENABLE = 1 << 8;
+
+/**
+ * Interrupt command register bits: the delivery modes, the delivery status (set while the IPI is
+ * being sent) and the level (always "assert" but for the obsolete INIT deassert).
+ */
+const uint32_t APIC_DELIVERY_FIXED = 0x000;
+const uint32_t APIC_DELIVERY_NMI = 0x400;
+const uint32_t APIC_DELIVERY_INIT = 0x500;
+const uint32_t APIC_DELIVERY_STARTUP = 0x600;
+const uint32_t APIC_DELIVERY_EXTINT = 0x700;
+const uint32_t APIC_DELIVERY_PENDING = 1 << 12;
+const uint32_t APIC_LEVEL_ASSERT = 1 << 14;
+
+/**
+ * Local vector table bits: masked, and (for the timer) periodic instead of one-shot. The divide
+ * configuration value 0x3 makes the timer count at the bus clock divided by 16.
+ */
+const uint32_t APIC_LVT_MASKED = 1 << 16;
+const uint32_t APIC_TIMER_PERIODIC = 1 << 17;
+const uint32_t APIC_TIMER_DIVIDE_BY_16 = 0x3;
+
+/**
+ * The length of a time slice on the application processors.
+ */
+const uint32_t TIME_SLICE_MILLISECONDS = 10;
+
+/**
+ * The model specific register holding the local APIC's base address, and its global enable bit.
+ */
+const uint32_t IA32_APIC_BASE = 0x1B;
+const uint32_t IA32_APIC_BASE_ENABLE = 1 << 11;
+
+/**
+ * Set in the model specific register of the bootstrap processor only.
+ */
+const uint32_t IA32_APIC_BASE_BOOTSTRAP = 1 << 8;
+
+/**
+ * The number of polls of the interrupt command register to wait for an IPI to go out.
+ */
+const uint32_t APIC_SEND_TIMEOUT = 100000;
+
+/**
+ * The page the trampoline is copied to. Memory below 1 MiB is never handed out by the frame
+ * allocator, and this page is free of the BIOS data.
+ */
+const uint32_t TRAMPOLINE_ADDRESS = 0x8000;
+
+/**
+ * The trampoline, defined in smptrampoline.s. The data part is filled in before each start.
+ */
+extern "C" uint8_t smpTrampolineStart;
+extern "C" uint8_t smpTrampolineData;
+extern "C" uint8_t smpTrampolineEnd;
+
+/**
+ * @brief The data part of the trampoline. Its layout must match smptrampoline.s.
+ */
+struct TrampolineData
+{
+    /**
+     * The GDTR, loaded in real mode (the bootstrap processor's GDT).
+     */
+    uint16_t gdtLimit;
+    uint32_t gdtBase;
+
+    uint32_t cr0;
+    uint32_t cr3;
+    uint32_t cr4;
+
+    /**
+     * The top of the stack, and the function called on it.
+     */
+    uint32_t stack;
+    uint32_t entry;
+} __attribute__((packed));
+
+static TrampolineData *Trampoline()
+{
+    return (TrampolineData *)(TRAMPOLINE_ADDRESS + (&smpTrampolineData - &smpTrampolineStart));
+}
+
+/**
+ * @brief Waits for some microseconds, on the time stamp counter.
+ */
+static void Delay(uint32_t microseconds)
+{
+    uint64_t end =
+        ReadTimestampCounter() + (uint64_t)microseconds * (TimestampCounterFrequency() / 1000000);
+    while (ReadTimestampCounter() < end)
+    {
+        asm volatile("pause");
+    }
+}
+
+/** LocalAPIC Class */
+
+LocalAPIC::LocalAPIC(uint32_t address)
+{
+    registers = (volatile uint32_t *)address;
+    timerTicksPerMillisecond = 0;
+}
+
+LocalAPIC::~LocalAPIC() {}
+
+uint32_t LocalAPIC::Read(uint32_t offset) { return registers[offset / 4]; }
+
+void LocalAPIC::Write(uint32_t offset, uint32_t value) { registers[offset / 4] = value; }
+
+void LocalAPIC::Enable()
+{
+    uint32_t low, high;
+    asm volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(IA32_APIC_BASE));
+    if (!(low & IA32_APIC_BASE_ENABLE))
+    {
+        low |= IA32_APIC_BASE_ENABLE;
+        asm volatile("wrmsr" : : "c"(IA32_APIC_BASE), "a"(low), "d"(high));
+    }
+
+    /**
+     * The spurious interrupt vector is set either way, as the firmware's may be anything.
+     */
+    uint32_t spurious = Read(APIC_SPURIOUS_VECTOR);
+    Write(APIC_SPURIOUS_VECTOR,
+          (spurious & ~0xFF) | APIC_SOFTWARE_ENABLE | APIC_SPURIOUS_INTERRUPT);
+    if (spurious & APIC_SOFTWARE_ENABLE)
+    {
+        return;
+    }
+
+    /**
+     * A disabled local APIC masks its local interrupt lines, and enabling it doesn't unmask them.
+     * The PICs are wired to LINT0 of the bootstrap processor (and NMIs come on LINT1), so those
+     * are set up the way the firmware would have ("virtual wire" mode). On the other processors
+     * the lines stay masked.
+     */
+    if (low & IA32_APIC_BASE_BOOTSTRAP)
+    {
+        Write(APIC_LVT_LINT0, APIC_DELIVERY_EXTINT);
+        Write(APIC_LVT_LINT1, APIC_DELIVERY_NMI);
+    }
+}
+
+uint8_t LocalAPIC::Id() { return Read(APIC_ID) >> 24; }
+
+void LocalAPIC::EndOfInterrupt() { Write(APIC_END_OF_INTERRUPT, 0); }
+
+bool LocalAPIC::Send(uint8_t apicId, uint32_t command)
+{
+    /**
+     * Nothing else may send an IPI between the writes of the two halves.
+     */
+    uint32_t eflags;
+    asm volatile("pushfl\n"
+                 "popl %0\n"
+                 "cli"
+                 : "=r"(eflags));
+
+    bool sent = false;
+    for (uint32_t i = 0; i < APIC_SEND_TIMEOUT && !sent; i++)
+    {
+        if (!(Read(APIC_INTERRUPT_COMMAND_LOW) & APIC_DELIVERY_PENDING))
+        {
+            /**
+             * Writing the low half sends the IPI, so the destination goes first.
+             */
+            Write(APIC_INTERRUPT_COMMAND_HIGH, (uint32_t)apicId << 24);
+            Write(APIC_INTERRUPT_COMMAND_LOW, command);
+            sent = true;
+        }
+        else
+        {
+            asm volatile("pause");
+        }
+    }
+
+    asm volatile("pushl %0\n"
+                 "popfl"
+                 :
+                 : "r"(eflags)
+                 : "cc");
+    return sent;
+}
+
+bool LocalAPIC::SendInit(uint8_t apicId)
+{
+    return Send(apicId, APIC_DELIVERY_INIT | APIC_LEVEL_ASSERT);
+}
+
+bool LocalAPIC::SendStartup(uint8_t apicId, uint8_t page)
+{
+    return Send(apicId, APIC_DELIVERY_STARTUP | APIC_LEVEL_ASSERT | page);
+}
+
+bool LocalAPIC::SendInterrupt(uint8_t apicId, uint8_t interruptNumber)
+{
+    return Send(apicId, APIC_DELIVERY_FIXED | APIC_LEVEL_ASSERT | interruptNumber);
+}
+
+void LocalAPIC::CalibrateTimer()
+{
+    Write(APIC_TIMER_DIVIDE, APIC_TIMER_DIVIDE_BY_16);
+    Write(APIC_LVT_TIMER, APIC_LVT_MASKED | APIC_TIMER_INTERRUPT);
+    Write(APIC_TIMER_INITIAL_COUNT, 0xFFFFFFFF);
+    Delay(10000);
+    uint32_t counted = 0xFFFFFFFF - Read(APIC_TIMER_CURRENT_COUNT);
+    Write(APIC_TIMER_INITIAL_COUNT, 0);
+    timerTicksPerMillisecond = counted / 10;
+}
+
+void LocalAPIC::StartTimer(uint8_t interruptNumber, uint32_t milliseconds)
+{
+    if (timerTicksPerMillisecond == 0)
+    {
+        return;
+    }
+    Write(APIC_TIMER_DIVIDE, APIC_TIMER_DIVIDE_BY_16);
+    Write(APIC_LVT_TIMER, APIC_TIMER_PERIODIC | interruptNumber);
+    Write(APIC_TIMER_INITIAL_COUNT, timerTicksPerMillisecond * milliseconds);
+}
+
+/** LocalAPICInterruptHandler Class */
+
+LocalAPICInterruptHandler::LocalAPICInterruptHandler(uint8_t interruptNumber,
+                                                     InterruptManager *manager,
+                                                     LocalAPIC *localAPIC)
+    : InterruptHandler(interruptNumber, manager)
+{
+    this->localAPIC = localAPIC;
+}
+
+LocalAPICInterruptHandler::~LocalAPICInterruptHandler() {}
+
+bool LocalAPICInterruptHandler::HandleInterrupt(uint32_t *esp)
+{
+    localAPIC->EndOfInterrupt();
+    return true;
+}
+
+/** Processor Class */
+
+Processor::Processor(uint32_t index, uint8_t apicId, bool bootstrap, LocalAPIC *localAPIC)
+{
+    this->index = index;
+    this->apicId = apicId;
+    this->bootstrap = bootstrap;
+    this->localAPIC = localAPIC;
+    stack = 0;
+    gdt = 0;
+    started = false;
+    work = 0;
+    argument = 0;
+}
+
+Processor::~Processor() {}
+
+uint32_t Processor::Index() { return index; }
+
+uint8_t Processor::ApicId() { return apicId; }
+
+bool Processor::Bootstrap() { return bootstrap; }
+
+bool Processor::Started() { return started; }
+
+GlobalDescriptorTable *Processor::Gdt() { return gdt; }
+
+ProcessorData *Processor::Data() { return gdt != 0 ? &gdt->processorData : 0; }
+
+bool Processor::Run(void (*work)(void *), void *argument)
+{
+    if (bootstrap || !started || this->work != 0)
+    {
+        return false;
+    }
+
+    /**
+     * The argument must be in place before the processor can see the work.
+     */
+    this->argument = argument;
+    this->work = work;
+    WakeUp();
+    return true;
+}
+
+void Processor::Wait()
+{
+    while (work != 0)
+    {
+        asm volatile("pause");
+    }
+}
+
+void Processor::WakeUp()
+{
+    if (localAPIC != 0 && !bootstrap)
+    {
+        localAPIC->SendInterrupt(apicId, IPI_WAKEUP);
+    }
+}
+
+void Processor::RunWork()
+{
+    while (true)
+    {
+        /**
+         * The work is checked with interrupts disabled, and `Halt` only enables them right before
+         * halting, so a wakeup sent after the check still ends the `hlt`.
+         */
+        asm volatile("cli");
+        if (work == 0)
+        {
+            TaskManager::activeTaskManager->Halt();
+            continue;
+        }
+
+        /**
+         * The work runs with interrupts disabled, as it did before the processor ran tasks: its
+         * timings aren't split by time slices.
+         */
+        work(argument);
+        work = 0;
+    }
+}
+
+/** ProcessorManager Class */
+
+ProcessorManager *ProcessorManager::activeProcessorManager = 0;
+
+ProcessorManager::ProcessorManager(ACPITables *acpi, InterruptManager *interrupts,
+                                   GlobalDescriptorTable *gdt)
+{
+    count = 0;
+    localAPIC = 0;
+    wakeupHandler = 0;
+    timerHandler = 0;
+    starting = 0;
+
+    if (acpi == 0 || !Discover(acpi, interrupts, gdt))
+    {
+        processors[0] = new Processor(0, 0, true, 0);
+        processors[0]->gdt = gdt;
+        processors[0]->started = true;
+        count = 1;
+    }
+    gdt->processorData.processor = processors[0];
+    activeProcessorManager = this;
+}
+
+ProcessorManager::~ProcessorManager()
+{
+    if (activeProcessorManager == this)
+    {
+        activeProcessorManager = 0;
+    }
+}
+
+bool ProcessorManager::Discover(ACPITables *acpi, InterruptManager *interrupts,
+                                GlobalDescriptorTable *gdt)
+{
+    const MultipleAPICDescriptionTable *madt =
+        (const MultipleAPICDescriptionTable *)acpi->Find("APIC");
+    if (madt == 0)
+    {
+        printf("smp: no MADT\n");
+        return false;
+    }
+
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    if (!(edx & (1 << 9)))
+    {
+        printf("smp: no local APIC\n");
+        return false;
+    }
+
+    const uint8_t *entries = (const uint8_t *)madt + sizeof(MultipleAPICDescriptionTable);
+    const uint8_t *end = (const uint8_t *)madt + madt->header.length;
+
+    uint64_t address = madt->localAPICAddress;
+    for (const uint8_t *entry = entries; entry + sizeof(MADTEntry) <= end;
+         entry += ((MADTEntry *)entry)->length)
+    {
+        if (((MADTEntry *)entry)->length < sizeof(MADTEntry))
+        {
+            break;
+        }
+        if (((MADTEntry *)entry)->type == MADT_LOCAL_APIC_ADDRESS)
+        {
+            address = ((MADTLocalAPICAddress *)entry)->address;
+        }
+    }
+
+    /**
+     * The registers must be in the uncached, identity mapped top of the address space.
+     */
+    if (address < USER_SPACE_END || address > 0xFFFFF000)
+    {
+        printf("smp: the local APIC is out of reach\n");
+        return false;
+    }
+    localAPIC = new LocalAPIC((uint32_t)address);
+    localAPIC->Enable();
+    localAPIC->CalibrateTimer();
+
+    /**
+     * The bootstrap processor always comes first.
+     */
+    uint8_t bootstrapId = localAPIC->Id();
+    processors[0] = new Processor(0, bootstrapId, true, localAPIC);
+    processors[0]->gdt = gdt;
+    processors[0]->started = true;
+    count = 1;
+
+    for (const uint8_t *entry = entries; entry + sizeof(MADTEntry) <= end;
+         entry += ((MADTEntry *)entry)->length)
+    {
+        if (((MADTEntry *)entry)->length < sizeof(MADTEntry))
+        {
+            break;
+        }
+        MADTLocalAPIC *processor = (MADTLocalAPIC *)entry;
+        if (processor->entry.type != MADT_LOCAL_APIC ||
+            !(processor->flags & MADT_PROCESSOR_ENABLED) || processor->apicId == bootstrapId)
+        {
+            continue;
+        }
+        if (count == MAX_PROCESSORS)
+        {
+            printf("smp: too many processors, ignoring the rest\n");
+            break;
+        }
+        processors[count] = new Processor(count, processor->apicId, false, localAPIC);
+        count++;
+    }
+
+    wakeupHandler = new LocalAPICInterruptHandler(IPI_WAKEUP, interrupts, localAPIC);
+    timerHandler = new LocalAPICInterruptHandler(APIC_TIMER_INTERRUPT, interrupts, localAPIC);
+    return true;
+}
+
+void ProcessorManager::PrepareTrampoline()
+{
+    memcpy((void *)TRAMPOLINE_ADDRESS, &smpTrampolineStart,
+           &smpTrampolineEnd - &smpTrampolineStart);
+
+    /**
+     * The processors start with the bootstrap processor's GDT, control registers and the
+     * kernel's page directory, until they have built their own GDT.
+     */
+    struct GDTPointer
+    {
+        uint16_t limit;
+        uint32_t base;
+    } __attribute__((packed));
+    GDTPointer gdtr;
+    asm volatile("sgdt %0" : "=m"(gdtr));
+
+    TrampolineData *data = Trampoline();
+    data->gdtLimit = gdtr.limit;
+    data->gdtBase = gdtr.base;
+    asm volatile("movl %%cr0, %0" : "=r"(data->cr0));
+    asm volatile("movl %%cr4, %0" : "=r"(data->cr4));
+    data->cr3 = AddressSpace::Kernel()->PageDirectoryAddress();
+    data->entry = (uint32_t)&ApplicationProcessorEntry;
+}
+
+bool ProcessorManager::Start(Processor *processor)
+{
+    processor->stack = new uint8_t[Processor::STACK_SIZE];
+    Trampoline()->stack = (uint32_t)processor->stack + Processor::STACK_SIZE;
+    starting = processor;
+
+    /**
+     * INIT resets the processor into waiting for a SIPI, and the SIPI starts it. A second SIPI is
+     * sent if the first one isn't taken, as the specification says.
+     */
+    if (!localAPIC->SendInit(processor->apicId))
+    {
+        return false;
+    }
+    Delay(10000);
+    for (uint32_t attempt = 0; attempt < 2 && !processor->started; attempt++)
+    {
+        localAPIC->SendStartup(processor->apicId, TRAMPOLINE_ADDRESS >> 12);
+        Delay(200);
+    }
+
+    /**
+     * Under emulation, a processor may take a while to get going.
+     */
+    for (uint32_t i = 0; i < 1000 && !processor->started; i++)
+    {
+        Delay(100);
+    }
+
+    /**
+     * A processor that didn't start in time may still do so later, so its stack is never freed.
+     */
+    return processor->started;
+}
+
+void ProcessorManager::ApplicationProcessorEntry()
+{
+    ProcessorManager *manager = activeProcessorManager;
+    Processor *processor = manager->starting;
+
+    processor->gdt = new (processor->gdtStorage) GlobalDescriptorTable();
+    processor->gdt->processorData.index = processor->index;
+    processor->gdt->processorData.processor = processor;
+    processor->gdt->processorData.addressSpace = AddressSpace::Kernel();
+    InterruptManager::LoadDescriptorTable();
+    SyscallHandler::EnableFastSystemCalls(processor->gdt);
+    manager->localAPIC->Enable();
+
+    /**
+     * The code running here becomes the processor's idle task.
+     */
+    TaskManager::activeTaskManager->AddProcessor();
+    manager->localAPIC->StartTimer(APIC_TIMER_INTERRUPT, TIME_SLICE_MILLISECONDS);
+
+    processor->started = true;
+    processor->RunWork();
+}
+
+uint32_t ProcessorManager::StartApplicationProcessors()
+{
+    if (count == 1)
+    {
+        return 1;
+    }
+
+    PrepareTrampoline();
+    uint32_t running = 1;
+    for (uint32_t i = 1; i < count; i++)
+    {
+        if (Start(processors[i]))
+        {
+            running++;
+        }
+        else
+        {
+            printf("smp: processor ");
+            printfDec(processors[i]->apicId);
+            printf(" didn't start\n");
+        }
+    }
+
+    printf("smp: ");
+    printfDec(running);
+    printf(" of ");
+    printfDec(count);
+    printf(" processors running\n");
+    return running;
+}
+
+uint32_t ProcessorManager::Count() { return count; }
+
+Processor *ProcessorManager::Get(uint32_t index) { return index < count ? processors[index] : 0; }
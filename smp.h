@@ -0,0 +1,265 @@
+/**
+ * @file smp.h
+ * @author rohan843
+ * @brief Contains the local APIC, and the bring-up of the application processors.
+ *
+ * Only the bootstrap processor runs after a reset. The others (the application processors) wait
+ * for an INIT IPI followed by a startup IPI (SIPI), which makes them start in real mode at the
+ * 4 KiB page the SIPI names. A trampoline copied to that page switches to protected mode with the
+ * kernel's segments and page directory, and jumps into the kernel on a stack of the processor's
+ * own. There the processor gets its own GDT, TSS and data (see percpu.h), and loads the shared IDT.
+ *
+ * Once started, a processor runs tasks like the bootstrap processor, with its local APIC timer
+ * ending the time slices. When it has no task to run, it runs the work handed to it with
+ * `Processor::Run`, or waits (halted) for either, until an IPI wakes it up.
+ */
+
+#ifndef __SMP_H
+#define __SMP_H
+
+#include "acpi.h"
+#include "gdt.h"
+#include "interrupts.h"
+#include "percpu.h"
+#include "types.h"
+
+/**
+ * The interrupt that wakes a processor up to look for work, or tasks.
+ */
+const uint8_t IPI_WAKEUP = 0xF0;
+
+/**
+ * The interrupt of the local APIC timer, which ends the time slices on the application
+ * processors.
+ */
+const uint8_t APIC_TIMER_INTERRUPT = 0xF1;
+
+/**
+ * The interrupt a local APIC raises for an interrupt that went away before it was delivered. It
+ * needs no EOI, so the IDT's default (ignoring) gate handles it.
+ */
+const uint8_t APIC_SPURIOUS_INTERRUPT = 0xFF;
+
+/**
+ * @brief The local APIC, the interrupt controller of each processor. All processors see their
+ * own at the same address.
+ */
+class LocalAPIC
+{
+  protected:
+    volatile uint32_t *registers;
+
+    /**
+     * How far the timer counts down in a millisecond, or 0 before `CalibrateTimer`.
+     */
+    uint32_t timerTicksPerMillisecond;
+
+    uint32_t Read(uint32_t offset);
+    void Write(uint32_t offset, uint32_t value);
+
+    /**
+     * @brief Sends an IPI, waiting until the previous one has been delivered.
+     *
+     * @param command The low half of the interrupt command register (delivery mode and vector).
+     * @return false if the previous one wasn't delivered within a while.
+     */
+    bool Send(uint8_t apicId, uint32_t command);
+
+  public:
+    /**
+     * @param address The physical address of the registers.
+     */
+    LocalAPIC(uint32_t address);
+    ~LocalAPIC();
+
+    /**
+     * @brief Turns the local APIC of the processor this runs on on, if the firmware hasn't.
+     */
+    void Enable();
+
+    /**
+     * @brief The ID of the processor this runs on.
+     */
+    uint8_t Id();
+
+    /**
+     * @brief Ends the interrupt being handled on the processor this runs on.
+     */
+    void EndOfInterrupt();
+
+    bool SendInit(uint8_t apicId);
+
+    /**
+     * @param page The 4 KiB page (below 1 MiB) the processor starts at.
+     */
+    bool SendStartup(uint8_t apicId, uint8_t page);
+
+    bool SendInterrupt(uint8_t apicId, uint8_t interruptNumber);
+
+    /**
+     * @brief Measures the timer's rate against the time stamp counter. All processors' timers run
+     * at the same rate, so this is done once.
+     */
+    void CalibrateTimer();
+
+    /**
+     * @brief Starts the timer of the processor this runs on, raising an interrupt periodically.
+     */
+    void StartTimer(uint8_t interruptNumber, uint32_t milliseconds);
+};
+
+/**
+ * @brief Ends the interrupts raised by the local APIC itself (the wakeup IPIs, and the timer). The
+ * interrupt manager reschedules on them.
+ */
+class LocalAPICInterruptHandler : public InterruptHandler
+{
+    LocalAPIC *localAPIC;
+
+  public:
+    LocalAPICInterruptHandler(uint8_t interruptNumber, InterruptManager *manager,
+                              LocalAPIC *localAPIC);
+    ~LocalAPICInterruptHandler();
+
+    virtual bool HandleInterrupt(uint32_t *esp);
+};
+
+class ProcessorManager;
+
+class Processor
+{
+    friend class ProcessorManager;
+
+  protected:
+    uint32_t index;
+    uint8_t apicId;
+    bool bootstrap;
+
+    /**
+     * The stack the processor starts on, or 0 for the bootstrap processor.
+     */
+    uint8_t *stack;
+
+    /**
+     * The processor's GDT (and TSS). It has to be built on the processor itself, as building one
+     * loads it, so it is placed into `gdtStorage` once the processor has started.
+     */
+    GlobalDescriptorTable *gdt;
+    uint8_t gdtStorage[sizeof(GlobalDescriptorTable)] __attribute__((aligned(8)));
+
+    volatile bool started;
+
+    /**
+     * The work handed to the processor, or 0 once it is done with it.
+     */
+    void (*volatile work)(void *);
+    void *volatile argument;
+
+    LocalAPIC *localAPIC;
+
+    /**
+     * @brief Runs the work handed to the processor, and halts when there is none, forever. This is
+     * the processor's idle task. Called on the processor itself.
+     */
+    void RunWork();
+
+  public:
+    static const uint32_t STACK_SIZE = 16 * 1024;
+
+    Processor(uint32_t index, uint8_t apicId, bool bootstrap, LocalAPIC *localAPIC);
+    ~Processor();
+
+    uint32_t Index();
+    uint8_t ApicId();
+    bool Bootstrap();
+    bool Started();
+    GlobalDescriptorTable *Gdt();
+
+    /**
+     * @brief Returns the processor's data (see percpu.h), or 0 if it hasn't started.
+     */
+    ProcessorData *Data();
+
+    /**
+     * @brief Hands a function to an (application) processor that has started, and wakes it up.
+     *
+     * @return false if the processor hasn't started, is the bootstrap processor, or is still busy.
+     */
+    bool Run(void (*work)(void *), void *argument);
+
+    /**
+     * @brief Waits until the processor is done with the work handed to it.
+     */
+    void Wait();
+
+    /**
+     * @brief Wakes the processor up if it is halted, e.g., because a task was queued for it.
+     */
+    void WakeUp();
+};
+
+class ProcessorManager
+{
+  protected:
+    static const uint32_t MAX_PROCESSORS = 16;
+
+    Processor *processors[MAX_PROCESSORS];
+    uint32_t count;
+
+    LocalAPIC *localAPIC;
+    LocalAPICInterruptHandler *wakeupHandler;
+    LocalAPICInterruptHandler *timerHandler;
+
+    /**
+     * The processor being started. The trampoline has room for the stack of one processor at a
+     * time, so they are started one after the other.
+     */
+    Processor *volatile starting;
+
+    /**
+     * @brief Reads the processors from the MADT.
+     *
+     * @return false if there is no MADT, or no local APIC.
+     */
+    bool Discover(ACPITables *acpi, InterruptManager *interrupts, GlobalDescriptorTable *gdt);
+
+    /**
+     * @brief Copies the trampoline to its page, and fills in what the processors need to get into
+     * the kernel.
+     */
+    void PrepareTrampoline();
+
+    /**
+     * @brief Starts a processor with INIT-SIPI-SIPI, and waits until it is in the kernel.
+     */
+    bool Start(Processor *processor);
+
+    /**
+     * @brief Where the trampoline jumps to, on the started processor's stack.
+     */
+    static void ApplicationProcessorEntry();
+
+  public:
+    static ProcessorManager *activeProcessorManager;
+
+    /**
+     * @brief Finds the processors in the ACPI tables. Without them (or a local APIC), the
+     * bootstrap processor is the only one.
+     *
+     * @param gdt The bootstrap processor's GDT.
+     */
+    ProcessorManager(ACPITables *acpi, InterruptManager *interrupts, GlobalDescriptorTable *gdt);
+    ~ProcessorManager();
+
+    /**
+     * @brief Starts all the enabled application processors.
+     *
+     * @return The number of processors running, the bootstrap processor included.
+     */
+    uint32_t StartApplicationProcessors();
+
+    uint32_t Count();
+    Processor *Get(uint32_t index);
+};
+
+#endif
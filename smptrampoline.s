@@ -0,0 +1,83 @@
+# The code the application processors start in, in real mode, after the startup IPI. It is copied
+# to TRAMPOLINE (see smp.cpp) before the processors are started, so it may only refer to its own
+# labels relative to smpTrampolineStart.
+
+.set TRAMPOLINE, 0x8000
+
+# The offsets of the kernel code and data segments in the GDT (see gdt.cpp).
+.set KERNEL_CODE_SEGMENT, 0x10
+.set KERNEL_DATA_SEGMENT, 0x18
+
+# The protection enable bit of CR0.
+.set CR0_PROTECTION, 1
+
+.section .text
+
+.global smpTrampolineStart
+.global smpTrampolineData
+.global smpTrampolineEnd
+
+.code16
+smpTrampolineStart:
+    cli
+    cld
+
+    # The startup IPI sets CS to the trampoline's page, but the data segment may be anything.
+    xorw %ax, %ax
+    movw %ax, %ds
+
+    # Protected mode, with the bootstrap processor's GDT. The far jump loads CS from it. (The
+    # assembler gets 16 - bit addresses of labels further down wrong, so the GDTR's address goes
+    # through a register.)
+    movl $TRAMPOLINE + (trampolineGdtr - smpTrampolineStart), %ebx
+    lgdtl (%bx)
+    movl %cr0, %eax
+    orl $CR0_PROTECTION, %eax
+    movl %eax, %cr0
+    ljmpl $KERNEL_CODE_SEGMENT, $TRAMPOLINE + (1f - smpTrampolineStart)
+
+.code32
+1:
+    movw $KERNEL_DATA_SEGMENT, %ax
+    movw %ax, %ds
+    movw %ax, %es
+    movw %ax, %fs
+    movw %ax, %gs
+    movw %ax, %ss
+
+    # Paging, with the kernel's page directory. CR4 first, as the kernel uses 4 MiB pages. The
+    # trampoline is identity mapped, so it goes on the same way after paging is on.
+    movl TRAMPOLINE + (trampolineCr4 - smpTrampolineStart), %eax
+    movl %eax, %cr4
+    movl TRAMPOLINE + (trampolineCr3 - smpTrampolineStart), %eax
+    movl %eax, %cr3
+    movl TRAMPOLINE + (trampolineCr0 - smpTrampolineStart), %eax
+    movl %eax, %cr0
+
+    movl TRAMPOLINE + (trampolineStack - smpTrampolineStart), %esp
+    movl TRAMPOLINE + (trampolineEntry - smpTrampolineStart), %eax
+    call *%eax
+
+    # The entry function never returns.
+2:
+    cli
+    hlt
+    jmp 2b
+
+# The fields of `TrampolineData` (see smp.cpp).
+.align 4
+smpTrampolineData:
+trampolineGdtr:
+    .word 0
+    .long 0
+trampolineCr0:
+    .long 0
+trampolineCr3:
+    .long 0
+trampolineCr4:
+    .long 0
+trampolineStack:
+    .long 0
+trampolineEntry:
+    .long 0
+smpTrampolineEnd:
@@ -0,0 +1,122 @@
+#include "spinlock.h"
+#include "benchmark.h"
+
+/** LockClass Class */
+
+LockClass *LockClass::first = 0;
+
+LockClass::LockClass(const char *name)
+{
+    this->name = name;
+    acquires = 0;
+    contended = 0;
+    spinCycles = 0;
+
+    /**
+     * Classes are built by the global constructors, before any other processor runs.
+     */
+    next = first;
+    first = this;
+}
+
+LockClass::~LockClass() {}
+
+void LockClass::Record(uint64_t spun)
+{
+    /**
+     * The locks of a class may be held by several processors at once, so the counters are
+     * updated atomically.
+     */
+    __sync_fetch_and_add(&acquires, 1);
+    if (spun != 0)
+    {
+        __sync_fetch_and_add(&contended, 1);
+        __sync_fetch_and_add(&spinCycles, spun);
+    }
+}
+
+const char *LockClass::Name() { return name; }
+
+uint32_t LockClass::Acquires() { return acquires; }
+
+uint32_t LockClass::Contended() { return contended; }
+
+uint64_t LockClass::SpinCycles() { return spinCycles; }
+
+void LockClass::Reset()
+{
+    acquires = 0;
+    contended = 0;
+    spinCycles = 0;
+}
+
+LockClass *LockClass::First() { return first; }
+
+LockClass *LockClass::Next() { return next; }
+
+/** Spinlock Class */
+
+Spinlock::Spinlock(LockClass *lockClass)
+{
+    tickets = 0;
+    this->lockClass = lockClass;
+}
+
+Spinlock::~Spinlock() {}
+
+void Spinlock::Acquire()
+{
+    uint32_t taken = __sync_fetch_and_add(&tickets, 0x10000);
+    uint16_t ticket = taken >> 16;
+    if ((uint16_t)taken == ticket)
+    {
+        lockClass->Record(0);
+        return;
+    }
+
+    uint64_t start = ReadTimestampCounter();
+    while ((uint16_t)tickets != ticket)
+    {
+        asm volatile("pause" : : : "memory");
+    }
+    lockClass->Record(ReadTimestampCounter() - start);
+}
+
+void Spinlock::Release()
+{
+    /**
+     * Only the holder changes the low half. A 16 - bit add keeps its wraparound from carrying
+     * into the next ticket.
+     */
+    asm volatile("lock incw %0" : "+m"(tickets) : : "memory");
+}
+
+bool Spinlock::Held()
+{
+    uint32_t value = tickets;
+    return (uint16_t)value != (uint16_t)(value >> 16);
+}
+
+/** SpinlockGuard Class */
+
+SpinlockGuard::SpinlockGuard(Spinlock *lock)
+{
+    this->lock = lock;
+    asm volatile("pushfl\n"
+                 "popl %0\n"
+                 "cli"
+                 : "=r"(eflags)
+                 :
+                 : "memory");
+    lock->Acquire();
+}
+
+SpinlockGuard::~SpinlockGuard()
+{
+    lock->Release();
+    asm volatile("pushl %0\n"
+                 "popfl"
+                 :
+                 : "r"(eflags)
+                 : "memory", "cc");
+}
@@ -0,0 +1,100 @@
+/**
+ * @file spinlock.h
+ * @author rohan843
+ * @brief Contains the ticket spinlocks guarding the state processors share, and the statistics
+ * kept about them.
+ *
+ * A ticket lock serves processors in the order they asked for it: each takes the next ticket, and
+ * spins until the lock serves that ticket. No processor can starve, and the waiters only read the
+ * lock while they spin.
+ *
+ * Every lock belongs to a class (e.g., "heap"), which counts how often its locks were taken, how
+ * often that meant waiting, and the cycles spent waiting. The classes with the most waiting are
+ * where the kernel stops scaling with more processors.
+ */
+
+#ifndef __SPINLOCK_H
+#define __SPINLOCK_H
+
+#include "types.h"
+
+class LockClass
+{
+  protected:
+    const char *name;
+
+    volatile uint32_t acquires;
+    volatile uint32_t contended;
+    volatile uint64_t spinCycles;
+
+    /**
+     * All the classes, in a list, so that their statistics can be printed.
+     */
+    LockClass *next;
+    static LockClass *first;
+
+  public:
+    /**
+     * @brief Defines a class. Classes are meant to be global objects, which are never destroyed.
+     */
+    LockClass(const char *name);
+    ~LockClass();
+
+    /**
+     * @brief Counts an acquisition of one of the class's locks.
+     *
+     * @param spun The cycles spent waiting for it, or 0 if it was free.
+     */
+    void Record(uint64_t spun);
+
+    const char *Name();
+    uint32_t Acquires();
+    uint32_t Contended();
+    uint64_t SpinCycles();
+
+    void Reset();
+
+    static LockClass *First();
+    LockClass *Next();
+};
+
+class Spinlock
+{
+  protected:
+    /**
+     * The ticket being served in the low 16 bits, and the next ticket to hand out in the high 16
+     * bits. Taking a ticket is a single `lock xadd`, which also tells whose turn it is.
+     */
+    volatile uint32_t tickets;
+
+    LockClass *lockClass;
+
+  public:
+    Spinlock(LockClass *lockClass);
+    ~Spinlock();
+
+    /**
+     * @brief Waits for the lock and takes it. Interrupts should be disabled (see `SpinlockGuard`),
+     * as an interrupt handler taking the same lock on this processor would wait forever.
+     */
+    void Acquire();
+    void Release();
+
+    bool Held();
+};
+
+/**
+ * @brief Disables interrupts and takes a lock for as long as it exists, e.g., for a function.
+ */
+class SpinlockGuard
+{
+  protected:
+    Spinlock *lock;
+    uint32_t eflags;
+
+  public:
+    SpinlockGuard(Spinlock *lock);
+    ~SpinlockGuard();
+};
+
+#endif
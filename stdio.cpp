@@ -1,59 +1,35 @@
 #include "stdio.h"
+#include "terminal.h"
 
-void printf(const char *str)
-{
-    /**
-     * @brief The memory location where the VGA display expects data to be kept.
-     *
-     * The dimensions of the character grid are 80 columns and 25 rows.
-     *
-     */
-    uint16_t *VideoMemory = (uint16_t *)0xb8000;
+void printf(const char *str) { VirtualTerminal::Get(0)->Write(str); }
 
+void printfDec(uint32_t number)
+{
     /**
-     * @brief A cursor telling which row/column we're on at the moment.
+     * 10 digits are enough for any 32 - bit number. The digits are filled from the end.
      */
-    static uint8_t x = 0, y = 0;
-
-    for (int i = 0; str[i] != '\0'; i++)
+    char str[11];
+    int i = 10;
+    str[i] = '\0';
+    do
     {
-        if (str[i] != '\n')
-        {
-            VideoMemory[80 * y + x] = (VideoMemory[80 * y + x] & 0xFF00) | str[i];
-            x++;
-            if (x == 80)
-            {
-                /**
-                 * If the full row is filled, we go to the next line.
-                 */
-                y++;
-                x = 0;
-            }
-        }
-        else
-        {
-            /**
-             * If '\n' encountered, we go to the next line.
-             */
-            y++;
-            x = 0;
-        }
-        if (y == 25)
-        {
-            /**
-             * If all rows are filled, we clear the screen and go back to the top.
-             */
+        str[--i] = '0' + number % 10;
+        number /= 10;
+    } while (number != 0);
 
-            for (x = 0; x < 80; x++)
-            {
-                for (y = 0; y < 25; y++)
-                {
-                    VideoMemory[80 * y + x] = (VideoMemory[80 * y + x] & 0xFF00) | ' ';
-                }
-            }
+    printf(str + i);
+}
 
-            x = 0;
-            y = 0;
-        }
+void printfHex(uint32_t number)
+{
+    const char *hex = "0123456789ABCDEF";
+    char str[9];
+    for (int i = 7; i >= 0; i--)
+    {
+        str[i] = hex[number & 0xF];
+        number >>= 4;
     }
+    str[8] = '\0';
+
+    printf(str);
 }
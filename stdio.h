@@ -6,12 +6,25 @@
 /**
  * @brief Prints a string to the display.
  *
- * This function places the charecters of a provided string directly into the VGA Video Memory
- * location (0xb8000). Fills the screen top to down, left to right. If the entire screen is filled,
- * next characterss will be printed at the top of the screen, after clearing the screen.
+ * The string goes to the first virtual terminal (see terminal.h), which keeps it in its scrollback
+ * and, when it is the one shown, puts it on the screen. When the screen is full, its lines move up.
  *
  * @param str Pointer to the string being printed.
  */
 void printf(const char *str);
 
+/**
+ * @brief Prints an unsigned number in decimal.
+ *
+ * @param number The number to print.
+ */
+void printfDec(uint32_t number);
+
+/**
+ * @brief Prints an unsigned number as 8 hexadecimal digits (without any "0x" prefix).
+ *
+ * @param number The number to print.
+ */
+void printfHex(uint32_t number);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,228 @@
+#include "sync.h"
+#include "paging.h"
+
+/** WaitQueue Class */
+
+WaitQueue::WaitQueue()
+{
+    head = 0;
+    tail = 0;
+}
+
+WaitQueue::~WaitQueue() {}
+
+void WaitQueue::Wait(Spinlock *lock, uint32_t key)
+{
+    Task *current = TaskManager::activeTaskManager->CurrentTask();
+    current->waitNext = 0;
+    current->waitKey = key;
+    if (tail != 0)
+    {
+        tail->waitNext = current;
+    }
+    else
+    {
+        head = current;
+    }
+    tail = current;
+
+    TaskManager::activeTaskManager->Block(lock);
+}
+
+uint32_t WaitQueue::Wake(uint32_t count, uint32_t key)
+{
+    uint32_t woken = 0;
+    Task *previous = 0;
+    Task *task = head;
+    while (task != 0 && woken < count)
+    {
+        Task *next = task->waitNext;
+        if (task->waitKey != key)
+        {
+            previous = task;
+            task = next;
+            continue;
+        }
+
+        if (previous != 0)
+        {
+            previous->waitNext = next;
+        }
+        else
+        {
+            head = next;
+        }
+        if (tail == task)
+        {
+            tail = previous;
+        }
+        task->waitNext = 0;
+        TaskManager::activeTaskManager->Unblock(task);
+        woken++;
+        task = next;
+    }
+    return woken;
+}
+
+bool WaitQueue::Empty() { return head == 0; }
+
+/** Semaphore Class */
+
+static LockClass semaphoreLockClass("semaphore");
+
+Semaphore::Semaphore(uint32_t count) : lock(&semaphoreLockClass) { this->count = count; }
+
+Semaphore::~Semaphore() {}
+
+void Semaphore::Down()
+{
+    SpinlockGuard guard(&lock);
+    while (count == 0)
+    {
+        waiters.Wait(&lock);
+    }
+    count--;
+}
+
+bool Semaphore::TryDown()
+{
+    SpinlockGuard guard(&lock);
+    if (count == 0)
+    {
+        return false;
+    }
+    count--;
+    return true;
+}
+
+void Semaphore::Up()
+{
+    SpinlockGuard guard(&lock);
+    count++;
+    waiters.Wake();
+}
+
+uint32_t Semaphore::Count() { return count; }
+
+/** Futexes */
+
+static LockClass futexLockClass("futex");
+
+/**
+ * The tasks waiting on futexes are spread over buckets, by the physical address of the word they
+ * wait on, each with a lock of its own.
+ */
+static const uint32_t FUTEX_BUCKETS = 64;
+
+struct FutexBucket
+{
+    WaitQueue waiters;
+    Spinlock lock;
+
+    FutexBucket();
+};
+
+FutexBucket::FutexBucket() : lock(&futexLockClass) {}
+
+static FutexBucket futexBuckets[FUTEX_BUCKETS];
+
+/**
+ * @brief Returns the physical address of a futex's word, or 0 if the address isn't valid.
+ */
+static uint32_t FutexKey(volatile uint32_t *address)
+{
+    uint32_t virtualAddress = (uint32_t)address;
+    if (virtualAddress % 4 != 0)
+    {
+        return 0;
+    }
+
+    AddressSpace *addressSpace = AddressSpace::Current();
+    uint32_t physicalAddress = addressSpace->Translate(virtualAddress);
+    if (physicalAddress == 0 && virtualAddress >= USER_SPACE_START &&
+        virtualAddress < USER_SPACE_END &&
+        addressSpace->HandlePageFault(virtualAddress, PAGE_FAULT_USER))
+    {
+        physicalAddress = addressSpace->Translate(virtualAddress);
+    }
+    return physicalAddress;
+}
+
+static FutexBucket *FutexBucketOf(uint32_t key) { return &futexBuckets[(key / 4) % FUTEX_BUCKETS]; }
+
+bool FutexWait(volatile uint32_t *address, uint32_t expected)
+{
+    uint32_t key = FutexKey(address);
+    if (key == 0)
+    {
+        return false;
+    }
+
+    FutexBucket *bucket = FutexBucketOf(key);
+    SpinlockGuard guard(&bucket->lock);
+
+    /**
+     * Whoever changes the word calls `FutexWake` afterwards, which takes the bucket's lock. So
+     * either the change is seen here, or the wakeup finds this task queued.
+     */
+    if (*address != expected)
+    {
+        return false;
+    }
+    bucket->waiters.Wait(&bucket->lock, key);
+    return true;
+}
+
+uint32_t FutexWake(volatile uint32_t *address, uint32_t count)
+{
+    uint32_t key = FutexKey(address);
+    if (key == 0 || count == 0)
+    {
+        return 0;
+    }
+
+    FutexBucket *bucket = FutexBucketOf(key);
+    SpinlockGuard guard(&bucket->lock);
+    return bucket->waiters.Wake(count, key);
+}
+
+/** Mutex Class */
+
+Mutex::Mutex() { state = MUTEX_FREE; }
+
+Mutex::~Mutex() {}
+
+void Mutex::Lock()
+{
+    uint32_t previous = __sync_val_compare_and_swap(&state, MUTEX_FREE, MUTEX_LOCKED);
+    if (previous == MUTEX_FREE)
+    {
+        return;
+    }
+
+    /**
+     * A task that waits marks the mutex contended, so that it is woken up when the mutex is
+     * released. One that takes it after waiting leaves it contended, as it can't tell whether
+     * others still wait; at worst, that costs a wakeup nobody needed.
+     */
+    if (previous != MUTEX_CONTENDED)
+    {
+        previous = __sync_lock_test_and_set(&state, MUTEX_CONTENDED);
+    }
+    while (previous != MUTEX_FREE)
+    {
+        FutexWait(&state, MUTEX_CONTENDED);
+        previous = __sync_lock_test_and_set(&state, MUTEX_CONTENDED);
+    }
+}
+
+bool Mutex::TryLock() { return __sync_bool_compare_and_swap(&state, MUTEX_FREE, MUTEX_LOCKED); }
+
+void Mutex::Unlock()
+{
+    if (__sync_fetch_and_sub(&state, 1) != MUTEX_LOCKED)
+    {
+        state = MUTEX_FREE;
+        FutexWake(&state, 1);
+    }
+}
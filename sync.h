@@ -0,0 +1,152 @@
+/**
+ * @file sync.h
+ * @author rohan843
+ * @brief Contains what tasks sleep on while they wait for each other: wait queues, semaphores,
+ * mutexes and futexes.
+ *
+ * A `WaitQueue` keeps the tasks waiting for something in the order they started to, so that a
+ * wakeup can take just the oldest one instead of every task sleeping on a channel (see
+ * `TaskManager::Wakeup`, which goes through all the tasks). The queue has no lock of its own: the
+ * lock guarding what is waited for guards it too, which is what makes checking and going to sleep
+ * one step for the tasks waking it up.
+ *
+ * A futex is a word of memory tasks wait on while it holds a value, and are woken through by its
+ * address. Waiters are kept by the physical address of the word, so tasks in different address
+ * spaces sharing it find each other. Mutexes are built on them: a mutex is a word that is taken
+ * and given back with one atomic instruction while nobody waits for it, and only the tasks that
+ * have to wait, and the ones releasing it to them, go to the kernel (see `UserMutexLock` in
+ * "syscalls.h" for ring 3).
+ */
+
+#ifndef __SYNC_H
+#define __SYNC_H
+
+#include "multitasking.h"
+#include "spinlock.h"
+#include "types.h"
+
+/**
+ * The states of a mutex's word: free, taken, and taken with tasks that may be waiting for it (so
+ * whoever releases it has to wake one of them up).
+ */
+const uint32_t MUTEX_FREE = 0;
+const uint32_t MUTEX_LOCKED = 1;
+const uint32_t MUTEX_CONTENDED = 2;
+
+class WaitQueue
+{
+  protected:
+    Task *head;
+    Task *tail;
+
+  public:
+    WaitQueue();
+    ~WaitQueue();
+
+    /**
+     * @brief Puts the running task to sleep at the end of the queue until it is woken through it.
+     *
+     * The caller holds the lock guarding the queue, with interrupts disabled (e.g., through a
+     * `SpinlockGuard`), and has checked that what it waits for hasn't happened yet. The lock is
+     * released while the task sleeps, and taken again before this returns. Callers should check
+     * again on return, in a loop, as another task may have come first.
+     *
+     * @param key What the task waits for, if the queue is shared by several things (see `Wake`).
+     */
+    void Wait(Spinlock *lock, uint32_t key = 0);
+
+    /**
+     * @brief Wakes up the tasks that have waited the longest, taking them out of the queue. The
+     * queue's lock must be held. Can be called from interrupt handlers.
+     *
+     * @param count The most tasks to wake up.
+     * @param key Only tasks waiting with this key are woken up.
+     * @return The number of tasks woken up.
+     */
+    uint32_t Wake(uint32_t count = 1, uint32_t key = 0);
+
+    bool Empty();
+};
+
+/**
+ * @brief A counting semaphore.
+ */
+class Semaphore
+{
+  protected:
+    uint32_t count;
+    WaitQueue waiters;
+    Spinlock lock;
+
+  public:
+    Semaphore(uint32_t count = 0);
+    ~Semaphore();
+
+    /**
+     * @brief Takes one from the count, waiting until it isn't 0.
+     */
+    void Down();
+
+    /**
+     * @brief Takes one from the count, unless it is 0.
+     *
+     * @return false if the count was 0.
+     */
+    bool TryDown();
+
+    /**
+     * @brief Adds one to the count, waking up the task that has waited the longest. Can be called
+     * from interrupt handlers.
+     */
+    void Up();
+
+    uint32_t Count();
+};
+
+/**
+ * @brief Waits until woken through an address (by `FutexWake`), unless the word there doesn't hold
+ * a value anymore. Checking the word and going to sleep are one step for `FutexWake`.
+ *
+ * @param address A 4 byte aligned address of the current address space. A page of user space not
+ * touched yet is filled in first.
+ * @return false if the word didn't hold `expected` or the address isn't valid, true once woken.
+ */
+bool FutexWait(volatile uint32_t *address, uint32_t expected);
+
+/**
+ * @brief Wakes up the tasks that have waited the longest on an address.
+ *
+ * @param count The most tasks to wake up.
+ * @return The number of tasks woken up.
+ */
+uint32_t FutexWake(volatile uint32_t *address, uint32_t count);
+
+/**
+ * @brief A sleeping lock for kernel tasks, built on a futex.
+ */
+class Mutex
+{
+  protected:
+    /**
+     * `MUTEX_FREE`, `MUTEX_LOCKED` or `MUTEX_CONTENDED`.
+     */
+    volatile uint32_t state;
+
+  public:
+    Mutex();
+    ~Mutex();
+
+    /**
+     * @brief Takes the mutex, sleeping until it is free.
+     */
+    void Lock();
+
+    /**
+     * @return false if the mutex wasn't free.
+     */
+    bool TryLock();
+
+    void Unlock();
+};
+
+#endif
@@ -0,0 +1,445 @@
+#include "syscalls.h"
+#include "initrd.h"
+#include "input.h"
+#include "ipc.h"
+#include "percpu.h"
+#include "stdio.h"
+#include "tty.h"
+
+/**
+ * Model specific registers that configure `sysenter`.
+ */
+const uint32_t IA32_SYSENTER_CS = 0x174;
+const uint32_t IA32_SYSENTER_ESP = 0x175;
+const uint32_t IA32_SYSENTER_EIP = 0x176;
+
+/**
+ * The longest path `SYSCALL_MAP_FILE` takes.
+ */
+const uint32_t MAX_PATH_LENGTH = 255;
+
+/**
+ * The most events one `SYSCALL_READ_EVENTS` takes. They are read into the kernel stack first.
+ */
+const uint32_t MAX_EVENTS_PER_READ = 32;
+
+/**
+ * The most characters one `SYSCALL_READ` takes, as many as a TTY queues.
+ */
+const uint32_t MAX_READ_SIZE = 256;
+
+static void WriteModelSpecificRegister(uint32_t msr, uint32_t value)
+{
+    asm volatile("wrmsr" : : "c"(msr), "a"(value), "d"(0));
+}
+
+SyscallHandler *SyscallHandler::ActiveSyscallHandler = 0;
+
+SyscallHandler::SyscallHandler(InterruptManager *manager, GlobalDescriptorTable *gdt,
+                               TaskManager *taskManager)
+    : InterruptHandler(0x80, manager)
+{
+    this->gdt = gdt;
+    this->taskManager = taskManager;
+    ActiveSyscallHandler = this;
+
+    EnableFastSystemCalls(gdt);
+}
+
+SyscallHandler::~SyscallHandler()
+{
+    if (ActiveSyscallHandler == this)
+    {
+        ActiveSyscallHandler = 0;
+    }
+}
+
+void SyscallHandler::EnableFastSystemCalls(GlobalDescriptorTable *gdt)
+{
+    if (FastSystemCallsSupported())
+    {
+        /**
+         * `sysenter` loads CS from this MSR and SS from the descriptor right after it. `sysexit`
+         * uses the two descriptors after those for ring 3.
+         */
+        WriteModelSpecificRegister(IA32_SYSENTER_CS, gdt->CodeSegmentSelector());
+
+        /**
+         * `sysenter` loads ESP from this MSR. The kernel stack changes along with the TSS `esp0`,
+         * so instead of rewriting the MSR each time, it points just past `esp0` in the TSS and
+         * `SysenterEntry` loads the real stack pointer from there.
+         */
+        WriteModelSpecificRegister(IA32_SYSENTER_ESP, (uint32_t)&gdt->taskStateSegment.ss0);
+        WriteModelSpecificRegister(IA32_SYSENTER_EIP, (uint32_t)&SysenterEntry);
+    }
+}
+
+bool SyscallHandler::FastSystemCallsSupported()
+{
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    return edx & (1 << 11);
+}
+
+bool SyscallHandler::HandleInterrupt(uint32_t *esp)
+{
+    *esp = DoSystemCall(*esp);
+    return true;
+}
+
+uint32_t SyscallHandler::handleFastSystemCall(uint32_t esp)
+{
+    if (ActiveSyscallHandler != 0)
+    {
+        return ActiveSyscallHandler->DoSystemCall(esp);
+    }
+    return esp;
+}
+
+uint32_t SyscallHandler::DoSystemCall(uint32_t esp)
+{
+    ThisProcessor()->systemCalls++;
+
+    CPUState *cpu = (CPUState *)esp;
+
+    switch (cpu->eax)
+    {
+    case SYSCALL_NULL:
+        cpu->eax = 0;
+        break;
+    case SYSCALL_PRINT:
+        cpu->eax = Print(cpu->ebx);
+        break;
+    case SYSCALL_EXIT:
+        if ((cpu->cs & 3) && !taskManager->CurrentTask()->IsUserTask())
+        {
+            /**
+             * `enterUserMode` left its resume frame right above the kernel stack pointer it stored
+             * in the TSS. Continuing with that frame returns from `EnterUserMode`.
+             */
+            return ThisProcessor()->gdt->taskStateSegment.esp0;
+        }
+        return (uint32_t)taskManager->ExitCurrentTask(cpu);
+    case SYSCALL_YIELD:
+        cpu->eax = 0;
+        return (uint32_t)taskManager->Schedule(cpu);
+    case SYSCALL_MAP_FILE:
+        cpu->eax = MapFile(cpu->ebx, cpu->esi);
+        break;
+    case SYSCALL_READ_EVENTS:
+        cpu->eax = ReadEvents(cpu->ebx, cpu->esi);
+        break;
+    case SYSCALL_READ:
+        cpu->eax = ReadTerminal(cpu->ebx, cpu->esi, cpu->edi);
+        break;
+    case SYSCALL_SET_TERMINAL_MODE:
+        cpu->eax = SetTerminalMode(cpu->ebx, cpu->esi);
+        break;
+    case SYSCALL_IPC_CREATE_PORT:
+    case SYSCALL_IPC_SEND:
+    case SYSCALL_IPC_SEND_PAGES:
+    case SYSCALL_IPC_CALL:
+    case SYSCALL_IPC_RECEIVE:
+    case SYSCALL_IPC_REPLY:
+    case SYSCALL_IPC_REPLY_RECEIVE:
+        DoMessageSystemCall(cpu);
+        break;
+    case SYSCALL_FUTEX_WAIT:
+    case SYSCALL_FUTEX_WAKE:
+        /**
+         * Words of the kernel (e.g., a `Mutex`) are off limits: ring 3 could wake up kernel tasks
+         * with them, and learn what they hold.
+         */
+        if (!IsUserRange(cpu->ebx, sizeof(uint32_t)))
+        {
+            cpu->eax = cpu->eax == SYSCALL_FUTEX_WAIT ? (uint32_t)-1 : 0;
+        }
+        else if (cpu->eax == SYSCALL_FUTEX_WAIT)
+        {
+            cpu->eax = FutexWait((volatile uint32_t *)cpu->ebx, cpu->esi) ? 0 : (uint32_t)-1;
+        }
+        else
+        {
+            cpu->eax = FutexWake((volatile uint32_t *)cpu->ebx, cpu->esi);
+        }
+        break;
+    default:
+        cpu->eax = (uint32_t)-1;
+        break;
+    }
+
+    return esp;
+}
+
+uint32_t SyscallHandler::Print(uint32_t text)
+{
+    /**
+     * The string is copied and printed a piece at a time, so it may be of any length.
+     */
+    char piece[128];
+    while (true)
+    {
+        uint32_t length = CopyStringFromUser(piece, text, sizeof(piece));
+        if (length == (uint32_t)-1)
+        {
+            return (uint32_t)-1;
+        }
+        printf(piece);
+        if (length < sizeof(piece))
+        {
+            return 0;
+        }
+        text += sizeof(piece) - 1;
+    }
+}
+
+uint32_t SyscallHandler::ReadEvents(uint32_t buffer, uint32_t max)
+{
+    InputEventQueue *queue = InputEventQueue::activeInputEventQueue;
+    if (queue == 0 || max == 0)
+    {
+        return 0;
+    }
+
+    /**
+     * The queue is read with interrupts disabled, so the events are copied out afterwards, where
+     * a bad buffer can only fail the call. The buffer is checked first, so that a bad one doesn't
+     * take events away from the console.
+     */
+    if (max > MAX_EVENTS_PER_READ)
+    {
+        max = MAX_EVENTS_PER_READ;
+    }
+    if (!IsUserRange(buffer, max * sizeof(InputEvent)))
+    {
+        return (uint32_t)-1;
+    }
+
+    InputEvent events[MAX_EVENTS_PER_READ];
+    uint32_t taken = queue->ReadEvents(events, max);
+    if (!CopyToUser(buffer, events, taken * sizeof(InputEvent)))
+    {
+        return (uint32_t)-1;
+    }
+    return taken;
+}
+
+uint32_t SyscallHandler::ReadTerminal(uint32_t index, uint32_t buffer, uint32_t size)
+{
+    TTY *tty = TTY::Get(index);
+    if (tty == 0)
+    {
+        return (uint32_t)-1;
+    }
+
+    /**
+     * The TTY is read with its lock held and interrupts disabled, so the characters are copied
+     * out afterwards (see `ReadEvents`).
+     */
+    if (size > MAX_READ_SIZE)
+    {
+        size = MAX_READ_SIZE;
+    }
+    if (!IsUserRange(buffer, size))
+    {
+        return (uint32_t)-1;
+    }
+
+    char text[MAX_READ_SIZE];
+    uint32_t taken = tty->Read(text, size);
+    if (!CopyToUser(buffer, text, taken))
+    {
+        return (uint32_t)-1;
+    }
+    return taken;
+}
+
+uint32_t SyscallHandler::SetTerminalMode(uint32_t index, uint32_t mode)
+{
+    TTY *tty = TTY::Get(index);
+    if (tty == 0)
+    {
+        return (uint32_t)-1;
+    }
+    tty->SetMode(mode);
+    return 0;
+}
+
+void SyscallHandler::DoMessageSystemCall(CPUState *cpu)
+{
+    uint32_t number = cpu->eax;
+    cpu->eax = IPC_ERROR;
+
+    if (number == SYSCALL_IPC_CREATE_PORT)
+    {
+        MessagePort *port = new MessagePort();
+        if (port->Id() == IPC_ERROR)
+        {
+            delete port;
+            return;
+        }
+        cpu->eax = port->Id();
+        return;
+    }
+
+    MessagePort *port = MessagePort::Get(cpu->ebx & 0xFFFF);
+    if (port == 0)
+    {
+        return;
+    }
+    uint32_t token = cpu->ebx >> 16;
+
+    Message message;
+    message.words[0] = cpu->esi;
+    message.words[1] = cpu->edi;
+    message.frames = 0;
+    message.pages = 0;
+
+    /**
+     * Kernel tasks running in ring 3 have no user space of their own to move pages in or out of.
+     */
+    AddressSpace *addressSpace = AddressSpace::Current();
+    bool userSpace = addressSpace != AddressSpace::Kernel();
+
+    switch (number)
+    {
+    case SYSCALL_IPC_SEND:
+        cpu->eax = port->Send(&message) ? 0 : IPC_ERROR;
+        return;
+    case SYSCALL_IPC_SEND_PAGES:
+        if (!userSpace || cpu->edi > IPC_MAX_PAGES)
+        {
+            return;
+        }
+        message.frames = addressSpace->TakePages(cpu->esi, cpu->edi);
+        if (message.frames == 0)
+        {
+            return;
+        }
+        message.pages = cpu->edi;
+        if (!port->Send(&message))
+        {
+            /**
+             * The pages go back where they were.
+             */
+            addressSpace->GivePages(cpu->esi, message.frames, message.pages);
+            delete[] message.frames;
+            return;
+        }
+        cpu->eax = 0;
+        return;
+    case SYSCALL_IPC_CALL:
+        if (port->Call(&message))
+        {
+            cpu->eax = 0;
+            cpu->esi = message.words[0];
+            cpu->edi = message.words[1];
+        }
+        return;
+    case SYSCALL_IPC_REPLY:
+        cpu->eax = port->Reply(token, &message) ? 0 : IPC_ERROR;
+        return;
+    }
+
+    uint32_t window = 0;
+    uint32_t windowPages = IPC_MAX_PAGES;
+    if (number == SYSCALL_IPC_REPLY_RECEIVE)
+    {
+        if (!port->Reply(token, &message))
+        {
+            return;
+        }
+    }
+    else
+    {
+        window = cpu->esi;
+        windowPages = cpu->edi;
+    }
+
+    token = port->Receive(&message);
+    cpu->eax = token;
+    cpu->esi = message.words[0];
+    cpu->edi = message.words[1];
+    if (message.frames == 0)
+    {
+        return;
+    }
+
+    /**
+     * Pages that can't be mapped are freed, and the receiver learns only that they came.
+     */
+    uint32_t address = 0;
+    if (userSpace && message.pages <= windowPages)
+    {
+        address = addressSpace->GivePages(window, message.frames, message.pages);
+    }
+    if (address == 0)
+    {
+        for (uint32_t i = 0; i < message.pages; i++)
+        {
+            PhysicalMemoryManager::activePhysicalMemoryManager->FreeFrame(message.frames[i]);
+        }
+    }
+    delete[] message.frames;
+    cpu->eax = token | IPC_RECEIVED_PAGES;
+    cpu->esi = address;
+    cpu->edi = address != 0 ? message.pages : 0;
+}
+
+uint32_t SyscallHandler::MapFile(uint32_t path, uint32_t size)
+{
+    InitialRamdisk *initrd = InitialRamdisk::activeInitialRamdisk;
+    AddressSpace *addressSpace = AddressSpace::Current();
+
+    /**
+     * Kernel tasks running in ring 3 have no user space of their own to map into.
+     */
+    if (initrd == 0 || addressSpace == AddressSpace::Kernel())
+    {
+        return 0;
+    }
+
+    /**
+     * A path too long to copy whole can't be one of the ramdisk's (tar limits them to 255
+     * characters).
+     */
+    char pathCopy[MAX_PATH_LENGTH + 1];
+    if (CopyStringFromUser(pathCopy, path, sizeof(pathCopy)) > MAX_PATH_LENGTH)
+    {
+        return 0;
+    }
+
+    InitrdFile *file = initrd->Open(pathCopy);
+    if (file == 0)
+    {
+        return 0;
+    }
+
+    /**
+     * The size is stored first: once mapped, the file stays mapped, even if the call fails.
+     */
+    if (size != 0 && !CopyToUser(size, &file->size, sizeof(uint32_t)))
+    {
+        return 0;
+    }
+    return initrd->Map(file, addressSpace);
+}
+
+void SyscallHandler::EnterUserMode(void (*entry)(), uint32_t userStack)
+{
+    /**
+     * With interrupts disabled, the task stays on this processor until it is in ring 3, and from
+     * then on its resume frame moves along with the TSS `esp0` (see `TaskManager::Schedule`).
+     */
+    uint32_t eflags;
+    asm volatile("pushfl\n"
+                 "popl %0\n"
+                 "cli"
+                 : "=r"(eflags));
+    enterUserMode((uint32_t)entry, userStack, &ThisProcessor()->gdt->taskStateSegment);
+    asm volatile("pushl %0\n"
+                 "popfl"
+                 :
+                 : "r"(eflags)
+                 : "cc");
+}
@@ -0,0 +1,364 @@
+/**
+ * @file syscalls.h
+ * @author rohan843
+ * @brief Contains the system call interface.
+ *
+ * Ring 3 code can enter the kernel in two ways:
+ *
+ * 1. `int $0x80` - goes through the IDT like any other interrupt. Always available.
+ * 2. `sysenter` - the fast path. It skips the IDT/GDT lookups and the stack frame pushes an
+ *    interrupt does, but needs the CPU to support it (CPUID.01H:EDX bit 11).
+ *
+ * Both paths use the same convention: `eax` holds the system call number, `ebx`, `esi` and `edi`
+ * hold up to 3 arguments, and the result is returned in `eax`. `ecx` and `edx` are not available
+ * as arguments since `sysenter` uses them to pass the user stack pointer and return address.
+ */
+
+#ifndef __SYSCALLS_H
+#define __SYSCALLS_H
+
+#include "gdt.h"
+#include "interrupts.h"
+#include "multitasking.h"
+#include "sync.h"
+#include "types.h"
+
+enum SystemCallNumber
+{
+    /**
+     * Does nothing. Used to measure the cost of the entry and exit paths.
+     */
+    SYSCALL_NULL = 0,
+
+    /**
+     * Prints the string pointed to by the first argument. Returns 0, or -1 if it doesn't point to
+     * memory of the caller (see `IsUserRange` in "paging.h").
+     */
+    SYSCALL_PRINT = 1,
+
+    /**
+     * Ends the calling task. If it is a kernel task that dropped to ring 3 with
+     * `SyscallHandler::EnterUserMode`, returns to the kernel code that did so instead.
+     */
+    SYSCALL_EXIT = 2,
+
+    /**
+     * Gives up the CPU to the next runnable task.
+     */
+    SYSCALL_YIELD = 3,
+
+    /**
+     * Maps a file of the initial ramdisk read-only into the caller's address space. The first
+     * argument points to the path; if the second isn't 0, the file size is stored where it points.
+     * Returns the address of the file's data (see `InitialRamdisk::Map`), or 0 if the file doesn't
+     * exist or can't be mapped, or a pointer doesn't point to memory of the caller (see
+     * `IsUserRange` in "paging.h").
+     */
+    SYSCALL_MAP_FILE = 4,
+
+    /**
+     * Takes the queued input events (see "input.h"), waiting for some if there are none. The
+     * first argument points to an array of `InputEvent`, and the second is its length. Returns
+     * the number of events stored (at most 32 per call), or -1 if the array isn't memory of the
+     * caller. Readers share the one queue with the kernel's console.
+     */
+    SYSCALL_READ_EVENTS = 5,
+
+    /**
+     * Reads what was typed on a terminal (see "tty.h"), waiting for some if there is none. The
+     * first argument is the terminal's index, the second points to the buffer and the third is
+     * its size. Returns the number of characters stored (at most 256 per call), or -1 if there is
+     * no such terminal or the buffer isn't memory of the caller.
+     */
+    SYSCALL_READ = 6,
+
+    /**
+     * Sets the mode bits (`TTY_CANONICAL`, `TTY_ECHO`) of the terminal whose index is the first
+     * argument to the second argument. Returns 0, or -1 if there is no such terminal.
+     */
+    SYSCALL_SET_TERMINAL_MODE = 7,
+
+    /**
+     * The message passing system calls (see "ipc.h"). Except for `SYSCALL_IPC_CREATE_PORT`, the
+     * first argument is a port number, and a message's words are passed in `esi` and `edi` (the
+     * second and third arguments), both ways. All return `IPC_ERROR` when they fail.
+     *
+     * Creates a port. Returns its number.
+     */
+    SYSCALL_IPC_CREATE_PORT = 8,
+
+    /**
+     * Queues a message without waiting for it to be received. Returns 0.
+     */
+    SYSCALL_IPC_SEND = 9,
+
+    /**
+     * Moves pages to the port instead of words: the second argument is the page aligned address of
+     * the first, the third the number of pages. They are unmapped from the caller, and read as 0
+     * afterwards. Returns 0.
+     */
+    SYSCALL_IPC_SEND_PAGES = 10,
+
+    /**
+     * Sends a message and waits for the reply, whose words replace the message's. Returns 0.
+     */
+    SYSCALL_IPC_CALL = 11,
+
+    /**
+     * Waits for a message. If it carries pages, they are mapped where the second argument says (0
+     * for wherever there is room; the third argument is the number of pages there is room for)
+     * and the words returned are their address and number. Returns the token to reply with in the
+     * low 16 bits (0 if the message needs no reply), and `IPC_RECEIVED_PAGES` if it carried pages.
+     */
+    SYSCALL_IPC_RECEIVE = 12,
+
+    /**
+     * Replies to a call received. The first argument has the reply token in its high 16 bits.
+     * Returns 0.
+     */
+    SYSCALL_IPC_REPLY = 13,
+
+    /**
+     * Replies like `SYSCALL_IPC_REPLY`, then waits for a message like `SYSCALL_IPC_RECEIVE` (with
+     * pages mapped wherever there is room), in one system call.
+     */
+    SYSCALL_IPC_REPLY_RECEIVE = 14,
+
+    /**
+     * Waits on the word the first argument points to, while it holds the second argument (see
+     * `FutexWait` in "sync.h"). Returns 0 once woken, or -1 if the word didn't hold the value or
+     * isn't memory of the caller (see `IsUserRange` in "paging.h").
+     */
+    SYSCALL_FUTEX_WAIT = 15,
+
+    /**
+     * Wakes up as many as the second argument says of the tasks waiting on the word the first
+     * argument points to. Returns the number woken up (0 if the word isn't memory of the caller).
+     */
+    SYSCALL_FUTEX_WAKE = 16,
+};
+
+/**
+ * @brief Makes a system call through `int $0x80`.
+ *
+ * Always inlined, so that ring 3 code placed in the kernel image (see `USER_TEXT`) can use it.
+ */
+static inline __attribute__((always_inline)) uint32_t SystemCall(uint32_t number,
+                                                                 uint32_t arg0 = 0,
+                                                                 uint32_t arg1 = 0,
+                                                                 uint32_t arg2 = 0)
+{
+    uint32_t result;
+    asm volatile("int $0x80"
+                 : "=a"(result)
+                 : "a"(number), "b"(arg0), "S"(arg1), "D"(arg2)
+                 : "memory");
+    return result;
+}
+
+/**
+ * @brief Makes a system call through `sysenter`.
+ *
+ * The kernel returns with `sysexit`, which takes the user stack pointer from `ecx` and the return
+ * address from `edx`.
+ */
+static inline __attribute__((always_inline)) uint32_t FastSystemCall(uint32_t number,
+                                                                     uint32_t arg0 = 0,
+                                                                     uint32_t arg1 = 0,
+                                                                     uint32_t arg2 = 0)
+{
+    uint32_t result;
+    asm volatile("movl %%esp, %%ecx\n"
+                 "leal 1f, %%edx\n"
+                 "sysenter\n"
+                 "1:"
+                 : "=a"(result)
+                 : "a"(number), "b"(arg0), "S"(arg1), "D"(arg2)
+                 : "ecx", "edx", "memory");
+    return result;
+}
+
+/**
+ * @brief Makes a system call through `int $0x80` that passes a message's words in `esi` and `edi`
+ * and gets them back there.
+ */
+static inline __attribute__((always_inline)) uint32_t MessageSystemCall(uint32_t number,
+                                                                        uint32_t arg0,
+                                                                        uint32_t *words)
+{
+    uint32_t result;
+    asm volatile("int $0x80"
+                 : "=a"(result), "+S"(words[0]), "+D"(words[1])
+                 : "a"(number), "b"(arg0)
+                 : "memory");
+    return result;
+}
+
+/**
+ * @brief Makes a system call like `MessageSystemCall`, through `sysenter`.
+ */
+static inline __attribute__((always_inline)) uint32_t FastMessageSystemCall(uint32_t number,
+                                                                            uint32_t arg0,
+                                                                            uint32_t *words)
+{
+    uint32_t result;
+    asm volatile("movl %%esp, %%ecx\n"
+                 "leal 1f, %%edx\n"
+                 "sysenter\n"
+                 "1:"
+                 : "=a"(result), "+S"(words[0]), "+D"(words[1])
+                 : "a"(number), "b"(arg0)
+                 : "ecx", "edx", "memory");
+    return result;
+}
+
+/**
+ * @brief Takes a mutex that is a word of user memory, like `Mutex::Lock` (see "sync.h"), making a
+ * system call only if it has to wait for it.
+ */
+static inline __attribute__((always_inline)) void UserMutexLock(volatile uint32_t *mutex)
+{
+    uint32_t previous = __sync_val_compare_and_swap(mutex, MUTEX_FREE, MUTEX_LOCKED);
+    if (previous == MUTEX_FREE)
+    {
+        return;
+    }
+    if (previous != MUTEX_CONTENDED)
+    {
+        previous = __sync_lock_test_and_set(mutex, MUTEX_CONTENDED);
+    }
+    while (previous != MUTEX_FREE)
+    {
+        SystemCall(SYSCALL_FUTEX_WAIT, (uint32_t)mutex, MUTEX_CONTENDED);
+        previous = __sync_lock_test_and_set(mutex, MUTEX_CONTENDED);
+    }
+}
+
+/**
+ * @brief Releases a mutex taken with `UserMutexLock`, making a system call only if a task may be
+ * waiting for it.
+ */
+static inline __attribute__((always_inline)) void UserMutexUnlock(volatile uint32_t *mutex)
+{
+    if (__sync_fetch_and_sub(mutex, 1) != MUTEX_LOCKED)
+    {
+        *mutex = MUTEX_FREE;
+        SystemCall(SYSCALL_FUTEX_WAKE, (uint32_t)mutex, 1);
+    }
+}
+
+class SyscallHandler : public InterruptHandler
+{
+    GlobalDescriptorTable *gdt;
+    TaskManager *taskManager;
+
+    /**
+     * Points to the system call handler `sysenter` leads to. (There is no IDT entry telling the
+     * CPU which object to use, same as with `InterruptManager::ActiveInterruptManager`.)
+     */
+    static SyscallHandler *ActiveSyscallHandler;
+
+    /**
+     * @brief The `sysenter` entry point.
+     *
+     * This is defined in assembly in the file "syscallstubs.s"
+     */
+    static void SysenterEntry();
+
+    /**
+     * @brief Saves a kernel resume frame and drops to ring 3.
+     *
+     * This is defined in assembly in the file "syscallstubs.s"
+     *
+     * @param entry The ring 3 address to jump to.
+     * @param userStack The ring 3 stack pointer.
+     * @param tss The TSS to store the kernel stack pointer (`esp0`) in. The resume frame sits right
+     * above that stack pointer.
+     */
+    static void enterUserMode(uint32_t entry, uint32_t userStack, TaskStateSegment *tss);
+
+    /**
+     * @brief Implements `SYSCALL_PRINT`.
+     */
+    uint32_t Print(uint32_t text);
+
+    /**
+     * @brief Implements `SYSCALL_MAP_FILE` for the current address space.
+     *
+     * @param path, size The arguments, as ring 3 passed them: addresses only read and written
+     * through `CopyFromUser` and `CopyToUser` (see "paging.h").
+     */
+    uint32_t MapFile(uint32_t path, uint32_t size);
+
+    /**
+     * @brief Implements `SYSCALL_READ_EVENTS`.
+     *
+     * @param buffer The ring 3 address of the array (see `MapFile`).
+     */
+    uint32_t ReadEvents(uint32_t buffer, uint32_t max);
+
+    /**
+     * @brief Implement `SYSCALL_READ` and `SYSCALL_SET_TERMINAL_MODE`.
+     *
+     * @param buffer The ring 3 address of the buffer (see `MapFile`).
+     */
+    uint32_t ReadTerminal(uint32_t index, uint32_t buffer, uint32_t size);
+    uint32_t SetTerminalMode(uint32_t index, uint32_t mode);
+
+    /**
+     * @brief Implements the `SYSCALL_IPC_*` system calls, taking the arguments from and leaving the
+     * results in the saved registers.
+     */
+    void DoMessageSystemCall(CPUState *cpu);
+
+  public:
+    SyscallHandler(InterruptManager *manager, GlobalDescriptorTable *gdt,
+                   TaskManager *taskManager);
+    ~SyscallHandler();
+
+    /**
+     * @brief Handles `int $0x80`.
+     */
+    virtual bool HandleInterrupt(uint32_t *esp);
+
+    /**
+     * @brief Handles `sysenter`. Called from `SysenterEntry` with a stack frame laid out like the
+     * one the interrupt stubs build.
+     *
+     * @param esp Pointer to the saved `CPUState`.
+     * @return The stack pointer to continue with. If it differs from `esp`, the stub leaves
+     * through `iret` instead of `sysexit`.
+     */
+    static uint32_t handleFastSystemCall(uint32_t esp);
+
+    /**
+     * @brief Runs the system call described by the saved registers.
+     *
+     * @param esp Pointer to the saved `CPUState`.
+     * @return The stack pointer to continue with.
+     */
+    uint32_t DoSystemCall(uint32_t esp);
+
+    /**
+     * @brief Tells whether the CPU supports `sysenter`/`sysexit`.
+     */
+    static bool FastSystemCallsSupported();
+
+    /**
+     * @brief Points `sysenter` on the processor this runs on at the kernel, with the TSS of the
+     * given GDT. Each processor has to do this, as the MSRs are its own.
+     */
+    static void EnableFastSystemCalls(GlobalDescriptorTable *gdt);
+
+    /**
+     * @brief Runs a function in ring 3, returning once it makes the `SYSCALL_EXIT` system call.
+     *
+     * Interrupts must already be active, since the way back into the kernel is a system call.
+     *
+     * @param entry The function to run.
+     * @param userStack The top of the stack it should run on.
+     */
+    void EnterUserMode(void (*entry)(), uint32_t userStack);
+};
+
+#endif
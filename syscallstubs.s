@@ -0,0 +1,151 @@
+# This file contains the system call entry points that don't go through the IDT, the code that
+# drops from ring 0 to ring 3, and the copying of memory handed to system calls by ring 3.
+
+# The GDT offsets (see gdt.cpp), with the requested priveledge level OR-ed in for ring 3.
+.set KERNEL_DATA_SEGMENT, 0x18
+.set PROCESSOR_DATA_SEGMENT, 0x38
+.set USER_CODE_SEGMENT, 0x20 | 3
+.set USER_DATA_SEGMENT, 0x28 | 3
+
+# The offset of `switchedFrom` in `ProcessorData` (see percpu.h).
+.set PROCESSOR_SWITCHED_FROM, 4
+
+# The interrupt enable flag in EFLAGS.
+.set EFLAGS_IF, 0x200
+
+.section .text
+
+.extern _ZN14SyscallHandler20handleFastSystemCallEj
+
+# `sysenter` lands here with interrupts disabled, CS/SS set to the kernel segments, ESP set to the
+# IA32_SYSENTER_ESP MSR, the user stack pointer in ECX and the user return address in EDX.
+.global _ZN14SyscallHandler13SysenterEntryEv
+_ZN14SyscallHandler13SysenterEntryEv:
+    # The MSR points right past the TSS `esp0` field. Switch to the actual kernel stack.
+    movl -4(%esp), %esp
+
+    # Build the same frame `int $0x80` from ring 3 would, so both paths share `CPUState`.
+    pushl $USER_DATA_SEGMENT
+    pushl %ecx
+    pushfl
+    orl $EFLAGS_IF, (%esp)
+    pushl $USER_CODE_SEGMENT
+    pushl %edx
+    pushl $0
+    pushl $0x80
+
+    pusha
+    pushl %ds
+    pushl %es
+    pushl %fs
+    pushl %gs
+
+    movw $KERNEL_DATA_SEGMENT, %ax
+    movw %ax, %ds
+    movw %ax, %es
+    movw $PROCESSOR_DATA_SEGMENT, %ax
+    movw %ax, %gs
+
+    pushl %esp
+    call _ZN14SyscallHandler20handleFastSystemCallEj
+    addl $4, %esp
+
+    # A different stack pointer means we're not returning to the caller (e.g., `SYSCALL_EXIT`).
+    # That frame can only be left through `iret`.
+    cmpl %eax, %esp
+    jne 1f
+
+    popl %gs
+    popl %fs
+    popl %es
+    popl %ds
+    popa
+    addl $8, %esp
+
+    # `sysexit` returns to EDX with the stack pointer in ECX. Restoring EFLAGS re-enables
+    # interrupts.
+    popl %edx
+    addl $4, %esp
+    popfl
+    popl %ecx
+    sysexit
+
+1:
+    movl %eax, %esp
+
+    # Lets other processors run the task switched away from (see interruptstubs.s).
+    movl %gs:PROCESSOR_SWITCHED_FROM, %eax
+    testl %eax, %eax
+    jz 3f
+    movb $0, (%eax)
+    movl $0, %gs:PROCESSOR_SWITCHED_FROM
+3:
+    popl %gs
+    popl %fs
+    popl %es
+    popl %ds
+    popa
+    addl $8, %esp
+    iret
+
+# void SyscallHandler::enterUserMode(uint32_t entry, uint32_t userStack, TaskStateSegment *tss)
+.global _ZN14SyscallHandler13enterUserModeEjjP16TaskStateSegment
+_ZN14SyscallHandler13enterUserModeEjjP16TaskStateSegment:
+    movl 4(%esp), %eax
+    movl 8(%esp), %ecx
+    movl 12(%esp), %edx
+
+    # The resume frame: an interrupt frame for ring 0 that `iret`s to label 2 below. The
+    # `SYSCALL_EXIT` system call switches to it.
+    pushfl
+    pushl %cs
+    pushl $2f
+    pushl $0
+    pushl $0
+    pusha
+    pushl %ds
+    pushl %es
+    pushl %fs
+    pushl %gs
+
+    # Interrupts from ring 3 will push their frames right below the resume frame (TSS `esp0`).
+    movl %esp, 4(%edx)
+
+    # The ring 3 frame for `iret`.
+    pushl $USER_DATA_SEGMENT
+    pushl %ecx
+    pushfl
+    orl $EFLAGS_IF, (%esp)
+    pushl $USER_CODE_SEGMENT
+    pushl %eax
+
+    movw $USER_DATA_SEGMENT, %ax
+    movw %ax, %ds
+    movw %ax, %es
+    movw %ax, %fs
+    movw %ax, %gs
+    iret
+
+2:
+    ret
+
+# uint32_t copyUserBytes(void *destination, const void *source, uint32_t size)
+# Returns the number of bytes not copied: 0, unless a page fault the page fault handler couldn't
+# serve cut the copy short. The handler resumes such a fault at `copyUserBytesDone`, with ECX still
+# counting the bytes left (see `PageFaultHandler::HandleInterrupt`).
+.global copyUserBytes
+.global copyUserBytesAccess
+.global copyUserBytesDone
+copyUserBytes:
+    pushl %esi
+    pushl %edi
+    movl 12(%esp), %edi
+    movl 16(%esp), %esi
+    movl 20(%esp), %ecx
+copyUserBytesAccess:
+    rep movsb
+copyUserBytesDone:
+    movl %ecx, %eax
+    popl %edi
+    popl %esi
+    ret
@@ -0,0 +1,223 @@
+#include "terminal.h"
+#include "memorymanagement.h"
+
+/**
+ * @brief The memory location where the VGA display expects data to be kept, 80 columns by 25 rows
+ * of cells.
+ */
+static uint16_t *const VideoMemory = (uint16_t *)0xb8000;
+
+/**
+ * Light grey on black, with a space.
+ */
+const uint16_t TERMINAL_ATTRIBUTE = 0x0700;
+const uint16_t TERMINAL_BLANK = TERMINAL_ATTRIBUTE | ' ';
+
+/** VirtualTerminal Class */
+
+static LockClass screenLockClass("screen");
+Spinlock VirtualTerminal::lock(&screenLockClass);
+
+VirtualTerminal VirtualTerminal::terminals[VirtualTerminal::COUNT];
+uint32_t VirtualTerminal::active = 0;
+
+VirtualTerminal::VirtualTerminal()
+{
+    first = 0;
+    last = 0;
+    column = 0;
+    scrollback = 0;
+    index = this - terminals;
+    for (uint32_t i = 0; i < COLUMNS; i++)
+    {
+        lines[0][i] = TERMINAL_BLANK;
+    }
+}
+
+VirtualTerminal::~VirtualTerminal() {}
+
+uint16_t *VirtualTerminal::Line(uint32_t number) { return lines[number % SCROLLBACK_LINES]; }
+
+uint32_t VirtualTerminal::Bottom() { return last >= ROWS ? last - (ROWS - 1) : 0; }
+
+uint32_t VirtualTerminal::Top() { return Bottom() - scrollback; }
+
+bool VirtualTerminal::Visible() { return index == active && scrollback == 0; }
+
+void VirtualTerminal::Put(char character)
+{
+    uint16_t cell = TERMINAL_ATTRIBUTE | (uint8_t)character;
+    Line(last)[column] = cell;
+    if (Visible())
+    {
+        VideoMemory[COLUMNS * (last - Top()) + column] = cell;
+    }
+    column++;
+    if (column == COLUMNS)
+    {
+        NewLine();
+    }
+}
+
+void VirtualTerminal::NewLine()
+{
+    column = 0;
+    last++;
+    if (last - first == SCROLLBACK_LINES)
+    {
+        first++;
+    }
+    uint16_t *line = Line(last);
+    for (uint32_t i = 0; i < COLUMNS; i++)
+    {
+        line[i] = TERMINAL_BLANK;
+    }
+
+    if (index != active)
+    {
+        return;
+    }
+    if (scrollback != 0)
+    {
+        /**
+         * A view scrolled back stays on the same lines, unless they are gone from the history.
+         */
+        if (scrollback < Bottom() - first)
+        {
+            scrollback++;
+        }
+        else
+        {
+            scrollback = Bottom() - first;
+            Redraw();
+        }
+        return;
+    }
+
+    /**
+     * At the bottom of the screen, the lines on it move up by one.
+     */
+    uint32_t row = last - Top();
+    if (last >= ROWS)
+    {
+        memmove(VideoMemory, VideoMemory + COLUMNS, COLUMNS * (ROWS - 1) * 2);
+    }
+    memcpy(VideoMemory + COLUMNS * row, line, COLUMNS * 2);
+}
+
+void VirtualTerminal::Redraw()
+{
+    uint32_t top = Top();
+    for (uint32_t row = 0; row < ROWS; row++)
+    {
+        if (top + row <= last)
+        {
+            memcpy(VideoMemory + COLUMNS * row, Line(top + row), COLUMNS * 2);
+        }
+        else
+        {
+            for (uint32_t i = 0; i < COLUMNS; i++)
+            {
+                VideoMemory[COLUMNS * row + i] = TERMINAL_BLANK;
+            }
+        }
+    }
+}
+
+void VirtualTerminal::Write(const char *str)
+{
+    SpinlockGuard guard(&lock);
+    for (int i = 0; str[i] != '\0'; i++)
+    {
+#ifdef BENCHMARK
+        /**
+         * Benchmark kernels also write everything the kernel prints to QEMU's debug console
+         * (`-debugcon`), so results can be collected without looking at the screen.
+         */
+        if (index == 0)
+        {
+            asm volatile("outb %0, $0xE9" : : "a"(str[i]));
+        }
+#endif
+        if (str[i] == '\n')
+        {
+            NewLine();
+        }
+        else if (str[i] == '\b')
+        {
+            if (column > 0)
+            {
+                column--;
+            }
+        }
+        else
+        {
+            Put(str[i]);
+        }
+    }
+}
+
+void VirtualTerminal::Scroll(int32_t lines)
+{
+    SpinlockGuard guard(&lock);
+    int32_t target = (int32_t)scrollback + lines;
+    int32_t max = Bottom() - first;
+    if (target < 0)
+    {
+        target = 0;
+    }
+    if (target > max)
+    {
+        target = max;
+    }
+    if ((uint32_t)target == scrollback)
+    {
+        return;
+    }
+    scrollback = target;
+    if (index == active)
+    {
+        Redraw();
+    }
+}
+
+uint32_t VirtualTerminal::Index() { return index; }
+
+VirtualTerminal *VirtualTerminal::Get(uint32_t index)
+{
+    return index < COUNT ? &terminals[index] : 0;
+}
+
+VirtualTerminal *VirtualTerminal::Active() { return &terminals[active]; }
+
+void VirtualTerminal::Switch(uint32_t index)
+{
+    if (index >= COUNT)
+    {
+        return;
+    }
+    SpinlockGuard guard(&lock);
+    active = index;
+    terminals[index].Redraw();
+}
+
+bool VirtualTerminal::HandleKey(KeyboardEvent *key)
+{
+    if (!key->pressed)
+    {
+        return false;
+    }
+    if ((key->modifiers & MODIFIER_ALT) && key->keyCode >= KEY_F1 && key->keyCode < KEY_F1 + COUNT)
+    {
+        Switch(key->keyCode - KEY_F1);
+        return true;
+    }
+    if ((key->modifiers & MODIFIER_SHIFT) &&
+        (key->keyCode == KEY_PAGE_UP || key->keyCode == KEY_PAGE_DOWN))
+    {
+        int32_t page = ROWS - 1;
+        Active()->Scroll(key->keyCode == KEY_PAGE_UP ? page : -page);
+        return true;
+    }
+    return false;
+}
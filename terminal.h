@@ -0,0 +1,124 @@
+/**
+ * @file terminal.h
+ * @author rohan843
+ * @brief Contains the virtual terminals, which share the VGA text screen.
+ *
+ * Each terminal keeps the text written to it in a ring of lines (its scrollback), of which the
+ * screen shows 25 when the terminal is the active one: the last 25, or earlier ones when it is
+ * scrolled back. Text written to the active terminal also goes straight to the screen, and a new
+ * line at the bottom moves the screen's lines up. Switching terminals or scrolling copies the 25
+ * lines shown to the screen, whatever the length of the history.
+ *
+ * Alt+F1 to Alt+F6 switch terminals, and Shift+Page Up/Page Down scroll the active one by a page.
+ * The kernel prints to the first one.
+ */
+
+#ifndef __TERMINAL_H
+#define __TERMINAL_H
+
+#include "keyboard.h"
+#include "spinlock.h"
+#include "types.h"
+
+class VirtualTerminal
+{
+  public:
+    static const uint32_t COUNT = 6;
+    static const uint32_t COLUMNS = 80;
+    static const uint32_t ROWS = 25;
+
+  protected:
+    /**
+     * The lines kept, a power of 2 so that a line's number maps to its place in the ring cheaply.
+     */
+    static const uint32_t SCROLLBACK_LINES = 4096;
+
+    /**
+     * The lines, as VGA cells (the character in the low byte, the colors in the high one). Line
+     * number n is at `lines[n % SCROLLBACK_LINES]`.
+     */
+    uint16_t lines[SCROLLBACK_LINES][COLUMNS];
+
+    /**
+     * The numbers of the oldest line kept and of the cursor's line, and the cursor's column.
+     */
+    uint32_t first;
+    uint32_t last;
+    uint32_t column;
+
+    /**
+     * The lines the view is scrolled back by from the bottom.
+     */
+    uint32_t scrollback;
+
+    uint32_t index;
+
+    static VirtualTerminal terminals[COUNT];
+    static uint32_t active;
+
+    /**
+     * The screens and the terminals are shared by all processors. The lock keeps lines from being
+     * mixed up.
+     */
+    static Spinlock lock;
+
+    uint16_t *Line(uint32_t number);
+
+    /**
+     * @brief The number of the line at the top of the screen when the view isn't scrolled back.
+     */
+    uint32_t Bottom();
+
+    /**
+     * @brief The number of the line at the top of the view.
+     */
+    uint32_t Top();
+
+    /**
+     * @brief Tells whether the terminal's output goes to the screen as it is written.
+     */
+    bool Visible();
+
+    void Put(char character);
+    void NewLine();
+
+    /**
+     * @brief Copies the lines in view to the screen. The lock must be held.
+     */
+    void Redraw();
+
+  public:
+    VirtualTerminal();
+    ~VirtualTerminal();
+
+    /**
+     * @brief Writes a string at the cursor, going to the next line on '\n' and at the end of a
+     * line, and back a column (within the line) on '\b'.
+     */
+    void Write(const char *str);
+
+    /**
+     * @brief Scrolls the view back (positive) or forward (negative) by a number of lines, as far
+     * as the history goes.
+     */
+    void Scroll(int32_t lines);
+
+    uint32_t Index();
+
+    static VirtualTerminal *Get(uint32_t index);
+    static VirtualTerminal *Active();
+
+    /**
+     * @brief Shows a terminal on the screen.
+     */
+    static void Switch(uint32_t index);
+
+    /**
+     * @brief Switches or scrolls the terminals for Alt+F1..F6 and Shift+Page Up/Page Down.
+     *
+     * @return Whether the key was one of these, and so shouldn't be handled further.
+     */
+    static bool HandleKey(KeyboardEvent *key);
+};
+
+#endif
@@ -0,0 +1,336 @@
+#include "timer.h"
+#include "stdio.h"
+
+/** Timer Class */
+
+Timer::Timer(void (*callback)(void *), void *argument)
+{
+    this->callback = callback;
+    this->argument = argument;
+    expires = 0;
+    next = 0;
+    link = 0;
+    wheel = 0;
+}
+
+Timer::~Timer() { Cancel(); }
+
+void Timer::SetCallback(void (*callback)(void *), void *argument)
+{
+    this->callback = callback;
+    this->argument = argument;
+}
+
+void Timer::Start(uint32_t milliseconds)
+{
+    if (SystemTimer::activeSystemTimer != 0)
+    {
+        SystemTimer::activeSystemTimer->Add(this, milliseconds);
+    }
+}
+
+bool Timer::Cancel()
+{
+    TimerWheel *wheel = this->wheel;
+    return wheel != 0 && wheel->Cancel(this);
+}
+
+bool Timer::Pending() { return link != 0; }
+
+/** TimerWheel Class */
+
+static LockClass timerWheelLockClass("timer wheel");
+
+TimerWheel::TimerWheel() : lock(&timerWheelLockClass)
+{
+    for (uint32_t i = 0; i < ROOT_SIZE; i++)
+    {
+        root[i] = 0;
+    }
+    for (uint32_t level = 0; level < LEVELS; level++)
+    {
+        for (uint32_t i = 0; i < LEVEL_SIZE; i++)
+        {
+            levels[level][i] = 0;
+        }
+    }
+    expired = 0;
+    now = 0;
+    pending = 0;
+}
+
+TimerWheel::~TimerWheel() {}
+
+void TimerWheel::Insert(Timer **list, Timer *timer)
+{
+    timer->next = *list;
+    if (timer->next != 0)
+    {
+        timer->next->link = &timer->next;
+    }
+    timer->link = list;
+    *list = timer;
+}
+
+void TimerWheel::Remove(Timer *timer)
+{
+    *timer->link = timer->next;
+    if (timer->next != 0)
+    {
+        timer->next->link = timer->link;
+    }
+    timer->next = 0;
+    timer->link = 0;
+}
+
+void TimerWheel::Place(Timer *timer)
+{
+    uint32_t ticks = timer->expires - now;
+
+    /**
+     * A timer that should have expired already (it was cascaded late, or added for tick 0) goes
+     * into the slot processed next.
+     */
+    if ((int32_t)ticks < 0)
+    {
+        Insert(&root[now % ROOT_SIZE], timer);
+        return;
+    }
+    if (ticks < ROOT_SIZE)
+    {
+        Insert(&root[timer->expires % ROOT_SIZE], timer);
+        return;
+    }
+    for (uint32_t level = 0; level < LEVELS; level++)
+    {
+        uint32_t shift = ROOT_BITS + level * LEVEL_BITS;
+        if (level == LEVELS - 1 || ticks < (1u << (shift + LEVEL_BITS)))
+        {
+            Insert(&levels[level][(timer->expires >> shift) % LEVEL_SIZE], timer);
+            return;
+        }
+    }
+}
+
+uint32_t TimerWheel::Cascade(uint32_t level)
+{
+    uint32_t index = (now >> (ROOT_BITS + level * LEVEL_BITS)) % LEVEL_SIZE;
+    Timer *list = levels[level][index];
+    levels[level][index] = 0;
+    while (list != 0)
+    {
+        Timer *timer = list;
+        list = timer->next;
+        timer->next = 0;
+        timer->link = 0;
+        Place(timer);
+    }
+    return index;
+}
+
+void TimerWheel::Add(Timer *timer, uint32_t ticks)
+{
+    if (timer->wheel != 0 && timer->wheel != this)
+    {
+        timer->wheel->Cancel(timer);
+    }
+    if (ticks > MAX_TICKS)
+    {
+        ticks = MAX_TICKS;
+    }
+
+    SpinlockGuard guard(&lock);
+    if (timer->link != 0)
+    {
+        Remove(timer);
+        pending--;
+    }
+    timer->wheel = this;
+    timer->expires = now + ticks;
+    Place(timer);
+    pending++;
+}
+
+bool TimerWheel::Cancel(Timer *timer)
+{
+    SpinlockGuard guard(&lock);
+    if (timer->link == 0)
+    {
+        return false;
+    }
+    Remove(timer);
+    timer->wheel = 0;
+    pending--;
+    return true;
+}
+
+bool TimerWheel::Tick()
+{
+    SpinlockGuard guard(&lock);
+
+    /**
+     * When the finest wheel comes round, the next slot of the wheel above is spread over it, and
+     * so on up while the wheels above come round too.
+     */
+    uint32_t index = now % ROOT_SIZE;
+    for (uint32_t level = 0; index == 0 && level < LEVELS; level++)
+    {
+        index = Cascade(level);
+    }
+    index = now % ROOT_SIZE;
+
+    bool any = root[index] != 0;
+    while (root[index] != 0)
+    {
+        Timer *timer = root[index];
+        Remove(timer);
+        Insert(&expired, timer);
+    }
+    now++;
+    return any;
+}
+
+uint32_t TimerWheel::RunExpired()
+{
+    uint32_t count = 0;
+    while (true)
+    {
+        void (*callback)(void *);
+        void *argument;
+        {
+            SpinlockGuard guard(&lock);
+            Timer *timer = expired;
+            if (timer == 0)
+            {
+                break;
+            }
+            Remove(timer);
+            timer->wheel = 0;
+            pending--;
+            callback = timer->callback;
+            argument = timer->argument;
+        }
+
+        /**
+         * The timer isn't touched after this, so the callback may free or restart it.
+         */
+        if (callback != 0)
+        {
+            callback(argument);
+        }
+        count++;
+    }
+    return count;
+}
+
+bool TimerWheel::HasExpired()
+{
+    SpinlockGuard guard(&lock);
+    return expired != 0;
+}
+
+uint32_t TimerWheel::Now() { return now; }
+
+uint32_t TimerWheel::Pending() { return pending; }
+
+/** SystemTimer Class */
+
+SystemTimer *SystemTimer::activeSystemTimer = 0;
+
+SystemTimer::SystemTimer(InterruptManager *manager, TaskManager *taskManager)
+    : InterruptHandler(0x20, manager), channel0Port(0x40), commandPort(0x43)
+{
+    this->taskManager = taskManager;
+
+    uint32_t divisor = PIT_FREQUENCY / TIMER_FREQUENCY;
+    commandPort.Write(0x34); // Channel 0, low then high byte, mode 2 (rate generator), binary.
+    channel0Port.Write(divisor & 0xFF);
+    channel0Port.Write(divisor >> 8);
+
+    activeSystemTimer = this;
+
+    /**
+     * The task runs where the ticks come from, so waking it up takes no IPI.
+     */
+    if (taskManager->StartKernelTask(&Task, 0) == 0)
+    {
+        printf("timer: couldn't start the timer task\n");
+    }
+}
+
+SystemTimer::~SystemTimer()
+{
+    if (activeSystemTimer == this)
+    {
+        activeSystemTimer = 0;
+    }
+}
+
+bool SystemTimer::HandleInterrupt(uint32_t *esp)
+{
+    if (wheel.Tick())
+    {
+        taskManager->Wakeup(this);
+    }
+    return true;
+}
+
+void SystemTimer::Task() { activeSystemTimer->Run(); }
+
+void SystemTimer::Run()
+{
+    while (1)
+    {
+        if (wheel.RunExpired() != 0)
+        {
+            continue;
+        }
+        asm volatile("cli");
+        if (!wheel.HasExpired())
+        {
+            taskManager->Sleep(this);
+        }
+        asm volatile("sti");
+    }
+}
+
+void SystemTimer::Add(Timer *timer, uint32_t milliseconds)
+{
+    /**
+     * The next tick may come right away, so the ticks are rounded up.
+     */
+    wheel.Add(timer, (milliseconds + MILLISECONDS_PER_TICK - 1) / MILLISECONDS_PER_TICK);
+}
+
+/**
+ * @brief The callback of the timers `Sleep` waits for.
+ */
+static void WakeSleeper(void *argument)
+{
+    *(volatile bool *)argument = true;
+    TaskManager::activeTaskManager->Wakeup(argument);
+}
+
+void SystemTimer::Sleep(uint32_t milliseconds)
+{
+    volatile bool done = false;
+    Timer timer(&WakeSleeper, (void *)&done);
+
+    uint32_t eflags;
+    asm volatile("pushfl\n"
+                 "popl %0\n"
+                 "cli"
+                 : "=r"(eflags));
+    Add(&timer, milliseconds);
+    while (!done)
+    {
+        taskManager->Sleep((void *)&done);
+    }
+    asm volatile("pushl %0\n"
+                 "popfl"
+                 :
+                 : "r"(eflags)
+                 : "cc");
+}
+
+uint32_t SystemTimer::Ticks() { return wheel.Now(); }
@@ -0,0 +1,246 @@
+/**
+ * @file timer.h
+ * @author rohan843
+ * @brief Contains the timers, kept in a hierarchical timing wheel, and the system timer driving
+ * them.
+ *
+ * A timing wheel is an array of slots, one per tick, each holding the timers expiring on that
+ * tick: adding a timer is putting it into its slot, and each tick empties one slot. The timers
+ * expiring within 256 ticks are in the first wheel. Those further out are in coarser wheels of 64
+ * slots each, every slot of which covers a whole turn of the wheel below; when the wheel below
+ * completes a turn, the next slot of the coarser wheel is emptied into it ("cascaded"). So adding
+ * and cancelling a timer take the same time however many are pending, and so does a tick, but for
+ * the cascades, where each timer is moved at most once per wheel.
+ *
+ * A tick only moves the expired timers aside. Their callbacks run later, in a task of their own,
+ * with interrupts enabled, so they may take locks, sleep, and start timers.
+ */
+
+#ifndef __TIMER_H
+#define __TIMER_H
+
+#include "interrupts.h"
+#include "multitasking.h"
+#include "port.h"
+#include "spinlock.h"
+#include "types.h"
+
+/**
+ * The PIT's input clock, in Hz.
+ */
+const uint32_t PIT_FREQUENCY = 1193182;
+
+/**
+ * The ticks per second of the system timer, and the length of one.
+ */
+const uint32_t TIMER_FREQUENCY = 100;
+const uint32_t MILLISECONDS_PER_TICK = 1000 / TIMER_FREQUENCY;
+
+class TimerWheel;
+
+class Timer
+{
+    friend class TimerWheel;
+
+  protected:
+    void (*callback)(void *);
+    void *argument;
+
+    /**
+     * The tick it expires on.
+     */
+    uint32_t expires;
+
+    /**
+     * The list it is in (a slot, or the expired timers), linked through the pointer pointing to
+     * it, so that it can be taken out without knowing which list it is. Both are 0 while the timer
+     * is in none.
+     */
+    Timer *next;
+    Timer **link;
+
+    /**
+     * The wheel it was added to, or 0.
+     */
+    TimerWheel *wheel;
+
+  public:
+    /**
+     * @param callback Called with `argument` when the timer expires.
+     */
+    Timer(void (*callback)(void *) = 0, void *argument = 0);
+
+    /**
+     * @brief Cancels the timer, if it is pending.
+     */
+    ~Timer();
+
+    void SetCallback(void (*callback)(void *), void *argument);
+
+    /**
+     * @brief Starts the timer on the system timer, or restarts it if it is pending.
+     */
+    void Start(uint32_t milliseconds);
+
+    /**
+     * @brief Stops the timer if it is pending.
+     *
+     * @return false if it wasn't (its callback may be running).
+     */
+    bool Cancel();
+
+    /**
+     * @brief Tells whether the timer was started and its callback hasn't been called yet.
+     */
+    bool Pending();
+};
+
+class TimerWheel
+{
+  protected:
+    static const uint32_t ROOT_BITS = 8;
+    static const uint32_t ROOT_SIZE = 1 << ROOT_BITS;
+    static const uint32_t LEVEL_BITS = 6;
+    static const uint32_t LEVEL_SIZE = 1 << LEVEL_BITS;
+    static const uint32_t LEVELS = 3;
+
+    /**
+     * The furthest a timer can be: timers further out expire then instead.
+     */
+    static const uint32_t MAX_TICKS = (1 << (ROOT_BITS + LEVELS * LEVEL_BITS)) - 1;
+
+    /**
+     * The finest wheel, with a slot per tick, and the coarser ones.
+     */
+    Timer *root[ROOT_SIZE];
+    Timer *levels[LEVELS][LEVEL_SIZE];
+
+    /**
+     * The timers that expired and whose callbacks haven't run yet.
+     */
+    Timer *expired;
+
+    /**
+     * The next tick to process.
+     */
+    uint32_t now;
+
+    /**
+     * The timers in the wheels, and the expired ones.
+     */
+    uint32_t pending;
+
+    Spinlock lock;
+
+    static void Insert(Timer **list, Timer *timer);
+    static void Remove(Timer *timer);
+
+    /**
+     * @brief Puts a timer into the slot of its expiry tick. The lock must be held.
+     */
+    void Place(Timer *timer);
+
+    /**
+     * @brief Empties a slot of a coarser wheel into the wheels below.
+     *
+     * @return The slot's index.
+     */
+    uint32_t Cascade(uint32_t level);
+
+  public:
+    TimerWheel();
+    ~TimerWheel();
+
+    /**
+     * @brief Adds a timer, or moves it if it is pending.
+     *
+     * @param ticks The ticks from now until it expires. 0 makes it expire on the next tick.
+     */
+    void Add(Timer *timer, uint32_t ticks);
+
+    /**
+     * @return false if the timer wasn't pending.
+     */
+    bool Cancel(Timer *timer);
+
+    /**
+     * @brief Advances the wheels by a tick, setting the timers expiring on it aside. Can be called
+     * from interrupt handlers.
+     *
+     * @return Whether any timers expired.
+     */
+    bool Tick();
+
+    /**
+     * @brief Calls the callbacks of the timers that expired, with the wheel's lock released.
+     *
+     * @return The number of callbacks called.
+     */
+    uint32_t RunExpired();
+
+    /**
+     * @brief Tells whether there are expired timers whose callbacks haven't run yet.
+     */
+    bool HasExpired();
+
+    /**
+     * @brief The ticks since the wheel was created.
+     */
+    uint32_t Now();
+
+    /**
+     * @brief The number of timers added whose callbacks haven't been called, and which weren't
+     * cancelled.
+     */
+    uint32_t Pending();
+};
+
+/**
+ * @brief Ticks a timing wheel with PIT channel 0 (IRQ0), on the bootstrap processor, and runs the
+ * expired timers' callbacks in a kernel task.
+ */
+class SystemTimer : public InterruptHandler
+{
+  protected:
+    Port8Bit channel0Port;
+    Port8Bit commandPort;
+
+    TimerWheel wheel;
+    TaskManager *taskManager;
+
+    static void Task();
+
+    /**
+     * @brief Runs the callbacks whenever timers expired, forever.
+     */
+    void Run();
+
+  public:
+    static SystemTimer *activeSystemTimer;
+
+    /**
+     * @brief Sets the PIT to tick at `TIMER_FREQUENCY`. That also makes the time slices on the
+     * bootstrap processor a tick long.
+     */
+    SystemTimer(InterruptManager *manager, TaskManager *taskManager);
+    ~SystemTimer();
+
+    virtual bool HandleInterrupt(uint32_t *esp);
+
+    /**
+     * @brief Adds a timer expiring after at least `milliseconds`.
+     */
+    void Add(Timer *timer, uint32_t milliseconds);
+
+    /**
+     * @brief Blocks the running task for at least `milliseconds`.
+     */
+    void Sleep(uint32_t milliseconds);
+
+    /**
+     * @brief The ticks since the system timer started.
+     */
+    uint32_t Ticks();
+};
+
+#endif
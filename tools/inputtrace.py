@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+"""Makes input traces for the input benchmark, which replays them through the PS/2 drivers.
+
+Usage: inputtrace.py synth OUT [--text TEXT] [--seconds N]
+       inputtrace.py extract LOG OUT
+
+A trace file is a header ("ITRC", the entry count and the mouse packet size the trace was recorded
+with), followed by one entry per byte a PS/2 device sent: the microseconds since the previous byte,
+the port (0 for the keyboard, 1 for the mouse), the byte, and two reserved bytes. Everything is
+little endian.
+
+`synth` makes a deterministic trace: the text typed at 10 keys a second (scan code set 1, with
+Shift for the capitals and symbols), while an IntelliMouse (4 byte packets) draws circles at 200
+packets a second.
+
+`extract` takes the last trace a kernel printed (the "inputtrace:" lines printed when Scroll Lock
+is turned off again after recording) from a debug console log, e.g., from `make record`.
+"""
+
+import argparse
+import math
+import struct
+import sys
+
+TEXT = "The quick brown fox jumps over the lazy dog. 0123456789 (Hello, World!)\n"
+
+KEY_INTERVAL = 100000
+KEY_HOLD = 40000
+MOUSE_INTERVAL = 5000
+MOUSE_PACKET_SIZE = 4
+MOUSE_RADIUS = 200
+
+# The set 1 make codes of the US layout, without and with Shift.
+ROWS = [
+    (0x02, "1234567890-=", "!@#$%^&*()_+"),
+    (0x10, "qwertyuiop[]", "QWERTYUIOP{}"),
+    (0x1E, "asdfghjkl;'`", 'ASDFGHJKL:"~'),
+    (0x2B, "\\zxcvbnm,./", "|ZXCVBNM<>?"),
+]
+LEFT_SHIFT = 0x2A
+
+
+def key_codes():
+    codes = {" ": (0x39, False), "\n": (0x1C, False), "\t": (0x0F, False)}
+    for first, plain, shifted in ROWS:
+        for i, (lower, upper) in enumerate(zip(plain, shifted)):
+            codes[lower] = (first + i, False)
+            codes[upper] = (first + i, True)
+    return codes
+
+
+def synthesize(text, seconds):
+    """Returns the (time in microseconds, port, byte) of every byte, in time order."""
+    codes = key_codes()
+    events = []
+
+    time = 0
+    end = int(seconds * 1000000)
+    while time < end:
+        for character in text:
+            if time >= end:
+                break
+            if character not in codes:
+                continue
+            code, shift = codes[character]
+            if shift:
+                events.append((time, 0, LEFT_SHIFT))
+            events.append((time + 1000, 0, code))
+            events.append((time + KEY_HOLD, 0, code | 0x80))
+            if shift:
+                events.append((time + KEY_HOLD + 1000, 0, LEFT_SHIFT | 0x80))
+            time += KEY_INTERVAL
+
+    # A circle a second: each packet moves along the circle from the previous point.
+    x = y = 0
+    for packet in range(end // MOUSE_INTERVAL):
+        angle = 2 * math.pi * packet * MOUSE_INTERVAL / 1000000
+        next_x = round(MOUSE_RADIUS * math.cos(angle))
+        next_y = round(MOUSE_RADIUS * math.sin(angle))
+        dx, dy = next_x - x, next_y - y
+        x, y = next_x, next_y
+
+        # The first byte always has bit 3 set, and the sign bits of both movements. The mouse
+        # counts up as positive.
+        first = 0x08 | (0x10 if dx < 0 else 0) | (0x20 if -dy < 0 else 0)
+        packet_bytes = [first, dx & 0xFF, -dy & 0xFF, 0]
+        for i, byte in enumerate(packet_bytes):
+            events.append((packet * MOUSE_INTERVAL + 100 * i, 1, byte))
+
+    events.sort(key=lambda event: event[0])
+    return events
+
+
+def write_trace(path, entries, mouse_packet_size):
+    """Writes (delay, port, byte) entries."""
+    with open(path, "wb") as file:
+        file.write(struct.pack("<4sIB3x", b"ITRC", len(entries), mouse_packet_size))
+        for delay, port, byte in entries:
+            file.write(struct.pack("<IBBH", min(delay, 0xFFFFFFFF), port, byte, 0))
+
+
+def synth(arguments):
+    events = synthesize(arguments.text, arguments.seconds)
+    entries = []
+    previous = 0
+    for time, port, byte in events:
+        entries.append((time - previous, port, byte))
+        previous = time
+    write_trace(arguments.out, entries, MOUSE_PACKET_SIZE)
+    print(f"{arguments.out}: {len(entries)} bytes of input over {previous / 1000000:.1f} s")
+
+
+def extract(arguments):
+    trace = result = None
+    with open(arguments.log, "rb") as log:
+        for line in log.read().decode("latin-1").splitlines():
+            fields = line.split()
+            if len(fields) < 2 or fields[0] != "inputtrace:":
+                continue
+            if fields[1] == "begin" and len(fields) == 3:
+                trace = (int(fields[2]), [])
+            elif fields[1] == "end":
+                if trace is not None:
+                    result = trace
+                trace = None
+            elif trace is not None and len(fields) == 3:
+                value = int(fields[2], 16)
+                trace[1].append((int(fields[1], 16), value >> 8, value & 0xFF))
+    if result is None:
+        sys.exit(f"{arguments.log}: no complete trace found")
+
+    mouse_packet_size, entries = result
+    write_trace(arguments.out, entries, mouse_packet_size)
+    print(f"{arguments.out}: {len(entries)} bytes of input")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Makes input traces for the input benchmark.")
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    synth_parser = commands.add_parser("synth", help="make a deterministic trace")
+    synth_parser.add_argument("out")
+    synth_parser.add_argument("--text", default=TEXT)
+    synth_parser.add_argument("--seconds", type=float, default=10)
+    synth_parser.set_defaults(function=synth)
+
+    extract_parser = commands.add_parser("extract", help="take the last trace printed to a log")
+    extract_parser.add_argument("log")
+    extract_parser.add_argument("out")
+    extract_parser.set_defaults(function=extract)
+
+    arguments = parser.parse_args()
+    arguments.function(arguments)
+
+
+if __name__ == "__main__":
+    main()
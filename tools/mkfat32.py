@@ -0,0 +1,314 @@
+#!/usr/bin/env python3
+"""Builds a FAT32 disk image from a directory, for the kernel's FAT32 driver.
+
+Usage: mkfat32.py IMAGE SIZE_MIB DIRECTORY [--benchmark-data]
+
+The volume fills the whole image (no partition table), with 512 byte sectors and clusters of one
+sector, so that files have long cluster chains. Every name gets long name entries.
+
+With --benchmark-data, the volume also gets the data set the FAT32 benchmark reads:
+- data/large.bin: 16 MiB, in consecutive clusters;
+- data/fragmented.bin: 4 MiB, in runs of 256 clusters with a free cluster between each;
+- many/: 1024 files named file0000.txt to file1023.txt.
+"""
+
+import os
+import struct
+import sys
+
+SECTOR = 512
+RESERVED_SECTORS = 32
+FAT_COUNT = 2
+END_OF_CHAIN = 0x0FFFFFFF
+
+ATTRIBUTE_DIRECTORY = 0x10
+ATTRIBUTE_ARCHIVE = 0x20
+ATTRIBUTE_LONG_NAME = 0x0F
+
+
+class Node:
+    def __init__(self, name, data=None, runs=None):
+        self.name = name
+        self.data = data
+        self.children = [] if data is None else None
+        self.runs = runs
+        self.clusters = []
+        self.parent = None
+
+    def child(self, name):
+        for node in self.children:
+            if node.name == name:
+                return node
+        node = Node(name)
+        self.children.append(node)
+        return node
+
+
+def pattern(size, seed):
+    """Returns bytes that differ at every 32 - bit word, so misplaced reads show."""
+    words = bytearray()
+    value = seed
+    for _ in range(size // 4):
+        value = (value * 1103515245 + 12345) & 0xFFFFFFFF
+        words += struct.pack("<I", value)
+    return bytes(words)
+
+
+def short_name(name, used):
+    """Returns an 11 byte short name for a long name, unique among `used`."""
+    base, _, extension = name.upper().rpartition(".")
+    if not base:
+        base, extension = extension, ""
+    keep = lambda text: "".join(c for c in text if c.isalnum() or c in "$%'-_@~`!(){}^#&")
+    base, extension = keep(base), keep(extension)[:3]
+    for number in range(1, 1000000):
+        suffix = "~%d" % number
+        candidate = (base[: 8 - len(suffix)] + suffix).ljust(8) + extension.ljust(3)
+        if candidate not in used:
+            used.add(candidate)
+            return candidate.encode("ascii")
+    raise ValueError("too many similar names: " + name)
+
+
+def checksum(name):
+    total = 0
+    for byte in name:
+        total = (((total & 1) << 7) + (total >> 1) + byte) & 0xFF
+    return total
+
+
+def long_name_entries(name, short):
+    """Returns the long name entries naming `short`, in the order they are stored."""
+    characters = [ord(c) for c in name] + [0]
+    characters += [0xFFFF] * (-len(characters) % 13)
+    parts = [characters[i : i + 13] for i in range(0, len(characters), 13)]
+    if len(name) % 13 == 0:
+        parts = parts[:-1]
+    entries = []
+    for index, part in enumerate(parts):
+        sequence = index + 1
+        if index == len(parts) - 1:
+            sequence |= 0x40
+        entries.append(
+            struct.pack(
+                "<B5HBBB6HH2H",
+                sequence,
+                *part[0:5],
+                ATTRIBUTE_LONG_NAME,
+                0,
+                checksum(short),
+                *part[5:11],
+                0,
+                *part[11:13],
+            )
+        )
+    return list(reversed(entries))
+
+
+def entry(name, attributes, cluster, size):
+    return struct.pack(
+        "<11sBBBHHHHHHHI",
+        name,
+        attributes,
+        0,
+        0,
+        0,
+        0x21,
+        0x21,
+        cluster >> 16,
+        0,
+        0x21,
+        cluster & 0xFFFF,
+        size,
+    )
+
+
+def entry_count(node):
+    """The number of directory entries a directory takes, including the end marker."""
+    count = 1 if node.parent is None else 3
+    for child in node.children:
+        count += 1 + (len(child.name) + 12) // 13
+    return count
+
+
+class Volume:
+    def __init__(self, size):
+        self.sectors = size // SECTOR
+        clusters = self.sectors - RESERVED_SECTORS
+        while True:
+            self.fat_sectors = ((clusters + 2) * 4 + SECTOR - 1) // SECTOR
+            fitting = self.sectors - RESERVED_SECTORS - FAT_COUNT * self.fat_sectors
+            if fitting >= clusters:
+                break
+            clusters = fitting
+        self.clusters = clusters
+        self.data_sector = RESERVED_SECTORS + FAT_COUNT * self.fat_sectors
+        self.fat = [0] * (clusters + 2)
+        self.fat[0] = 0x0FFFFFF8
+        self.fat[1] = END_OF_CHAIN
+        self.next_free = 2
+        self.image = bytearray(size)
+
+    def allocate(self, count, runs=None):
+        """Allocates a chain of clusters, leaving a free cluster after every `runs` of them."""
+        chain = []
+        for i in range(count):
+            if runs and i > 0 and i % runs == 0:
+                self.next_free += 1
+            if self.next_free >= self.clusters + 2:
+                raise ValueError("the volume is full")
+            chain.append(self.next_free)
+            self.next_free += 1
+        for current, following in zip(chain, chain[1:] + [END_OF_CHAIN]):
+            self.fat[current] = following
+        return chain
+
+    def write(self, chain, data):
+        for index, cluster in enumerate(chain):
+            offset = (self.data_sector + cluster - 2) * SECTOR
+            piece = data[index * SECTOR : (index + 1) * SECTOR]
+            self.image[offset : offset + len(piece)] = piece
+
+
+def allocate_directories(volume, node):
+    size = entry_count(node) * 32
+    node.clusters = volume.allocate((size + SECTOR - 1) // SECTOR)
+    for child in node.children:
+        if child.children is not None:
+            allocate_directories(volume, child)
+
+
+def allocate_files(volume, node):
+    for child in node.children:
+        if child.children is not None:
+            allocate_files(volume, child)
+        elif child.data:
+            child.clusters = volume.allocate((len(child.data) + SECTOR - 1) // SECTOR, child.runs)
+            volume.write(child.clusters, child.data)
+
+
+def write_directories(volume, node, root):
+    entries = []
+    if node.parent is not None:
+        parent = node.parent.clusters[0] if node.parent is not root else 0
+        entries.append(entry(b".          ", ATTRIBUTE_DIRECTORY, node.clusters[0], 0))
+        entries.append(entry(b"..         ", ATTRIBUTE_DIRECTORY, parent, 0))
+
+    used = set()
+    for child in node.children:
+        short = short_name(child.name, used)
+        entries += long_name_entries(child.name, short)
+        first = child.clusters[0] if child.clusters else 0
+        if child.children is not None:
+            entries.append(entry(short, ATTRIBUTE_DIRECTORY, first, 0))
+            write_directories(volume, child, root)
+        else:
+            entries.append(entry(short, ATTRIBUTE_ARCHIVE, first, len(child.data)))
+    volume.write(node.clusters, b"".join(entries))
+
+
+def boot_sector(volume):
+    sector = bytearray(SECTOR)
+    struct.pack_into(
+        "<3s8sHBHBHHBHHHII",
+        sector,
+        0,
+        b"\xEB\x58\x90",
+        b"MYOS    ",
+        SECTOR,
+        1,
+        RESERVED_SECTORS,
+        FAT_COUNT,
+        0,
+        0,
+        0xF8,
+        0,
+        32,
+        64,
+        0,
+        volume.sectors,
+    )
+    struct.pack_into(
+        "<IHHIHH12sBBBI11s8s",
+        sector,
+        36,
+        volume.fat_sectors,
+        0,
+        0,
+        2,
+        1,
+        6,
+        b"",
+        0x80,
+        0,
+        0x29,
+        0x4D594F53,
+        b"MYOS FAT32 ",
+        b"FAT32   ",
+    )
+    sector[510:512] = b"\x55\xAA"
+    return sector
+
+
+def information_sector(volume):
+    sector = bytearray(SECTOR)
+    free = volume.clusters + 2 - volume.next_free
+    struct.pack_into("<I", sector, 0, 0x41615252)
+    struct.pack_into("<IIII", sector, 484, 0x61417272, free, volume.next_free, 0)
+    struct.pack_into("<I", sector, 508, 0xAA550000)
+    return sector
+
+
+def main():
+    arguments = [argument for argument in sys.argv[1:] if not argument.startswith("--")]
+    if len(arguments) != 3:
+        sys.exit(__doc__)
+    image, size, directory = arguments[0], int(arguments[1]) * 1024 * 1024, arguments[2]
+
+    root = Node("")
+    for path, _, files in sorted(os.walk(directory)):
+        node = root
+        relative = os.path.relpath(path, directory)
+        if relative != ".":
+            for part in relative.split(os.sep):
+                node = node.child(part)
+        for name in sorted(files):
+            with open(os.path.join(path, name), "rb") as file:
+                node.children.append(Node(name, file.read()))
+
+    if "--benchmark-data" in sys.argv:
+        data = root.child("data")
+        data.children.append(Node("large.bin", pattern(16 * 1024 * 1024, 1)))
+        data.children.append(Node("fragmented.bin", pattern(4 * 1024 * 1024, 2), runs=256))
+        many = root.child("many")
+        for i in range(1024):
+            many.children.append(Node("file%04d.txt" % i, b"file %04d\n" % i))
+
+    def link(node):
+        for child in node.children:
+            child.parent = node
+            if child.children is not None:
+                link(child)
+
+    link(root)
+
+    volume = Volume(size)
+    allocate_directories(volume, root)
+    allocate_files(volume, root)
+    write_directories(volume, root, root)
+
+    boot = boot_sector(volume)
+    volume.image[0:SECTOR] = boot
+    volume.image[6 * SECTOR : 7 * SECTOR] = boot
+    volume.image[SECTOR : 2 * SECTOR] = information_sector(volume)
+    fat = struct.pack("<%dI" % len(volume.fat), *volume.fat)
+    for copy in range(FAT_COUNT):
+        offset = (RESERVED_SECTORS + copy * volume.fat_sectors) * SECTOR
+        volume.image[offset : offset + len(fat)] = fat
+
+    with open(image, "wb") as file:
+        file.write(volume.image)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""Floods a QEMU guest's network card with Ethernet frames, over a local UDP socket backend.
+
+Usage: netflood.py [--seconds N] [--rate FRAMES_PER_SECOND] [--size BYTES]
+                   [--listen PORT] [--guest PORT]
+
+QEMU must be started with a UDP socket network backend, which carries each Ethernet frame as
+one UDP datagram between two local ports (nothing leaves the machine):
+
+    -netdev socket,id=net0,udp=127.0.0.1:5555,localaddr=127.0.0.1:5556 -device e1000,netdev=net0
+
+The flood is sent to the guest's port (5556), from the port QEMU sends the guest's frames to
+(5555), so the frames the guest sends are counted too. Without --rate, frames are sent as fast as
+possible. Every second, the frames sent and received in that second are printed.
+"""
+
+import argparse
+import socket
+import struct
+import time
+
+ETHERTYPE_LOCAL_EXPERIMENTAL = 0x88B5
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Floods a QEMU guest with Ethernet frames.")
+    parser.add_argument("--seconds", type=float, default=30)
+    parser.add_argument("--rate", type=int, default=0, help="frames per second, 0 for no limit")
+    parser.add_argument("--size", type=int, default=60, help="frame size, without the CRC")
+    parser.add_argument("--listen", type=int, default=5555)
+    parser.add_argument("--guest", type=int, default=5556)
+    arguments = parser.parse_args()
+
+    size = max(arguments.size, 14 + 4)
+    destination = b"\xff" * 6
+    source = b"\x52\x54\x00\x00\x00\x01"
+    header = destination + source + struct.pack(">H", ETHERTYPE_LOCAL_EXPERIMENTAL)
+    padding = bytes(size - len(header) - 4)
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4 * 1024 * 1024)
+    sock.bind(("127.0.0.1", arguments.listen))
+    sock.setblocking(False)
+    guest = ("127.0.0.1", arguments.guest)
+
+    start = time.monotonic()
+    second = start
+    sequence = 0
+    sent = received = 0
+    total_sent = total_received = 0
+    interval = 1.0 / arguments.rate if arguments.rate else 0
+
+    while True:
+        now = time.monotonic()
+        if now - start >= arguments.seconds:
+            break
+
+        if interval == 0 or sequence < (now - start) / interval:
+            try:
+                sock.sendto(header + struct.pack(">I", sequence) + padding, guest)
+                sequence += 1
+                sent += 1
+            except (BlockingIOError, ConnectionRefusedError):
+                pass
+
+        while True:
+            try:
+                sock.recv(65536)
+                received += 1
+            except (BlockingIOError, ConnectionRefusedError):
+                break
+
+        if now - second >= 1:
+            print("sent %d frames/s, received %d frames/s" % (sent, received), flush=True)
+            total_sent += sent
+            total_received += received
+            sent = received = 0
+            second = now
+
+    total_sent += sent
+    total_received += received
+    elapsed = time.monotonic() - start
+    print(
+        "total: sent %d frames (%d/s), received %d frames (%d/s)"
+        % (total_sent, total_sent / elapsed, total_received, total_received / elapsed)
+    )
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,171 @@
+#include "tty.h"
+#include "multitasking.h"
+
+/** TTY Class */
+
+static LockClass ttyLockClass("tty");
+
+TTY TTY::ttys[VirtualTerminal::COUNT];
+
+TTY::TTY() : lock(&ttyLockClass)
+{
+    terminal = VirtualTerminal::Get(this - ttys);
+    mode = TTY_CANONICAL | TTY_ECHO;
+    head = 0;
+    count = 0;
+    lines = 0;
+    lineLength = 0;
+}
+
+TTY::~TTY() {}
+
+TTY *TTY::Get(uint32_t index) { return index < VirtualTerminal::COUNT ? &ttys[index] : 0; }
+
+bool TTY::Queue(char character)
+{
+    if (count == INPUT_SIZE)
+    {
+        return false;
+    }
+    input[(head + count) % INPUT_SIZE] = character;
+    count++;
+    if (character == '\n')
+    {
+        lines++;
+    }
+    return true;
+}
+
+bool TTY::Readable() { return mode & TTY_CANONICAL ? lines != 0 : count != 0; }
+
+void TTY::SetMode(uint32_t mode)
+{
+    {
+        SpinlockGuard guard(&lock);
+        if ((this->mode & TTY_CANONICAL) && !(mode & TTY_CANONICAL))
+        {
+            for (uint32_t i = 0; i < lineLength; i++)
+            {
+                Queue(line[i]);
+            }
+            lineLength = 0;
+        }
+        this->mode = mode;
+    }
+    TaskManager::activeTaskManager->Wakeup(this);
+}
+
+uint32_t TTY::Mode() { return mode; }
+
+void TTY::Input(char character)
+{
+    /**
+     * What to echo: the character, or for a Backspace that erased one, a step back over a blank.
+     */
+    const char *echo = 0;
+    char str[2] = {character, '\0'};
+    bool queued = false;
+    {
+        SpinlockGuard guard(&lock);
+        if (!(mode & TTY_CANONICAL))
+        {
+            queued = Queue(character);
+            echo = str;
+        }
+        else if (character == '\b')
+        {
+            if (lineLength > 0)
+            {
+                lineLength--;
+                echo = "\b \b";
+            }
+        }
+        else if (character == '\n')
+        {
+            /**
+             * The line is queued whole or not at all, so that reads never see part of it.
+             */
+            if (INPUT_SIZE - count > lineLength)
+            {
+                for (uint32_t i = 0; i < lineLength; i++)
+                {
+                    Queue(line[i]);
+                }
+                Queue('\n');
+                lineLength = 0;
+                queued = true;
+                echo = str;
+            }
+        }
+        else if (lineLength < LINE_SIZE - 1)
+        {
+            line[lineLength++] = character;
+            echo = str;
+        }
+        if (!(mode & TTY_ECHO))
+        {
+            echo = 0;
+        }
+    }
+
+    if (echo != 0)
+    {
+        terminal->Write(echo);
+    }
+    if (queued)
+    {
+        TaskManager::activeTaskManager->Wakeup(this);
+    }
+}
+
+uint32_t TTY::Read(char *buffer, uint32_t size)
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    uint32_t eflags;
+    asm volatile("pushfl\n"
+                 "popl %0\n"
+                 "cli"
+                 : "=r"(eflags));
+
+    uint32_t taken = 0;
+    while (true)
+    {
+        {
+            SpinlockGuard guard(&lock);
+            if (Readable())
+            {
+                bool canonical = mode & TTY_CANONICAL;
+                while (taken < size && count != 0)
+                {
+                    char character = input[head];
+                    head = (head + 1) % INPUT_SIZE;
+                    count--;
+                    buffer[taken++] = character;
+                    if (character == '\n')
+                    {
+                        lines--;
+                        if (canonical)
+                        {
+                            break;
+                        }
+                    }
+                }
+                break;
+            }
+        }
+        TaskManager::activeTaskManager->Sleep(this);
+    }
+
+    asm volatile("pushl %0\n"
+                 "popfl"
+                 :
+                 : "r"(eflags)
+                 : "cc");
+    return taken;
+}
+
+void TTY::Write(const char *str) { terminal->Write(str); }
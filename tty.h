@@ -0,0 +1,105 @@
+/**
+ * @file tty.h
+ * @author rohan843
+ * @brief Contains the TTYs, which sit between the keyboard and the virtual terminals.
+ *
+ * The input console hands the characters typed to the TTY of the terminal shown, which queues them
+ * for the tasks reading it. In canonical mode, characters are first collected into a line that can
+ * be edited (Backspace takes the last one back), and only whole lines are queued, when Enter is
+ * pressed. In raw mode, each character is queued as it is typed. The characters are echoed to the
+ * terminal, unless echoing is turned off.
+ *
+ * `Read` puts the calling task to sleep until there is input, so tasks waiting for input take no
+ * CPU time.
+ */
+
+#ifndef __TTY_H
+#define __TTY_H
+
+#include "spinlock.h"
+#include "terminal.h"
+#include "types.h"
+
+/**
+ * Mode bits: queue whole lines after editing them (instead of each character), and echo the
+ * characters typed.
+ */
+const uint32_t TTY_CANONICAL = 0x1;
+const uint32_t TTY_ECHO = 0x2;
+
+class TTY
+{
+  protected:
+    static const uint32_t INPUT_SIZE = 256;
+    static const uint32_t LINE_SIZE = 128;
+
+    VirtualTerminal *terminal;
+    uint32_t mode;
+
+    /**
+     * The characters queued for reading, and how many whole lines (ending in '\n') are among them.
+     */
+    char input[INPUT_SIZE];
+    uint32_t head;
+    uint32_t count;
+    uint32_t lines;
+
+    /**
+     * The line being edited, in canonical mode.
+     */
+    char line[LINE_SIZE];
+    uint32_t lineLength;
+
+    Spinlock lock;
+
+    static TTY ttys[VirtualTerminal::COUNT];
+
+    /**
+     * @brief Queues a character for reading. The lock must be held.
+     *
+     * @return false if there is no room for it.
+     */
+    bool Queue(char character);
+
+    /**
+     * @brief Tells whether a read would return something. The lock must be held.
+     */
+    bool Readable();
+
+  public:
+    /**
+     * @brief Creates the TTY of the next terminal, in canonical mode with echo.
+     */
+    TTY();
+    ~TTY();
+
+    static TTY *Get(uint32_t index);
+
+    /**
+     * @brief Sets the mode bits. Going to raw mode queues the line being edited.
+     */
+    void SetMode(uint32_t mode);
+    uint32_t Mode();
+
+    /**
+     * @brief Handles a character typed on the TTY's terminal.
+     */
+    void Input(char character);
+
+    /**
+     * @brief Takes queued input, waiting for some if there is none: in canonical mode, (up to
+     * `size` characters of) a line, with its '\n', and in raw mode, the characters queued.
+     *
+     * @param buffer Kernel memory: it is filled with the TTY's lock held and interrupts disabled,
+     * where a page fault can't be served (see `SyscallHandler::ReadTerminal` for ring 3).
+     * @return The number of characters stored (not null terminated).
+     */
+    uint32_t Read(char *buffer, uint32_t size);
+
+    /**
+     * @brief Writes a string to the TTY's terminal.
+     */
+    void Write(const char *str);
+};
+
+#endif
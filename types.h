@@ -13,4 +13,6 @@ typedef unsigned int uint32_t; /*4 byte unsigned data*/
 typedef long long int64_t;           /*8 byte data*/
 typedef unsigned long long uint64_t; /*8 byte unsigned data*/
 
+typedef uint32_t size_t; /*Size of an object, as used by `new` and `sizeof`*/
+
 #endif
@@ -0,0 +1,23 @@
+/**
+ * @file hello.cpp
+ * @author rohan843
+ * @brief A small user program, loaded by the kernel from a boot module.
+ */
+
+#include "../syscalls.h"
+
+/**
+ * Lives in the writable segment, so every instance gets a private copy of it.
+ */
+static int runs = 0;
+
+extern "C" void _start()
+{
+    runs++;
+    if (runs == 1)
+    {
+        SystemCall(SYSCALL_PRINT, (uint32_t) "Hello from ring 3!\n");
+    }
+
+    SystemCall(SYSCALL_EXIT);
+}
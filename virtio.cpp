@@ -0,0 +1,477 @@
+#include "virtio.h"
+#include "memorymanagement.h"
+#include "multitasking.h"
+#include "stdio.h"
+
+/**
+ * Bits of the device status register.
+ */
+const uint8_t VIRTIO_STATUS_ACKNOWLEDGE = 1 << 0;
+const uint8_t VIRTIO_STATUS_DRIVER = 1 << 1;
+const uint8_t VIRTIO_STATUS_DRIVER_OK = 1 << 2;
+const uint8_t VIRTIO_STATUS_FAILED = 1 << 7;
+
+/**
+ * The bit of the interrupt status register telling that a queue has been used.
+ */
+const uint8_t VIRTIO_INTERRUPT_QUEUE = 1 << 0;
+
+/**
+ * The block device feature telling that it takes flush requests.
+ */
+const uint32_t VIRTIO_BLOCK_FLUSH = 1 << 9;
+
+const uint16_t VIRTQUEUE_DESCRIPTOR_NEXT = 1 << 0;
+const uint16_t VIRTQUEUE_DESCRIPTOR_WRITE = 1 << 1;
+
+/**
+ * Set by the device in the used ring's flags while it doesn't need kicks (it is already
+ * processing the queue).
+ */
+const uint16_t VIRTQUEUE_USED_NO_NOTIFY = 1 << 0;
+
+/**
+ * Legacy virtqueues align their used ring (and their size) to 4 KiB.
+ */
+const uint32_t VIRTQUEUE_ALIGN = 4096;
+
+const uint32_t VIRTIO_BLOCK_IN = 0;
+const uint32_t VIRTIO_BLOCK_OUT = 1;
+const uint32_t VIRTIO_BLOCK_FLUSH_REQUEST = 4;
+
+const uint32_t VIRTIO_SECTOR_SIZE = 512;
+
+/**
+ * The most sectors a single request of `Read`/`Write` moves, and how many such requests are
+ * queued before a kick.
+ */
+const uint32_t VIRTIO_MAX_REQUEST_SECTORS = 256;
+const uint32_t VIRTIO_BATCH = 16;
+
+static uint32_t AlignUp(uint32_t value, uint32_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+/**
+ * @brief Returns the I/O port base of the legacy interface (BAR 0).
+ */
+static uint16_t PortBase(PeripheralComponentInterconnectDeviceDescriptor *device)
+{
+    return device->bars[0].address;
+}
+
+VirtioBlockDevice *VirtioBlockDevice::activeVirtioBlockDevice = 0;
+
+VirtioBlockDevice::VirtioBlockDevice(PeripheralComponentInterconnectDeviceDescriptor *device,
+                                     InterruptManager *interrupts)
+    : InterruptHandler(0x20 + device->interrupt, interrupts),
+      deviceFeaturesPort(PortBase(device) + 0x00), driverFeaturesPort(PortBase(device) + 0x04),
+      queueAddressPort(PortBase(device) + 0x08), queueSizePort(PortBase(device) + 0x0C),
+      queueSelectPort(PortBase(device) + 0x0E), queueNotifyPort(PortBase(device) + 0x10),
+      deviceStatusPort(PortBase(device) + 0x12), interruptStatusPort(PortBase(device) + 0x13),
+      capacityLowPort(PortBase(device) + 0x14), capacityHighPort(PortBase(device) + 0x18)
+{
+    static uint32_t deviceNumber = 0;
+    name[0] = 'v';
+    name[1] = 'd';
+    name[2] = '0' + deviceNumber++;
+    name[3] = '\0';
+
+    sectorCount = 0;
+    flushSupported = false;
+    queueSize = 0;
+    queueMemory = 0;
+    queuePages = 0;
+    requests = 0;
+    headers = 0;
+    statuses = 0;
+    freeCount = 0;
+    lastUsed = 0;
+    pending = 0;
+    kicks = 0;
+}
+
+VirtioBlockDevice::~VirtioBlockDevice()
+{
+    if (activeVirtioBlockDevice == this)
+    {
+        activeVirtioBlockDevice = 0;
+    }
+}
+
+void VirtioBlockDevice::Activate()
+{
+    /**
+     * Resets the device, then tells it that it has been found and has a driver.
+     */
+    deviceStatusPort.Write(0);
+    deviceStatusPort.Write(VIRTIO_STATUS_ACKNOWLEDGE);
+    deviceStatusPort.Write(VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    uint32_t features = deviceFeaturesPort.Read() & VIRTIO_BLOCK_FLUSH;
+    driverFeaturesPort.Write(features);
+    flushSupported = features != 0;
+
+    queueSelectPort.Write(0);
+    queueSize = queueSizePort.Read();
+
+    /**
+     * The descriptor table and available ring, then the used ring on the next aligned boundary.
+     */
+    uint32_t availableOffset = sizeof(VirtqueueDescriptor) * queueSize;
+    uint32_t availableSize = sizeof(VirtqueueAvailable) + sizeof(uint16_t) * (queueSize + 1);
+    uint32_t usedOffset = AlignUp(availableOffset + availableSize, VIRTQUEUE_ALIGN);
+    uint32_t usedSize =
+        sizeof(VirtqueueUsed) + sizeof(VirtqueueUsedElement) * queueSize + sizeof(uint16_t);
+    uint32_t size = usedOffset + AlignUp(usedSize, VIRTQUEUE_ALIGN);
+    queuePages = size / PAGE_SIZE;
+
+    PhysicalMemoryManager *frames = PhysicalMemoryManager::activePhysicalMemoryManager;
+    uint32_t requestPages =
+        AlignUp((sizeof(VirtioBlockRequestHeader) + 1) * queueSize, PAGE_SIZE) / PAGE_SIZE;
+    queueMemory = queueSize != 0 ? frames->AllocateFrames(queuePages) : 0;
+    uint32_t requestMemory = queueMemory != 0 ? frames->AllocateFrames(requestPages) : 0;
+    if (requestMemory == 0)
+    {
+        if (queueMemory != 0)
+        {
+            frames->FreeFrames(queueMemory, queuePages);
+        }
+        queueMemory = 0;
+        deviceStatusPort.Write(VIRTIO_STATUS_FAILED);
+        return;
+    }
+    memset((void *)queueMemory, 0, queuePages * PAGE_SIZE);
+    memset((void *)requestMemory, 0, requestPages * PAGE_SIZE);
+
+    descriptors = (volatile VirtqueueDescriptor *)queueMemory;
+    available = (volatile VirtqueueAvailable *)(queueMemory + availableOffset);
+    used = (volatile VirtqueueUsed *)(queueMemory + usedOffset);
+
+    headers = (VirtioBlockRequestHeader *)requestMemory;
+    statuses = (volatile uint8_t *)(requestMemory + sizeof(VirtioBlockRequestHeader) * queueSize);
+    requests = new VirtioBlockRequest *[queueSize];
+
+    for (uint16_t i = 0; i < queueSize; i++)
+    {
+        descriptors[i].next = i + 1;
+        requests[i] = 0;
+    }
+    freeDescriptor = 0;
+    freeCount = queueSize;
+
+    queueAddressPort.Write(queueMemory / VIRTQUEUE_ALIGN);
+    deviceStatusPort.Write(VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER |
+                           VIRTIO_STATUS_DRIVER_OK);
+
+    /**
+     * The capacity is in 512 byte sectors, whatever the device's block size.
+     */
+    uint32_t capacityHigh = capacityHighPort.Read();
+    sectorCount = capacityHigh != 0 ? 0xFFFFFFFF : capacityLowPort.Read();
+
+    activeVirtioBlockDevice = this;
+    BlockDevice::Register(this);
+
+    printf(name);
+    printf(": ");
+    printfDec(sectorCount / 2048);
+    printf(" MiB, queue of ");
+    printfDec(queueSize);
+    printf("\n");
+}
+
+bool VirtioBlockDevice::HandleInterrupt(uint32_t *esp)
+{
+    /**
+     * Reading the interrupt status acknowledges the interrupt. It is 0 if the interrupt came from
+     * another device on the line.
+     */
+    uint8_t status = interruptStatusPort.Read();
+    if ((status & VIRTIO_INTERRUPT_QUEUE) && Reap() != 0)
+    {
+        TaskManager::activeTaskManager->Wakeup(this);
+    }
+    return status != 0;
+}
+
+uint16_t VirtioBlockDevice::AllocateDescriptor()
+{
+    uint16_t descriptor = freeDescriptor;
+    freeDescriptor = descriptors[descriptor].next;
+    freeCount--;
+    return descriptor;
+}
+
+void VirtioBlockDevice::FreeDescriptors(uint16_t head)
+{
+    uint16_t descriptor = head;
+    while (true)
+    {
+        uint16_t flags = descriptors[descriptor].flags;
+        uint16_t next = descriptors[descriptor].next;
+
+        descriptors[descriptor].next = freeDescriptor;
+        freeDescriptor = descriptor;
+        freeCount++;
+
+        if (!(flags & VIRTQUEUE_DESCRIPTOR_NEXT))
+        {
+            break;
+        }
+        descriptor = next;
+    }
+}
+
+uint32_t VirtioBlockDevice::Reap()
+{
+    uint32_t reaped = 0;
+    while (lastUsed != used->index)
+    {
+        uint16_t head = used->ring[lastUsed % queueSize].id;
+
+        VirtioBlockRequest *request = requests[head];
+        requests[head] = 0;
+        FreeDescriptors(head);
+        lastUsed++;
+        reaped++;
+
+        if (request != 0)
+        {
+            request->success = statuses[head] == 0;
+            request->done = true;
+        }
+    }
+    return reaped;
+}
+
+bool VirtioBlockDevice::Queue(VirtioBlockRequest *request, uint32_t type)
+{
+    bool hasData = type != VIRTIO_BLOCK_FLUSH_REQUEST;
+    if (queueMemory == 0)
+    {
+        return false;
+    }
+    if (hasData && (request->count == 0 || request->sector >= sectorCount ||
+                    request->count > sectorCount - request->sector ||
+                    (uint32_t)request->buffer + request->count * VIRTIO_SECTOR_SIZE >
+                        PHYSICAL_MEMORY_LIMIT))
+    {
+        return false;
+    }
+
+    uint32_t eflags;
+    asm volatile("pushfl\n"
+                 "popl %0\n"
+                 "cli"
+                 : "=r"(eflags));
+
+    bool queued = false;
+    if (freeCount >= (hasData ? 3 : 2))
+    {
+        /**
+         * The header (read by the device), the data, and the status byte (written by it).
+         */
+        uint16_t head = AllocateDescriptor();
+        headers[head].type = type;
+        headers[head].reserved = 0;
+        headers[head].sector = request->sector;
+        statuses[head] = 0xFF;
+        requests[head] = request;
+        request->done = false;
+        request->success = false;
+
+        descriptors[head].address = (uint32_t)&headers[head];
+        descriptors[head].length = sizeof(VirtioBlockRequestHeader);
+        descriptors[head].flags = VIRTQUEUE_DESCRIPTOR_NEXT;
+        uint16_t last = head;
+
+        if (hasData)
+        {
+            uint16_t data = AllocateDescriptor();
+            descriptors[last].next = data;
+            descriptors[data].address = (uint32_t)request->buffer;
+            descriptors[data].length = request->count * VIRTIO_SECTOR_SIZE;
+            descriptors[data].flags =
+                VIRTQUEUE_DESCRIPTOR_NEXT | (request->write ? 0 : VIRTQUEUE_DESCRIPTOR_WRITE);
+            last = data;
+        }
+
+        uint16_t status = AllocateDescriptor();
+        descriptors[last].next = status;
+        descriptors[status].address = (uint32_t)&statuses[head];
+        descriptors[status].length = 1;
+        descriptors[status].flags = VIRTQUEUE_DESCRIPTOR_WRITE;
+
+        /**
+         * The ring entry must be visible before the index that publishes it.
+         */
+        available->ring[available->index % queueSize] = head;
+        asm volatile("" : : : "memory");
+        available->index = available->index + 1;
+        pending++;
+        queued = true;
+    }
+
+    asm volatile("pushl %0\n"
+                 "popfl"
+                 :
+                 : "r"(eflags)
+                 : "cc");
+    return queued;
+}
+
+bool VirtioBlockDevice::Submit(VirtioBlockRequest *request)
+{
+    return Queue(request, request->write ? VIRTIO_BLOCK_OUT : VIRTIO_BLOCK_IN);
+}
+
+void VirtioBlockDevice::Kick()
+{
+    if (pending == 0)
+    {
+        return;
+    }
+    pending = 0;
+
+    /**
+     * The device reads the available index, then decides whether to be notified. Without the
+     * fence, x86 may load the flags before its store of the index reaches memory: the device could
+     * see the old index, ask not to be notified, and never come back for the requests.
+     */
+    asm volatile("mfence" : : : "memory");
+    if (!(used->flags & VIRTQUEUE_USED_NO_NOTIFY))
+    {
+        queueNotifyPort.Write(0);
+        kicks++;
+    }
+}
+
+bool VirtioBlockDevice::Wait(VirtioBlockRequest *request)
+{
+    uint32_t eflags;
+    asm volatile("pushfl\n"
+                 "popl %0\n"
+                 "cli"
+                 : "=r"(eflags));
+
+    while (!request->done)
+    {
+        TaskManager::activeTaskManager->Sleep(this);
+    }
+
+    asm volatile("pushl %0\n"
+                 "popfl"
+                 :
+                 : "r"(eflags)
+                 : "cc");
+    return request->success;
+}
+
+bool VirtioBlockDevice::Transfer(uint32_t sector, uint32_t count, uint8_t *buffer, bool write)
+{
+    VirtioBlockRequest batch[VIRTIO_BATCH];
+
+    while (count > 0)
+    {
+        /**
+         * Queues as many requests as fit in the batch (and the queue), with a single kick.
+         */
+        uint32_t queued = 0;
+        while (count > 0 && queued < VIRTIO_BATCH)
+        {
+            VirtioBlockRequest *request = &batch[queued];
+            request->sector = sector;
+            request->count =
+                count < VIRTIO_MAX_REQUEST_SECTORS ? count : VIRTIO_MAX_REQUEST_SECTORS;
+            request->buffer = buffer;
+            request->write = write;
+            if (!Submit(request))
+            {
+                break;
+            }
+
+            queued++;
+            sector += request->count;
+            buffer += request->count * VIRTIO_SECTOR_SIZE;
+            count -= request->count;
+        }
+        if (queued == 0)
+        {
+            return false;
+        }
+        Kick();
+
+        bool success = true;
+        for (uint32_t i = 0; i < queued; i++)
+        {
+            success = Wait(&batch[i]) && success;
+        }
+        if (!success)
+        {
+            return false;
+        }
+    }
+
+    return write ? Flush() : true;
+}
+
+bool VirtioBlockDevice::Flush()
+{
+    if (!flushSupported)
+    {
+        return true;
+    }
+
+    VirtioBlockRequest request;
+    request.sector = 0;
+    request.count = 0;
+    request.buffer = 0;
+    request.write = true;
+    if (!Queue(&request, VIRTIO_BLOCK_FLUSH_REQUEST))
+    {
+        return false;
+    }
+    Kick();
+    return Wait(&request);
+}
+
+const char *VirtioBlockDevice::Name() { return name; }
+
+uint32_t VirtioBlockDevice::SectorCount() { return sectorCount; }
+
+bool VirtioBlockDevice::Read(uint32_t sector, uint32_t count, void *buffer)
+{
+    return Transfer(sector, count, (uint8_t *)buffer, false);
+}
+
+bool VirtioBlockDevice::Write(uint32_t sector, uint32_t count, const void *buffer)
+{
+    return Transfer(sector, count, (uint8_t *)buffer, true);
+}
+
+uint32_t VirtioBlockDevice::QueueDepth() { return queueSize / 3; }
+
+uint32_t VirtioBlockDevice::Kicks() { return kicks; }
+
+/**
+ * @brief Creates the driver for a virtio block device found on the PCI bus.
+ */
+static Driver *CreateVirtioBlockDevice(PeripheralComponentInterconnectDeviceDescriptor *device,
+                                       PeripheralComponentInterconnectController *pci,
+                                       InterruptManager *interrupts)
+{
+    /**
+     * Only the legacy interface is supported, which sits in an I/O BAR.
+     */
+    if (device->bars[0].type != InputOutput || device->bars[0].address == 0)
+    {
+        return 0;
+    }
+    pci->EnableBusMastering(device);
+    return new VirtioBlockDevice(device, interrupts);
+}
+
+const PeripheralComponentInterconnectDriverEntry VirtioBlockDevice::DriverEntry = {
+    0x1AF4, 0x1001, PCI_ANY_CLASS, PCI_ANY_CLASS, &CreateVirtioBlockDevice};
@@ -0,0 +1,214 @@
+/**
+ * @file virtio.h
+ * @author rohan843
+ * @brief Contains the driver for virtio block devices (legacy virtio over PCI, as QEMU offers with
+ * `-drive if=virtio`).
+ *
+ * A virtio device is driven through virtqueues in guest memory. A queue has 3 parts:
+ *
+ * 1. The descriptor table: buffers (physical address, length, flags), chained into requests.
+ * 2. The available ring: heads of the requests the driver has queued.
+ * 3. The used ring: heads of the requests the device has completed.
+ *
+ * The driver only has to write to a port (a "kick") to tell the device to look at the available
+ * ring, and that port access is the expensive part under virtualization. So requests are queued
+ * first and kicked once, and the interrupt handler reaps all completed requests at once.
+ */
+
+#ifndef __VIRTIO_H
+#define __VIRTIO_H
+
+#include "blockdevice.h"
+#include "driver.h"
+#include "interrupts.h"
+#include "pci.h"
+#include "port.h"
+#include "types.h"
+
+struct VirtqueueDescriptor
+{
+    uint64_t address;
+    uint32_t length;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed));
+
+struct VirtqueueAvailable
+{
+    uint16_t flags;
+    uint16_t index;
+    uint16_t ring[];
+} __attribute__((packed));
+
+struct VirtqueueUsedElement
+{
+    uint32_t id;
+    uint32_t length;
+} __attribute__((packed));
+
+struct VirtqueueUsed
+{
+    uint16_t flags;
+    uint16_t index;
+    VirtqueueUsedElement ring[];
+} __attribute__((packed));
+
+/**
+ * @brief The header at the start of every block request.
+ */
+struct VirtioBlockRequestHeader
+{
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__((packed));
+
+/**
+ * @brief A request, submitted with `VirtioBlockDevice::Submit`. It must stay valid until done.
+ */
+struct VirtioBlockRequest
+{
+    uint32_t sector;
+    uint32_t count;
+
+    /**
+     * Must be in kernel memory (below 1 GiB), as the device uses physical addresses.
+     */
+    void *buffer;
+    bool write;
+
+    /**
+     * Set by the interrupt handler.
+     */
+    volatile bool done;
+    bool success;
+};
+
+class VirtioBlockDevice : public BlockDevice, public Driver, public InterruptHandler
+{
+  protected:
+    Port32Bit deviceFeaturesPort;
+    Port32Bit driverFeaturesPort;
+    Port32Bit queueAddressPort;
+    Port16Bit queueSizePort;
+    Port16Bit queueSelectPort;
+    Port16Bit queueNotifyPort;
+    Port8Bit deviceStatusPort;
+    Port8Bit interruptStatusPort;
+    Port32Bit capacityLowPort;
+    Port32Bit capacityHighPort;
+
+    char name[4];
+    uint32_t sectorCount;
+    bool flushSupported;
+
+    /**
+     * The queue, in physically contiguous frames.
+     */
+    uint16_t queueSize;
+    uint32_t queueMemory;
+    uint32_t queuePages;
+    volatile VirtqueueDescriptor *descriptors;
+    volatile VirtqueueAvailable *available;
+    volatile VirtqueueUsed *used;
+
+    /**
+     * The free descriptors, linked through their `next` fields.
+     */
+    uint16_t freeDescriptor;
+    uint16_t freeCount;
+
+    /**
+     * The used ring entries up to here have been reaped.
+     */
+    uint16_t lastUsed;
+
+    /**
+     * Per head descriptor: the request it belongs to, and its header and status byte (which the
+     * device reads and writes, so they are in a frame of their own).
+     */
+    VirtioBlockRequest **requests;
+    VirtioBlockRequestHeader *headers;
+    volatile uint8_t *statuses;
+
+    /**
+     * Requests queued since the last kick.
+     */
+    uint32_t pending;
+
+    /**
+     * The kicks made so far.
+     */
+    uint32_t kicks;
+
+    uint16_t AllocateDescriptor();
+    void FreeDescriptors(uint16_t head);
+
+    /**
+     * @brief Queues a request of the given type (read, write or flush).
+     */
+    bool Queue(VirtioBlockRequest *request, uint32_t type);
+
+    /**
+     * @brief Takes the completed requests off the used ring.
+     *
+     * @return The number of requests reaped.
+     */
+    uint32_t Reap();
+
+    bool Transfer(uint32_t sector, uint32_t count, uint8_t *buffer, bool write);
+
+    /**
+     * @brief Makes a request without data (a flush) and waits for it.
+     */
+    bool Flush();
+
+  public:
+    static VirtioBlockDevice *activeVirtioBlockDevice;
+
+    VirtioBlockDevice(PeripheralComponentInterconnectDeviceDescriptor *device,
+                      InterruptManager *interrupts);
+    ~VirtioBlockDevice();
+
+    virtual void Activate();
+    virtual bool HandleInterrupt(uint32_t *esp);
+
+    virtual const char *Name();
+    virtual uint32_t SectorCount();
+    virtual bool Read(uint32_t sector, uint32_t count, void *buffer);
+    virtual bool Write(uint32_t sector, uint32_t count, const void *buffer);
+
+    /**
+     * @brief Queues a request, without telling the device yet (see `Kick`).
+     *
+     * @return false if the queue is full (kick and wait for some requests first), or the request
+     * is invalid.
+     */
+    bool Submit(VirtioBlockRequest *request);
+
+    /**
+     * @brief Tells the device about the requests queued since the last kick.
+     */
+    void Kick();
+
+    /**
+     * @brief Sleeps until a request is done. Interrupts must be active.
+     *
+     * @return Whether the request succeeded.
+     */
+    bool Wait(VirtioBlockRequest *request);
+
+    /**
+     * @brief The number of requests that can be queued at once.
+     */
+    uint32_t QueueDepth();
+
+    uint32_t Kicks();
+
+    /**
+     * The driver registry entry (legacy and transitional virtio block devices).
+     */
+    static const PeripheralComponentInterconnectDriverEntry DriverEntry;
+};
+
+#endif